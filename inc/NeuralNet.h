@@ -26,6 +26,22 @@ typedef int Status;
 
 #define STATUS_TO_MANY_HIDDEN 100 ///< To many calls to NeuralNet_add_hidden
 
+#define NEURAL_NET_OUTPUT_SIGMOID 0 ///< Sigmoid outputs, squared error loss
+#define NEURAL_NET_OUTPUT_SOFTMAX 1 ///< Softmax outputs, cross entropy loss
+
+#define NEURAL_NET_ALLOC_HEAP    0 ///< calloc per layer and neuron
+#define NEURAL_NET_ALLOC_MMAP    1 ///< One mmap'd arena of base pages
+#define NEURAL_NET_ALLOC_THP     2 ///< One arena using transparent huge pages
+#define NEURAL_NET_ALLOC_HUGETLB 3 ///< One arena of hugetlbfs pages
+
+#define NEURAL_NET_WEIGHTS_DOUBLE 0 ///< Weights are doubles
+#define NEURAL_NET_WEIGHTS_BF16   1 ///< bf16 weights, float master copy
+#define NEURAL_NET_WEIGHTS_FP16   2 ///< fp16 weights, float master copy
+
+#define NEURAL_NET_TUNE_OFF   0 ///< Dense layers use the default loops
+#define NEURAL_NET_TUNE_CACHE 1 ///< Reuse cached kernel choices, tune the rest
+#define NEURAL_NET_TUNE_FORCE 2 ///< Tune every dense layer, update the cache
+
 /** Evaluates to true if status is good */
 #define StatusOk(s) ((s) == STATUS_OK)
 
@@ -39,6 +55,15 @@ typedef int Status;
 typedef struct Pattern Pattern;
 typedef struct Neuron Neuron;
 typedef struct NeuronLayer NeuronLayer;
+typedef struct NeuronLayerSparse NeuronLayerSparse;
+typedef struct NeuronLayerMask NeuronLayerMask;
+typedef struct NeuronLayerConv NeuronLayerConv;
+typedef struct NeuronLayerHalf NeuronLayerHalf;
+typedef struct NeuronLayerTuned NeuronLayerTuned;
+typedef struct NeuronLayerSkip NeuronLayerSkip;
+typedef struct NeuralNetConvSpec NeuralNetConvSpec;
+typedef struct NeuralNetArena NeuralNetArena;
+typedef struct NeuralNetTune NeuralNetTune;
 typedef struct NeuralNet NeuralNet;
 
 // NeuralNet methods
@@ -50,6 +75,8 @@ typedef void (*NeuralNet_Stop)(NeuralNet* nn);
 
 typedef Status (*NeuralNet_AddHidden)(NeuralNet* nn, unsigned long count);
 
+typedef Status (*NeuralNet_AddConv)(NeuralNet* nn, NeuralNetConvSpec* spec);
+
 typedef unsigned long (*NeuralNet_GetPoints)(NeuralNet* nn);
 
 typedef void (*NeuralNet_SetInputs)(NeuralNet* nn, Pattern* input);
@@ -60,6 +87,8 @@ typedef double (*NeuralNet_AdjustWeights)(NeuralNet* nn, Pattern* output, Patter
 
 typedef void (*NeuralNet_Process)(NeuralNet* nn);
 
+typedef Status (*NeuralNet_Prune)(NeuralNet* nn, double threshold, unsigned long top_k);
+
 
 typedef struct Pattern {
   unsigned long count;
@@ -78,6 +107,14 @@ typedef struct Neuron {
 typedef struct NeuronLayer {
   unsigned long count;  // Number of neurons
   Neuron* neurons;      // The neurons
+  NeuronLayerSparse* sparse; // CSR weights once pruned, NULL while dense
+  NeuronLayerMask* mask;  // Pruned weights of a dense layer, NULL if none
+  NeuronLayerConv* conv;  // Shared kernels, NULL if fully connected
+  NeuronLayerHalf* half;  // Half precision weights, NULL if double
+  NeuronLayerTuned* tuned;// Autotuned kernels, NULL for the default loops
+  NeuronLayerSkip* skip;  // Saturated neuron skipping, NULL if off
+  unsigned long in_arena; // neurons, weights and momentums are in nn->arena
+  unsigned long frozen;   // adjust_weights leaves the weights alone
 } NeuronLayer;
 
 typedef struct NeuralNet {
@@ -89,9 +126,21 @@ typedef struct NeuralNet {
   double error;             // The overall network error
   double learning_rate;     // Learning rate aka 'eta'
   double momentum_factor;   // Momentum factor aka 'aplha'
+  double skip_threshold;    // Skip updates of neurons with |pd_error| below
+                            // this, 0.0 for off, set before start
+  double sparse_max_density;// prune keeps a layer dense above this density
+  double lse;               // log(sum(exp(logits))) of the last softmax
+  unsigned long output_type;// NEURAL_NET_OUTPUT_xxx, set before start
+  unsigned long alloc_mode; // NEURAL_NET_ALLOC_xxx, set before start
+  unsigned long weight_type;// NEURAL_NET_WEIGHTS_xxx, set before start
+  unsigned long tune_mode;  // NEURAL_NET_TUNE_xxx, set before start
   unsigned long points;     // Points is number
 
   Pattern* input;           // Input pattern
+  double* logits;           // Output layer weighted sums if softmax
+  NeuralNetArena* arena;    // Storage unless alloc_mode is heap
+  char* tune_cache;         // Kernel choices file, NULL for none
+  NeuralNetTune* tune;      // Autotuning state, NULL unless tuned
 
   // There will always be at least two layers,
   // plus there are zero or more hidden layers.
@@ -102,15 +151,25 @@ typedef struct NeuralNet {
   NeuralNet_Start start;
   NeuralNet_Stop stop;
   NeuralNet_AddHidden add_hidden;
+  NeuralNet_AddConv add_conv;
   NeuralNet_GetPoints get_points;
   NeuralNet_SetInputs set_inputs;
   NeuralNet_GetOutputs get_outputs;
   NeuralNet_AdjustWeights adjust_weights;
   NeuralNet_Process process;
+  NeuralNet_Prune prune;
 
 } NeuralNet;
 
 Status NeuralNet_init(NeuralNet* nn, unsigned long num_in, unsigned long num_hidden, unsigned long num_out);
 
+/**
+ * Return weight i of neuron n of the layer, where i == 0 is the bias,
+ * regardless of whether the layer is stored dense, sparse, in half
+ * precision or is a convolution. A skipped neuron's weight includes the
+ * momentum it is still owed.
+ */
+double NeuronLayer_weight(NeuronLayer* layer, unsigned long n, unsigned long i);
+
 
 #endif
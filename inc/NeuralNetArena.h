@@ -0,0 +1,90 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEURAL_NET_ARENA_H
+#define NEURAL_NET_ARENA_H
+
+#include "NeuralNet.h"
+
+/**
+ * A single mapping that a NeuralNet's neurons, weights and momentums
+ * are carved out of, see NeuralNet.alloc_mode.
+ */
+typedef struct NeuralNetArena {
+  char* base;                 // Start of the mapping
+  unsigned long size;         // Bytes mapped
+  unsigned long used;         // Bytes handed out
+  unsigned long mode;         // NEURAL_NET_ALLOC_xxx actually achieved
+  unsigned long page_size;    // Page size the mapping was aligned to
+  int fd;                     // Sealed memfd of the last snapshot, -1 if none
+  int forked;                 // Mapped privately from another arena's snapshot
+} NeuralNetArena;
+
+/** Where a network's storage lives */
+typedef struct NeuralNetFootprint {
+  unsigned long mode;           // NEURAL_NET_ALLOC_xxx actually achieved
+  unsigned long page_size;      // Page size backing most of the storage
+  unsigned long bytes;          // Bytes of neurons, weights and momentums
+  unsigned long mapped_bytes;   // Bytes mapped, 0 for the heap
+  unsigned long resident_bytes; // Bytes of the mapping resident in memory
+  unsigned long huge_bytes;     // Bytes of the mapping backed by huge pages
+  unsigned long private_bytes;  // Bytes of the mapping not shared with a snapshot
+} NeuralNetFootprint;
+
+/**
+ * Map an arena of at least size bytes. NEURAL_NET_ALLOC_HUGETLB falls
+ * back to NEURAL_NET_ALLOC_THP when no huge pages are reserved, which
+ * falls back to NEURAL_NET_ALLOC_MMAP when transparent huge pages are
+ * unavailable, arena->mode is what was achieved.
+ */
+Status NeuralNetArena_init(NeuralNetArena* arena, unsigned long size,
+    unsigned long mode);
+
+/** Unmap the arena */
+void NeuralNetArena_deinit(NeuralNetArena* arena);
+
+/**
+ * Snapshot the used part of the arena into a sealed memfd and remap the
+ * arena in place as a private copy on write view of it, so the arena's
+ * addresses stay valid and its later writes never reach the snapshot.
+ * A previous snapshot is released, forks keep their own reference.
+ */
+Status NeuralNetArena_share(NeuralNetArena* arena);
+
+/**
+ * Map a private copy on write view of shared's snapshot as arena. Pages
+ * stay shared with the snapshot until they are written.
+ */
+Status NeuralNetArena_fork(NeuralNetArena* arena, NeuralNetArena* shared);
+
+/**
+ * Zeroed bytes from the arena aligned to align, a power of 2.
+ * @return NULL if the arena is exhausted
+ */
+void* NeuralNetArena_alloc(NeuralNetArena* arena, unsigned long bytes,
+    unsigned long align);
+
+/**
+ * Move nn's neurons, weights and momentums into a new arena of
+ * nn->alloc_mode, the weights and momentums of a started network
+ * are copied.
+ */
+Status NeuralNet_create_arena(NeuralNet* nn);
+
+/** Report where nn's storage lives and how much of it is resident */
+Status NeuralNet_footprint(NeuralNet* nn, NeuralNetFootprint* fp);
+
+#endif
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEURAL_NET_CHECKPOINT_H
+#define NEURAL_NET_CHECKPOINT_H
+
+#include "NeuralNet.h"
+
+#include <pthread.h>
+
+typedef struct NeuralNetCheckpoint NeuralNetCheckpoint;
+
+typedef void (*NeuralNetCheckpoint_Deinit)(NeuralNetCheckpoint* cp);
+typedef Status (*NeuralNetCheckpoint_Save)(NeuralNetCheckpoint* cp,
+    unsigned long epoch, double error, unsigned int* perm,
+    unsigned long perm_count);
+
+/**
+ * Periodic checkpointing of the full training state: the network's
+ * weights and momentums, the calling thread's rand0_1 generator, the
+ * epochs completed, the last epoch's error and the pattern permutation.
+ * Skipped neurons are saved with the steps of momentum they still owe,
+ * so a resumed run continues bit for bit where the saved one left off.
+ *
+ * save() serializes the state into a spare buffer and hands it to a
+ * writer thread, the training thread only waits for a mutex to swap
+ * buffers. If the writer is still busy when another snapshot is
+ * taken the older pending snapshot is superseded. The writer writes
+ * to out_path + ".tmp", fsyncs it, renames it over out_path and fsyncs
+ * the directory so a checkpoint file is always complete and durable.
+ */
+typedef struct NeuralNetCheckpoint {
+  NeuralNet* nn;            // Neural net
+  char* out_path;           // Checkpoint path
+  char* tmp_path;           // out_path + ".tmp"
+  char* dir_path;           // Directory of out_path
+
+  unsigned char* fill;      // Buffer save() serializes into
+  unsigned long fill_size;  // Allocated size of fill
+  unsigned long fill_len;   // Bytes used in fill
+  unsigned char* pending;   // Snapshot waiting for the writer
+  unsigned long pending_size;
+  unsigned long pending_len;
+  unsigned char* writing;   // Snapshot the writer owns
+  unsigned long writing_size;
+  unsigned long writing_len;
+
+  unsigned long saved;      // Snapshots taken
+  unsigned long written;    // Snapshots written to out_path
+  unsigned long superseded; // Snapshots replaced before being written
+  unsigned long failed;     // Snapshots the writer failed to write
+  int has_pending;          // pending holds a snapshot
+  int stopping;             // deinit has been called
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t writer;
+
+  // Methods
+  NeuralNetCheckpoint_Deinit deinit;
+  NeuralNetCheckpoint_Save save;
+
+} NeuralNetCheckpoint;
+
+/**
+ * Initialize cp to checkpoint nn to out_path and start its writer
+ * thread. deinit writes any pending snapshot before returning.
+ */
+Status NeuralNetCheckpoint_init(NeuralNetCheckpoint* cp, NeuralNet* nn,
+    char* out_path);
+
+/**
+ * Restore a checkpoint into nn, which must have been started with the
+ * same topology. The calling thread's rand0_1 generator is restored,
+ * *epoch and, if not NULL, *error are set to the values passed to save()
+ * and if perm is not NULL the permutation is copied to it, perm_count
+ * must match. Layers that were sparse when saved are made sparse.
+ */
+Status NeuralNetCheckpoint_load(char* path, NeuralNet* nn,
+    unsigned long* epoch, double* error, unsigned int* perm,
+    unsigned long perm_count);
+
+#endif
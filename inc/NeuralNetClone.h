@@ -0,0 +1,56 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEURAL_NET_CLONE_H
+#define NEURAL_NET_CLONE_H
+
+#include "NeuralNet.h"
+
+/**
+ * Make dst an independent copy of the started network src, weights,
+ * momentums, outputs and settings included, with a single memcpy of
+ * src's arena. A heap network is first moved into an
+ * NEURAL_NET_ALLOC_MMAP arena. Kernel tuning isn't copied, dst uses the
+ * default loops. Networks with convolution, half precision, sparse or
+ * masked layers aren't supported.
+ */
+Status NeuralNet_clone(NeuralNet* dst, NeuralNet* src);
+
+/**
+ * Snapshot nn's current state so it can be forked. A heap network is
+ * first moved into an NEURAL_NET_ALLOC_MMAP arena. nn keeps training as
+ * usual, calling this again takes a new snapshot for later forks.
+ */
+Status NeuralNet_share(NeuralNet* nn);
+
+/**
+ * Make dst a copy on write fork of base's last snapshot, taking one if
+ * base has none. Until dst is trained it shares every page with the
+ * snapshot, training it only copies the pages that it writes. Later
+ * changes to base are not seen by dst and vice versa.
+ */
+Status NeuralNet_fork(NeuralNet* dst, NeuralNet* base);
+
+/**
+ * Train only layers first_trained .. out_layer of nn, adjust_weights
+ * leaves the weights and momentums of the layers below alone and
+ * doesn't back propagate to them. Each layer's weights and momentums
+ * have pages of their own so a fork fine-tuning its top layers only
+ * copies theirs. 1 trains every layer again.
+ */
+Status NeuralNet_freeze(NeuralNet* nn, unsigned long first_trained);
+
+#endif
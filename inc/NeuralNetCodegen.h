@@ -0,0 +1,53 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef NEURAL_NET_CODEGEN_H
+#define NEURAL_NET_CODEGEN_H
+
+#include "NeuralNet.h"
+
+#include <stdio.h>
+
+/**
+ * Write a self contained C file for the forward pass of nn:
+ *
+ *   void <prefix>_predict(const double* input, double* output);
+ *
+ * The weights are static const arrays aligned to a cache line and the
+ * loops have the exact layer sizes as bounds so the compiler can unroll
+ * and vectorize them. If unroll is set every weighted sum is instead
+ * written out with the weights as literals and zero weights dropped,
+ * which suits small or pruned nets. Summation is in the same order as
+ * NeuralNet process so outputs match it exactly unless the file is
+ * compiled with -ffast-math. The file only needs exp from libm.
+ *
+ * @return STATUS_BAD_PARAM if nn isn't started or has a weight that
+ * isn't finite.
+ */
+Status NeuralNetCodegen_write(NeuralNet* nn, char* prefix, unsigned long unroll,
+    FILE* out);
+
+/**
+ * Write a test program for the file written by NeuralNetCodegen_write.
+ * It runs <prefix>_predict on each of inputs, compares the outputs to
+ * those of nn's process with tolerance and times the predictions. It
+ * exits with 0 if every output matched.
+ */
+Status NeuralNetCodegen_write_test(NeuralNet* nn, char* prefix,
+    Pattern** inputs, unsigned long count, double tolerance, FILE* out);
+
+#endif
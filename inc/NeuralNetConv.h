@@ -0,0 +1,92 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEURAL_NET_CONV_H
+#define NEURAL_NET_CONV_H
+
+#include "NeuralNet.h"
+
+/**
+ * Shape of a convolutional layer. The previous layer's neurons are
+ * taken as in_channels planes of in_height rows of in_width, and
+ * the layer has out_channels planes of out_height rows of out_width
+ * neurons. For 1D use in_height = kernel_height = 1.
+ */
+typedef struct NeuralNetConvSpec {
+  unsigned long in_channels;
+  unsigned long in_height;
+  unsigned long in_width;
+  unsigned long out_channels;
+  unsigned long kernel_height;
+  unsigned long kernel_width;
+  unsigned long stride_height;  // 0 is taken as 1
+  unsigned long stride_width;   // 0 is taken as 1
+  unsigned long pad_height;     // Zeros added above and below
+  unsigned long pad_width;      // Zeros added left and right
+} NeuralNetConvSpec;
+
+/**
+ * A convolutional layer, every neuron of an output channel shares that
+ * channel's kernel. The forward pass expands the inputs with im2col so
+ * it and the backward pass are matrix products.
+ */
+typedef struct NeuronLayerConv {
+  NeuralNetConvSpec spec;
+  unsigned long out_height;
+  unsigned long out_width;
+  unsigned long positions;  // out_height * out_width
+  unsigned long patch;      // in_channels * kernel_height * kernel_width
+  double* weights;          // [out_channels][patch + 1], column 0 is the bias
+  double* momentums;        // [out_channels][patch + 1]
+  double* weights_t;        // [patch][out_channels] kernels transposed
+  double* col;              // [patch][positions] im2col of the inputs
+  double* dcol;             // [patch][positions] pd_error of col
+  double* sums;             // [out_channels][positions] weighted sums
+  double* errors;           // [out_channels][positions] pd_error
+} NeuronLayerConv;
+
+/**
+ * Validate spec against the in_count neurons of the previous layer
+ * and allocate a layer of *count neurons.
+ * @return NULL if the spec is invalid or out of memory
+ */
+NeuronLayerConv* NeuronLayerConv_create(NeuralNetConvSpec* spec,
+    unsigned long in_count, unsigned long* count);
+
+/** Connect the neurons of layer to in_layer and initialize the kernels */
+Status NeuronLayerConv_start(NeuronLayer* layer, NeuronLayer* in_layer);
+
+/** Forward pass, compute the output of each neuron of layer */
+void NeuronLayerConv_process(NeuronLayer* layer);
+
+/** Back propagate the layer's pd_error to prev_layer */
+void NeuronLayerConv_backprop(NeuronLayer* layer, NeuronLayer* prev_layer);
+
+/** Update the kernels with momentum from the layer's pd_error */
+void NeuronLayerConv_adjust_weights(NeuronLayer* layer, double learning_rate,
+    double momentum_factor);
+
+/**
+ * Return weight i of neuron n, i == 0 is the bias, as if the layer
+ * were fully connected, 0.0 outside of the neuron's receptive field.
+ */
+double NeuronLayerConv_weight(NeuronLayer* layer, unsigned long n,
+    unsigned long i);
+
+/** Free the convolution of layer, if any */
+void NeuronLayerConv_deinit(NeuronLayer* layer);
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef NEURAL_NET_CSV_H
+#define NEURAL_NET_CSV_H
+
+#include "NeuralNet.h"
+
+#include <pthread.h>
+
+#define NEURAL_NET_CSV_NORM_NONE   0 ///< Values as parsed
+#define NEURAL_NET_CSV_NORM_ZSCORE 1 ///< Inputs scaled to mean 0, stddev 1
+#define NEURAL_NET_CSV_NORM_MINMAX 2 ///< Inputs scaled to [0, 1]
+
+#define NEURAL_NET_CSV_CHUNK_BYTES (1024 * 1024)
+
+typedef struct NeuralNetCsvData NeuralNetCsvData;
+typedef struct NeuralNetCsvBatcher NeuralNetCsvBatcher;
+
+typedef struct NeuralNetCsvSpec {
+  unsigned long input_count;  // Leading columns of a row
+  unsigned long target_count; // Trailing columns of a row
+  unsigned long header;       // Skip the first line
+  unsigned long normalize;    // NEURAL_NET_CSV_NORM_xxx
+  unsigned long workers;      // Parser threads, 0 is one per cpu
+  unsigned long chunk_bytes;  // 0 is NEURAL_NET_CSV_CHUNK_BYTES
+} NeuralNetCsvSpec;
+
+/** Statistics of a column, computed while parsing before normalizing */
+typedef struct NeuralNetCsvStats {
+  double mean;
+  double m2;                  // Sum of squared deviations from mean
+  double stddev;
+  double min;
+  double max;
+} NeuralNetCsvStats;
+
+typedef void (*NeuralNetCsvData_Deinit)(NeuralNetCsvData* data);
+
+typedef struct NeuralNetCsvData {
+  unsigned long rows;
+  unsigned long input_count;
+  unsigned long target_count;
+  unsigned long cols;         // input_count + target_count
+  double* values;             // rows * cols, row major
+  NeuralNetCsvStats* stats;   // Per column
+  unsigned long normalize;    // Normalization that was applied
+  unsigned long bytes;        // Size of the file
+  unsigned long chunks;       // Pieces it was parsed in
+  double parse_secs;
+
+  // Methods
+  NeuralNetCsvData_Deinit deinit;
+
+} NeuralNetCsvData;
+
+/**
+ * Load the CSV file at path. Fields are separated by commas, blanks,
+ * tabs or semicolons and every non empty line must have input_count +
+ * target_count of them. The file is mapped and split into chunks at
+ * line boundaries which a ThreadPool parses concurrently, each chunk
+ * also gathering the column statistics. The chunks' statistics are
+ * merged and, if requested, the inputs normalized in a second parallel
+ * pass over the parsed values.
+ */
+Status NeuralNetCsv_load(NeuralNetCsvData* data, char* path, NeuralNetCsvSpec* spec);
+
+/** A batch of patterns, valid until the next call to next() */
+typedef struct NeuralNetCsvBatch {
+  Pattern** inputs;
+  Pattern** targets;
+  unsigned long count;        // Patterns in the batch
+  unsigned long epoch;        // Pass over the data it belongs to
+  unsigned long filled;       // Ready for the trainer
+} NeuralNetCsvBatch;
+
+typedef void (*NeuralNetCsvBatcher_Deinit)(NeuralNetCsvBatcher* batcher);
+typedef NeuralNetCsvBatch* (*NeuralNetCsvBatcher_Next)(NeuralNetCsvBatcher* batcher);
+
+/**
+ * Double buffered batches of Patterns. A prefetch thread fills one
+ * batch while the trainer works on the other, so copying and shuffling
+ * the rows stays off the training thread. Batches never straddle an
+ * epoch, the last one of an epoch may be short.
+ */
+typedef struct NeuralNetCsvBatcher {
+  NeuralNetCsvData* data;
+  unsigned long batch_size;
+  unsigned long shuffle;      // Reshuffle the rows every epoch
+  unsigned long seed;         // Of the prefetch thread's rand0_1
+  unsigned int* perm;         // Row order of the current epoch
+  unsigned long pos;          // Next row of perm to copy
+  unsigned long epoch;        // Epoch being prefetched
+  unsigned long current;      // Batch the trainer holds, or will get next
+  unsigned long held;         // The trainer holds batches[current]
+  unsigned long waits;        // Times next() had to wait for the prefetch
+  unsigned long quit;
+  NeuralNetCsvBatch batches[2];
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t thread;
+  unsigned long started;
+
+  // Methods
+  NeuralNetCsvBatcher_Deinit deinit;
+  NeuralNetCsvBatcher_Next next;  // Releases the previous batch
+
+} NeuralNetCsvBatcher;
+
+/** Start prefetching batches of batch_size rows of data */
+Status NeuralNetCsvBatcher_init(NeuralNetCsvBatcher* batcher,
+    NeuralNetCsvData* data, unsigned long batch_size, unsigned long shuffle,
+    unsigned long seed);
+
+#endif
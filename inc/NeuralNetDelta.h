@@ -0,0 +1,86 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef NEURAL_NET_DELTA_H
+#define NEURAL_NET_DELTA_H
+
+#include "NeuralNet.h"
+
+typedef struct NeuralNetDelta NeuralNetDelta;
+
+/** Counters of incremental evaluation */
+typedef struct NeuralNetDeltaStats {
+  unsigned long queries;      // Calls to process
+  unsigned long full;         // Queries recomputed from scratch
+  unsigned long updates;      // Rank-1 column updates applied
+  unsigned long suppressed;   // Output changes under epsilon not propagated
+  unsigned long macs;         // Multiply adds done
+  unsigned long full_macs;    // Multiply adds a full forward pass would do
+} NeuralNetDeltaStats;
+
+typedef void (*NeuralNetDelta_Deinit)(NeuralNetDelta* delta);
+typedef Status (*NeuralNetDelta_Sync)(NeuralNetDelta* delta);
+typedef void (*NeuralNetDelta_Process)(NeuralNetDelta* delta, Pattern* input, Pattern* output);
+typedef void (*NeuralNetDelta_Stats)(NeuralNetDelta* delta, NeuralNetDeltaStats* stats);
+
+/**
+ * Incremental forward evaluation of a network whose consecutive inputs
+ * differ in a few values. The weighted sums of every layer are cached
+ * and a changed input i only applies sum += w[:,i] * (new_i - old_i).
+ * A neuron's output is passed on to the next layer the same way, but
+ * only once it differs by more than epsilon from the value the next
+ * layer last saw, so every cached sum is within epsilon of exact per
+ * input. Rounding drift is bounded by recomputing from scratch every
+ * refresh queries.
+ *
+ * The weights are copied column major at init, whatever the layer's
+ * storage, call sync after the network's weights change.
+ */
+typedef struct NeuralNetDelta {
+  NeuralNet* nn;
+  double epsilon;             // Output changes up to this aren't propagated
+  unsigned long refresh;      // Recompute every refresh queries, 0 never
+  unsigned long out_layer;    // Same as nn->out_layer
+  unsigned long output_type;  // NEURAL_NET_OUTPUT_xxx
+  unsigned long since_full;   // Queries since the last full recompute
+  unsigned long full_macs;    // Multiply adds of a full forward pass
+  unsigned long* counts;      // Neurons per layer, counts[0] are the inputs
+  double** columns;           // columns[l] has the biases then one column per input
+  double** sums;              // sums[l] are layer l's weighted sums
+  double** seen;              // seen[l] are layer l's outputs as the next layer saw them
+  double* outputs;            // Outputs of the output layer
+  double* deltas;             // Scratch, changes of a layer's outputs
+  unsigned long* changed;     // Scratch, indexes of the changes
+  NeuralNetDeltaStats counters;
+
+  // Methods
+  NeuralNetDelta_Deinit deinit;
+  NeuralNetDelta_Sync sync;       // Reload the weights, the next query is full
+  NeuralNetDelta_Process process; // Outputs for input
+  NeuralNetDelta_Process full;    // Outputs for input recomputed from scratch
+  NeuralNetDelta_Stats stats;
+
+} NeuralNetDelta;
+
+/**
+ * Initialize incremental evaluation of nn, which must have been
+ * started. An epsilon of 0.0 propagates every change.
+ */
+Status NeuralNetDelta_init(NeuralNetDelta* delta, NeuralNet* nn,
+    double epsilon, unsigned long refresh);
+
+#endif
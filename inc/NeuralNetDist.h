@@ -0,0 +1,131 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEURAL_NET_DIST_H
+#define NEURAL_NET_DIST_H
+
+#include "NeuralNet.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define NEURAL_NET_DIST_NONE 0 ///< Gradients are exchanged as doubles
+#define NEURAL_NET_DIST_FP16 1 ///< Gradients are scaled and rounded to fp16
+#define NEURAL_NET_DIST_TOPK 2 ///< Only the top_k largest gradients of each rank
+
+/**
+ * POSIX shared memory layout made by NeuralNetDist_create:
+ *
+ *   NeuralNetDistHeader
+ *   ranks slots at slot_offset, each slot_bytes long:
+ *     NeuralNetDistSlot
+ *     the rank's gradient, params doubles, params fp16 or top_k
+ *     NeuralNetDistPair depending on compress
+ *   params doubles of the reduced gradient at result_offset
+ *
+ * A step is a reduce scatter then an all gather. Every rank publishes
+ * its gradient to its slot, then sums chunk r of every slot, in rank
+ * order, into the result. Once all chunks are summed every rank
+ * applies the whole result, so the replicas stay bit for bit the same.
+ * Since the slots are shared memory each rank reads its peers' chunks
+ * directly rather than passing them round a ring.
+ */
+#define NEURAL_NET_DIST_MAGIC "NNDIST01"
+
+typedef struct NeuralNetDistHeader {
+  char magic[8];                // NEURAL_NET_DIST_MAGIC once initialized
+  unsigned long ranks;
+  unsigned long params;         // Weights, biases included, of the network
+  unsigned long compress;       // NEURAL_NET_DIST_xxx
+  unsigned long top_k;          // Entries per rank if NEURAL_NET_DIST_TOPK
+  unsigned long slot_offset;    // Offset of slot 0
+  unsigned long slot_bytes;     // Stride of the slots
+  unsigned long result_offset;  // Offset of the reduced gradient
+  atomic_uint arrived;          // Ranks at the barrier
+  atomic_uint generation;       // Futex word, bumped as the barrier opens
+} NeuralNetDistHeader;
+
+typedef struct NeuralNetDistSlot {
+  double loss;                  // Summed loss of the rank's samples
+  double scale;                 // fp16 values are multiplied by this
+  unsigned long samples;        // Samples in the rank's mini batch
+  unsigned long count;          // Pairs used if NEURAL_NET_DIST_TOPK
+} NeuralNetDistSlot;
+
+typedef struct NeuralNetDistPair {
+  uint32_t index;               // Ascending within a slot
+  float value;
+} NeuralNetDistPair;
+
+typedef struct NeuralNetDist NeuralNetDist;
+
+typedef void (*NeuralNetDist_Deinit)(NeuralNetDist* dist);
+typedef Status (*NeuralNetDist_Sync)(NeuralNetDist* dist);
+typedef double (*NeuralNetDist_Step)(NeuralNetDist* dist, Pattern** inputs,
+    Pattern** targets, unsigned long count);
+
+/**
+ * One rank of data parallel training of a NeuralNet by cooperating
+ * processes. Each process trains its own copy of the network on its
+ * own samples, step() averages the gradients of a mini batch across
+ * the ranks and applies it with momentum like NeuralNetPipeline does.
+ * Every rank must call sync() and step() the same number of times.
+ *
+ * With compression the part of the gradient that wasn't sent is kept
+ * in residuals and added to the next step's gradient.
+ *
+ * Only fully connected dense double layers are supported.
+ */
+typedef struct NeuralNetDist {
+  NeuralNet* nn;
+  NeuralNetDistHeader* header;
+  unsigned long map_size;
+  unsigned long rank;
+  unsigned long ranks;
+  unsigned long params;
+  unsigned long samples;        // Samples of all the ranks in the last step
+  unsigned long* offsets;       // Offset of each layer's gradient, plus the total
+  double* grads;                // Gradient summed over the mini batch
+  double* residuals;            // Left over by compression, NULL if none
+  double* mags;                 // Scratch for picking the top_k
+  Pattern* output;
+
+  // Methods
+  NeuralNetDist_Deinit deinit;
+  NeuralNetDist_Sync sync;      // Copy rank 0's weights and momentums to every rank
+  NeuralNetDist_Step step;      // Returns the summed loss of every rank's samples
+
+} NeuralNetDist;
+
+/**
+ * Create the shared memory object name, e.g. "/nn-dist", for ranks
+ * processes training networks shaped like the started nn. top_k is
+ * only used with NEURAL_NET_DIST_TOPK. Remove it with NeuralNetDist_remove.
+ */
+Status NeuralNetDist_create(char* name, NeuralNet* nn, unsigned long ranks,
+    unsigned long compress, unsigned long top_k);
+
+/** Unlink the shared memory object name */
+void NeuralNetDist_remove(char* name);
+
+/**
+ * Attach to name as rank, 0 .. ranks-1, training the started nn, which
+ * must be shaped like the network name was created for.
+ */
+Status NeuralNetDist_init(NeuralNetDist* dist, NeuralNet* nn, char* name,
+    unsigned long rank);
+
+#endif
@@ -0,0 +1,98 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef NEURAL_NET_HALF_H
+#define NEURAL_NET_HALF_H
+
+#include "NeuralNet.h"
+
+#include <stdint.h>
+
+typedef float (*NeuronLayerHalf_Dot)(const uint16_t* w, const float* x, unsigned long n);
+typedef void (*NeuronLayerHalf_Axpy)(float a, const uint16_t* w, float* y, unsigned long n);
+typedef void (*NeuronLayerHalf_Round)(const float* src, uint16_t* dst, unsigned long n);
+
+/**
+ * A fully connected layer whose weights are kept as bf16 or fp16 for
+ * the forward and backward passes, which accumulate in float. The
+ * updates are made to a float master copy which is then rounded to
+ * the half precision weights. Rows are padded with zeros to a multiple
+ * of 16 so the kernels need no tail handling.
+ *
+ * The kernels use AVX-512F or F16C with AVX2 and FMA when the cpu
+ * has them and portable C otherwise.
+ */
+typedef struct NeuronLayerHalf {
+  unsigned long format;     // NEURAL_NET_WEIGHTS_BF16 or NEURAL_NET_WEIGHTS_FP16
+  unsigned long rows;       // Neurons
+  unsigned long cols;       // Inputs plus the bias
+  unsigned long stride;     // cols rounded up to a multiple of 16
+  uint16_t* weights;        // [rows][stride], column 0 is the bias
+  float* master;            // [rows][stride]
+  float* momentums;         // [rows][stride]
+  float* inputs;            // [stride] 1.0 then the previous layer's outputs
+  float* acc;               // [stride] backprop accumulator
+  const char* isa;          // Name of the kernels in use
+
+  // Methods
+  NeuronLayerHalf_Dot dot;  // Sum of w[i] * x[i]
+  NeuronLayerHalf_Axpy axpy;// y[i] += a * w[i]
+  NeuronLayerHalf_Round round; // Round floats to the format
+} NeuronLayerHalf;
+
+/**
+ * Create half precision storage of format for the dense layer, the
+ * weights and momentums are copied from its neurons.
+ * @return NULL if format is invalid or out of memory
+ */
+NeuronLayerHalf* NeuronLayerHalf_create(NeuronLayer* layer, unsigned long format);
+
+/**
+ * Switch layer over to half, freeing its dense weights and momentums
+ * unless they're in the arena.
+ */
+void NeuronLayerHalf_attach(NeuronLayer* layer, NeuronLayerHalf* half);
+
+/** Free the half storage of layer, if any */
+void NeuronLayerHalf_deinit(NeuronLayer* layer);
+
+/** Round the master weights of row n, or every row if n == rows */
+void NeuronLayerHalf_sync(NeuronLayerHalf* half, unsigned long n);
+
+/** Return weight i of neuron n as used by the forward pass */
+double NeuronLayerHalf_weight(NeuronLayerHalf* half, unsigned long n, unsigned long i);
+
+/**
+ * Forward pass, compute the output of each neuron of layer. If logits
+ * is not NULL the weighted sums are stored there instead.
+ */
+void NeuronLayerHalf_process(NeuronLayer* layer, double* logits);
+
+/** Back propagate the pd_error of layer to the previous layer */
+void NeuronLayerHalf_backprop(NeuronLayer* layer, NeuronLayer* prev_layer);
+
+/** Update the master weights and momentums of layer then round them */
+void NeuronLayerHalf_adjust_weights(NeuronLayer* layer,
+    double learning_rate, double momentum_factor);
+
+/** Round f to the nearest fp16, ties to even */
+uint16_t NeuronLayerHalf_to_fp16(float f);
+
+/** The value of the fp16 h */
+float NeuronLayerHalf_from_fp16(uint16_t h);
+
+#endif
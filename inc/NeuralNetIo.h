@@ -22,6 +22,37 @@
 #include <stdio.h>
 
 typedef struct NeuralNetIoWriter NeuralNetIoWriter;
+typedef struct NeuralNetIoShmHeader NeuralNetIoShmHeader;
+typedef struct NeuralNetIoShmSlot NeuralNetIoShmSlot;
+typedef struct NeuralNetIoNpy NeuralNetIoNpy;
+
+/**
+ * File layout written by NeuralNetIoWriter:
+ *
+ *   unsigned long epochs            back-patched by close_file
+ *   unsigned long points_per_epoch
+ *   char header[]                   "x y z value\n"
+ *   frames                          points_per_epoch points of 4 doubles each
+ *   NeuralNetIoFooter               written by close_file
+ *
+ * Frame 0 is at data_offset 28, the frames are not aligned to their
+ * doubles so a reader of a mapped file copies them to a buffer aligned
+ * to NEURAL_NET_IO_DATA_ALIGN. A file from a run that didn't call
+ * close_file has no footer.
+ */
+#define NEURAL_NET_IO_DATA_ALIGN 32
+#define NEURAL_NET_IO_FOOTER_MAGIC "NNIOIDX1"
+
+typedef struct NeuralNetIoFooter {
+  char magic[8];                // NEURAL_NET_IO_FOOTER_MAGIC
+  unsigned long data_offset;    // Offset of frame 0
+  unsigned long frame_bytes;    // Size of each frame
+  unsigned long frame_count;    // Number of frames
+  unsigned long first_seq;      // Value passed to begin_epoch for frame 0
+  unsigned long epochs;         // Same as the header's epochs
+  unsigned long footer_bytes;   // sizeof(NeuralNetIoFooter)
+  char end_magic[8];            // NEURAL_NET_IO_FOOTER_MAGIC
+} NeuralNetIoFooter;
 
 typedef void (*NeuralNetIoWriter_deinit)(NeuralNetIoWriter* writer, unsigned long epochs);
 typedef Status (*NeuralNetIoWriter_write_str)(NeuralNetIoWriter* writer, char* s);
@@ -39,6 +70,16 @@ typedef struct NeuralNetIoWriter {
   FILE* out_file;       // Output file
   NeuralNet* nn;        // Neural net
   char* out_path;       // output path
+  unsigned long data_offset; // Offset of the first frame
+  unsigned long frame_bytes; // Bytes per frame
+  unsigned long frames;      // Frames written
+  unsigned long first_seq;   // Value passed to begin_epoch for frame 0
+  NeuralNetIoShmHeader* shm; // Shared memory ring instead of out_file
+  NeuralNetIoShmSlot* slot;  // Slot of the frame being written
+  unsigned long shm_bytes;   // Size of the ring mapping
+  unsigned long shm_slot_count; // Frames the ring holds
+  unsigned long slot_pos;    // Doubles written to slot
+  NeuralNetIoNpy* npy;       // .npy arrays instead of out_file
 
   // Methods
   NeuralNetIoWriter_deinit deinit;
@@ -58,5 +99,11 @@ typedef struct NeuralNetIoWriter {
 Status NeuralNetIoWriter_init(NeuralNetIoWriter* writer, NeuralNet* nn,
     unsigned long points_per_epoch, char* out_path);
 
+/**
+ * The write_epoch method of every backend, writes the points of a
+ * frame using write_point_val.
+ */
+Status NeuralNetIo_write_epoch(NeuralNetIoWriter* writer);
+
 
 #endif
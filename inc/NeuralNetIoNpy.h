@@ -0,0 +1,63 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEURAL_NET_IO_NPY_H
+#define NEURAL_NET_IO_NPY_H
+
+#include "NeuralNet.h"
+#include "NeuralNetIo.h"
+
+#include <stdio.h>
+
+/**
+ * NumPy .npy arrays written by NeuralNetIoNpyWriter_init, one row per
+ * frame, to <prefix>.<name>.npy:
+ *
+ *   weights  float64 [frames, weights]  every layer's weights, bias first,
+ *                                       in layer then neuron order
+ *   outputs  float64 [frames, outputs]  the output layer's outputs
+ *   error    float64 [frames, 1]        nn->error of the frame's sample
+ *   seq      uint64  [frames, 1]        value passed to begin_epoch
+ *
+ * Each file is a version 1.0 header padded to NEURAL_NET_IO_NPY_HEADER_BYTES
+ * followed by the rows, so the data can be mapped in place. Rows are
+ * appended as they're written and close_file rewrites the header with
+ * the number of frames; until then the header's shape has 0 frames.
+ */
+#define NEURAL_NET_IO_NPY_HEADER_BYTES 128
+
+#define NEURAL_NET_IO_NPY_WEIGHTS 0
+#define NEURAL_NET_IO_NPY_OUTPUTS 1
+#define NEURAL_NET_IO_NPY_ERROR   2
+#define NEURAL_NET_IO_NPY_SEQ     3
+#define NEURAL_NET_IO_NPY_ARRAYS  4
+
+typedef struct NeuralNetIoNpy {
+  FILE* files[NEURAL_NET_IO_NPY_ARRAYS];
+  char* paths[NEURAL_NET_IO_NPY_ARRAYS];
+  unsigned long columns[NEURAL_NET_IO_NPY_ARRAYS];
+  double* row;                  // A frame of the widest array
+  unsigned long seq;            // Value passed to begin_epoch for this frame
+} NeuralNetIoNpy;
+
+/**
+ * Initialize writer to write the frames as .npy arrays named from
+ * prefix, e.g. "run1" writes run1.weights.npy and so on.
+ */
+Status NeuralNetIoNpyWriter_init(NeuralNetIoWriter* writer, NeuralNet* nn,
+    char* prefix);
+
+#endif
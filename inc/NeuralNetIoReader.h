@@ -0,0 +1,86 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEURAL_NET_IO_READER_H
+#define NEURAL_NET_IO_READER_H
+
+#include "NeuralNet.h"
+#include "NeuralNetIo.h"
+
+typedef struct NeuralNetIoReader NeuralNetIoReader;
+
+/**
+ * Called for each frame by for_each, points is the frame's
+ * points_per_epoch points of 4 doubles, valid until cb returns.
+ * Returning an error stops the iteration.
+ */
+typedef Status (*NeuralNetIoReader_FrameCb)(void* ctx, unsigned long frame,
+    const double* points);
+
+typedef void (*NeuralNetIoReader_deinit)(NeuralNetIoReader* reader);
+typedef const double* (*NeuralNetIoReader_frame)(NeuralNetIoReader* reader,
+    unsigned long frame);
+typedef const double* (*NeuralNetIoReader_frames)(NeuralNetIoReader* reader,
+    unsigned long first, unsigned long* count);
+typedef Status (*NeuralNetIoReader_for_each)(NeuralNetIoReader* reader,
+    unsigned long first, unsigned long count, NeuralNetIoReader_FrameCb cb,
+    void* ctx);
+
+/** Size of the aligned buffer frames are copied to */
+#define NEURAL_NET_IO_READER_WINDOW_BYTES (1024 * 1024)
+
+/**
+ * Reads a file written by NeuralNetIoWriter by mapping it. The frames
+ * in the file aren't aligned so the ones asked for are copied from the
+ * mapping to an aligned window and returned from there, a pointer is
+ * valid until the next call. If the file has no valid footer, e.g. the
+ * run crashed, the frames are found from the header and a trailing
+ * partial frame is ignored.
+ */
+typedef struct NeuralNetIoReader {
+  unsigned char* map;           // The mapped file
+  unsigned long map_size;       // Size of the mapping
+  unsigned long epochs;         // Epochs from the header, 0 if not closed
+  unsigned long points_per_epoch; // Points in each frame
+  unsigned long data_offset;    // Offset of frame 0
+  unsigned long frame_bytes;    // Size of each frame
+  unsigned long frame_count;    // Number of complete frames
+  unsigned long first_seq;      // begin_epoch value of frame 0
+  unsigned long truncated;      // 1 if the footer was missing or invalid
+  double* window;               // Aligned copy of the frames last returned
+  unsigned long window_frames;  // Frames window holds
+
+  // Methods
+  NeuralNetIoReader_deinit deinit;
+  NeuralNetIoReader_frame frame;
+  NeuralNetIoReader_frames frames;
+  NeuralNetIoReader_for_each for_each;
+
+} NeuralNetIoReader;
+
+/**
+ * Map in_path and locate its frames.
+ *
+ * frame(reader, n) returns frame n or NULL if n >= frame_count.
+ * frames(reader, first, &count) returns frame first and clips *count
+ * to the frames available and that fit the window, the frames are
+ * contiguous.
+ * for_each(reader, first, count, cb, ctx) calls cb for each frame of
+ * the clipped range.
+ */
+Status NeuralNetIoReader_init(NeuralNetIoReader* reader, char* in_path);
+
+#endif
@@ -0,0 +1,112 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEURAL_NET_IO_SHM_H
+#define NEURAL_NET_IO_SHM_H
+
+#include "NeuralNet.h"
+#include "NeuralNetIo.h"
+
+#include <stdatomic.h>
+
+/**
+ * POSIX shared memory layout written by NeuralNetIoShmWriter_init:
+ *
+ *   NeuralNetIoShmHeader
+ *   slot_count slots at data_offset, each slot_bytes long:
+ *     NeuralNetIoShmSlot
+ *     points_per_epoch points of 4 doubles, the same as a file frame
+ *
+ * Frame f goes to slot f % slot_count. Each slot is a seqlock, seq is
+ * odd while the writer is filling it, so the writer never waits for a
+ * reader; a reader that was overtaken sees seq change and retries.
+ */
+#define NEURAL_NET_IO_SHM_MAGIC "NNIOSHM1"
+#define NEURAL_NET_IO_SHM_SLOTS 8
+
+// Looks at a slot whose seq stays odd before peek gives up on the writer
+#define NEURAL_NET_IO_SHM_PEEK_TRIES 10000
+
+typedef struct NeuralNetIoShmHeader {
+  char magic[8];                // NEURAL_NET_IO_SHM_MAGIC once initialized
+  unsigned long slot_count;
+  unsigned long slot_bytes;     // Stride of the slots
+  unsigned long data_offset;    // Offset of slot 0
+  unsigned long points_per_epoch;
+  unsigned long frame_bytes;    // Bytes of points in a slot
+  atomic_ulong head;            // Frames published, latest is head - 1
+  atomic_ulong closed;          // 1 once the writer has finished
+} NeuralNetIoShmHeader;
+
+typedef struct NeuralNetIoShmSlot {
+  atomic_ulong seq;             // Odd while being written
+  unsigned long frame;          // Frame number
+  unsigned long epoch;          // Value passed to begin_epoch
+  unsigned long reserved;       // Keeps the points 32 byte aligned
+} NeuralNetIoShmSlot;
+
+/**
+ * Initialize writer to publish frames to the shared memory object
+ * name, e.g. "/nn-live", with a ring of slot_count frames. The object
+ * is unlinked by deinit.
+ */
+Status NeuralNetIoShmWriter_init(NeuralNetIoWriter* writer, NeuralNet* nn,
+    unsigned long points_per_epoch, char* name, unsigned long slot_count);
+
+typedef struct NeuralNetIoShmReader NeuralNetIoShmReader;
+
+/** A frame in place in the ring, valid until the writer reuses its slot */
+typedef struct NeuralNetIoShmView {
+  const double* points;         // points_per_epoch points of 4 doubles
+  unsigned long frame;
+  unsigned long epoch;
+  unsigned long seq;            // Slot seq when the view was taken
+  NeuralNetIoShmSlot* slot;
+} NeuralNetIoShmView;
+
+typedef void (*NeuralNetIoShmReader_deinit)(NeuralNetIoShmReader* reader);
+typedef Status (*NeuralNetIoShmReader_peek)(NeuralNetIoShmReader* reader,
+    NeuralNetIoShmView* view);
+typedef int (*NeuralNetIoShmReader_valid)(NeuralNetIoShmReader* reader,
+    NeuralNetIoShmView* view);
+typedef Status (*NeuralNetIoShmReader_latest)(NeuralNetIoShmReader* reader,
+    double* points, NeuralNetIoShmView* view);
+
+/**
+ * Maps a ring read only. peek() returns the latest frame in place
+ * without copying, after using it valid() says whether the writer
+ * overwrote it meanwhile. latest() copies the latest frame to points,
+ * retrying until it gets a consistent one. Both return STATUS_ERR
+ * if there is no frame yet or the writer closed or died while
+ * publishing the latest one, so its slot never became readable.
+ */
+typedef struct NeuralNetIoShmReader {
+  NeuralNetIoShmHeader* header;
+  unsigned long map_size;
+  unsigned long points_per_epoch;
+
+  // Methods
+  NeuralNetIoShmReader_deinit deinit;
+  NeuralNetIoShmReader_peek peek;     // STATUS_ERR if no readable frame
+  NeuralNetIoShmReader_valid valid;
+  NeuralNetIoShmReader_latest latest; // STATUS_ERR if no readable frame
+
+} NeuralNetIoShmReader;
+
+/** Map the ring name, STATUS_ERR if it doesn't exist or isn't ready */
+Status NeuralNetIoShmReader_init(NeuralNetIoShmReader* reader, char* name);
+
+#endif
@@ -0,0 +1,103 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef NEURAL_NET_KERNELS_H
+#define NEURAL_NET_KERNELS_H
+
+#include "NeuralNet.h"
+#include "ThreadPool.h"
+
+#define NEURAL_NET_KERNEL_FORWARD  0 ///< Weighted sums and activations
+#define NEURAL_NET_KERNEL_BACKWARD 1 ///< pd_error of the previous layer
+#define NEURAL_NET_KERNEL_ADJUST   2 ///< Weight and momentum update
+#define NEURAL_NET_KERNEL_OPS      3
+
+typedef struct NeuronLayerTuned NeuronLayerTuned;
+
+typedef void (*NeuralNetKernel_Forward)(NeuronLayer* layer, double* logits);
+typedef void (*NeuralNetKernel_Backward)(NeuronLayer* layer, NeuronLayer* prev_layer);
+typedef void (*NeuralNetKernel_Adjust)(NeuronLayer* layer, double learning_rate,
+    double momentum_factor);
+
+/** Row helpers of the widest instruction set the cpu has */
+typedef double (*NeuralNetKernel_Dot)(const double* w, const double* x, unsigned long n);
+typedef void (*NeuralNetKernel_Axpy)(double a, const double* w, double* y, unsigned long n);
+typedef void (*NeuralNetKernel_Update)(double* w, double* m, const double* x,
+    double a, double momentum_factor, unsigned long n);
+
+/**
+ * A candidate implementation of one op for a dense double layer.
+ * Only the function of its op is set. Every candidate computes the
+ * same thing but they sum in different orders, so the results may
+ * differ from the default loops in the last bits.
+ */
+typedef struct NeuralNetKernel {
+  const char* name;               // Unique within the op, kept in the cache
+  unsigned long op;               // NEURAL_NET_KERNEL_xxx
+  const char* cpu;                // Feature __builtin_cpu_supports needs, NULL for none
+  unsigned long threaded;         // Fans the rows out over the tuned pool
+  NeuralNetKernel_Forward forward;
+  NeuralNetKernel_Backward backward;
+  NeuralNetKernel_Adjust adjust;
+} NeuralNetKernel;
+
+/** A range of rows run by a pool worker */
+typedef struct NeuronLayerTunedTask {
+  NeuronLayer* layer;
+  double* logits;
+  double learning_rate;
+  double momentum_factor;
+  unsigned long first;            // First neuron
+  unsigned long last;             // One past the last neuron
+  unsigned long op;               // NEURAL_NET_KERNEL_xxx
+} NeuronLayerTunedTask;
+
+/** The kernels chosen for a dense layer and their scratch space */
+typedef struct NeuronLayerTuned {
+  const NeuralNetKernel* kernels[NEURAL_NET_KERNEL_OPS];
+  double ns[NEURAL_NET_KERNEL_OPS]; // Measured time of each choice
+  double* inputs;                 // Previous layer's outputs, gathered
+  double* acc;                    // Backprop accumulator
+  ThreadPool* pool;               // For threaded kernels, NULL if none
+  NeuronLayerTunedTask* tasks;    // One per pool worker
+  unsigned long task_count;
+  NeuralNetKernel_Dot dot;
+  NeuralNetKernel_Axpy axpy;
+  NeuralNetKernel_Update update;
+} NeuronLayerTuned;
+
+/**
+ * Return the candidate kernels, count is set to their number.
+ */
+const NeuralNetKernel* NeuralNetKernel_list(unsigned long* count);
+
+/** @return 1 if the cpu can run kernel and any pool it needs is present */
+int NeuralNetKernel_usable(const NeuralNetKernel* kernel, ThreadPool* pool);
+
+/** @return the kernel of op named name, or NULL */
+const NeuralNetKernel* NeuralNetKernel_find(unsigned long op, const char* name);
+
+/**
+ * Attach tuned state to the dense layer, starting with the default
+ * loops, threaded kernels use pool which may be NULL.
+ */
+Status NeuronLayerTuned_attach(NeuronLayer* layer, ThreadPool* pool);
+
+/** Free the tuned state of layer, if any */
+void NeuronLayerTuned_deinit(NeuronLayer* layer);
+
+#endif
@@ -0,0 +1,120 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef NEURAL_NET_LBFGS_H
+#define NEURAL_NET_LBFGS_H
+
+#include "NeuralNet.h"
+#include "ThreadPool.h"
+
+/** Corrections kept by default */
+#define NEURAL_NET_LBFGS_HISTORY 10
+
+/** Samples per gradient task, smaller data sets are done by the caller */
+#define NEURAL_NET_LBFGS_MIN_CHUNK 64
+
+typedef struct NeuralNetLbfgs NeuralNetLbfgs;
+
+/** A slice of the data set and its own loss and gradient accumulators */
+typedef struct NeuralNetLbfgsChunk {
+  NeuralNetLbfgs* opt;
+  const double* x;          // Parameters being evaluated
+  unsigned long first;      // First sample of the slice
+  unsigned long end;        // One past the last sample
+  double loss;              // Loss of the slice
+  double* grad;             // Gradient of the slice
+  double* acts;             // Outputs of every layer for one sample
+  double* deltas;           // dLoss/dsum of every layer for one sample
+} NeuralNetLbfgsChunk;
+
+typedef void (*NeuralNetLbfgs_Deinit)(NeuralNetLbfgs* opt);
+typedef double (*NeuralNetLbfgs_Evaluate)(NeuralNetLbfgs* opt, const double* x, double* g);
+typedef Status (*NeuralNetLbfgs_Step)(NeuralNetLbfgs* opt);
+typedef Status (*NeuralNetLbfgs_Run)(NeuralNetLbfgs* opt, unsigned long max_iterations);
+
+/**
+ * Full batch training with L-BFGS. Each evaluation is the exact loss and
+ * gradient over the whole data set, the same loss adjust_weights returns
+ * summed over the samples. The samples are split into chunks with their
+ * own accumulators that run on a ThreadPool and are then summed in chunk
+ * order, so for a given thread count results don't depend on scheduling.
+ *
+ * Each iteration picks a direction with the two loop recursion over the
+ * last history corrections and a backtracking line search that satisfies
+ * the Armijo condition. A correction without positive curvature is
+ * dropped, and if the line search fails the history is cleared and the
+ * search retried along the steepest descent.
+ *
+ * The weights of nn are updated after every iteration so nn can be used
+ * between them, its momentums are zeroed at init. Only dense double
+ * layers are supported.
+ */
+typedef struct NeuralNetLbfgs {
+  NeuralNet* nn;
+  Pattern** inputs;         // The training set
+  Pattern** targets;
+  unsigned long count;
+
+  double error_threshold;   // run stops once the loss is below this, 0 never
+  double grad_tolerance;    // run stops once every |gradient| is below this
+  unsigned long history;    // Corrections kept
+  unsigned long param_count;// Weights and biases of every layer
+  unsigned long act_count;  // Neurons of every layer
+  unsigned long* weight_offsets; // Of each layer's weights in x
+  unsigned long* act_offsets;    // Of each layer in a chunk's acts and deltas
+
+  unsigned long iterations; // Steps taken
+  unsigned long evaluations;// Passes over the data set
+  unsigned long restarts;   // Line searches retried along the gradient
+  unsigned long stored;     // Corrections held, up to history
+  unsigned long newest;     // Index of the newest correction
+  unsigned long done;       // Converged or can't make progress
+  double loss;              // Loss at x
+  double grad_max;          // Largest |gradient| at x
+
+  double* x;                // Parameters
+  double* g;                // Gradient at x
+  double* d;                // Search direction
+  double* x_new;
+  double* g_new;
+  double* s;                // history corrections of x
+  double* y;                // history corrections of g
+  double* rho;              // 1 / (y . s) of each correction
+  double* alpha;            // Scratch of the two loop recursion
+
+  NeuralNetLbfgsChunk* chunks;
+  unsigned long chunk_count;
+  ThreadPool pool;
+
+  // Methods
+  NeuralNetLbfgs_Deinit deinit;
+  NeuralNetLbfgs_Evaluate evaluate; // Loss at x, gradient into g
+  NeuralNetLbfgs_Step step;         // One iteration, STATUS_ERR if no progress
+  NeuralNetLbfgs_Run run;           // Step until done or max_iterations, 0 no limit
+
+} NeuralNetLbfgs;
+
+/**
+ * Initialize full batch training of the started nn on count samples.
+ * A history of 0 uses NEURAL_NET_LBFGS_HISTORY, threads of 0 uses one per
+ * online cpu.
+ */
+Status NeuralNetLbfgs_init(NeuralNetLbfgs* opt, NeuralNet* nn, Pattern** inputs,
+    Pattern** targets, unsigned long count, unsigned long history,
+    unsigned long threads);
+
+#endif
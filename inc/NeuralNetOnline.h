@@ -0,0 +1,72 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEURAL_NET_ONLINE_H
+#define NEURAL_NET_ONLINE_H
+
+#include "NeuralNet.h"
+#include "NeuralNetQueue.h"
+
+#include <pthread.h>
+
+#define NEURAL_NET_ONLINE_ERROR_DECAY 0.999
+
+typedef struct NeuralNetOnline NeuralNetOnline;
+
+typedef struct NeuralNetOnlineTrainer {
+  NeuralNetOnline* online;
+  Pattern* input;
+  Pattern* target;
+  Pattern* output;
+  unsigned long samples;      // Samples this trainer stepped on
+  pthread_t thread;
+  unsigned long started;      // thread is running
+} NeuralNetOnlineTrainer;
+
+typedef void (*NeuralNetOnline_Deinit)(NeuralNetOnline* online);
+typedef void (*NeuralNetOnline_Wait)(NeuralNetOnline* online);
+
+/**
+ * Online training of one NeuralNet, each trainer thread pops samples
+ * from the queue and takes a training step on the network until the
+ * queue is closed and drained. Steps hold the lock so the network sees
+ * the stream one sample at a time, as a single trainer would, more
+ * trainers only overlap popping the next samples with the step.
+ */
+typedef struct NeuralNetOnline {
+  NeuralNetQueue* queue;
+  NeuralNet* nn;              // The network every trainer steps
+  NeuralNetOnlineTrainer* trainers;
+  unsigned long count;        // Number of trainers
+  unsigned long samples;      // Samples nn was trained on
+  double error_decay;         // Weight of the old error in the average
+  double error;               // Moving average of the sample error
+  pthread_mutex_t lock;       // Held for each step of nn
+
+  // Methods
+  NeuralNetOnline_Deinit deinit; // Closes the queue and waits
+  NeuralNetOnline_Wait wait;  // Until the trainers are done, close the queue first
+
+} NeuralNetOnline;
+
+/**
+ * Start count trainer threads training the started network nn
+ * with samples consumed from queue.
+ */
+Status NeuralNetOnline_init(NeuralNetOnline* online, NeuralNetQueue* queue,
+    NeuralNet* nn, unsigned long count);
+
+#endif
@@ -0,0 +1,114 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef NEURAL_NET_PIPELINE_H
+#define NEURAL_NET_PIPELINE_H
+
+#include "NeuralNet.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define NEURAL_NET_PIPELINE_GPIPE 0 ///< All forwards of a mini batch then all backwards
+#define NEURAL_NET_PIPELINE_1F1B  1 ///< Alternate forwards and backwards once warmed up
+
+typedef struct NeuralNetPipeline NeuralNetPipeline;
+
+/**
+ * Single producer, single consumer ring of micro batch numbers
+ * between adjacent stages. The activations and pd_errors themselves
+ * stay in NeuralNetPipeline.outs and errs, the ring only hands them off.
+ */
+typedef struct NeuralNetPipelineRing {
+  atomic_ulong tail;          // Written by the producer
+  char pad0[56];
+  atomic_ulong head;          // Written by the consumer
+  char pad1[56];
+  unsigned long mask;         // Slots - 1, slots is a power of 2
+  unsigned long* slots;
+} NeuralNetPipelineRing;
+
+typedef struct NeuralNetPipelineStage {
+  NeuralNetPipeline* pipe;
+  unsigned long index;        // Stage number, 0 is fed the inputs
+  unsigned long first_layer;  // nn->layers[first_layer..last_layer]
+  unsigned long last_layer;
+  unsigned long* offsets;     // Offset of each layer's parameters, plus the total
+  double* weights;            // Packed copy of the layers' weights
+  double* momentums;          // Packed copy of the layers' momentums
+  double* grads;              // Gradient summed over the mini batch
+  double error;               // Loss of the last job, last stage only
+  unsigned long seen;         // Generation of the last job run
+  pthread_t thread;
+  unsigned long started;      // thread is running
+} NeuralNetPipelineStage;
+
+typedef void (*NeuralNetPipeline_Deinit)(NeuralNetPipeline* pipe);
+typedef double (*NeuralNetPipeline_Train)(NeuralNetPipeline* pipe,
+    Pattern** inputs, Pattern** targets, unsigned long count);
+
+/**
+ * Pipeline parallel training of one NeuralNet. The weighted layers
+ * are split into contiguous stages of about equal work, each trained
+ * by its own thread on a packed private copy of its weights. A mini
+ * batch of micro_batches micro batches of micro_batch_size samples
+ * flows forward through the stages and its pd_errors flow back, then
+ * each stage applies the averaged gradient to its own layers, so the
+ * result doesn't depend on the schedule or the number of stages.
+ *
+ * Only fully connected dense layers are supported.
+ */
+typedef struct NeuralNetPipeline {
+  NeuralNet* nn;
+  unsigned long stage_count;
+  unsigned long micro_batches;    // Micro batches per mini batch
+  unsigned long micro_batch_size; // Samples per micro batch
+  unsigned long schedule;         // NEURAL_NET_PIPELINE_xxx
+  unsigned long pin;              // Pin stage s to cpu s % cpus
+  NeuralNetPipelineStage* stages;
+  NeuralNetPipelineRing* forward;  // forward[s] from stage s to s + 1
+  NeuralNetPipelineRing* backward; // backward[s] from stage s + 1 to s
+  double** outs;              // Per layer, outputs of every sample of a mini batch
+  double** errs;              // Per layer, pd_errors of every sample of a mini batch
+
+  // The current job
+  Pattern** inputs;
+  Pattern** targets;
+  unsigned long count;
+  unsigned long generation;   // Bumped for each job
+  unsigned long pending;      // Stages still running the job
+  unsigned long quit;
+  pthread_mutex_t lock;
+  pthread_cond_t start_cond;
+  pthread_cond_t done_cond;
+
+  // Methods
+  NeuralNetPipeline_Deinit deinit;
+  NeuralNetPipeline_Train train;  // Returns the summed loss of the samples
+
+} NeuralNetPipeline;
+
+/**
+ * Create a pipeline of stage_count stages for the started nn, 0 is one
+ * per cpu. It's capped at the number of weighted layers. train() copies
+ * the updated weights back to nn before returning.
+ */
+Status NeuralNetPipeline_init(NeuralNetPipeline* pipe, NeuralNet* nn,
+    unsigned long stage_count, unsigned long micro_batches,
+    unsigned long micro_batch_size, unsigned long schedule);
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEURAL_NET_POP_H
+#define NEURAL_NET_POP_H
+
+#include "NeuralNet.h"
+
+/**
+ * A population of networks with the same topology trained in lock step.
+ *
+ * Every per network value is stored interleaved, value v of network k is
+ * at [(v * stride) + k], so the inner loops run across networks over
+ * contiguous memory and each SIMD lane handles a different network.
+ * stride is width rounded up to NEURAL_NET_POP_LANES, the padding lanes
+ * are never active.
+ */
+#define NEURAL_NET_POP_LANES 8
+
+typedef struct NeuralNetPop NeuralNetPop;
+
+// NeuralNetPop methods
+typedef void (*NeuralNetPop_Deinit)(NeuralNetPop* pop);
+
+typedef unsigned long (*NeuralNetPop_TrainEpoch)(NeuralNetPop* pop,
+    Pattern** inputs, Pattern** targets, unsigned int pattern_count);
+
+typedef Status (*NeuralNetPop_Extract)(NeuralNetPop* pop, unsigned long k,
+    NeuralNet* nn);
+
+// One pattern through the lane loops, the variant built for the CPU
+typedef void (*NeuralNetPop_Step)(NeuralNetPop* pop, Pattern** targets);
+
+typedef struct NeuralNetPop {
+  unsigned long width;      // Number of networks
+  unsigned long stride;     // width rounded up to NEURAL_NET_POP_LANES
+  unsigned long num_layers; // Number of layers including input and output
+  unsigned long* counts;    // Number of neurons in each layer
+  unsigned long* neuron_base; // Index of each layer's first neuron
+  unsigned long* weight_base; // Index of each layer's first weight
+  unsigned long num_neurons;  // Total neurons
+  unsigned long num_weights;  // Total weights including biases
+  double learning_rate;     // Learning rate aka 'eta'
+  double momentum_factor;   // Momentum factor aka 'aplha'
+  double error_threshold;   // A network converges when its epoch error is below this
+
+  double* weights;          // [num_weights][stride]
+  double* momentums;        // [num_weights][stride]
+  double* outputs;          // [num_neurons][stride]
+  double* pd_errors;        // [num_neurons][stride]
+  double* scratch;          // [stride] weighted sums
+  double* sample_errors;    // [stride] error of the current pattern
+  double* errors;           // [stride] error of the last epoch of each network
+  unsigned long* epochs;    // [stride] epochs each network has trained
+  unsigned long* rand_state;// [stride] each network's data order generator
+  unsigned int* perms;      // [stride][perm_count] each network's data order
+  unsigned long perm_count; // Number of entries of each perms row
+  unsigned int* lane_pattern; // [stride] pattern each network is processing
+  unsigned char* active;    // [stride] 1 while the network is still training
+  NeuralNetPop_Step step;   // Widest lane loops the CPU supports
+
+  // Methods
+  NeuralNetPop_Deinit deinit;
+  NeuralNetPop_TrainEpoch train_epoch;
+  NeuralNetPop_Extract extract;
+
+} NeuralNetPop;
+
+/**
+ * Initialize a population of width networks with num_layers layers,
+ * counts[0] is the number of inputs and counts[num_layers-1] the number
+ * of outputs. Weights are initialized with rand0_1() one network after
+ * the other so network 0 matches a NeuralNet started right after the
+ * same srand(). seed selects the per network data order.
+ */
+Status NeuralNetPop_init(NeuralNetPop* pop, unsigned long width,
+    unsigned long num_layers, unsigned long* counts, unsigned long seed);
+
+#endif
@@ -0,0 +1,109 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEURAL_NET_QUEUE_H
+#define NEURAL_NET_QUEUE_H
+
+#include "NeuralNet.h"
+
+#include <stdatomic.h>
+
+typedef struct NeuralNetQueue NeuralNetQueue;
+
+/** A snapshot of a queue's counters */
+typedef struct NeuralNetQueueStats {
+  unsigned long pushed;       // Samples pushed
+  unsigned long popped;       // Samples popped
+  unsigned long depth;        // Samples waiting, pushed - popped
+  unsigned long full_waits;   // Pushes that waited for room, backpressure
+  unsigned long empty_waits;  // Pops that waited for a sample
+  unsigned long lag_ns_max;   // Longest time a sample spent queued
+  double lag_ns_avg;          // Average time a sample spent queued
+  double elapsed_sec;         // Since init
+  double throughput;          // Samples popped per second
+} NeuralNetQueueStats;
+
+typedef void (*NeuralNetQueue_Deinit)(NeuralNetQueue* queue);
+typedef Status (*NeuralNetQueue_Push)(NeuralNetQueue* queue, Pattern* input, Pattern* target);
+typedef Status (*NeuralNetQueue_Pop)(NeuralNetQueue* queue, Pattern* input, Pattern* target);
+typedef void (*NeuralNetQueue_Close)(NeuralNetQueue* queue);
+typedef void (*NeuralNetQueue_Stats)(NeuralNetQueue* queue, NeuralNetQueueStats* stats);
+
+/**
+ * A bounded lock free multi producer, multi consumer queue of training
+ * samples, each an input pattern and its target. Every slot carries a
+ * sequence number so producers and consumers only contend on claiming
+ * a position. push waits while the queue is full, which is how a slow
+ * trainer pushes back on its producers, and pop waits while it is empty.
+ * close sets the top bit of tail, so a push either claimed its position
+ * before the close or fails, and pops drain every claimed position.
+ *
+ * The producer and consumer positions are kept a cache line apart.
+ */
+typedef struct NeuralNetQueue {
+  // Written by producers
+  atomic_ulong tail;          // Next position to push, top bit set once closed
+  atomic_ulong pushed;
+  atomic_ulong full_waits;
+  char pad0[40];
+
+  // Written by consumers
+  atomic_ulong head;          // Next position to pop
+  atomic_ulong popped;
+  atomic_ulong empty_waits;
+  atomic_ulong lag_ns_sum;
+  atomic_ulong lag_ns_max;
+  char pad1[24];
+
+  // Read mostly
+  unsigned long cap;          // Slots, a power of 2
+  unsigned long mask;
+  unsigned long input_count;  // Values of an input pattern
+  unsigned long target_count; // Values of a target pattern
+  unsigned long slot_bytes;
+  unsigned long start_ns;
+  char* slots;
+
+  // Methods
+  NeuralNetQueue_Deinit deinit;
+  NeuralNetQueue_Push push;       // STATUS_ERR once closed
+  NeuralNetQueue_Push try_push;   // STATUS_ERR if full or closed
+  NeuralNetQueue_Pop pop;         // STATUS_ERR once closed and drained
+  NeuralNetQueue_Pop try_pop;     // STATUS_ERR if empty
+  NeuralNetQueue_Close close;
+  NeuralNetQueue_Stats stats;
+
+} NeuralNetQueue;
+
+/**
+ * Initialize a queue of at least capacity samples, rounded
+ * up to a power of 2, each an input_count input and a
+ * target_count target.
+ */
+Status NeuralNetQueue_init(NeuralNetQueue* queue, unsigned long capacity,
+    unsigned long input_count, unsigned long target_count);
+
+/**
+ * A producer reading binary rows from fd until end of file and pushing
+ * them to queue. A row is input_count then target_count doubles in host
+ * byte order, as written by fwrite of a double array.
+ *
+ * @return STATUS_OK at end of file, STATUS_ERR on a read error, a
+ * partial last row or if the queue was closed.
+ */
+Status NeuralNetQueue_read_fd(NeuralNetQueue* queue, int fd);
+
+#endif
@@ -0,0 +1,122 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef NEURAL_NET_RACE_H
+#define NEURAL_NET_RACE_H
+
+#include "NeuralNet.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+#define NEURAL_NET_RACE_RUNNING 0 ///< Still training
+#define NEURAL_NET_RACE_WON     1 ///< Reached the error threshold first
+#define NEURAL_NET_RACE_LOST    2 ///< Cancelled because another racer won
+#define NEURAL_NET_RACE_SPENT   3 ///< Gave up, no seeds left to restart with
+#define NEURAL_NET_RACE_FAILED  4 ///< Setting up a run failed
+
+/**
+ * What to race. Every run trains the same single hidden layer network
+ * with a different seed, the first to get below error_threshold wins.
+ */
+typedef struct NeuralNetRaceSpec {
+  unsigned long racers;           // Threads, 0 for one per cpu
+  unsigned long first_seed;       // Racer r starts with seed first_seed + r
+  unsigned long max_restarts;     // Fresh seeds handed out to abandoned runs
+  unsigned long hidden;           // Neurons of the single hidden layer
+  double learning_rate;
+  double momentum_factor;
+  unsigned long alloc_mode;       // NEURAL_NET_ALLOC_xxx
+  unsigned long weight_type;      // NEURAL_NET_WEIGHTS_xxx
+
+  double error_threshold;         // A run wins below this
+  unsigned long max_epochs;       // Abandon a run after this, 0 for no limit
+  unsigned long stall_epochs;     // Window a run must improve over, 0 never stalls
+  double stall_improvement;       // Required relative improvement per window
+  double straggler_ratio;         // Abandon a run this many times worse than
+                                  // the best when at least half as far
+                                  // along, 0 disables
+  unsigned long poll_ms;          // Interval the trajectories are checked at
+
+  Pattern** inputs;               // The training set
+  Pattern** targets;
+  unsigned long pattern_count;
+} NeuralNetRaceSpec;
+
+typedef struct NeuralNetRace NeuralNetRace;
+
+/** A racing thread, it restarts with a fresh seed when a run is abandoned */
+typedef struct NeuralNetRacer {
+  NeuralNetRace* race;
+  unsigned long index;
+  unsigned long seed;             // Seed of the current run
+  atomic_ulong run;               // Number of the current run
+  atomic_ulong epochs;            // Epochs of the current run
+  _Atomic double error;           // Error of the last epoch
+  atomic_ulong abandon;           // Run number + 1 the monitor wants restarted
+  atomic_ulong state;             // NEURAL_NET_RACE_xxx
+  unsigned long runs;             // Runs started
+  unsigned long stalls;           // Runs abandoned for not improving
+  unsigned long straggles;        // Runs abandoned by the monitor
+  unsigned long total_epochs;     // Epochs of all of its runs
+  double time_sec;                // Training time
+  Status status;
+  int started;                    // nn has been initialized
+  NeuralNet nn;
+  unsigned int* perm;
+  Pattern* output;
+  pthread_t thread;
+  unsigned long running;          // thread is running
+} NeuralNetRacer;
+
+typedef void (*NeuralNetRace_Deinit)(NeuralNetRace* race);
+typedef Status (*NeuralNetRace_Run)(NeuralNetRace* race);
+typedef Status (*NeuralNetRace_Take)(NeuralNetRace* race, NeuralNet* nn);
+typedef void (*NeuralNetRace_Print)(NeuralNetRace* race, FILE* f);
+
+/**
+ * Speculative parallel restarts. Each racer trains its own copy of the
+ * job on its own thread, a run is abandoned and restarted with the next
+ * unused seed if it stops improving, exceeds max_epochs or the monitor
+ * finds it straggling. Cancellation is cooperative, racers check their
+ * flags between epochs, and the first run to converge stops them all.
+ */
+typedef struct NeuralNetRace {
+  NeuralNetRaceSpec spec;
+  NeuralNetRacer* racers;
+  unsigned long count;            // Number of racers
+  NeuralNetRacer* winner;         // NULL if no run converged
+  atomic_long won;                // Index of the winner, -1 while racing
+  atomic_ulong next_seed;         // Next seed for a restart
+  atomic_ulong restarts;          // Seeds handed out for restarts
+  unsigned long finished;         // Racers that have stopped
+  double time_sec;                // Wall clock time of run
+  pthread_mutex_t lock;
+  pthread_cond_t cond;            // Signalled as each racer stops
+
+  // Methods
+  NeuralNetRace_Deinit deinit;
+  NeuralNetRace_Run run;
+  NeuralNetRace_Take take;        // Move the winner's network to nn
+  NeuralNetRace_Print print;
+
+} NeuralNetRace;
+
+Status NeuralNetRace_init(NeuralNetRace* race, NeuralNetRaceSpec* spec);
+
+#endif
@@ -0,0 +1,87 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef NEURAL_NET_SKIP_H
+#define NEURAL_NET_SKIP_H
+
+#include "NeuralNet.h"
+
+/**
+ * Saturation aware updates of a dense layer. A neuron whose |pd_error|
+ * is below threshold is left out of back propagation and its weight
+ * and momentum update is skipped. Its momentum is still owed, so the
+ * number of skipped steps k is counted and, when the neuron is next
+ * active, the k steps of decay are applied at once:
+ *
+ *   weights += momentums * alpha * (1 - alpha^k) / (1 - alpha)
+ *   momentums *= alpha^k
+ *
+ * which is exactly where k updates with a zero pd_error would have
+ * left them.
+ */
+typedef struct NeuronLayerSkip {
+  double threshold;         // Skip neurons with |pd_error| below this
+  unsigned long* pending;   // Per neuron, skipped steps not yet applied
+  unsigned long* active;    // Neurons at or above threshold this step
+  unsigned long active_count;
+  unsigned long selected;   // active is current for this step
+  unsigned long updates;    // Neuron updates asked for
+  unsigned long skipped;    // Neuron updates skipped
+  double momentum_factor;   // Of the last step, to settle pending neurons
+} NeuronLayerSkip;
+
+/**
+ * Allocate the skip state of a layer of count neurons.
+ * @return NULL if out of memory
+ */
+NeuronLayerSkip* NeuronLayerSkip_create(unsigned long count, double threshold);
+
+/** Free the skip state of layer, if any */
+void NeuronLayerSkip_deinit(NeuronLayer* layer);
+
+/**
+ * Back propagate the pd_error of layer's active neurons to the previous
+ * layer, neurons becoming active first catch up on their momentum.
+ */
+void NeuronLayerSkip_backprop(NeuronLayer* layer, NeuronLayer* prev_layer,
+    double momentum_factor);
+
+/** Update the weights and momentums of layer's active neurons */
+void NeuronLayerSkip_adjust_weights(NeuronLayer* layer,
+    double learning_rate, double momentum_factor);
+
+/**
+ * Apply the momentum still owed by every skipped neuron of nn. Readers
+ * don't need this, NeuronLayer_weight returns the settled weights, but
+ * anything that takes over nn's weights and momentums to train them
+ * itself must flush first.
+ */
+void NeuralNet_skip_flush(NeuralNet* nn);
+
+/**
+ * Weight i of neuron n of a skip layer and its momentum as they will be
+ * once the momentum still owed is applied, the layer is left unchanged
+ * so readers don't perturb training. Either output may be NULL.
+ */
+void NeuronLayerSkip_settled(NeuronLayer* layer, unsigned long n,
+    unsigned long i, double momentum_factor, double* weight, double* momentum);
+
+/** Neuron updates asked for and skipped over all of nn's layers */
+void NeuralNet_skip_stats(NeuralNet* nn, unsigned long* updates,
+    unsigned long* skipped);
+
+#endif
@@ -0,0 +1,134 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef NEURAL_NET_SNAPSHOT_H
+#define NEURAL_NET_SNAPSHOT_H
+
+#include "NeuralNet.h"
+
+#include <stdatomic.h>
+
+typedef struct NeuralNetVersion NeuralNetVersion;
+typedef struct NeuralNetSnapshot NeuralNetSnapshot;
+typedef struct NeuralNetSnapshotReader NeuralNetSnapshotReader;
+
+/**
+ * An immutable copy of a network's weights. Every layer is stored
+ * dense, whether the network's layer is dense, sparse, half precision
+ * or a convolution, so readers have one forward pass for them all.
+ */
+typedef struct NeuralNetVersion {
+  NeuralNetVersion* next;     // Retired or free list link
+  unsigned long version;      // 1 for the first publish, then 2, 3, ...
+  unsigned long retired_epoch;// Epoch it was replaced in, 0 while current
+  unsigned long out_layer;    // counts[out_layer] is the output layer
+  unsigned long output_type;  // NEURAL_NET_OUTPUT_xxx
+  unsigned long* counts;      // Neurons per layer, counts[0] are the inputs
+  double* weights;            // Each layer's rows of bias then input weights
+} NeuralNetVersion;
+
+/** A reader's epoch, one per cache line so readers don't contend */
+typedef struct NeuralNetSnapshotSlot {
+  atomic_ulong epoch;         // Epoch entered at, 0 when not reading
+  atomic_ulong claimed;       // Owned by a reader
+  atomic_ulong predictions;   // Forward passes by the reader
+  char pad[40];
+} NeuralNetSnapshotSlot;
+
+/** Counters of a snapshot */
+typedef struct NeuralNetSnapshotStats {
+  unsigned long published;    // Versions published
+  unsigned long reclaimed;    // Replaced versions no reader can still see
+  unsigned long retired;      // Replaced versions waiting on readers
+  unsigned long predictions;  // Forward passes by all readers
+} NeuralNetSnapshotStats;
+
+typedef void (*NeuralNetSnapshot_Deinit)(NeuralNetSnapshot* snap);
+typedef Status (*NeuralNetSnapshot_Publish)(NeuralNetSnapshot* snap, NeuralNet* nn);
+typedef void (*NeuralNetSnapshot_Stats)(NeuralNetSnapshot* snap, NeuralNetSnapshotStats* stats);
+
+/**
+ * Publishes versions of a network's weights that any number of reader
+ * threads can run forward passes on while the network keeps training.
+ *
+ * This is epoch based RCU. publish copies the weights into a new
+ * version, swaps it in as current and bumps the epoch. A reader records
+ * the epoch in its slot before loading current and clears it when done,
+ * so a replaced version is freed once every reader in a slot entered at
+ * or after the epoch it was replaced in. Readers never wait and the
+ * trainer never waits on readers, versions still in use are left on the
+ * retired list and reclaimed by a later publish.
+ *
+ * Only one thread, normally the trainer, may call publish.
+ */
+typedef struct NeuralNetSnapshot {
+  // Read by readers on every prediction
+  _Atomic(NeuralNetVersion*) current;
+  atomic_ulong epoch;         // Starts at 1, bumped by every publish
+  char pad0[48];
+
+  // Publisher only
+  NeuralNetSnapshotSlot* slots;
+  unsigned long max_readers;
+  unsigned long max_width;    // Neurons in the widest layer
+  unsigned long weight_count; // Doubles in a version
+  unsigned long version_bytes;
+  unsigned long published;
+  unsigned long reclaimed;
+  unsigned long retired_count;
+  NeuralNetVersion* retired;  // Replaced, newest first
+  NeuralNetVersion* free_list;// Reclaimed, reused by publish
+
+  // Methods
+  NeuralNetSnapshot_Deinit deinit;
+  NeuralNetSnapshot_Publish publish;
+  NeuralNetSnapshot_Stats stats;
+
+} NeuralNetSnapshot;
+
+typedef void (*NeuralNetSnapshotReader_Deinit)(NeuralNetSnapshotReader* reader);
+typedef Status (*NeuralNetSnapshotReader_Predict)(NeuralNetSnapshotReader* reader,
+    Pattern* input, Pattern* output, unsigned long* version);
+
+/**
+ * A thread's handle for running forward passes on the current version.
+ * It owns a slot of the snapshot and scratch activations, so a reader
+ * must only be used by one thread at a time.
+ */
+typedef struct NeuralNetSnapshotReader {
+  NeuralNetSnapshot* snap;
+  NeuralNetSnapshotSlot* slot;
+  double* acts[2];            // Activations of the previous and next layer
+
+  // Methods
+  NeuralNetSnapshotReader_Deinit deinit;
+  NeuralNetSnapshotReader_Predict predict; // STATUS_ERR if nothing is published
+
+} NeuralNetSnapshotReader;
+
+/**
+ * Initialize a snapshot of nn's shape for up to max_readers readers,
+ * nn must have been started. Nothing is published until publish.
+ */
+Status NeuralNetSnapshot_init(NeuralNetSnapshot* snap, NeuralNet* nn,
+    unsigned long max_readers);
+
+/** Initialize a reader of snap, STATUS_ERR if all of its slots are taken */
+Status NeuralNetSnapshotReader_init(NeuralNetSnapshotReader* reader,
+    NeuralNetSnapshot* snap);
+
+#endif
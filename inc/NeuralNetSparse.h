@@ -0,0 +1,115 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEURAL_NET_SPARSE_H
+#define NEURAL_NET_SPARSE_H
+
+#include "NeuralNet.h"
+
+/**
+ * Compressed sparse row storage for a pruned layer. Row n holds the
+ * surviving weights of neuron n in column order. Column 0 is the bias,
+ * which is never pruned so it is always the first entry of a row, and
+ * column i+1 is input neuron i.
+ */
+typedef struct NeuronLayerSparse {
+  unsigned long rows;       // Number of neurons in the layer
+  unsigned long nnz;        // Number of stored weights including the biases
+  unsigned long* row_start; // rows + 1 offsets into cols, weights and momentums
+  unsigned int* cols;       // Column of each stored weight
+  double* weights;          // Stored weights
+  double* momentums;        // Momentum of each stored weight
+} NeuronLayerSparse;
+
+/**
+ * The weights pruned from a layer that was kept dense, in the same
+ * row_start/cols layout as NeuronLayerSparse. They stay zero because
+ * the mask is re-applied after every update.
+ */
+typedef struct NeuronLayerMask {
+  unsigned long rows;       // Number of neurons in the layer
+  unsigned long count;      // Number of pruned weights
+  unsigned long* row_start; // rows + 1 offsets into cols
+  unsigned int* cols;       // Column of each pruned weight, never 0
+} NeuronLayerMask;
+
+/** Layers at or below this density after pruning are converted to CSR */
+#define NEURAL_NET_SPARSE_MAX_DENSITY 0.3
+
+/**
+ * Prune the weights of layer whose magnitude is < threshold and if top_k
+ * is > 0 keep at most top_k input weights per neuron, biases are always
+ * kept. If the density left is at or below max_density the layer is
+ * converted to CSR storage and its dense weights are freed. Above it the
+ * CSR loops are slower than the dense ones, so the layer stays dense with
+ * the pruned weights zeroed and recorded in layer->mask. Either way the
+ * pruned weights stay pruned while training continues.
+ */
+Status NeuronLayer_prune(NeuronLayer* layer, double threshold,
+    unsigned long top_k, double max_density);
+
+/**
+ * Allocate a zeroed CSR layout of rows and nnz entries.
+ * @return NULL if out of memory
+ */
+NeuronLayerSparse* NeuronLayerSparse_create(unsigned long rows, unsigned long nnz);
+
+/** Free CSR storage that isn't attached to a layer */
+void NeuronLayerSparse_free(NeuronLayerSparse* sparse);
+
+/**
+ * Switch layer over to sparse, freeing the layer's previous dense
+ * or sparse weights.
+ */
+void NeuronLayerSparse_attach(NeuronLayer* layer, NeuronLayerSparse* sparse);
+
+/** Free the CSR storage of layer, if any */
+void NeuronLayerSparse_deinit(NeuronLayer* layer);
+
+/**
+ * Allocate a zeroed mask of rows and count entries.
+ * @return NULL if out of memory
+ */
+NeuronLayerMask* NeuronLayerMask_create(unsigned long rows, unsigned long count);
+
+/** Free a mask that isn't attached to a layer */
+void NeuronLayerMask_free(NeuronLayerMask* mask);
+
+/** Free the mask of layer, if any */
+void NeuronLayerMask_deinit(NeuronLayer* layer);
+
+/** Zero the masked weights and momentums of layer */
+void NeuronLayerMask_apply(NeuronLayer* layer);
+
+/** Return weight i of row n, 0.0 if it was pruned */
+double NeuronLayerSparse_weight(NeuronLayerSparse* sparse, unsigned long n,
+    unsigned long i);
+
+/**
+ * Forward pass, compute the output of each neuron of layer. If logits
+ * is not NULL the weighted sums are stored there instead and the
+ * outputs are left to the caller.
+ */
+void NeuronLayerSparse_process(NeuronLayer* layer, double* logits);
+
+/** Back propagate the pd_error of layer to the previous layer */
+void NeuronLayerSparse_backprop(NeuronLayer* layer, NeuronLayer* prev_layer);
+
+/** Update the stored weights and momentums of layer */
+void NeuronLayerSparse_adjust_weights(NeuronLayer* layer,
+    double learning_rate, double momentum_factor);
+
+#endif
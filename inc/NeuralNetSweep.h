@@ -0,0 +1,109 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEURAL_NET_SWEEP_H
+#define NEURAL_NET_SWEEP_H
+
+#include "NeuralNet.h"
+#include "ThreadPool.h"
+#include "rand0_1.h"
+
+#include <stdio.h>
+
+/**
+ * What to sweep. With random_samples == 0 every combination of the
+ * lists is run, otherwise random_samples configurations are drawn:
+ * learning_rate log uniform and momentum_factor uniform between the
+ * smallest and largest listed values, hidden and seed from the lists.
+ */
+typedef struct NeuralNetSweepSpec {
+  double* learning_rates;
+  unsigned long learning_rate_count;
+  double* momentum_factors;
+  unsigned long momentum_factor_count;
+  unsigned long* hidden;          // Neurons of the single hidden layer
+  unsigned long hidden_count;
+  unsigned long* seeds;           // rand0_1 seeds
+  unsigned long seed_count;
+  unsigned long random_samples;   // 0 for a grid search
+  unsigned long random_seed;      // Seed for drawing random samples
+
+  unsigned long min_epochs;       // Budget of the first rung
+  unsigned long max_epochs;       // Largest budget
+  unsigned long eta;              // Keep 1/eta of the configurations per rung
+  double error_threshold;         // A configuration converges below this
+  unsigned long workers;          // Pool size, 0 for one per cpu
+
+  Pattern** inputs;               // The training set
+  Pattern** targets;
+  unsigned long pattern_count;
+} NeuralNetSweepSpec;
+
+/** A configuration and its result */
+typedef struct NeuralNetSweepConfig {
+  double learning_rate;
+  double momentum_factor;
+  unsigned long hidden;
+  unsigned long seed;
+
+  unsigned long epochs;           // Epochs trained
+  double error;                   // Error of the last epoch
+  unsigned long converged;        // 1 if error < error_threshold
+  unsigned long rung;             // Last rung it was trained in
+  double time_sec;                // Training time
+  Status status;                  // STATUS_OK unless setting up failed
+  int started;                    // nn has been initialized
+
+  NeuralNet nn;
+  Rand0_1State rand_state;        // Its generator between rungs
+  unsigned int* perm;
+  Pattern* output;
+  unsigned long target_epochs;    // Budget of the current rung
+  struct NeuralNetSweep* sweep;
+} NeuralNetSweepConfig;
+
+typedef struct NeuralNetSweep NeuralNetSweep;
+
+typedef void (*NeuralNetSweep_Deinit)(NeuralNetSweep* sweep);
+typedef Status (*NeuralNetSweep_Run)(NeuralNetSweep* sweep);
+typedef void (*NeuralNetSweep_Print)(NeuralNetSweep* sweep, FILE* f);
+
+/**
+ * Runs each configuration as an independent NeuralNet with a single
+ * hidden layer on a work stealing pool, using successive halving:
+ * every survivor trains to the rung's budget, the best 1/eta are kept
+ * and the budget is multiplied by eta until one remains, all of the
+ * survivors converged or max_epochs is reached.
+ */
+typedef struct NeuralNetSweep {
+  NeuralNetSweepSpec spec;
+  NeuralNetSweepConfig* configs;  // Ranked best first after run
+  unsigned long config_count;
+  NeuralNetSweepConfig** alive;   // Survivors of the current rung
+  unsigned long alive_count;
+  double time_sec;                // Wall clock time of run
+  ThreadPool pool;
+
+  // Methods
+  NeuralNetSweep_Deinit deinit;
+  NeuralNetSweep_Run run;
+  NeuralNetSweep_Print print;
+
+} NeuralNetSweep;
+
+Status NeuralNetSweep_init(NeuralNetSweep* sweep, NeuralNetSweepSpec* spec);
+
+#endif
@@ -0,0 +1,70 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEURAL_NET_SYNTH_H
+#define NEURAL_NET_SYNTH_H
+
+#include "NeuralNet.h"
+
+#define NEURAL_NET_SYNTH_PARITY   0 ///< One target, the parity of the 0/1 inputs
+#define NEURAL_NET_SYNTH_GAUSSIAN 1 ///< One hot class of a gaussian mixture
+#define NEURAL_NET_SYNTH_TEACHER  2 ///< Outputs of a random sigmoid teacher network
+#define NEURAL_NET_SYNTH_BARS     3 ///< Square image of a bar, one hot horizontal or vertical
+
+typedef struct NeuralNetSynth NeuralNetSynth;
+
+typedef struct NeuralNetSynthSpec {
+  unsigned long kind;           // NEURAL_NET_SYNTH_xxx
+  unsigned long input_count;    // Bars needs a square, side * side pixels
+  unsigned long target_count;   // Classes or teacher outputs, parity has 1, bars 2
+  unsigned long samples;        // 0 for parity is all 2^input_count patterns
+  unsigned long hidden;         // Teacher hidden neurons, 0 is input_count
+  unsigned long seed;
+  double spread;                // Cluster stddev, teacher target or pixel noise
+} NeuralNetSynthSpec;
+
+typedef void (*NeuralNetSynth_Deinit)(NeuralNetSynth* synth);
+typedef void (*NeuralNetSynth_Sample)(NeuralNetSynth* synth, unsigned long index,
+    Pattern* input, Pattern* target);
+typedef Status (*NeuralNetSynth_Write)(NeuralNetSynth* synth, char* path);
+
+/**
+ * Deterministic synthetic data of any width and size. Sample i is a
+ * function of the seed and i alone, so samples can be generated on the
+ * fly in any order and by any number of threads, and the same spec
+ * always produces the same data. Parity of 2 inputs is test-nn's XOR.
+ */
+typedef struct NeuralNetSynth {
+  NeuralNetSynthSpec spec;
+  double* centers;              // Gaussian, [target_count][input_count]
+  double* teacher;              // Teacher, [hidden][input_count + 1] then
+                                // [target_count][hidden + 1], bias first
+  unsigned long side;           // Bars, pixels per row and column
+
+  // Methods
+  NeuralNetSynth_Deinit deinit;
+  NeuralNetSynth_Sample sample; // Fill input and target with sample index
+  NeuralNetSynth_Write write;   // Write every sample to a CSV file for NeuralNetCsv_load
+
+} NeuralNetSynth;
+
+/**
+ * Initialize synth from spec, the spec is copied and target_count and
+ * samples filled in for parity and target_count for bars.
+ */
+Status NeuralNetSynth_init(NeuralNetSynth* synth, NeuralNetSynthSpec* spec);
+
+#endif
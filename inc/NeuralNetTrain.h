@@ -0,0 +1,57 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEURAL_NET_TRAIN_H
+#define NEURAL_NET_TRAIN_H
+
+#include "NeuralNet.h"
+
+/**
+ * Allocate a zeroed pattern of count values.
+ * @return NULL if out of memory, release with free()
+ */
+Pattern* Pattern_create(unsigned long count);
+
+/**
+ * Shuffle perm into a random order of 0..count-1 using rand0_1(), the
+ * order train_epoch uses.
+ */
+void NeuralNet_shuffle(unsigned int* perm, unsigned int count);
+
+/** Called by NeuralNet_train_epoch_each after the rp'th pattern of an epoch */
+typedef void (*NeuralNet_SampleDone)(void* arg, unsigned int rp);
+
+/**
+ * Train nn for one epoch the way test-nn does: shuffle perm with
+ * rand0_1(), then for each pattern in that order set the inputs,
+ * process, get the outputs into output and adjust the weights.
+ * output must have room for the output layer.
+ *
+ * @return the sum of the pattern errors
+ */
+double NeuralNet_train_epoch(NeuralNet* nn, Pattern** inputs,
+    Pattern** targets, Pattern* output, unsigned int* perm,
+    unsigned int pattern_count);
+
+/**
+ * NeuralNet_train_epoch calling done(arg, rp) after each pattern, for
+ * callers that look at the network mid epoch. done may be NULL.
+ */
+double NeuralNet_train_epoch_each(NeuralNet* nn, Pattern** inputs,
+    Pattern** targets, Pattern* output, unsigned int* perm,
+    unsigned int pattern_count, NeuralNet_SampleDone done, void* arg);
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef NEURAL_NET_TRAINER_H
+#define NEURAL_NET_TRAINER_H
+
+#include "NeuralNet.h"
+#include "rand0_1.h"
+
+/** Samples between clock reads are picked so a read happens about this often */
+#define NEURAL_NET_TRAINER_CHECK_NS 20000.0
+
+typedef struct NeuralNetTrainer NeuralNetTrainer;
+
+/** A snapshot of a trainer's progress */
+typedef struct NeuralNetTrainerProgress {
+  unsigned long epoch;            // Epochs completed
+  unsigned long cursor;           // Samples done of the current epoch
+  unsigned long samples;          // Samples trained in total
+  unsigned long done;             // 1 once converged or max_epochs is reached
+  double epoch_error;             // Error so far of the current epoch
+  double last_error;              // Error of the last complete epoch
+  double fraction;                // Fraction of the current epoch done
+  double ns_per_sample;           // Estimated cost of a sample, 0 until timed
+} NeuralNetTrainerProgress;
+
+typedef void (*NeuralNetTrainer_Deinit)(NeuralNetTrainer* t);
+typedef unsigned long (*NeuralNetTrainer_Step)(NeuralNetTrainer* t,
+    unsigned long max_samples, unsigned long budget_ns);
+typedef void (*NeuralNetTrainer_Progress)(NeuralNetTrainer* t,
+    NeuralNetTrainerProgress* p);
+
+/**
+ * Resumable training for embedding in an event loop. Each step trains
+ * the samples that fit in its budget and returns, the cursor into the
+ * epoch's shuffled order, the error accumulators and the trainer's own
+ * rand0_1 generator carry over to the next step, the calling thread's
+ * generator is restored before step returns. Stepping through an epoch
+ * trains exactly as NeuralNet_train_epoch does.
+ */
+typedef struct NeuralNetTrainer {
+  NeuralNet* nn;
+  Pattern** inputs;               // The training set
+  Pattern** targets;
+  unsigned long pattern_count;
+  Pattern* output;
+  unsigned int* perm;             // Order of the current epoch
+
+  double error_threshold;         // Done once an epoch is below this, 0 never
+  unsigned long max_epochs;       // Done after this many epochs, 0 no limit
+
+  unsigned long cursor;           // Next position in perm
+  unsigned long epoch;            // Epochs completed
+  unsigned long samples;          // Samples trained in total
+  unsigned long done;             // Converged or reached max_epochs
+  double epoch_error;             // Error so far of the current epoch
+  double last_error;              // Error of the last complete epoch
+  double ns_per_sample;           // Moving average of the sample cost
+  Rand0_1State rand_state;        // The generator between steps
+
+  // Methods
+  NeuralNetTrainer_Deinit deinit;
+  NeuralNetTrainer_Step step;     // Train up to max_samples or budget_ns,
+                                  // 0 is no limit and with both 0 the rest
+                                  // of the epoch, returns the samples run
+  NeuralNetTrainer_Progress progress;
+
+} NeuralNetTrainer;
+
+/**
+ * Initialize a trainer for the started nn. The trainer takes over the
+ * calling thread's rand0_1 generator as it is now, so a trainer set up
+ * where a training loop would start shuffles the same way.
+ */
+Status NeuralNetTrainer_init(NeuralNetTrainer* t, NeuralNet* nn,
+    Pattern** inputs, Pattern** targets, unsigned long pattern_count);
+
+#endif
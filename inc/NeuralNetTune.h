@@ -0,0 +1,73 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef NEURAL_NET_TUNE_H
+#define NEURAL_NET_TUNE_H
+
+#include "NeuralNet.h"
+#include "NeuralNetKernels.h"
+#include "ThreadPool.h"
+
+#include <stdio.h>
+
+#define NEURAL_NET_TUNE_MAGIC "# nn kernel cache v1"
+#define NEURAL_NET_TUNE_MIN_NS 200000.0 ///< Each measurement runs at least this long
+#define NEURAL_NET_TUNE_TRIALS 3        ///< Fastest of this many measurements
+
+/** The choices for a layer shape, one line of the cache file */
+typedef struct NeuralNetTuneEntry {
+  unsigned long inputs;           // Neurons of the previous layer
+  unsigned long neurons;          // Neurons of the layer
+  unsigned long logits;           // 1 if a softmax output layer
+  unsigned long workers;          // Pool size it was tuned with
+  char names[NEURAL_NET_KERNEL_OPS][16];
+  double ns[NEURAL_NET_KERNEL_OPS];
+} NeuralNetTuneEntry;
+
+/**
+ * Autotuning state of a network. For each dense layer every usable
+ * candidate of each op is timed on the layer itself and the fastest is
+ * kept. Choices are cached per layer shape in nn->tune_cache along with
+ * the widest instruction set of the host, a cache written on another
+ * kind of host is ignored.
+ */
+typedef struct NeuralNetTune {
+  ThreadPool* pool;               // For threaded kernels, NULL if unused
+  unsigned long workers;          // Pool size the kernels were tuned for
+  unsigned long tuned;            // Layers benchmarked
+  unsigned long cached;           // Layers whose choices came from the cache
+  double time_sec;                // Time spent tuning
+  NeuralNetTuneEntry* entries;    // The cache, loaded plus new entries
+  unsigned long entry_count;
+  const char* host;               // Widest instruction set of this host
+} NeuralNetTune;
+
+/**
+ * Tune the dense double layers of the started nn as nn->tune_mode
+ * says, replacing any previous tuning. workers is the pool size for
+ * the threaded kernels, 0 for one per cpu and 1 for none.
+ * NeuralNet_start calls this with 0 unless tune_mode is OFF.
+ */
+Status NeuralNetTune_start(NeuralNet* nn, unsigned long workers);
+
+/** Release the tuning of nn, its layers go back to the default loops */
+void NeuralNetTune_deinit(NeuralNet* nn);
+
+/** Print the kernel chosen for each layer */
+void NeuralNetTune_print(NeuralNet* nn, FILE* f);
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include "NeuralNet.h"
+
+#include <pthread.h>
+
+typedef struct ThreadPool ThreadPool;
+typedef struct ThreadPoolWorker ThreadPoolWorker;
+
+/** A task, worker is the index of the worker running it */
+typedef void (*ThreadPool_Fn)(void* arg, unsigned long worker);
+
+typedef struct ThreadPoolTask {
+  ThreadPool_Fn fn;
+  void* arg;
+} ThreadPoolTask;
+
+/**
+ * A worker's deque, the owner pushes and pops at the tail
+ * and thieves take from the head.
+ */
+typedef struct ThreadPoolDeque {
+  pthread_mutex_t lock;
+  ThreadPoolTask* tasks;    // Ring of cap tasks
+  unsigned long cap;
+  unsigned long head;       // Next task to steal
+  unsigned long tail;       // Next free slot
+} ThreadPoolDeque;
+
+typedef struct ThreadPoolWorker {
+  ThreadPool* pool;
+  unsigned long index;      // Index of this worker
+  unsigned long executed;   // Tasks this worker ran
+  unsigned long stolen;     // Tasks this worker stole from others
+  pthread_t thread;
+  ThreadPoolDeque deque;
+} ThreadPoolWorker;
+
+typedef void (*ThreadPool_Deinit)(ThreadPool* pool);
+typedef Status (*ThreadPool_Submit)(ThreadPool* pool, ThreadPool_Fn fn, void* arg);
+typedef void (*ThreadPool_Wait)(ThreadPool* pool);
+
+/**
+ * A work stealing thread pool. Tasks submitted from outside the
+ * pool are spread round robin over the workers, tasks submitted by
+ * a task go to the submitting worker's deque. A worker runs its own
+ * newest task first and when it runs dry steals the oldest task of
+ * another worker.
+ */
+typedef struct ThreadPool {
+  unsigned long count;      // Number of workers
+  ThreadPoolWorker* workers;
+  unsigned long next;       // Next worker for an outside submit
+  unsigned long queued;     // Tasks in the deques
+  unsigned long pending;    // Tasks queued or running
+  unsigned long stopping;   // deinit has been called
+
+  pthread_mutex_t lock;
+  pthread_cond_t work;      // Signalled when a task is queued
+  pthread_cond_t idle;      // Signalled when pending reaches 0
+
+  // Methods
+  ThreadPool_Deinit deinit;
+  ThreadPool_Submit submit;
+  ThreadPool_Wait wait;
+
+} ThreadPool;
+
+/**
+ * Start a pool of count workers, if count is 0 one
+ * per online cpu is started.
+ */
+Status ThreadPool_init(ThreadPool* pool, unsigned long count);
+
+#endif
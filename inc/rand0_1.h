@@ -26,4 +26,26 @@
 extern double rand0_1(void);
 #endif
 
+/** Size of the generator state, the same as the default for rand() */
+#define RAND0_1_STATE_SIZE 128
+
+/** A saved rand0_1 generator, see rand0_1_save and rand0_1_restore */
+typedef struct Rand0_1State {
+  long fptr;                      // Offset of the front pointer
+  long rptr;                      // Offset of the rear pointer
+  char state[RAND0_1_STATE_SIZE]; // The generator's state array
+} Rand0_1State;
+
+/**
+ * Seed the calling thread's generator, each thread has its own.
+ * An unseeded thread behaves as if seeded with 1.
+ */
+extern void rand0_1_seed(unsigned int seed);
+
+/** Save the calling thread's generator */
+extern void rand0_1_save(Rand0_1State* s);
+
+/** Restore the calling thread's generator so it continues from s */
+extern void rand0_1_restore(Rand0_1State* s);
+
 #endif
@@ -15,6 +15,13 @@
  */
 
 #include "NeuralNet.h"
+#include "NeuralNetArena.h"
+#include "NeuralNetConv.h"
+#include "NeuralNetHalf.h"
+#include "NeuralNetKernels.h"
+#include "NeuralNetSkip.h"
+#include "NeuralNetSparse.h"
+#include "NeuralNetTune.h"
 #include "dbg.h"
 #include "rand0_1.h"
 #include "unused.h"
@@ -24,6 +31,8 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
 
 // Forward declarations
@@ -31,12 +40,14 @@ static void NeuralNet_deinit(NeuralNet* nn);
 static Status NeuralNet_start(NeuralNet* nn);
 static void NeuralNet_stop(NeuralNet* nn);
 static Status NeuralNet_add_hidden(NeuralNet* nn, unsigned long count);
+static Status NeuralNet_add_conv(NeuralNet* nn, NeuralNetConvSpec* spec);
 static unsigned long NeuralNet_get_points(NeuralNet* nn);
 static void NeuralNet_set_inputs(NeuralNet* nn, Pattern* input);
 static void NeuralNet_get_outputs(NeuralNet* nn, Pattern* output);
 static double NeuralNet_adjust_weights(NeuralNet* nn, Pattern* output,
     Pattern* target);
 static void NeuralNet_process(NeuralNet* nn);
+static Status NeuralNet_prune(NeuralNet* nn, double threshold, unsigned long top_k);
 
 static Status NeuralNet_create_layer(NeuronLayer* l, unsigned long count) {
   Status status;
@@ -69,10 +80,15 @@ static Status Neuron_init(Neuron* n, NeuronLayer* inputs) {
     points = 1;
   } else {
     // Calculate the initial weights. Note weights[0] is the bias
-    // so we increase count of weights by one.
+    // so we increase count of weights by one. The weights and
+    // momentums are already assigned if they're in the nn's arena.
     unsigned long count = inputs->count + 1;
-    weights = calloc(count, sizeof(double));
-    if (weights == NULL) { status = STATUS_OOM; goto done; }
+    weights = n->weights;
+    momentums = n->momentums;
+    if (weights == NULL) {
+      weights = calloc(count, sizeof(double));
+      if (weights == NULL) { status = STATUS_OOM; goto done; }
+    }
 
     // Initialize weights >= -0.5 and < 0.5
     dbg("Neuron_init:+%p inputs=%p count=%ld\n", (void*)n, (void*)inputs, count);
@@ -82,8 +98,10 @@ static Status Neuron_init(Neuron* n, NeuronLayer* inputs) {
     }
 
     // Allocate an array of mementums initialize to 0.0
-    momentums = calloc(count, sizeof(double));
-    if (momentums == NULL) { status = STATUS_OOM; goto done; }
+    if (momentums == NULL) {
+      momentums = calloc(count, sizeof(double));
+      if (momentums == NULL) { status = STATUS_OOM; goto done; }
+    }
 
     points = count; // + 1 // for output
   }
@@ -116,6 +134,17 @@ Status NeuralNet_init(NeuralNet* nn, unsigned long num_in_neurons, unsigned long
   nn->error = 0;       // No errors yet
   nn->learning_rate = 0.5; // Learning rate aka eta
   nn->momentum_factor = 0.9; // momemtum factor aka alpha
+  nn->skip_threshold = 0.0;
+  nn->sparse_max_density = NEURAL_NET_SPARSE_MAX_DENSITY;
+  nn->lse = 0.0;
+  nn->output_type = NEURAL_NET_OUTPUT_SIGMOID;
+  nn->alloc_mode = NEURAL_NET_ALLOC_HEAP;
+  nn->weight_type = NEURAL_NET_WEIGHTS_DOUBLE;
+  nn->tune_mode = NEURAL_NET_TUNE_OFF;
+  nn->logits = NULL;
+  nn->arena = NULL;
+  nn->tune_cache = NULL;
+  nn->tune = NULL;
   nn->layers = NULL;   // No layers yet
 
   // Create the layers
@@ -132,11 +161,13 @@ Status NeuralNet_init(NeuralNet* nn, unsigned long num_in_neurons, unsigned long
   nn->start = NeuralNet_start;
   nn->stop = NeuralNet_stop;
   nn->add_hidden = NeuralNet_add_hidden;
+  nn->add_conv = NeuralNet_add_conv;
   nn->get_points = NeuralNet_get_points;
   nn->set_inputs = NeuralNet_set_inputs;
   nn->get_outputs = NeuralNet_get_outputs;
   nn->adjust_weights = NeuralNet_adjust_weights;
   nn->process = NeuralNet_process;
+  nn->prune = NeuralNet_prune;
 
   status = STATUS_OK;
 
@@ -152,13 +183,31 @@ void NeuralNet_deinit(NeuralNet* nn) {
   dbg("NeuralNet_deinit:+%p\n", (void*)nn);
 
   if (nn->layers != NULL) {
+    NeuralNetTune_deinit(nn);
     for (unsigned long i = 0; i < nn->max_layers; i++) {
-      if (nn->layers[i].neurons != NULL) {
-        free(nn->layers[i].neurons);
+      NeuronLayer* layer = &nn->layers[i];
+      NeuronLayerSparse_deinit(layer);
+      NeuronLayerMask_deinit(layer);
+      NeuronLayerConv_deinit(layer);
+      NeuronLayerHalf_deinit(layer);
+      NeuronLayerSkip_deinit(layer);
+      if ((layer->neurons != NULL) && !layer->in_arena) {
+        for (unsigned long n = 0; n < layer->count; n++) {
+          free(layer->neurons[n].weights);
+          free(layer->neurons[n].momentums);
+        }
+        free(layer->neurons);
       }
-      nn->layers[i].neurons = NULL;
+      layer->neurons = NULL;
     }
     free(nn->layers);
+    free(nn->logits);
+    nn->logits = NULL;
+    if (nn->arena != NULL) {
+      NeuralNetArena_deinit(nn->arena);
+      free(nn->arena);
+      nn->arena = NULL;
+    }
     nn->max_layers = 0;
     nn->last_hidden = 0;
     nn->out_layer = 0;
@@ -188,6 +237,121 @@ done:
   return status;
 }
 
+/**
+ * Move the neurons of every layer into a single arena and assign each
+ * neuron its weights and momentums there. The neurons of all the layers
+ * come first, they are written by every pass. Then each layer's weights
+ * and its momentums start on pages of their own, so a fork that only
+ * trains some layers only copies their pages. Within a layer the weights
+ * are contiguous, so process and adjust_weights walk memory sequentially.
+ */
+Status NeuralNet_create_arena(NeuralNet* nn) {
+  Status status;
+  unsigned long page = (unsigned long)sysconf(_SC_PAGESIZE);
+  unsigned long align = 64;
+  unsigned long size = page;
+
+  dbg("NeuralNet_create_arena:+%p alloc_mode=%ld\n", (void*)nn, nn->alloc_mode);
+
+  for (unsigned long l = 0; l <= nn->out_layer; l++) {
+    NeuronLayer* layer = &nn->layers[l];
+    size += align + (layer->count * sizeof(Neuron));
+    if ((l > 0) && (layer->conv == NULL)) {
+      unsigned long weights = layer->count * (nn->layers[l-1].count + 1);
+      size += 2 * (page + (weights * sizeof(double)));
+    }
+  }
+
+  nn->arena = calloc(1, sizeof(NeuralNetArena));
+  if (nn->arena == NULL) { status = STATUS_OOM; goto done; }
+  status = NeuralNetArena_init(nn->arena, size, nn->alloc_mode);
+  if (StatusErr(status)) {
+    free(nn->arena);
+    nn->arena = NULL;
+    goto done;
+  }
+
+  for (unsigned long l = 0; l <= nn->out_layer; l++) {
+    NeuronLayer* layer = &nn->layers[l];
+    Neuron* neurons = NeuralNetArena_alloc(nn->arena,
+        layer->count * sizeof(Neuron), align);
+    if (neurons == NULL) { status = STATUS_BAD_CODE; goto done; }
+    memcpy(neurons, layer->neurons, layer->count * sizeof(Neuron));
+    free(layer->neurons);
+    layer->neurons = neurons;
+    layer->in_arena = 1;
+  }
+
+  for (unsigned long l = 1; l <= nn->out_layer; l++) {
+    NeuronLayer* layer = &nn->layers[l];
+
+    // Convolutions keep their shared kernels in the layer's conv
+    if (layer->conv == NULL) {
+      unsigned long count = nn->layers[l-1].count + 1;
+      double* weights = NeuralNetArena_alloc(nn->arena,
+          layer->count * count * sizeof(double), page);
+      double* momentums = NeuralNetArena_alloc(nn->arena,
+          layer->count * count * sizeof(double), page);
+      if ((weights == NULL) || (momentums == NULL)) {
+        status = STATUS_BAD_CODE;
+        goto done;
+      }
+      for (unsigned long n = 0; n < layer->count; n++) {
+        Neuron* neuron = &layer->neurons[n];
+
+        // A started heap network brings its weights along
+        if (neuron->weights != NULL) {
+          memcpy(&weights[n * count], neuron->weights, count * sizeof(double));
+          free(neuron->weights);
+        }
+        if (neuron->momentums != NULL) {
+          memcpy(&momentums[n * count], neuron->momentums, count * sizeof(double));
+          free(neuron->momentums);
+        }
+        neuron->weights = &weights[n * count];
+        neuron->momentums = &momentums[n * count];
+      }
+    }
+  }
+
+  status = STATUS_OK;
+
+done:
+  dbg("NeuralNet_create_arena:-%p status=%d\n", (void*)nn, StatusVal(status));
+  return status;
+}
+
+static Status NeuralNet_add_conv(NeuralNet* nn, NeuralNetConvSpec* spec) {
+  Status status;
+  NeuronLayerConv* conv;
+  unsigned long count;
+
+  dbg("NeuralNet_add_conv:+%p\n", (void*)nn);
+
+  if ((nn->last_hidden + 1) >= (nn->max_layers - 1)) {
+    status = STATUS_TO_MANY_HIDDEN;
+    goto done;
+  }
+
+  // The spec must match the layer it's connected to
+  conv = NeuronLayerConv_create(spec, nn->layers[nn->last_hidden].count, &count);
+  if (conv == NULL) {
+    status = STATUS_BAD_PARAM;
+    goto done;
+  }
+  status = NeuralNet_add_hidden(nn, count);
+  if (StatusErr(status)) {
+    NeuronLayer layer = { .conv = conv };
+    NeuronLayerConv_deinit(&layer);
+    goto done;
+  }
+  nn->layers[nn->last_hidden].conv = conv;
+
+done:
+  dbg("NeuralNet_add_conv:-%p status=%d\n", (void*)nn, StatusVal(status));
+  return status;
+}
+
 static Status NeuralNet_start(NeuralNet* nn) {
   Status status;
   dbg("NeurnaNet_start:+%p\n", (void*)nn);
@@ -206,6 +370,11 @@ static Status NeuralNet_start(NeuralNet* nn) {
   dbg("NeuralNet_start: %p max_layers=%ld last_hidden=%ld out_layer=%ld\n",
       (void*)nn, nn->max_layers, nn->last_hidden, nn->out_layer);
 
+  if (nn->alloc_mode != NEURAL_NET_ALLOC_HEAP) {
+    status = NeuralNet_create_arena(nn);
+    if (StatusErr(status)) goto done;
+  }
+
   // Initialize the neurons for all of the layers
   nn->points = 0;
   for (unsigned long l = 0; l < nn->max_layers; l++) {
@@ -218,8 +387,14 @@ static Status NeuralNet_start(NeuralNet* nn) {
     }
     dbg("NeuralNet_start: nn->layers[%ld].count=%ld in_layer=%p\n", l,
         nn->layers[l].count, (void*)in_layer);
+    if (nn->layers[l].conv != NULL) {
+      status = NeuronLayerConv_start(&nn->layers[l], in_layer);
+      if (StatusErr(status)) goto done;
+    }
     for (unsigned long n = 0; n < nn->layers[l].count; n++) {
-      Neuron_init(&nn->layers[l].neurons[n], in_layer);
+      if (nn->layers[l].conv == NULL) {
+        Neuron_init(&nn->layers[l].neurons[n], in_layer);
+      }
       nn->points += nn->layers[l].neurons[n].points;
     }
   }
@@ -230,8 +405,50 @@ static Status NeuralNet_start(NeuralNet* nn) {
   // Add two more for the bounding box
   nn->points += 2;
 
+  // Move the fully connected layers to half precision, the
+  // convolutions keep their double kernels
+  if (nn->weight_type != NEURAL_NET_WEIGHTS_DOUBLE) {
+    for (unsigned long l = 1; l <= nn->out_layer; l++) {
+      if (nn->layers[l].conv != NULL) {
+        continue;
+      }
+      NeuronLayerHalf* half = NeuronLayerHalf_create(&nn->layers[l], nn->weight_type);
+      if (half == NULL) { status = STATUS_BAD_PARAM; goto done; }
+      NeuronLayerHalf_attach(&nn->layers[l], half);
+    }
+  }
+
+  // Dense double layers can skip their saturated neurons
+  if (nn->skip_threshold > 0.0) {
+    for (unsigned long l = 1; l <= nn->out_layer; l++) {
+      NeuronLayer* layer = &nn->layers[l];
+      if ((layer->conv != NULL) || (layer->half != NULL) || (layer->skip != NULL)) {
+        continue;
+      }
+      layer->skip = NeuronLayerSkip_create(layer->count, nn->skip_threshold);
+      if (layer->skip == NULL) { status = STATUS_OOM; goto done; }
+    }
+  }
+
+  // A softmax output layer keeps its weighted sums for the loss
+  if (nn->output_type == NEURAL_NET_OUTPUT_SOFTMAX) {
+    free(nn->logits);
+    nn->logits = calloc(nn->layers[nn->out_layer].count, sizeof(double));
+    if (nn->logits == NULL) { status = STATUS_OOM; goto done; }
+  } else if (nn->output_type != NEURAL_NET_OUTPUT_SIGMOID) {
+    status = STATUS_BAD_PARAM;
+    goto done;
+  }
+
+  // Pick the fastest kernels for the dense layers
+  if (nn->tune_mode != NEURAL_NET_TUNE_OFF) {
+    status = NeuralNetTune_start(nn, 0);
+    if (StatusErr(status)) goto done;
+  }
+
   status = STATUS_OK;
 
+done:
   dbg("NeuralNet_start:-%p status=%d\n", (void*)nn, StatusVal(status));
   return status;
 }
@@ -260,12 +477,68 @@ static void NeuralNet_set_inputs(NeuralNet* nn, Pattern* input) {
   dbg("NeuralNet_set_inputs_:-%p\n", (void*)nn);
 }
 
+/**
+ * Softmax of the output layer's logits, the largest logit is subtracted
+ * before exponentiating so exp never overflows. Leaves log of the
+ * normalizer in nn->lse for the cross entropy loss.
+ *
+ * The cost is the one exp per output, the max and scale passes are
+ * nearly free beside it. Finding the max and the sum in one pass with
+ * a running max needs a second exp per output, to rescale the sum or
+ * to redo the exponentials, and measured 1.5 to 1.9 times slower for
+ * 4 to 1000 outputs, so there are three passes. adjust_weights does
+ * the loss and gradient together in one more pass since only it has
+ * the target.
+ */
+static void NeuralNet_softmax(NeuralNet* nn) {
+  NeuronLayer* layer = &nn->layers[nn->out_layer];
+  double* logits = nn->logits;
+  unsigned long count = layer->count;
+
+  double max = logits[0];
+  for (unsigned long n = 1; n < count; n++) {
+    max = logits[n] > max ? logits[n] : max;
+  }
+
+  double sum = 0.0;
+  for (unsigned long n = 0; n < count; n++) {
+    double e = exp(logits[n] - max);
+    layer->neurons[n].output = e;
+    sum += e;
+  }
+
+  double scale = 1.0 / sum;
+  for (unsigned long n = 0; n < count; n++) {
+    layer->neurons[n].output *= scale;
+  }
+  nn->lse = max + log(sum);
+}
+
 static void NeuralNet_process(NeuralNet* nn) {
   dbg("NeuralNet_process_:+%p\n", (void*)nn);
   // Calcuate the output for the fully connected layers,
   // which start at nn->layers[1]
   for (unsigned long l = 1; l <= nn->out_layer; l++) {
     NeuronLayer* layer = &nn->layers[l];
+
+    // The output layer's weighted sums go to logits if softmax
+    double* logits = (l == nn->out_layer) ? nn->logits : NULL;
+    if (layer->conv != NULL) {
+      NeuronLayerConv_process(layer);
+      continue;
+    }
+    if (layer->half != NULL) {
+      NeuronLayerHalf_process(layer, logits);
+      continue;
+    }
+    if (layer->sparse != NULL) {
+      NeuronLayerSparse_process(layer, logits);
+      continue;
+    }
+    if (layer->tuned != NULL) {
+      layer->tuned->kernels[NEURAL_NET_KERNEL_FORWARD]->forward(layer, logits);
+      continue;
+    }
     for (unsigned long n = 0; n < layer->count; n++) {
       // Get the next neuron
       Neuron* neuron = &layer->neurons[n];
@@ -286,12 +559,20 @@ static void NeuralNet_process(NeuralNet* nn) {
         weighted_sum += weights[i] * inputs[i].output;
       }
 
+      if (logits != NULL) {
+        logits[n] = weighted_sum;
+        continue;
+      }
+
       // Calcuate the output using a Sigmoidal Activation function
       neuron->output = 1.0 / (1.0 + exp(-weighted_sum));
       dbg("NeuralNet_process_: %p output=%lf weighted_sum=%lf\n",
           (void*)neuron, neuron->output, weighted_sum);
     }
   }
+  if (nn->logits != NULL) {
+    NeuralNet_softmax(nn);
+  }
   dbg("NeuralNet_process_:-%p\n", (void*)nn);
 }
 
@@ -323,28 +604,45 @@ static double NeuralNet_adjust_weights(NeuralNet* nn, Pattern* output,
   if (output->count != target->count) {
       return (double)NAN;
   }
-  for (unsigned long n = 0; n < output->count; n++) {
-    // Compute the error as the difference between target and output
-    double err = target->data[n] - output->data[n];
-    dbg("NeuralNet_adjust_weights_: %ld:%ld err:%lf = target:%lf + output:%lf\n",
-            nn->out_layer, n, err, target->data[n], output->data[n]);
-
-    // Compute the partial derivative of the activation w.r.t. error
-    double pd_err = err * output->data[n] * (1.0 - output->data[n]);
-    nn->layers[nn->out_layer].neurons[n].pd_error = pd_err;
-    dbg("NeuralNet_adjust_weights_: %ld:%ld pd_err:%lf ="
-        " err:%lf * output[%ld]:%lf * (1.0 - output[%ld]:%lf\n",
-        nn->out_layer, n, pd_err, err, n, output->data[n], n, output->data[n]);
-
-    // Compute the sub of the square of the error and add to total_error
-    double sse = 0.5 * err * err;
-    dbg("NeuralNet_adjust_weights_: %ld:%ld sse:%lf = 0.5 * err:%lf * err:%lf\n",
-            nn->out_layer, n, sse, err, err);
-
-    double tmp = nn->error;
-    nn->error = tmp + sse;
-    dbg("NeuralNet_adjust_weights_: %ld:%ld nn->error:%lf = nn->error:%lf + sse:%lf\n",
-        nn->out_layer, n, nn->error, tmp, sse);
+  if (nn->logits != NULL) {
+    // Softmax with cross entropy, the loss is sum(y * (lse - z)) and
+    // the partial derivative w.r.t. the logit is simply (y - p), both
+    // computed in one pass. Using the logits rather than log(p) keeps
+    // the loss finite when p underflows.
+    Neuron* neurons = nn->layers[nn->out_layer].neurons;
+    double* logits = nn->logits;
+    double lse = nn->lse;
+    double error = 0.0;
+    for (unsigned long n = 0; n < output->count; n++) {
+      double y = target->data[n];
+      neurons[n].pd_error = y - output->data[n];
+      error += y * (lse - logits[n]);
+    }
+    nn->error = error;
+  } else {
+    for (unsigned long n = 0; n < output->count; n++) {
+      // Compute the error as the difference between target and output
+      double err = target->data[n] - output->data[n];
+      dbg("NeuralNet_adjust_weights_: %ld:%ld err:%lf = target:%lf + output:%lf\n",
+              nn->out_layer, n, err, target->data[n], output->data[n]);
+
+      // Compute the partial derivative of the activation w.r.t. error
+      double pd_err = err * output->data[n] * (1.0 - output->data[n]);
+      nn->layers[nn->out_layer].neurons[n].pd_error = pd_err;
+      dbg("NeuralNet_adjust_weights_: %ld:%ld pd_err:%lf ="
+          " err:%lf * output[%ld]:%lf * (1.0 - output[%ld]:%lf\n",
+          nn->out_layer, n, pd_err, err, n, output->data[n], n, output->data[n]);
+
+      // Compute the sub of the square of the error and add to total_error
+      double sse = 0.5 * err * err;
+      dbg("NeuralNet_adjust_weights_: %ld:%ld sse:%lf = 0.5 * err:%lf * err:%lf\n",
+              nn->out_layer, n, sse, err, err);
+
+      double tmp = nn->error;
+      nn->error = tmp + sse;
+      dbg("NeuralNet_adjust_weights_: %ld:%ld nn->error:%lf = nn->error:%lf + sse:%lf\n",
+          nn->out_layer, n, nn->error, tmp, sse);
+    }
   }
   dbg("NeuralNet_adjust_weights_: out_layer:%ld this.error=%lf\n",
           nn->out_layer, nn->error);
@@ -352,12 +650,37 @@ static double NeuralNet_adjust_weights(NeuralNet* nn, Pattern* output,
   // For all of layers starting at the output layer back propagate the pd_error
   // to the previous layers. The output layers pd_error has been calculated above
   dbg("\nNeuralNet_adjust_weights_: %p backpropagate pd_error to hidden layers\n", (void*)nn);
+  // Layers below the first trained one don't need their pd_error
   unsigned long first_hidden_layer = 1;
+  while ((first_hidden_layer < nn->out_layer) && nn->layers[first_hidden_layer].frozen) {
+    first_hidden_layer += 1;
+  }
   for (unsigned long l = nn->out_layer; l > first_hidden_layer; l--) {
     NeuronLayer* cur_layer = &nn->layers[l];
     NeuronLayer* prev_layer = &nn->layers[l-1];
     dbg("NeuralNet_adjust_weights_: %p cur_layer=%ld prev_layer=%ld\n", (void*)nn, l, l-1);
 
+    if (cur_layer->conv != NULL) {
+      NeuronLayerConv_backprop(cur_layer, prev_layer);
+      continue;
+    }
+    if (cur_layer->half != NULL) {
+      NeuronLayerHalf_backprop(cur_layer, prev_layer);
+      continue;
+    }
+    if (cur_layer->sparse != NULL) {
+      NeuronLayerSparse_backprop(cur_layer, prev_layer);
+      continue;
+    }
+    if (cur_layer->skip != NULL) {
+      NeuronLayerSkip_backprop(cur_layer, prev_layer, nn->momentum_factor);
+      continue;
+    }
+    if (cur_layer->tuned != NULL) {
+      cur_layer->tuned->kernels[NEURAL_NET_KERNEL_BACKWARD]->backward(cur_layer, prev_layer);
+      continue;
+    }
+
     // Compute the partial derivative of the error for the previous layer
     for (unsigned long npl = 0; npl < prev_layer->count; npl++) {
       double sum_weighted_pd_err = 0.0;
@@ -392,6 +715,30 @@ static double NeuralNet_adjust_weights(NeuralNet* nn, Pattern* output,
   for (unsigned long l = 1; l <= nn->out_layer; l++) {
     NeuronLayer* layer = &nn->layers[l];
     dbg("NeuralNet_adjust_weights_: %p loop through layer %ld\n", (void*)nn, l);
+    if (layer->frozen) {
+      continue;
+    }
+    if (layer->conv != NULL) {
+      NeuronLayerConv_adjust_weights(layer, nn->learning_rate, nn->momentum_factor);
+      continue;
+    }
+    if (layer->half != NULL) {
+      NeuronLayerHalf_adjust_weights(layer, nn->learning_rate, nn->momentum_factor);
+      continue;
+    }
+    if (layer->sparse != NULL) {
+      NeuronLayerSparse_adjust_weights(layer, nn->learning_rate, nn->momentum_factor);
+      continue;
+    }
+    if (layer->skip != NULL) {
+      NeuronLayerSkip_adjust_weights(layer, nn->learning_rate, nn->momentum_factor);
+      continue;
+    }
+    if (layer->tuned != NULL) {
+      layer->tuned->kernels[NEURAL_NET_KERNEL_ADJUST]->adjust(layer,
+          nn->learning_rate, nn->momentum_factor);
+      continue;
+    }
     for (unsigned long n = 0; n < layer->count; n++) {
       Neuron* neuron = &layer->neurons[n];
       NeuronLayer* inputs = neuron->inputs;
@@ -441,6 +788,56 @@ static double NeuralNet_adjust_weights(NeuralNet* nn, Pattern* output,
     }
   }
 
+  // Pruned weights of the layers kept dense must stay zero
+  for (unsigned long l = 1; l <= nn->out_layer; l++) {
+    if (nn->layers[l].mask != NULL) {
+      NeuronLayerMask_apply(&nn->layers[l]);
+    }
+  }
+
   dbg("NeuralNet_adjust_weights_:-%p nn->error=%lf\n", (void*)nn, nn->error);
   return nn->error;
 }
+
+static Status NeuralNet_prune(NeuralNet* nn, double threshold, unsigned long top_k) {
+  Status status = STATUS_OK;
+
+  dbg("NeuralNet_prune:+%p threshold=%lf top_k=%ld\n", (void*)nn, threshold, top_k);
+
+  // Weights owed momentum by skipped neurons must be settled first
+  NeuralNet_skip_flush(nn);
+
+  // Prune the hidden layers and output layer, the input layer has no weights
+  // and the shared kernels of convolutions and half precision layers
+  // are left alone
+  for (unsigned long l = 1; l <= nn->out_layer; l++) {
+    if ((nn->layers[l].conv != NULL) || (nn->layers[l].half != NULL)) {
+      continue;
+    }
+    status = NeuronLayer_prune(&nn->layers[l], threshold, top_k,
+        nn->sparse_max_density);
+    if (StatusErr(status)) goto done;
+  }
+
+done:
+  dbg("NeuralNet_prune:-%p status=%d\n", (void*)nn, StatusVal(status));
+  return status;
+}
+
+double NeuronLayer_weight(NeuronLayer* layer, unsigned long n, unsigned long i) {
+  if (layer->conv != NULL) {
+    return NeuronLayerConv_weight(layer, n, i);
+  }
+  if (layer->half != NULL) {
+    return NeuronLayerHalf_weight(layer->half, n, i);
+  }
+  if (layer->sparse != NULL) {
+    return NeuronLayerSparse_weight(layer->sparse, n, i);
+  }
+  if (layer->skip != NULL) {
+    double weight;
+    NeuronLayerSkip_settled(layer, n, i, layer->skip->momentum_factor, &weight, NULL);
+    return weight;
+  }
+  return layer->neurons[n].weights[i];
+}
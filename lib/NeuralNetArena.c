@@ -0,0 +1,366 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "NeuralNet.h"
+#include "NeuralNetArena.h"
+#include "NeuralNetConv.h"
+#include "NeuralNetHalf.h"
+#include "NeuralNetSparse.h"
+#include "dbg.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define DEFAULT_HUGE_PAGE_SIZE (2UL * 1024 * 1024)
+
+static unsigned long base_page_size(void) {
+  long size = sysconf(_SC_PAGESIZE);
+  return (size > 0) ? (unsigned long)size : 4096;
+}
+
+/** The default huge page size from /proc/meminfo */
+static unsigned long huge_page_size(void) {
+  unsigned long size = DEFAULT_HUGE_PAGE_SIZE;
+  unsigned long kb;
+  char line[256];
+
+  FILE* f = fopen("/proc/meminfo", "r");
+  if (f == NULL) {
+    return size;
+  }
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1) {
+      size = kb * 1024;
+      break;
+    }
+  }
+  fclose(f);
+  return size;
+}
+
+static unsigned long round_up(unsigned long value, unsigned long align) {
+  return (value + align - 1) & ~(align - 1);
+}
+
+/** Map size bytes aligned to align by trimming an oversized mapping */
+static char* map_aligned(unsigned long size, unsigned long align) {
+  unsigned long len = size + align;
+  char* p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    return NULL;
+  }
+  unsigned long head = round_up((unsigned long)p, align) - (unsigned long)p;
+  if (head != 0) {
+    munmap(p, head);
+  }
+  unsigned long tail = len - head - size;
+  if (tail != 0) {
+    munmap(p + head + size, tail);
+  }
+  return p + head;
+}
+
+Status NeuralNetArena_init(NeuralNetArena* arena, unsigned long size,
+    unsigned long mode) {
+  Status status;
+  char* p = NULL;
+
+  dbg("NeuralNetArena_init:+%p size=%ld mode=%ld\n", (void*)arena, size, mode);
+
+  memset(arena, 0, sizeof(*arena));
+  arena->fd = -1;
+  if ((mode != NEURAL_NET_ALLOC_MMAP) && (mode != NEURAL_NET_ALLOC_THP)
+      && (mode != NEURAL_NET_ALLOC_HUGETLB)) {
+    status = STATUS_BAD_PARAM;
+    goto done;
+  }
+
+  if (mode == NEURAL_NET_ALLOC_HUGETLB) {
+    // Only succeeds if huge pages have been reserved, vm.nr_hugepages
+    unsigned long huge = huge_page_size();
+    unsigned long len = round_up(size, huge);
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+      arena->size = len;
+      arena->page_size = huge;
+    } else {
+      p = NULL;
+      mode = NEURAL_NET_ALLOC_THP;
+    }
+  }
+
+  if (mode == NEURAL_NET_ALLOC_THP) {
+    // Align to a huge page so the whole arena can be covered by them
+    unsigned long huge = huge_page_size();
+    unsigned long len = round_up(size, huge);
+    p = map_aligned(len, huge);
+    if (p == NULL) {
+      status = STATUS_OOM;
+      goto done;
+    }
+    arena->size = len;
+    arena->page_size = huge;
+    if (madvise(p, len, MADV_HUGEPAGE) != 0) {
+      // No transparent huge pages, keep the mapping with base pages
+      arena->page_size = base_page_size();
+      mode = NEURAL_NET_ALLOC_MMAP;
+    }
+  } else if (mode == NEURAL_NET_ALLOC_MMAP) {
+    unsigned long len = round_up(size, base_page_size());
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+      status = STATUS_OOM;
+      goto done;
+    }
+    arena->size = len;
+    arena->page_size = base_page_size();
+  }
+
+  arena->base = p;
+  arena->mode = mode;
+  status = STATUS_OK;
+
+done:
+  dbg("NeuralNetArena_init:-%p status=%d mode=%ld size=%ld\n", (void*)arena,
+      StatusVal(status), arena->mode, arena->size);
+  return status;
+}
+
+void NeuralNetArena_deinit(NeuralNetArena* arena) {
+  dbg("NeuralNetArena_deinit:+%p\n", (void*)arena);
+  if (arena->base != NULL) {
+    munmap(arena->base, arena->size);
+    arena->base = NULL;
+  }
+  if (arena->fd >= 0) {
+    close(arena->fd);
+    arena->fd = -1;
+  }
+  dbg("NeuralNetArena_deinit:-%p\n", (void*)arena);
+}
+
+Status NeuralNetArena_share(NeuralNetArena* arena) {
+  Status status;
+  int fd;
+
+  dbg("NeuralNetArena_share:+%p size=%ld\n", (void*)arena, arena->size);
+
+  fd = memfd_create("nn-arena", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0) {
+    status = STATUS_ERR;
+    goto done;
+  }
+  if (ftruncate(fd, (off_t)arena->size) != 0) {
+    status = STATUS_OOM;
+    goto done;
+  }
+
+  // Only the used bytes need writing, the rest of the file reads as zero
+  unsigned long off = 0;
+  while (off < arena->used) {
+    ssize_t n = pwrite(fd, arena->base + off, arena->used - off, (off_t)off);
+    if (n <= 0) {
+      status = STATUS_ERR;
+      goto done;
+    }
+    off += (unsigned long)n;
+  }
+  if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0) {
+    status = STATUS_ERR;
+    goto done;
+  }
+
+  // Replace the mapping in place, sealed files can still be mapped privately
+  char* p = mmap(arena->base, arena->size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_FIXED, fd, 0);
+  if (p == MAP_FAILED) {
+    status = STATUS_ERR;
+    goto done;
+  }
+  if (arena->fd >= 0) {
+    close(arena->fd);
+  }
+  arena->fd = fd;
+  fd = -1;
+  arena->mode = NEURAL_NET_ALLOC_MMAP;
+  arena->page_size = base_page_size();
+
+  status = STATUS_OK;
+
+done:
+  if (fd >= 0) {
+    close(fd);
+  }
+  dbg("NeuralNetArena_share:-%p status=%d\n", (void*)arena, StatusVal(status));
+  return status;
+}
+
+Status NeuralNetArena_fork(NeuralNetArena* arena, NeuralNetArena* shared) {
+  Status status;
+
+  dbg("NeuralNetArena_fork:+%p shared=%p\n", (void*)arena, (void*)shared);
+
+  memset(arena, 0, sizeof(*arena));
+  arena->fd = -1;
+  if (shared->fd < 0) {
+    status = STATUS_BAD_PARAM;
+    goto done;
+  }
+
+  // The mapping holds its own reference to the snapshot
+  char* p = mmap(NULL, shared->size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+      shared->fd, 0);
+  if (p == MAP_FAILED) {
+    status = STATUS_OOM;
+    goto done;
+  }
+  arena->base = p;
+  arena->size = shared->size;
+  arena->used = shared->used;
+  arena->mode = NEURAL_NET_ALLOC_MMAP;
+  arena->page_size = base_page_size();
+  arena->forked = 1;
+
+  status = STATUS_OK;
+
+done:
+  dbg("NeuralNetArena_fork:-%p status=%d\n", (void*)arena, StatusVal(status));
+  return status;
+}
+
+void* NeuralNetArena_alloc(NeuralNetArena* arena, unsigned long bytes,
+    unsigned long align) {
+  unsigned long offset = round_up(arena->used, align);
+  if ((offset > arena->size) || (bytes > (arena->size - offset))) {
+    return NULL;
+  }
+  arena->used = offset + bytes;
+
+  // A fresh anonymous mapping is already zero
+  return arena->base + offset;
+}
+
+/** Resident bytes of the arena, using mincore */
+static unsigned long resident_bytes(NeuralNetArena* arena) {
+  unsigned long page = base_page_size();
+  unsigned long pages = arena->size / page;
+  unsigned long resident = 0;
+
+  unsigned char* vec = malloc(pages);
+  if (vec == NULL) {
+    return 0;
+  }
+  if (mincore(arena->base, arena->size, vec) == 0) {
+    for (unsigned long i = 0; i < pages; i++) {
+      resident += vec[i] & 1;
+    }
+  }
+  free(vec);
+  return resident * page;
+}
+
+/** Sum of the smaps field, e.g. "AnonHugePages:", over the arena's mappings */
+static unsigned long smaps_bytes(NeuralNetArena* arena, const char* field) {
+  unsigned long start = (unsigned long)arena->base;
+  unsigned long end = start + arena->size;
+  unsigned long len = strlen(field);
+  unsigned long bytes = 0;
+  int in_arena = 0;
+  char line[256];
+
+  FILE* f = fopen("/proc/self/smaps", "r");
+  if (f == NULL) {
+    return 0;
+  }
+  while (fgets(line, sizeof(line), f) != NULL) {
+    unsigned long lo;
+    unsigned long hi;
+    unsigned long kb;
+    if (sscanf(line, "%lx-%lx ", &lo, &hi) == 2) {
+      // A mapping header, the arena may have been split in several
+      in_arena = (lo < end) && (hi > start);
+    } else if (in_arena && (strncmp(line, field, len) == 0)
+        && (sscanf(line + len, " %lu kB", &kb) == 1)) {
+      bytes += kb * 1024;
+    }
+  }
+  fclose(f);
+  return bytes;
+}
+
+Status NeuralNet_footprint(NeuralNet* nn, NeuralNetFootprint* fp) {
+  memset(fp, 0, sizeof(*fp));
+  fp->page_size = base_page_size();
+
+  if (nn->arena == NULL) {
+    // Heap, count what was asked for
+    fp->mode = NEURAL_NET_ALLOC_HEAP;
+    for (unsigned long l = 0; l <= nn->out_layer; l++) {
+      NeuronLayer* layer = &nn->layers[l];
+      fp->bytes += layer->count * sizeof(Neuron);
+      if (layer->conv != NULL) {
+        fp->bytes += 2 * layer->conv->spec.out_channels * (layer->conv->patch + 1) * sizeof(double);
+      } else if (layer->half != NULL) {
+        // The rounded weights plus the float master copy and momentums
+        fp->bytes += layer->half->rows * layer->half->stride
+          * (sizeof(uint16_t) + (2 * sizeof(float)));
+      } else if (layer->sparse != NULL) {
+        // The CSR offsets, columns, weights and momentums
+        fp->bytes += ((layer->sparse->rows + 1) * sizeof(unsigned long))
+          + (layer->sparse->nnz * (sizeof(unsigned int) + (2 * sizeof(double))));
+      } else if (l > 0) {
+        fp->bytes += 2 * layer->count * (nn->layers[l-1].count + 1) * sizeof(double);
+        if (layer->mask != NULL) {
+          fp->bytes += ((layer->mask->rows + 1) * sizeof(unsigned long))
+            + (layer->mask->count * sizeof(unsigned int));
+        }
+      }
+    }
+    fp->resident_bytes = fp->bytes;
+    fp->private_bytes = fp->bytes;
+    return STATUS_OK;
+  }
+
+  NeuralNetArena* arena = nn->arena;
+  fp->mode = arena->mode;
+  fp->bytes = arena->used;
+  fp->mapped_bytes = arena->size;
+  fp->resident_bytes = resident_bytes(arena);
+  if ((arena->fd >= 0) || arena->forked) {
+    // Pages still shared with the snapshot are clean
+    fp->private_bytes = smaps_bytes(arena, "Private_Dirty:");
+  } else {
+    fp->private_bytes = fp->resident_bytes;
+  }
+  if (arena->mode == NEURAL_NET_ALLOC_HUGETLB) {
+    fp->huge_bytes = fp->resident_bytes;
+    fp->page_size = arena->page_size;
+  } else if (arena->mode == NEURAL_NET_ALLOC_THP) {
+    fp->huge_bytes = smaps_bytes(arena, "AnonHugePages:");
+    if ((fp->huge_bytes != 0) && ((fp->huge_bytes * 2) >= fp->resident_bytes)) {
+      fp->page_size = arena->page_size;
+    }
+  }
+  return STATUS_OK;
+}
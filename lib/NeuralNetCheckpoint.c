@@ -0,0 +1,751 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "NeuralNet.h"
+#include "NeuralNetCheckpoint.h"
+#include "NeuralNetConv.h"
+#include "NeuralNetHalf.h"
+#include "NeuralNetSkip.h"
+#include "NeuralNetSparse.h"
+#include "dbg.h"
+#include "rand0_1.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Checkpoint file layout, all values are native endian:
+ *
+ *   char magic[8]                "NNCKPT03"
+ *   unsigned long epoch          Epochs completed
+ *   double error                 Error of the last epoch
+ *   unsigned long num_layers
+ *   unsigned long counts[num_layers]
+ *   double learning_rate
+ *   double momentum_factor
+ *   Rand0_1State rand_state
+ *   unsigned long perm_count
+ *   unsigned int perm[perm_count], zero padded to 8 bytes
+ *   for each layer 1 .. num_layers-1
+ *     unsigned long kind         LAYER_DENSE, LAYER_MASKED, LAYER_SPARSE,
+ *                                LAYER_CONV or LAYER_HALF
+ *     dense:  for each neuron weights[inputs+1] then momentums[inputs+1],
+ *             unsigned long skipping, if 1 unsigned long pending[count]
+ *             the steps of momentum each neuron still owes
+ *     masked: dense then unsigned long count, unsigned long row_start[count+1],
+ *             unsigned int cols[count] zero padded to 8 bytes
+ *     conv:   unsigned long count, double weights[count],
+ *             double momentums[count] of the shared kernels
+ *     sparse: unsigned long nnz, unsigned long row_start[count+1],
+ *             unsigned int cols[nnz] zero padded to 8 bytes,
+ *             double weights[nnz], double momentums[nnz]
+ *     half:   unsigned long format, for each neuron float master[inputs+1]
+ *             then float momentums[inputs+1], zero padded to 8 bytes
+ *   unsigned long checksum       FNV-1a of all of the preceding bytes
+ */
+#define CHECKPOINT_MAGIC "NNCKPT03"
+#define LAYER_DENSE 0
+#define LAYER_SPARSE 1
+#define LAYER_CONV 2
+#define LAYER_HALF 3
+#define LAYER_MASKED 4
+
+/**
+ * Serialization cursor, with a NULL buf put() only counts so the
+ * same code computes the size of a checkpoint.
+ */
+typedef struct Cursor {
+  unsigned char* buf;
+  unsigned long len;
+  unsigned long pos;
+  unsigned long err;
+} Cursor;
+
+static void put(Cursor* c, const void* data, unsigned long size) {
+  if (c->buf != NULL) {
+    memcpy(&c->buf[c->pos], data, size);
+  }
+  c->pos += size;
+}
+
+static void put_ulong(Cursor* c, unsigned long v) {
+  put(c, &v, sizeof(v));
+}
+
+static void put_pad(Cursor* c) {
+  static const unsigned char zeros[sizeof(unsigned long)];
+  unsigned long rem = c->pos % sizeof(unsigned long);
+  if (rem != 0) {
+    put(c, zeros, sizeof(unsigned long) - rem);
+  }
+}
+
+static void get(Cursor* c, void* data, unsigned long size) {
+  if ((c->err != 0) || (size > (c->len - c->pos))) {
+    c->err = 1;
+    memset(data, 0, size);
+    return;
+  }
+  memcpy(data, &c->buf[c->pos], size);
+  c->pos += size;
+}
+
+static unsigned long get_ulong(Cursor* c) {
+  unsigned long v;
+  get(c, &v, sizeof(v));
+  return v;
+}
+
+static void get_pad(Cursor* c) {
+  unsigned long rem = c->pos % sizeof(unsigned long);
+  if (rem != 0) {
+    unsigned char skip[sizeof(unsigned long)];
+    get(c, skip, sizeof(unsigned long) - rem);
+  }
+}
+
+static unsigned long checksum(unsigned char* data, unsigned long len) {
+  unsigned long hash = 0xcbf29ce484222325UL;
+  for (unsigned long i = 0; i < len; i++) {
+    hash ^= data[i];
+    hash *= 0x100000001b3UL;
+  }
+  return hash;
+}
+
+/** The pruned weights of a dense layer */
+static void put_mask(Cursor* c, NeuronLayerMask* mask) {
+  put_ulong(c, mask->count);
+  put(c, mask->row_start, (mask->rows + 1) * sizeof(unsigned long));
+  put(c, mask->cols, mask->count * sizeof(unsigned int));
+  put_pad(c);
+}
+
+/**
+ * Read and validate the mask of a layer of rows neurons with cols
+ * weights each.
+ * @return NULL if it is invalid or out of memory, with *status set
+ */
+static NeuronLayerMask* get_mask(Cursor* c, unsigned long rows,
+    unsigned long cols, Status* status) {
+  unsigned long count = get_ulong(c);
+  if ((c->err != 0) || (count >= (rows * cols))) {
+    *status = STATUS_ERR;
+    return NULL;
+  }
+  NeuronLayerMask* mask = NeuronLayerMask_create(rows, count);
+  if (mask == NULL) {
+    *status = STATUS_OOM;
+    return NULL;
+  }
+  get(c, mask->row_start, (rows + 1) * sizeof(unsigned long));
+  get(c, mask->cols, count * sizeof(unsigned int));
+  get_pad(c);
+
+  // Rows must have ascending columns and never mask the bias
+  int valid = (c->err == 0) && (mask->row_start[0] == 0)
+    && (mask->row_start[rows] == count);
+  for (unsigned long n = 0; valid && (n < rows); n++) {
+    unsigned long end = mask->row_start[n+1];
+    if ((end < mask->row_start[n]) || (end > count)) {
+      valid = 0;
+    }
+    for (unsigned long k = mask->row_start[n]; valid && (k < end); k++) {
+      if ((mask->cols[k] == 0) || (mask->cols[k] >= cols)
+          || ((k > mask->row_start[n]) && (mask->cols[k] <= mask->cols[k-1]))) {
+        valid = 0;
+      }
+    }
+  }
+  if (!valid) {
+    NeuronLayerMask_free(mask);
+    *status = STATUS_ERR;
+    return NULL;
+  }
+  return mask;
+}
+
+static void serialize(Cursor* c, NeuralNet* nn, unsigned long epoch,
+    double error, unsigned int* perm, unsigned long perm_count) {
+  Rand0_1State rand_state;
+
+  put(c, CHECKPOINT_MAGIC, 8);
+  put_ulong(c, epoch);
+  put(c, &error, sizeof(double));
+  put_ulong(c, nn->out_layer + 1);
+  for (unsigned long l = 0; l <= nn->out_layer; l++) {
+    put_ulong(c, nn->layers[l].count);
+  }
+  put(c, &nn->learning_rate, sizeof(double));
+  put(c, &nn->momentum_factor, sizeof(double));
+
+  rand0_1_save(&rand_state);
+  put(c, &rand_state, sizeof(rand_state));
+
+  put_ulong(c, perm_count);
+  put(c, perm, perm_count * sizeof(unsigned int));
+  put_pad(c);
+
+  for (unsigned long l = 1; l <= nn->out_layer; l++) {
+    NeuronLayer* layer = &nn->layers[l];
+    NeuronLayerSparse* sparse = layer->sparse;
+    if (layer->conv != NULL) {
+      unsigned long count = layer->conv->spec.out_channels * (layer->conv->patch + 1);
+      put_ulong(c, LAYER_CONV);
+      put_ulong(c, count);
+      put(c, layer->conv->weights, count * sizeof(double));
+      put(c, layer->conv->momentums, count * sizeof(double));
+    } else if (layer->half != NULL) {
+      NeuronLayerHalf* half = layer->half;
+      put_ulong(c, LAYER_HALF);
+      put_ulong(c, half->format);
+      for (unsigned long n = 0; n < half->rows; n++) {
+        put(c, &half->master[n * half->stride], half->cols * sizeof(float));
+        put(c, &half->momentums[n * half->stride], half->cols * sizeof(float));
+      }
+      put_pad(c);
+    } else if (sparse == NULL) {
+      put_ulong(c, (layer->mask != NULL) ? LAYER_MASKED : LAYER_DENSE);
+      for (unsigned long n = 0; n < layer->count; n++) {
+        Neuron* neuron = &layer->neurons[n];
+        unsigned long count = neuron->inputs->count + 1;
+        put(c, neuron->weights, count * sizeof(double));
+        put(c, neuron->momentums, count * sizeof(double));
+      }
+      // Skipped neurons are saved as they are along with the momentum
+      // they owe, settling it here would round differently than training
+      put_ulong(c, layer->skip != NULL);
+      if (layer->skip != NULL) {
+        put(c, layer->skip->pending, layer->count * sizeof(unsigned long));
+      }
+      if (layer->mask != NULL) {
+        put_mask(c, layer->mask);
+      }
+    } else {
+      put_ulong(c, LAYER_SPARSE);
+      put_ulong(c, sparse->nnz);
+      put(c, sparse->row_start, (sparse->rows + 1) * sizeof(unsigned long));
+      put(c, sparse->cols, sparse->nnz * sizeof(unsigned int));
+      put_pad(c);
+      put(c, sparse->weights, sparse->nnz * sizeof(double));
+      put(c, sparse->momentums, sparse->nnz * sizeof(double));
+    }
+  }
+}
+
+/**
+ * Parse a checkpoint, if apply is 0 it is only validated
+ * against nn otherwise nn is restored from it.
+ */
+static Status deserialize(Cursor* c, NeuralNet* nn, unsigned long* epoch,
+    double* error, unsigned int* perm, unsigned long perm_count, int apply) {
+  Status status;
+  char magic[8];
+  double learning_rate;
+  double momentum_factor;
+  Rand0_1State rand_state;
+  NeuronLayerSparse* sparse = NULL;
+  NeuronLayerMask* mask = NULL;
+
+  get(c, magic, sizeof(magic));
+  if ((c->err != 0) || (memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0)) {
+    status = STATUS_ERR;
+    goto done;
+  }
+  unsigned long saved_epoch = get_ulong(c);
+  double saved_error;
+  get(c, &saved_error, sizeof(double));
+  if (get_ulong(c) != (nn->out_layer + 1)) {
+    status = STATUS_BAD_PARAM;
+    goto done;
+  }
+  for (unsigned long l = 0; l <= nn->out_layer; l++) {
+    if (get_ulong(c) != nn->layers[l].count) {
+      status = STATUS_BAD_PARAM;
+      goto done;
+    }
+  }
+  get(c, &learning_rate, sizeof(double));
+  get(c, &momentum_factor, sizeof(double));
+  get(c, &rand_state, sizeof(rand_state));
+
+  unsigned long saved_perm_count = get_ulong(c);
+  if ((perm != NULL) && (saved_perm_count != perm_count)) {
+    status = STATUS_BAD_PARAM;
+    goto done;
+  }
+  if (saved_perm_count > ((c->len - c->pos) / sizeof(unsigned int))) {
+    status = STATUS_ERR;
+    goto done;
+  }
+  if (apply && (perm != NULL)) {
+    get(c, perm, saved_perm_count * sizeof(unsigned int));
+  } else {
+    c->pos += saved_perm_count * sizeof(unsigned int);
+  }
+  get_pad(c);
+
+  for (unsigned long l = 1; l <= nn->out_layer; l++) {
+    NeuronLayer* layer = &nn->layers[l];
+    unsigned long cols = layer->neurons[0].inputs->count + 1;
+    unsigned long kind = get_ulong(c);
+
+    if ((kind == LAYER_CONV) || (layer->conv != NULL)) {
+      NeuronLayerConv* conv = layer->conv;
+      unsigned long count = get_ulong(c);
+      if ((kind != LAYER_CONV) || (conv == NULL)
+          || (count != (conv->spec.out_channels * (conv->patch + 1)))) {
+        status = STATUS_BAD_PARAM;
+        goto done;
+      }
+      if (apply) {
+        get(c, conv->weights, count * sizeof(double));
+        get(c, conv->momentums, count * sizeof(double));
+      } else {
+        c->pos += 2 * count * sizeof(double);
+      }
+    } else if ((kind == LAYER_HALF) || (layer->half != NULL)) {
+      // The rounded weights are recomputed from the master copy
+      NeuronLayerHalf* half = layer->half;
+      unsigned long format = get_ulong(c);
+      if ((kind != LAYER_HALF) || (half == NULL) || (format != half->format)) {
+        status = STATUS_BAD_PARAM;
+        goto done;
+      }
+      for (unsigned long n = 0; n < half->rows; n++) {
+        if (apply) {
+          get(c, &half->master[n * half->stride], cols * sizeof(float));
+          get(c, &half->momentums[n * half->stride], cols * sizeof(float));
+        } else {
+          c->pos += 2 * cols * sizeof(float);
+        }
+      }
+      get_pad(c);
+      if (apply && (c->err == 0)) {
+        NeuronLayerHalf_sync(half, half->rows);
+      }
+    } else if ((kind == LAYER_DENSE) || (kind == LAYER_MASKED)) {
+      if (layer->sparse != NULL) {
+        // We can't go back to dense storage
+        status = STATUS_BAD_PARAM;
+        goto done;
+      }
+      for (unsigned long n = 0; n < layer->count; n++) {
+        Neuron* neuron = &layer->neurons[n];
+        if (apply) {
+          get(c, neuron->weights, cols * sizeof(double));
+          get(c, neuron->momentums, cols * sizeof(double));
+        } else {
+          c->pos += 2 * cols * sizeof(double);
+        }
+      }
+      if (get_ulong(c) != (layer->skip != NULL)) {
+        status = STATUS_BAD_PARAM;
+        goto done;
+      }
+      if ((layer->skip != NULL) && apply) {
+        get(c, layer->skip->pending, layer->count * sizeof(unsigned long));
+        layer->skip->momentum_factor = momentum_factor;
+      } else if (layer->skip != NULL) {
+        c->pos += layer->count * sizeof(unsigned long);
+      }
+      if (kind == LAYER_MASKED) {
+        mask = get_mask(c, layer->count, cols, &status);
+        if (mask == NULL) goto done;
+      }
+      if (apply) {
+        NeuronLayerMask_deinit(layer);
+        layer->mask = mask;
+        mask = NULL;
+      } else {
+        NeuronLayerMask_free(mask);
+        mask = NULL;
+      }
+    } else if (kind == LAYER_SPARSE) {
+      unsigned long nnz = get_ulong(c);
+      if ((nnz < layer->count) || (nnz > (layer->count * cols))) {
+        status = STATUS_ERR;
+        goto done;
+      }
+      sparse = NeuronLayerSparse_create(layer->count, nnz);
+      if (sparse == NULL) { status = STATUS_OOM; goto done; }
+      get(c, sparse->row_start, (layer->count + 1) * sizeof(unsigned long));
+      get(c, sparse->cols, nnz * sizeof(unsigned int));
+      get_pad(c);
+      get(c, sparse->weights, nnz * sizeof(double));
+      get(c, sparse->momentums, nnz * sizeof(double));
+      if (c->err != 0) {
+        status = STATUS_ERR;
+        goto done;
+      }
+
+      // Every row must start with its bias and have ascending columns
+      if ((sparse->row_start[0] != 0) || (sparse->row_start[layer->count] != nnz)) {
+        status = STATUS_ERR;
+        goto done;
+      }
+      for (unsigned long n = 0; n < layer->count; n++) {
+        unsigned long k = sparse->row_start[n];
+        unsigned long end = sparse->row_start[n+1];
+        if ((k >= end) || (end > nnz) || (sparse->cols[k] != 0)) {
+          status = STATUS_ERR;
+          goto done;
+        }
+        for (k += 1; k < end; k++) {
+          if ((sparse->cols[k] <= sparse->cols[k-1]) || (sparse->cols[k] >= cols)) {
+            status = STATUS_ERR;
+            goto done;
+          }
+        }
+      }
+
+      if (apply) {
+        NeuronLayerSparse_attach(layer, sparse);
+        sparse = NULL;
+      } else {
+        NeuronLayerSparse_free(sparse);
+        sparse = NULL;
+      }
+    } else {
+      status = STATUS_ERR;
+      goto done;
+    }
+    if (c->err != 0 || (c->pos > c->len)) {
+      status = STATUS_ERR;
+      goto done;
+    }
+  }
+
+  // Everything but the checksum must have been consumed
+  if ((c->err != 0) || ((c->pos + sizeof(unsigned long)) != c->len)) {
+    status = STATUS_ERR;
+    goto done;
+  }
+
+  if (apply) {
+    nn->learning_rate = learning_rate;
+    nn->momentum_factor = momentum_factor;
+    rand0_1_restore(&rand_state);
+    *epoch = saved_epoch;
+    if (error != NULL) {
+      *error = saved_error;
+    }
+  }
+
+  status = STATUS_OK;
+
+done:
+  NeuronLayerSparse_free(sparse);
+  NeuronLayerMask_free(mask);
+  return status;
+}
+
+static Status write_file(NeuralNetCheckpoint* cp, unsigned char* data,
+    unsigned long len) {
+  Status status;
+
+  FILE* f = fopen(cp->tmp_path, "w");
+  if (f == NULL) {
+    printf("NeuralNetCheckpoint.write_file: could not open file: '%s' err=%s\n",
+        cp->tmp_path, strerror(errno));
+    status = STATUS_ERR;
+    goto done;
+  }
+  if ((fwrite(data, 1, len, f) != len) || (fflush(f) != 0)
+      || (fsync(fileno(f)) != 0)) {
+    printf("NeuralNetCheckpoint.write_file: could not write file: '%s' err=%s\n",
+        cp->tmp_path, strerror(errno));
+    fclose(f);
+    status = STATUS_ERR;
+    goto done;
+  }
+  if (fclose(f) != 0) {
+    status = STATUS_ERR;
+    goto done;
+  }
+
+  // Atomically replace the previous checkpoint
+  if (rename(cp->tmp_path, cp->out_path) != 0) {
+    printf("NeuralNetCheckpoint.write_file: could not rename '%s' to '%s' err=%s\n",
+        cp->tmp_path, cp->out_path, strerror(errno));
+    status = STATUS_ERR;
+    goto done;
+  }
+
+  // The rename isn't durable until its directory is synced
+  int dir = open(cp->dir_path, O_RDONLY | O_DIRECTORY);
+  if ((dir < 0) || (fsync(dir) != 0)) {
+    printf("NeuralNetCheckpoint.write_file: could not sync directory '%s' err=%s\n",
+        cp->dir_path, strerror(errno));
+    if (dir >= 0) {
+      close(dir);
+    }
+    status = STATUS_ERR;
+    goto done;
+  }
+  close(dir);
+
+  status = STATUS_OK;
+
+done:
+  return status;
+}
+
+static void* writer_thread(void* arg) {
+  NeuralNetCheckpoint* cp = arg;
+
+  pthread_mutex_lock(&cp->lock);
+  for (;;) {
+    while (!cp->has_pending && !cp->stopping) {
+      pthread_cond_wait(&cp->cond, &cp->lock);
+    }
+    if (!cp->has_pending) {
+      break;
+    }
+
+    // Take the pending snapshot, giving our old buffer back as the spare
+    unsigned char* buf = cp->writing;
+    unsigned long size = cp->writing_size;
+    cp->writing = cp->pending;
+    cp->writing_size = cp->pending_size;
+    cp->writing_len = cp->pending_len;
+    cp->pending = buf;
+    cp->pending_size = size;
+    cp->pending_len = 0;
+    cp->has_pending = 0;
+    pthread_mutex_unlock(&cp->lock);
+
+    Status status = write_file(cp, cp->writing, cp->writing_len);
+
+    pthread_mutex_lock(&cp->lock);
+    if (StatusOk(status)) {
+      cp->written += 1;
+    } else {
+      cp->failed += 1;
+    }
+  }
+  pthread_mutex_unlock(&cp->lock);
+
+  return NULL;
+}
+
+static Status save(NeuralNetCheckpoint* cp, unsigned long epoch,
+    double error, unsigned int* perm, unsigned long perm_count) {
+  Status status;
+  Cursor c;
+
+  dbg("NeuralNetCheckpoint.save:+%p epoch=%ld\n", (void*)cp, epoch);
+
+  // Size the snapshot, it changes if a layer is pruned
+  memset(&c, 0, sizeof(c));
+  serialize(&c, cp->nn, epoch, error, perm, perm_count);
+  unsigned long len = c.pos + sizeof(unsigned long);
+  if (len > cp->fill_size) {
+    unsigned char* fill = realloc(cp->fill, len);
+    if (fill == NULL) {
+      status = STATUS_OOM;
+      goto done;
+    }
+    cp->fill = fill;
+    cp->fill_size = len;
+  }
+
+  memset(&c, 0, sizeof(c));
+  c.buf = cp->fill;
+  c.len = len;
+  serialize(&c, cp->nn, epoch, error, perm, perm_count);
+  put_ulong(&c, checksum(c.buf, c.pos));
+  cp->fill_len = c.pos;
+
+  // Hand the snapshot to the writer
+  pthread_mutex_lock(&cp->lock);
+  unsigned char* buf = cp->pending;
+  unsigned long size = cp->pending_size;
+  cp->pending = cp->fill;
+  cp->pending_size = cp->fill_size;
+  cp->pending_len = cp->fill_len;
+  cp->fill = buf;
+  cp->fill_size = size;
+  cp->fill_len = 0;
+  if (cp->has_pending) {
+    cp->superseded += 1;
+  }
+  cp->has_pending = 1;
+  cp->saved += 1;
+  pthread_cond_signal(&cp->cond);
+  pthread_mutex_unlock(&cp->lock);
+
+  status = STATUS_OK;
+
+done:
+  dbg("NeuralNetCheckpoint.save:-%p status=%d\n", (void*)cp, StatusVal(status));
+  return status;
+}
+
+static void deinit(NeuralNetCheckpoint* cp) {
+  dbg("NeuralNetCheckpoint.deinit:+%p\n", (void*)cp);
+
+  if (cp->tmp_path != NULL) {
+    // Let the writer finish any pending snapshot
+    pthread_mutex_lock(&cp->lock);
+    cp->stopping = 1;
+    pthread_cond_signal(&cp->cond);
+    pthread_mutex_unlock(&cp->lock);
+    pthread_join(cp->writer, NULL);
+    pthread_cond_destroy(&cp->cond);
+    pthread_mutex_destroy(&cp->lock);
+
+    free(cp->fill);
+    free(cp->pending);
+    free(cp->writing);
+    free(cp->tmp_path);
+    free(cp->dir_path);
+    cp->fill = NULL;
+    cp->pending = NULL;
+    cp->writing = NULL;
+    cp->tmp_path = NULL;
+    cp->dir_path = NULL;
+  }
+
+  dbg("NeuralNetCheckpoint.deinit:-%p\n", (void*)cp);
+}
+
+Status NeuralNetCheckpoint_init(NeuralNetCheckpoint* cp, NeuralNet* nn,
+    char* out_path) {
+  Status status;
+
+  dbg("NeuralNetCheckpoint_init:+%p nn=%p out_path=%s\n", (void*)cp, (void*)nn, out_path);
+
+  memset(cp, 0, sizeof(*cp));
+  cp->nn = nn;
+  cp->out_path = out_path;
+  cp->deinit = deinit;
+  cp->save = save;
+
+  if ((nn == NULL) || (out_path == NULL)) {
+    status = STATUS_BAD_PARAM;
+    goto done;
+  }
+
+  unsigned long len = strlen(out_path);
+  cp->tmp_path = calloc(len + sizeof(".tmp"), 1);
+  if (cp->tmp_path == NULL) {
+    status = STATUS_OOM;
+    goto done;
+  }
+  memcpy(cp->tmp_path, out_path, len);
+  memcpy(&cp->tmp_path[len], ".tmp", sizeof(".tmp"));
+
+  // The directory holding out_path, synced after each rename
+  char* slash = strrchr(out_path, '/');
+  unsigned long dir_len = (slash == NULL) ? 0 : (unsigned long)(slash - out_path);
+  cp->dir_path = calloc(dir_len + sizeof("."), 1);
+  if (cp->dir_path == NULL) {
+    free(cp->tmp_path);
+    cp->tmp_path = NULL;
+    status = STATUS_OOM;
+    goto done;
+  }
+  if (slash == NULL) {
+    memcpy(cp->dir_path, ".", sizeof("."));
+  } else if (dir_len == 0) {
+    memcpy(cp->dir_path, "/", sizeof("/"));
+  } else {
+    memcpy(cp->dir_path, out_path, dir_len);
+  }
+
+  pthread_mutex_init(&cp->lock, NULL);
+  pthread_cond_init(&cp->cond, NULL);
+  if (pthread_create(&cp->writer, NULL, writer_thread, cp) != 0) {
+    pthread_cond_destroy(&cp->cond);
+    pthread_mutex_destroy(&cp->lock);
+    free(cp->tmp_path);
+    free(cp->dir_path);
+    cp->tmp_path = NULL;
+    cp->dir_path = NULL;
+    status = STATUS_ERR;
+    goto done;
+  }
+
+  status = STATUS_OK;
+
+done:
+  dbg("NeuralNetCheckpoint_init:-%p status=%d\n", (void*)cp, StatusVal(status));
+  return status;
+}
+
+Status NeuralNetCheckpoint_load(char* path, NeuralNet* nn,
+    unsigned long* epoch, double* error, unsigned int* perm,
+    unsigned long perm_count) {
+  Status status;
+  Cursor c;
+  FILE* f = NULL;
+
+  dbg("NeuralNetCheckpoint_load:+%s nn=%p\n", path, (void*)nn);
+
+  memset(&c, 0, sizeof(c));
+  f = fopen(path, "r");
+  if (f == NULL) {
+    status = STATUS_ERR;
+    goto done;
+  }
+  if ((fseek(f, 0, SEEK_END) != 0) || (ftell(f) < 0)) {
+    status = STATUS_ERR;
+    goto done;
+  }
+  c.len = (unsigned long)ftell(f);
+  rewind(f);
+  if (c.len < (8 + sizeof(unsigned long))) {
+    status = STATUS_ERR;
+    goto done;
+  }
+  c.buf = malloc(c.len);
+  if (c.buf == NULL) {
+    status = STATUS_OOM;
+    goto done;
+  }
+  if (fread(c.buf, 1, c.len, f) != c.len) {
+    status = STATUS_ERR;
+    goto done;
+  }
+
+  unsigned long sum;
+  memcpy(&sum, &c.buf[c.len - sizeof(unsigned long)], sizeof(sum));
+  if (sum != checksum(c.buf, c.len - sizeof(unsigned long))) {
+    printf("NeuralNetCheckpoint_load: '%s' checksum mismatch\n", path);
+    status = STATUS_ERR;
+    goto done;
+  }
+
+  // Validate everything before changing nn
+  status = deserialize(&c, nn, epoch, error, perm, perm_count, 0);
+  if (StatusErr(status)) goto done;
+  c.pos = 0;
+  status = deserialize(&c, nn, epoch, error, perm, perm_count, 1);
+
+done:
+  if (f != NULL) {
+    fclose(f);
+  }
+  free(c.buf);
+  dbg("NeuralNetCheckpoint_load:-%s status=%d\n", path, StatusVal(status));
+  return status;
+}
@@ -0,0 +1,213 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "NeuralNet.h"
+#include "NeuralNetArena.h"
+#include "NeuralNetClone.h"
+#include "NeuralNetSkip.h"
+#include "dbg.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/** Only plain dense double layers have all their state in the neurons */
+static Status check_layers(NeuralNet* nn) {
+  if (nn->layers == NULL) {
+    return STATUS_BAD_PARAM;
+  }
+  for (unsigned long l = 0; l <= nn->out_layer; l++) {
+    NeuronLayer* layer = &nn->layers[l];
+    if ((layer->conv != NULL) || (layer->half != NULL) || (layer->sparse != NULL)
+        || (layer->mask != NULL)) {
+      return STATUS_BAD_PARAM;
+    }
+  }
+  return STATUS_OK;
+}
+
+/**
+ * Copy src's settings and methods to dst with its own layers array and
+ * logits. The layers have no neurons yet so dst can be deinit'd at any
+ * point while they are filled in.
+ */
+static Status copy_net(NeuralNet* dst, NeuralNet* src) {
+  *dst = *src;
+  dst->arena = NULL;
+  dst->tune = NULL;
+  dst->tune_mode = NEURAL_NET_TUNE_OFF;
+  dst->tune_cache = NULL;
+  dst->skip_threshold = 0.0;
+  dst->logits = NULL;
+  dst->input = NULL;
+
+  dst->layers = calloc(src->max_layers, sizeof(NeuronLayer));
+  if (dst->layers == NULL) {
+    return STATUS_OOM;
+  }
+  for (unsigned long l = 0; l < src->max_layers; l++) {
+    dst->layers[l].count = src->layers[l].count;
+  }
+  if (src->logits != NULL) {
+    unsigned long count = src->layers[src->out_layer].count;
+    dst->logits = calloc(count, sizeof(double));
+    if (dst->logits == NULL) {
+      return STATUS_OOM;
+    }
+    memcpy(dst->logits, src->logits, count * sizeof(double));
+  }
+  return STATUS_OK;
+}
+
+/** Point dst's layers at the same offsets of dst's arena as src's are in src's */
+static void rebase(NeuralNet* dst, NeuralNet* src) {
+  char* src_base = src->arena->base;
+  char* dst_base = dst->arena->base;
+
+  for (unsigned long l = 0; l <= src->out_layer; l++) {
+    NeuronLayer* src_layer = &src->layers[l];
+    NeuronLayer* layer = &dst->layers[l];
+    if (src_layer->neurons == NULL) {
+      continue;
+    }
+    layer->neurons = (Neuron*)(void*)(dst_base + ((char*)src_layer->neurons - src_base));
+    layer->in_arena = 1;
+    for (unsigned long n = 0; n < layer->count; n++) {
+      Neuron* neuron = &layer->neurons[n];
+      Neuron* src_neuron = &src_layer->neurons[n];
+      neuron->inputs = (l == 0) ? NULL : &dst->layers[l-1];
+      if (src_neuron->weights != NULL) {
+        neuron->weights = (double*)(void*)(dst_base
+            + ((char*)src_neuron->weights - src_base));
+        neuron->momentums = (double*)(void*)(dst_base
+            + ((char*)src_neuron->momentums - src_base));
+      }
+    }
+  }
+}
+
+Status NeuralNet_clone(NeuralNet* dst, NeuralNet* src) {
+  Status status;
+
+  dbg("NeuralNet_clone:+%p src=%p\n", (void*)dst, (void*)src);
+
+  memset(dst, 0, sizeof(*dst));
+  status = check_layers(src);
+  if (StatusErr(status)) goto done;
+  NeuralNet_skip_flush(src);
+  if (src->arena == NULL) {
+    // A neuron's heap weights are an allocation each, gather them
+    // once so this and every later clone is a single copy
+    src->alloc_mode = NEURAL_NET_ALLOC_MMAP;
+    status = NeuralNet_create_arena(src);
+    if (StatusErr(status)) goto done;
+    src->alloc_mode = src->arena->mode;
+  }
+  status = copy_net(dst, src);
+  if (StatusErr(status)) goto done;
+
+  // Everything is in the arena so one copy takes it all
+  NeuralNetArena* arena = src->arena;
+  dst->arena = calloc(1, sizeof(NeuralNetArena));
+  if (dst->arena == NULL) { status = STATUS_OOM; goto done; }
+  status = NeuralNetArena_init(dst->arena, arena->size, arena->mode);
+  if (StatusErr(status)) {
+    free(dst->arena);
+    dst->arena = NULL;
+    goto done;
+  }
+  memcpy(dst->arena->base, arena->base, arena->used);
+  dst->arena->used = arena->used;
+  rebase(dst, src);
+
+  status = STATUS_OK;
+
+done:
+  if (StatusErr(status) && (dst->deinit != NULL)) {
+    dst->deinit(dst);
+  }
+  dbg("NeuralNet_clone:-%p status=%d\n", (void*)dst, StatusVal(status));
+  return status;
+}
+
+Status NeuralNet_share(NeuralNet* nn) {
+  Status status;
+
+  dbg("NeuralNet_share:+%p\n", (void*)nn);
+
+  status = check_layers(nn);
+  if (StatusErr(status)) goto done;
+
+  if (nn->arena == NULL) {
+    nn->alloc_mode = NEURAL_NET_ALLOC_MMAP;
+    status = NeuralNet_create_arena(nn);
+    if (StatusErr(status)) goto done;
+  }
+  status = NeuralNetArena_share(nn->arena);
+  if (StatusErr(status)) goto done;
+  nn->alloc_mode = nn->arena->mode;
+
+done:
+  dbg("NeuralNet_share:-%p status=%d\n", (void*)nn, StatusVal(status));
+  return status;
+}
+
+Status NeuralNet_fork(NeuralNet* dst, NeuralNet* base) {
+  Status status;
+
+  dbg("NeuralNet_fork:+%p base=%p\n", (void*)dst, (void*)base);
+
+  memset(dst, 0, sizeof(*dst));
+  if ((base->arena == NULL) || (base->arena->fd < 0)) {
+    status = NeuralNet_share(base);
+    if (StatusErr(status)) goto done;
+  } else {
+    status = check_layers(base);
+    if (StatusErr(status)) goto done;
+  }
+  status = copy_net(dst, base);
+  if (StatusErr(status)) goto done;
+
+  dst->arena = calloc(1, sizeof(NeuralNetArena));
+  if (dst->arena == NULL) { status = STATUS_OOM; goto done; }
+  status = NeuralNetArena_fork(dst->arena, base->arena);
+  if (StatusErr(status)) {
+    free(dst->arena);
+    dst->arena = NULL;
+    goto done;
+  }
+  rebase(dst, base);
+
+  status = STATUS_OK;
+
+done:
+  if (StatusErr(status) && (dst->deinit != NULL)) {
+    dst->deinit(dst);
+  }
+  dbg("NeuralNet_fork:-%p status=%d\n", (void*)dst, StatusVal(status));
+  return status;
+}
+
+Status NeuralNet_freeze(NeuralNet* nn, unsigned long first_trained) {
+  dbg("NeuralNet_freeze:+-%p first_trained=%ld\n", (void*)nn, first_trained);
+
+  if ((first_trained < 1) || (first_trained > nn->out_layer)) {
+    return STATUS_BAD_PARAM;
+  }
+  for (unsigned long l = 1; l <= nn->out_layer; l++) {
+    nn->layers[l].frozen = l < first_trained;
+  }
+  return STATUS_OK;
+}
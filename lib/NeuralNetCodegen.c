@@ -0,0 +1,317 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "NeuralNet.h"
+#include "NeuralNetCodegen.h"
+#include "NeuralNetTrain.h"
+#include "dbg.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define VALUES_PER_LINE 4
+#define MAX_PREFIX 64
+
+/** Every layer has weights and they are all finite */
+static Status check(NeuralNet* nn, char* prefix) {
+  if ((nn->layers == NULL) || (nn->out_layer == 0) || (prefix == NULL)
+      || (strlen(prefix) == 0) || (strlen(prefix) >= MAX_PREFIX)) {
+    return STATUS_BAD_PARAM;
+  }
+  for (unsigned long l = 1; l <= nn->out_layer; l++) {
+    NeuronLayer* layer = &nn->layers[l];
+    if ((layer->neurons == NULL) || (layer->neurons[0].inputs == NULL)) {
+      return STATUS_BAD_PARAM;
+    }
+    for (unsigned long n = 0; n < layer->count; n++) {
+      for (unsigned long i = 0; i <= nn->layers[l - 1].count; i++) {
+        if (!isfinite(NeuronLayer_weight(layer, n, i))) {
+          return STATUS_BAD_PARAM;
+        }
+      }
+    }
+  }
+  return STATUS_OK;
+}
+
+static void write_upper(FILE* out, char* prefix) {
+  for (char* p = prefix; *p != 0; p++) {
+    fputc(toupper((unsigned char)*p), out);
+  }
+}
+
+/** A comma separated list of values, VALUES_PER_LINE to a line */
+static void write_values(FILE* out, double* values, unsigned long count,
+    char* indent) {
+  for (unsigned long i = 0; i < count; i++) {
+    if ((i % VALUES_PER_LINE) == 0) {
+      fprintf(out, "%s%s", (i == 0) ? "" : "\n", indent);
+    } else {
+      fputc(' ', out);
+    }
+    fprintf(out, "%.17g,", values[i]);
+  }
+  fputc('\n', out);
+}
+
+static void write_topology(FILE* out, NeuralNet* nn) {
+  for (unsigned long l = 0; l <= nn->out_layer; l++) {
+    fprintf(out, "%s%ld", (l == 0) ? "" : "-", nn->layers[l].count);
+  }
+  fprintf(out, " %s outputs",
+      (nn->output_type == NEURAL_NET_OUTPUT_SOFTMAX) ? "softmax" : "sigmoid");
+}
+
+/** The name of the activations layer l reads */
+static void write_source(FILE* out, char* prefix, unsigned long l) {
+  if (l == 1) {
+    fprintf(out, "input");
+  } else {
+    fprintf(out, "%s_a%ld", prefix, l - 1);
+  }
+}
+
+static void write_weights(FILE* out, NeuralNet* nn, char* prefix, unsigned long l) {
+  NeuronLayer* layer = &nn->layers[l];
+  unsigned long cols = nn->layers[l - 1].count + 1;
+  double row[VALUES_PER_LINE];
+
+  fprintf(out, "static const double %s_w%ld[%ld][%ld] __attribute__((aligned(64))) = {\n",
+      prefix, l, layer->count, cols);
+  for (unsigned long n = 0; n < layer->count; n++) {
+    fprintf(out, "  {\n");
+    for (unsigned long i = 0; i < cols; i += VALUES_PER_LINE) {
+      unsigned long c = 0;
+      for (; (c < VALUES_PER_LINE) && ((i + c) < cols); c++) {
+        row[c] = NeuronLayer_weight(layer, n, i + c);
+      }
+      write_values(out, row, c, "    ");
+    }
+    fprintf(out, "  },\n");
+  }
+  fprintf(out, "};\n\n");
+}
+
+/** Weighted sums of layer l into sums[n] with loops of constant bounds */
+static void write_loops(FILE* out, NeuralNet* nn, char* prefix, unsigned long l,
+    char* sums, int sigmoid) {
+  unsigned long count = nn->layers[l].count;
+  unsigned long inputs = nn->layers[l - 1].count;
+
+  fprintf(out, "  for (unsigned long n = 0; n < %ld; n++) {\n", count);
+  fprintf(out, "    double sum = %s_w%ld[n][0];\n", prefix, l);
+  fprintf(out, "    for (unsigned long i = 0; i < %ld; i++) {\n", inputs);
+  fprintf(out, "      sum += %s_w%ld[n][i + 1] * ", prefix, l);
+  write_source(out, prefix, l);
+  fprintf(out, "[i];\n");
+  fprintf(out, "    }\n");
+  if (sigmoid) {
+    fprintf(out, "    %s[n] = %s_sigmoid(sum);\n", sums, prefix);
+  } else {
+    fprintf(out, "    %s[n] = sum;\n", sums);
+  }
+  fprintf(out, "  }\n");
+}
+
+/** Weighted sums of layer l written out with the weights as literals */
+static void write_unrolled(FILE* out, NeuralNet* nn, char* prefix, unsigned long l,
+    char* sums, int sigmoid) {
+  NeuronLayer* layer = &nn->layers[l];
+  unsigned long inputs = nn->layers[l - 1].count;
+
+  for (unsigned long n = 0; n < layer->count; n++) {
+    fprintf(out, "  %s[%ld] = %.17g", sums, n, NeuronLayer_weight(layer, n, 0));
+    for (unsigned long i = 0; i < inputs; i++) {
+      double w = NeuronLayer_weight(layer, n, i + 1);
+      if (!(fabs(w) > 0.0)) {
+        continue;
+      }
+      fprintf(out, "\n      %c %.17g * ", (w < 0.0) ? '-' : '+', fabs(w));
+      write_source(out, prefix, l);
+      fprintf(out, "[%ld]", i);
+    }
+    fprintf(out, ";\n");
+    if (sigmoid) {
+      fprintf(out, "  %s[%ld] = %s_sigmoid(%s[%ld]);\n", sums, n, prefix, sums, n);
+    }
+  }
+}
+
+Status NeuralNetCodegen_write(NeuralNet* nn, char* prefix, unsigned long unroll,
+    FILE* out) {
+  Status status;
+
+  dbg("NeuralNetCodegen_write:+%p prefix=%s unroll=%ld\n", (void*)nn, prefix, unroll);
+
+  status = check(nn, prefix);
+  if (StatusErr(status)) goto done;
+
+  int softmax = (nn->output_type == NEURAL_NET_OUTPUT_SOFTMAX);
+  unsigned long outputs = nn->layers[nn->out_layer].count;
+
+  fprintf(out, "/*\n * Generated by NeuralNetCodegen, do not edit.\n * ");
+  write_topology(out, nn);
+  fprintf(out, "\n */\n\n#include <math.h>\n\n");
+  fprintf(out, "#define ");
+  write_upper(out, prefix);
+  fprintf(out, "_INPUTS %ld\n#define ", nn->layers[0].count);
+  write_upper(out, prefix);
+  fprintf(out, "_OUTPUTS %ld\n\n", outputs);
+
+  fprintf(out, "void %s_predict(const double* input, double* output);\n\n", prefix);
+  if (!unroll) {
+    for (unsigned long l = 1; l <= nn->out_layer; l++) {
+      write_weights(out, nn, prefix, l);
+    }
+  }
+  fprintf(out, "static inline double %s_sigmoid(double x) {\n", prefix);
+  fprintf(out, "  return 1.0 / (1.0 + exp(-x));\n}\n\n");
+
+  fprintf(out, "void %s_predict(const double* input, double* output) {\n", prefix);
+  for (unsigned long l = 1; l < nn->out_layer; l++) {
+    fprintf(out, "  double %s_a%ld[%ld];\n", prefix, l, nn->layers[l].count);
+  }
+  if (softmax) {
+    fprintf(out, "  double logits[%ld];\n", outputs);
+  }
+  for (unsigned long l = 1; l <= nn->out_layer; l++) {
+    char sums[MAX_PREFIX + 32];
+    if (l < nn->out_layer) {
+      snprintf(sums, sizeof(sums), "%s_a%ld", prefix, l);
+    } else {
+      snprintf(sums, sizeof(sums), "%s", softmax ? "logits" : "output");
+    }
+    int sigmoid = (l < nn->out_layer) || !softmax;
+    fprintf(out, "\n  // Layer %ld\n", l);
+    if (unroll) {
+      write_unrolled(out, nn, prefix, l, sums, sigmoid);
+    } else {
+      write_loops(out, nn, prefix, l, sums, sigmoid);
+    }
+  }
+  if (softmax) {
+    fprintf(out, "\n  // Softmax, less the largest logit so exp can't overflow\n");
+    fprintf(out, "  double max = logits[0];\n");
+    fprintf(out, "  for (unsigned long n = 1; n < %ld; n++) {\n", outputs);
+    fprintf(out, "    max = logits[n] > max ? logits[n] : max;\n  }\n");
+    fprintf(out, "  double sum = 0.0;\n");
+    fprintf(out, "  for (unsigned long n = 0; n < %ld; n++) {\n", outputs);
+    fprintf(out, "    output[n] = exp(logits[n] - max);\n    sum += output[n];\n  }\n");
+    fprintf(out, "  double scale = 1.0 / sum;\n");
+    fprintf(out, "  for (unsigned long n = 0; n < %ld; n++) {\n", outputs);
+    fprintf(out, "    output[n] *= scale;\n  }\n");
+  }
+  fprintf(out, "}\n");
+
+  status = ferror(out) ? STATUS_ERR : STATUS_OK;
+
+done:
+  dbg("NeuralNetCodegen_write:-%p status=%d\n", (void*)nn, StatusVal(status));
+  return status;
+}
+
+Status NeuralNetCodegen_write_test(NeuralNet* nn, char* prefix,
+    Pattern** inputs, unsigned long count, double tolerance, FILE* out) {
+  Status status;
+  Pattern* output = NULL;
+
+  dbg("NeuralNetCodegen_write_test:+%p prefix=%s count=%ld\n", (void*)nn, prefix, count);
+
+  status = check(nn, prefix);
+  if (StatusErr(status) || (count == 0)) {
+    status = STATUS_BAD_PARAM;
+    goto done;
+  }
+
+  unsigned long input_count = nn->layers[0].count;
+  unsigned long output_count = nn->layers[nn->out_layer].count;
+  output = Pattern_create(output_count);
+  if (output == NULL) { status = STATUS_OOM; goto done; }
+
+  fprintf(out, "/*\n * Generated by NeuralNetCodegen, do not edit. Checks %s_predict\n", prefix);
+  fprintf(out, " * against NeuralNet process for ");
+  write_topology(out, nn);
+  fprintf(out, "\n */\n\n#include <math.h>\n#include <stdio.h>\n#include <time.h>\n\n");
+  fprintf(out, "#define COUNT %ld\n#define INPUTS %ld\n#define OUTPUTS %ld\n", count,
+      input_count, output_count);
+  fprintf(out, "#define TOLERANCE %.17g\n\n", tolerance);
+  fprintf(out, "void %s_predict(const double* input, double* output);\n\n", prefix);
+
+  fprintf(out, "static const double inputs[COUNT][INPUTS] = {\n");
+  for (unsigned long p = 0; p < count; p++) {
+    fprintf(out, "  {\n");
+    write_values(out, inputs[p]->data, input_count, "    ");
+    fprintf(out, "  },\n");
+  }
+  fprintf(out, "};\n\n");
+
+  fprintf(out, "static const double expected[COUNT][OUTPUTS] = {\n");
+  for (unsigned long p = 0; p < count; p++) {
+    nn->set_inputs(nn, inputs[p]);
+    nn->process(nn);
+    nn->get_outputs(nn, output);
+    fprintf(out, "  {\n");
+    write_values(out, output->data, output_count, "    ");
+    fprintf(out, "  },\n");
+  }
+  fprintf(out, "};\n\n");
+
+  fprintf(out,
+      "int main(void) {\n"
+      "  double output[OUTPUTS];\n"
+      "  double max_diff = 0.0;\n"
+      "  unsigned long failed = 0;\n"
+      "\n"
+      "  for (unsigned long p = 0; p < COUNT; p++) {\n"
+      "    %s_predict(inputs[p], output);\n"
+      "    for (unsigned long n = 0; n < OUTPUTS; n++) {\n"
+      "      double diff = fabs(output[n] - expected[p][n]);\n"
+      "      max_diff = diff > max_diff ? diff : max_diff;\n"
+      "      failed += !(diff <= TOLERANCE);\n"
+      "    }\n"
+      "  }\n"
+      "\n"
+      "  // Time enough predictions to take a while\n"
+      "  unsigned long reps = (1000000 / COUNT) + 1;\n"
+      "  double sink = 0.0;\n"
+      "  struct timespec start, end;\n"
+      "  clock_gettime(CLOCK_MONOTONIC, &start);\n"
+      "  for (unsigned long r = 0; r < reps; r++) {\n"
+      "    for (unsigned long p = 0; p < COUNT; p++) {\n"
+      "      %s_predict(inputs[p], output);\n"
+      "      sink += output[0];\n"
+      "    }\n"
+      "  }\n"
+      "  clock_gettime(CLOCK_MONOTONIC, &end);\n"
+      "  double ns = ((double)(end.tv_sec - start.tv_sec) * 1e9)\n"
+      "      + (double)(end.tv_nsec - start.tv_nsec);\n"
+      "\n"
+      "  printf(\"%%s max_diff=%%g failed=%%lu ns_per_predict=%%.1f sink=%%g\\n\",\n"
+      "      failed ? \"FAIL\" : \"PASS\", max_diff, failed, ns / (double)(reps * COUNT), sink);\n"
+      "  return failed ? 1 : 0;\n"
+      "}\n", prefix, prefix);
+
+  status = ferror(out) ? STATUS_ERR : STATUS_OK;
+
+done:
+  free(output);
+  dbg("NeuralNetCodegen_write_test:-%p status=%d\n", (void*)nn, StatusVal(status));
+  return status;
+}
@@ -0,0 +1,327 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "NeuralNet.h"
+#include "NeuralNetConv.h"
+#include "dbg.h"
+#include "rand0_1.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Tile sizes of the GEMM, a BLOCK_K x BLOCK_N tile of B is 128KiB
+// so it stays in L2 while a BLOCK_M band of A streams past it
+#define BLOCK_M 64
+#define BLOCK_N 128
+#define BLOCK_K 128
+
+static unsigned long min_ul(unsigned long a, unsigned long b) {
+  return (a < b) ? a : b;
+}
+
+/**
+ * C[m][n] += A[m][k] * B[k][n], cache blocked. The innermost loop runs
+ * along rows of B and C so it vectorizes.
+ */
+static void gemm(unsigned long m, unsigned long n, unsigned long k,
+    const double* a, unsigned long lda, const double* b, unsigned long ldb,
+    double* c, unsigned long ldc) {
+  for (unsigned long j0 = 0; j0 < n; j0 += BLOCK_N) {
+    unsigned long j1 = min_ul(j0 + BLOCK_N, n);
+    for (unsigned long k0 = 0; k0 < k; k0 += BLOCK_K) {
+      unsigned long k1 = min_ul(k0 + BLOCK_K, k);
+      for (unsigned long i0 = 0; i0 < m; i0 += BLOCK_M) {
+        unsigned long i1 = min_ul(i0 + BLOCK_M, m);
+        for (unsigned long i = i0; i < i1; i++) {
+          double* crow = &c[i * ldc];
+          for (unsigned long kk = k0; kk < k1; kk++) {
+            double aik = a[(i * lda) + kk];
+            const double* brow = &b[kk * ldb];
+            for (unsigned long j = j0; j < j1; j++) {
+              crow[j] += aik * brow[j];
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+/** Expand the input planes so each column is one receptive field */
+static void im2col(NeuronLayerConv* conv, Neuron* inputs) {
+  NeuralNetConvSpec* s = &conv->spec;
+  double* col = conv->col;
+
+  for (unsigned long ic = 0; ic < s->in_channels; ic++) {
+    Neuron* plane = &inputs[ic * s->in_height * s->in_width];
+    for (unsigned long ky = 0; ky < s->kernel_height; ky++) {
+      for (unsigned long kx = 0; kx < s->kernel_width; kx++) {
+        for (unsigned long oy = 0; oy < conv->out_height; oy++) {
+          // Unsigned wrap makes positions in the padding >= in_height
+          unsigned long iy = (oy * s->stride_height) + ky - s->pad_height;
+          for (unsigned long ox = 0; ox < conv->out_width; ox++) {
+            unsigned long ix = (ox * s->stride_width) + kx - s->pad_width;
+            *col++ = ((iy < s->in_height) && (ix < s->in_width))
+              ? plane[(iy * s->in_width) + ix].output : 0.0;
+          }
+        }
+      }
+    }
+  }
+}
+
+/** Scatter add dcol back onto the input planes' pd_error */
+static void col2im(NeuronLayerConv* conv, Neuron* inputs) {
+  NeuralNetConvSpec* s = &conv->spec;
+  double* dcol = conv->dcol;
+
+  for (unsigned long ic = 0; ic < s->in_channels; ic++) {
+    Neuron* plane = &inputs[ic * s->in_height * s->in_width];
+    for (unsigned long ky = 0; ky < s->kernel_height; ky++) {
+      for (unsigned long kx = 0; kx < s->kernel_width; kx++) {
+        for (unsigned long oy = 0; oy < conv->out_height; oy++) {
+          unsigned long iy = (oy * s->stride_height) + ky - s->pad_height;
+          for (unsigned long ox = 0; ox < conv->out_width; ox++) {
+            unsigned long ix = (ox * s->stride_width) + kx - s->pad_width;
+            double d = *dcol++;
+            if ((iy < s->in_height) && (ix < s->in_width)) {
+              plane[(iy * s->in_width) + ix].pd_error += d;
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+static void conv_free(NeuronLayerConv* conv) {
+  if (conv != NULL) {
+    free(conv->weights);
+    free(conv->momentums);
+    free(conv->weights_t);
+    free(conv->col);
+    free(conv->dcol);
+    free(conv->sums);
+    free(conv->errors);
+    free(conv);
+  }
+}
+
+NeuronLayerConv* NeuronLayerConv_create(NeuralNetConvSpec* spec,
+    unsigned long in_count, unsigned long* count) {
+  NeuronLayerConv* conv = NULL;
+  NeuralNetConvSpec s = *spec;
+
+  dbg("NeuronLayerConv_create:+ in_count=%ld\n", in_count);
+
+  if (s.stride_height == 0) s.stride_height = 1;
+  if (s.stride_width == 0) s.stride_width = 1;
+  if ((s.in_channels == 0) || (s.out_channels == 0)
+      || (s.kernel_height == 0) || (s.kernel_width == 0)
+      || ((s.in_channels * s.in_height * s.in_width) != in_count)
+      || ((s.in_height + (2 * s.pad_height)) < s.kernel_height)
+      || ((s.in_width + (2 * s.pad_width)) < s.kernel_width)
+      || (s.pad_height >= s.kernel_height) || (s.pad_width >= s.kernel_width)) {
+    goto done;
+  }
+
+  conv = calloc(1, sizeof(NeuronLayerConv));
+  if (conv == NULL) goto done;
+  conv->spec = s;
+  conv->out_height = ((s.in_height + (2 * s.pad_height) - s.kernel_height) / s.stride_height) + 1;
+  conv->out_width = ((s.in_width + (2 * s.pad_width) - s.kernel_width) / s.stride_width) + 1;
+  conv->positions = conv->out_height * conv->out_width;
+  conv->patch = s.in_channels * s.kernel_height * s.kernel_width;
+  *count = s.out_channels * conv->positions;
+
+done:
+  dbg("NeuronLayerConv_create:-%p\n", (void*)conv);
+  return conv;
+}
+
+Status NeuronLayerConv_start(NeuronLayer* layer, NeuronLayer* in_layer) {
+  Status status;
+  NeuronLayerConv* conv = layer->conv;
+  unsigned long oc = conv->spec.out_channels;
+  unsigned long cols = conv->patch + 1;
+
+  dbg("NeuronLayerConv_start:+%p in_layer=%p\n", (void*)layer, (void*)in_layer);
+
+  // The neurons have no weights of their own, points are as if
+  // they were fully connected as that's how they're written out
+  for (unsigned long n = 0; n < layer->count; n++) {
+    Neuron* neuron = &layer->neurons[n];
+    neuron->inputs = in_layer;
+    neuron->weights = NULL;
+    neuron->momentums = NULL;
+    neuron->points = in_layer->count + 1;
+    neuron->output = 0.0;
+    neuron->pd_error = 0.0;
+  }
+
+  conv->weights = calloc(oc * cols, sizeof(double));
+  conv->momentums = calloc(oc * cols, sizeof(double));
+  conv->weights_t = calloc(conv->patch * oc, sizeof(double));
+  conv->col = calloc(conv->patch * conv->positions, sizeof(double));
+  conv->dcol = calloc(conv->patch * conv->positions, sizeof(double));
+  conv->sums = calloc(oc * conv->positions, sizeof(double));
+  conv->errors = calloc(oc * conv->positions, sizeof(double));
+  if ((conv->weights == NULL) || (conv->momentums == NULL)
+      || (conv->weights_t == NULL) || (conv->col == NULL)
+      || (conv->dcol == NULL) || (conv->sums == NULL) || (conv->errors == NULL)) {
+    status = STATUS_OOM;
+    goto done;
+  }
+
+  // Initialize weights >= -0.5 and < 0.5 like the dense layers
+  for (unsigned long w = 0; w < (oc * cols); w++) {
+    conv->weights[w] = rand0_1() - 0.5;
+  }
+
+  status = STATUS_OK;
+
+done:
+  dbg("NeuronLayerConv_start:-%p status=%d\n", (void*)layer, StatusVal(status));
+  return status;
+}
+
+void NeuronLayerConv_process(NeuronLayer* layer) {
+  NeuronLayerConv* conv = layer->conv;
+  unsigned long oc = conv->spec.out_channels;
+  unsigned long positions = conv->positions;
+  unsigned long cols = conv->patch + 1;
+
+  im2col(conv, layer->neurons[0].inputs->neurons);
+
+  // Start each channel's sums at its bias then add kernel * col
+  for (unsigned long c = 0; c < oc; c++) {
+    double bias = conv->weights[c * cols];
+    double* sums = &conv->sums[c * positions];
+    for (unsigned long p = 0; p < positions; p++) {
+      sums[p] = bias;
+    }
+  }
+  gemm(oc, positions, conv->patch, &conv->weights[1], cols,
+      conv->col, positions, conv->sums, positions);
+
+  // Calcuate the output using a Sigmoidal Activation function
+  for (unsigned long n = 0; n < layer->count; n++) {
+    layer->neurons[n].output = 1.0 / (1.0 + exp(-conv->sums[n]));
+  }
+}
+
+void NeuronLayerConv_backprop(NeuronLayer* layer, NeuronLayer* prev_layer) {
+  NeuronLayerConv* conv = layer->conv;
+  unsigned long oc = conv->spec.out_channels;
+  unsigned long cols = conv->patch + 1;
+  Neuron* prev = prev_layer->neurons;
+
+  for (unsigned long n = 0; n < layer->count; n++) {
+    conv->errors[n] = layer->neurons[n].pd_error;
+  }
+  for (unsigned long c = 0; c < oc; c++) {
+    for (unsigned long k = 0; k < conv->patch; k++) {
+      conv->weights_t[(k * oc) + c] = conv->weights[(c * cols) + k + 1];
+    }
+  }
+
+  // dcol = kernels^T * errors, then fold it back onto the inputs
+  memset(conv->dcol, 0, conv->patch * conv->positions * sizeof(double));
+  gemm(conv->patch, conv->positions, oc, conv->weights_t, oc,
+      conv->errors, conv->positions, conv->dcol, conv->positions);
+  for (unsigned long npl = 0; npl < prev_layer->count; npl++) {
+    prev[npl].pd_error = 0.0;
+  }
+  col2im(conv, prev);
+
+  for (unsigned long npl = 0; npl < prev_layer->count; npl++) {
+    double prev_out = prev[npl].output;
+    prev[npl].pd_error *= prev_out * (1.0 - prev_out);
+  }
+}
+
+void NeuronLayerConv_adjust_weights(NeuronLayer* layer, double learning_rate,
+    double momentum_factor) {
+  NeuronLayerConv* conv = layer->conv;
+  unsigned long oc = conv->spec.out_channels;
+  unsigned long positions = conv->positions;
+  unsigned long cols = conv->patch + 1;
+
+  for (unsigned long n = 0; n < layer->count; n++) {
+    conv->errors[n] = layer->neurons[n].pd_error;
+  }
+
+  // A shared weight's step is the sum over every position it's used
+  // at, errors * col^T, both rows are contiguous so it's a dot product
+  for (unsigned long c = 0; c < oc; c++) {
+    double* errors = &conv->errors[c * positions];
+    double* weights = &conv->weights[c * cols];
+    double* momentums = &conv->momentums[c * cols];
+
+    double pd_err = 0.0;
+    for (unsigned long p = 0; p < positions; p++) {
+      pd_err += errors[p];
+    }
+    momentums[0] = (learning_rate * pd_err) + (momentum_factor * momentums[0]);
+    weights[0] += momentums[0];
+
+    for (unsigned long k = 0; k < conv->patch; k++) {
+      double* col = &conv->col[k * positions];
+      double sum = 0.0;
+      for (unsigned long p = 0; p < positions; p++) {
+        sum += errors[p] * col[p];
+      }
+      momentums[k + 1] = (learning_rate * sum) + (momentum_factor * momentums[k + 1]);
+      weights[k + 1] += momentums[k + 1];
+    }
+  }
+}
+
+double NeuronLayerConv_weight(NeuronLayer* layer, unsigned long n,
+    unsigned long i) {
+  NeuronLayerConv* conv = layer->conv;
+  NeuralNetConvSpec* s = &conv->spec;
+  unsigned long cols = conv->patch + 1;
+  unsigned long c = n / conv->positions;
+  unsigned long oy = (n % conv->positions) / conv->out_width;
+  unsigned long ox = n % conv->out_width;
+
+  if (i == 0) {
+    return conv->weights[c * cols];
+  }
+  i -= 1;
+  unsigned long plane = s->in_height * s->in_width;
+  unsigned long ic = i / plane;
+  unsigned long iy = (i % plane) / s->in_width;
+  unsigned long ix = i % s->in_width;
+
+  // Position of the input within the neuron's receptive field,
+  // unsigned wrap puts inputs before it out of range
+  unsigned long ky = iy + s->pad_height - (oy * s->stride_height);
+  unsigned long kx = ix + s->pad_width - (ox * s->stride_width);
+  if ((ky >= s->kernel_height) || (kx >= s->kernel_width)) {
+    return 0.0;
+  }
+  return conv->weights[(c * cols) + 1
+    + (((ic * s->kernel_height) + ky) * s->kernel_width) + kx];
+}
+
+void NeuronLayerConv_deinit(NeuronLayer* layer) {
+  conv_free(layer->conv);
+  layer->conv = NULL;
+}
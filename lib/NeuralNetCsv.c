@@ -0,0 +1,789 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "NeuralNet.h"
+#include "NeuralNetCsv.h"
+#include "NeuralNetTrain.h"
+#include "ThreadPool.h"
+#include "dbg.h"
+#include "rand0_1.h"
+#include "unused.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_FALLBACK_FIELD 64
+#define MAX_FAST_MANTISSA (1UL << 53)
+
+typedef struct Loader Loader;
+
+/** A piece of the file, it owns the lines that start in [begin, end) */
+typedef struct Chunk {
+  Loader* loader;
+  unsigned long begin;
+  unsigned long end;
+  double* values;             // Parsed rows
+  unsigned long rows;
+  unsigned long cap;          // Rows values has room for
+  unsigned long first_row;    // Of the chunk in NeuralNetCsvData.values
+  unsigned long err_offset;   // File offset of the first bad line
+  NeuralNetCsvStats* stats;   // Per column, of this chunk's rows
+  Status status;
+  char pad[4];
+} Chunk;
+
+typedef struct Loader {
+  NeuralNetCsvData* data;
+  NeuralNetCsvSpec* spec;
+  const char* base;           // The mapped file
+  unsigned long size;
+} Loader;
+
+static const double pow10_exact[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+// Range of exponents the Eisel-Lemire path handles, results are normal
+#define POW5_MIN_EXP10 (-40)
+#define POW5_MAX_EXP10 40
+
+/**
+ * 5^q for q in [POW5_MIN_EXP10, POW5_MAX_EXP10], shifted so the top bit
+ * is set and truncated to 128 bits, the high 64 bits first. Negative q
+ * are the reciprocal rounded up.
+ */
+static const unsigned long pow5_128[][2] = {
+  {0x8b61313bbabce2c6UL, 0x2323ac4b3b3da015UL}, // 5^-40
+  {0xae397d8aa96c1b77UL, 0xabec975e0a0d081aUL}, // 5^-39
+  {0xd9c7dced53c72255UL, 0x96e7bd358c904a21UL}, // 5^-38
+  {0x881cea14545c7575UL, 0x7e50d64177da2e54UL}, // 5^-37
+  {0xaa242499697392d2UL, 0xdde50bd1d5d0b9e9UL}, // 5^-36
+  {0xd4ad2dbfc3d07787UL, 0x955e4ec64b44e864UL}, // 5^-35
+  {0x84ec3c97da624ab4UL, 0xbd5af13bef0b113eUL}, // 5^-34
+  {0xa6274bbdd0fadd61UL, 0xecb1ad8aeacdd58eUL}, // 5^-33
+  {0xcfb11ead453994baUL, 0x67de18eda5814af2UL}, // 5^-32
+  {0x81ceb32c4b43fcf4UL, 0x80eacf948770ced7UL}, // 5^-31
+  {0xa2425ff75e14fc31UL, 0xa1258379a94d028dUL}, // 5^-30
+  {0xcad2f7f5359a3b3eUL, 0x096ee45813a04330UL}, // 5^-29
+  {0xfd87b5f28300ca0dUL, 0x8bca9d6e188853fcUL}, // 5^-28
+  {0x9e74d1b791e07e48UL, 0x775ea264cf55347eUL}, // 5^-27
+  {0xc612062576589ddaUL, 0x95364afe032a819eUL}, // 5^-26
+  {0xf79687aed3eec551UL, 0x3a83ddbd83f52205UL}, // 5^-25
+  {0x9abe14cd44753b52UL, 0xc4926a9672793543UL}, // 5^-24
+  {0xc16d9a0095928a27UL, 0x75b7053c0f178294UL}, // 5^-23
+  {0xf1c90080baf72cb1UL, 0x5324c68b12dd6339UL}, // 5^-22
+  {0x971da05074da7beeUL, 0xd3f6fc16ebca5e04UL}, // 5^-21
+  {0xbce5086492111aeaUL, 0x88f4bb1ca6bcf585UL}, // 5^-20
+  {0xec1e4a7db69561a5UL, 0x2b31e9e3d06c32e6UL}, // 5^-19
+  {0x9392ee8e921d5d07UL, 0x3aff322e62439fd0UL}, // 5^-18
+  {0xb877aa3236a4b449UL, 0x09befeb9fad487c3UL}, // 5^-17
+  {0xe69594bec44de15bUL, 0x4c2ebe687989a9b4UL}, // 5^-16
+  {0x901d7cf73ab0acd9UL, 0x0f9d37014bf60a11UL}, // 5^-15
+  {0xb424dc35095cd80fUL, 0x538484c19ef38c95UL}, // 5^-14
+  {0xe12e13424bb40e13UL, 0x2865a5f206b06fbaUL}, // 5^-13
+  {0x8cbccc096f5088cbUL, 0xf93f87b7442e45d4UL}, // 5^-12
+  {0xafebff0bcb24aafeUL, 0xf78f69a51539d749UL}, // 5^-11
+  {0xdbe6fecebdedd5beUL, 0xb573440e5a884d1cUL}, // 5^-10
+  {0x89705f4136b4a597UL, 0x31680a88f8953031UL}, // 5^-9
+  {0xabcc77118461cefcUL, 0xfdc20d2b36ba7c3eUL}, // 5^-8
+  {0xd6bf94d5e57a42bcUL, 0x3d32907604691b4dUL}, // 5^-7
+  {0x8637bd05af6c69b5UL, 0xa63f9a49c2c1b110UL}, // 5^-6
+  {0xa7c5ac471b478423UL, 0x0fcf80dc33721d54UL}, // 5^-5
+  {0xd1b71758e219652bUL, 0xd3c36113404ea4a9UL}, // 5^-4
+  {0x83126e978d4fdf3bUL, 0x645a1cac083126eaUL}, // 5^-3
+  {0xa3d70a3d70a3d70aUL, 0x3d70a3d70a3d70a4UL}, // 5^-2
+  {0xccccccccccccccccUL, 0xcccccccccccccccdUL}, // 5^-1
+  {0x8000000000000000UL, 0x0000000000000000UL}, // 5^0
+  {0xa000000000000000UL, 0x0000000000000000UL}, // 5^1
+  {0xc800000000000000UL, 0x0000000000000000UL}, // 5^2
+  {0xfa00000000000000UL, 0x0000000000000000UL}, // 5^3
+  {0x9c40000000000000UL, 0x0000000000000000UL}, // 5^4
+  {0xc350000000000000UL, 0x0000000000000000UL}, // 5^5
+  {0xf424000000000000UL, 0x0000000000000000UL}, // 5^6
+  {0x9896800000000000UL, 0x0000000000000000UL}, // 5^7
+  {0xbebc200000000000UL, 0x0000000000000000UL}, // 5^8
+  {0xee6b280000000000UL, 0x0000000000000000UL}, // 5^9
+  {0x9502f90000000000UL, 0x0000000000000000UL}, // 5^10
+  {0xba43b74000000000UL, 0x0000000000000000UL}, // 5^11
+  {0xe8d4a51000000000UL, 0x0000000000000000UL}, // 5^12
+  {0x9184e72a00000000UL, 0x0000000000000000UL}, // 5^13
+  {0xb5e620f480000000UL, 0x0000000000000000UL}, // 5^14
+  {0xe35fa931a0000000UL, 0x0000000000000000UL}, // 5^15
+  {0x8e1bc9bf04000000UL, 0x0000000000000000UL}, // 5^16
+  {0xb1a2bc2ec5000000UL, 0x0000000000000000UL}, // 5^17
+  {0xde0b6b3a76400000UL, 0x0000000000000000UL}, // 5^18
+  {0x8ac7230489e80000UL, 0x0000000000000000UL}, // 5^19
+  {0xad78ebc5ac620000UL, 0x0000000000000000UL}, // 5^20
+  {0xd8d726b7177a8000UL, 0x0000000000000000UL}, // 5^21
+  {0x878678326eac9000UL, 0x0000000000000000UL}, // 5^22
+  {0xa968163f0a57b400UL, 0x0000000000000000UL}, // 5^23
+  {0xd3c21bcecceda100UL, 0x0000000000000000UL}, // 5^24
+  {0x84595161401484a0UL, 0x0000000000000000UL}, // 5^25
+  {0xa56fa5b99019a5c8UL, 0x0000000000000000UL}, // 5^26
+  {0xcecb8f27f4200f3aUL, 0x0000000000000000UL}, // 5^27
+  {0x813f3978f8940984UL, 0x4000000000000000UL}, // 5^28
+  {0xa18f07d736b90be5UL, 0x5000000000000000UL}, // 5^29
+  {0xc9f2c9cd04674edeUL, 0xa400000000000000UL}, // 5^30
+  {0xfc6f7c4045812296UL, 0x4d00000000000000UL}, // 5^31
+  {0x9dc5ada82b70b59dUL, 0xf020000000000000UL}, // 5^32
+  {0xc5371912364ce305UL, 0x6c28000000000000UL}, // 5^33
+  {0xf684df56c3e01bc6UL, 0xc732000000000000UL}, // 5^34
+  {0x9a130b963a6c115cUL, 0x3c7f400000000000UL}, // 5^35
+  {0xc097ce7bc90715b3UL, 0x4b9f100000000000UL}, // 5^36
+  {0xf0bdc21abb48db20UL, 0x1e86d40000000000UL}, // 5^37
+  {0x96769950b50d88f4UL, 0x1314448000000000UL}, // 5^38
+  {0xbc143fa4e250eb31UL, 0x17d955a000000000UL}, // 5^39
+  {0xeb194f8e1ae525fdUL, 0x5dcfab0800000000UL}, // 5^40
+};
+
+__extension__ typedef unsigned __int128 uint128;
+
+/**
+ * Eisel-Lemire, w * 10^q correctly rounded using the high bits of w
+ * times 5^q from pow5_128. Returns 0 when the truncated 5^q leaves the
+ * rounding ambiguous, then strtod has to decide.
+ */
+static int parse_eisel_lemire(unsigned long w, long q, int negative, double* out) {
+  if (w == 0) {
+    *out = negative ? -0.0 : 0.0;
+    return 1;
+  }
+  const unsigned long* pow5 = pow5_128[q - POW5_MIN_EXP10];
+  int lz = __builtin_clzl(w);
+  w <<= lz;
+
+  // 55 bits are kept, one more than the result and one to round with
+  uint128 product = (uint128)w * pow5[0];
+  unsigned long hi = (unsigned long)(product >> 64);
+  unsigned long lo = (unsigned long)product;
+  if ((hi & 0x1FF) == 0x1FF) {
+    // The dropped bits might carry into the kept ones, add the low half
+    unsigned long carry = (unsigned long)(((uint128)w * pow5[1]) >> 64);
+    lo += carry;
+    hi += lo < carry;
+    if ((lo == ~0UL) && ((q < -27) || (q > 55))) {
+      return 0;
+    }
+  }
+
+  unsigned long upper = hi >> 63;
+  unsigned long m = hi >> (upper + 9);
+  long power2 = (((152170 + 65536) * q) >> 16) + 63 + (long)upper - lz + 1023;
+
+  // Exactly half way ties to even, only possible where 5^q is exact
+  if ((lo <= 1) && (q >= -4) && (q <= 23) && ((m & 3) == 1)
+      && ((m << (upper + 9)) == hi)) {
+    m &= ~1UL;
+  }
+  m += m & 1;
+  m >>= 1;
+  if (m >= (2UL << 52)) {
+    m = 1UL << 52;
+    power2 += 1;
+  }
+  m &= ~(1UL << 52);
+
+  unsigned long bits = m | ((unsigned long)power2 << 52)
+      | ((unsigned long)negative << 63);
+  memcpy(out, &bits, sizeof(*out));
+  return 1;
+}
+
+static double now_secs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + ((double)ts.tv_nsec / 1.0e9);
+}
+
+static int is_separator(char c) {
+  return (c == ',') || (c == ' ') || (c == '\t') || (c == ';');
+}
+
+static int is_eol(char c) {
+  return (c == '\n') || (c == '\r');
+}
+
+/**
+ * Parse a double at p. Decimal numbers whose mantissa is below 2^53 and
+ * exponent within +-22 are exact as a product or quotient of two exactly
+ * representable doubles. Others of up to 19 significant digits, such as
+ * the 17 of %.17g, go to parse_eisel_lemire, anything else or an
+ * ambiguous rounding goes to strtod.
+ *
+ * @return the end of the number, or p if there isn't one
+ */
+static const char* parse_double(const char* p, const char* end, double* out) {
+  const char* start = p;
+  unsigned long mantissa = 0;
+  unsigned long digits = 0;
+  long exp10 = 0;
+  int negative = 0;
+  int any = 0;
+  int fast = 1;
+
+  if ((p < end) && ((*p == '-') || (*p == '+'))) {
+    negative = *p == '-';
+    p++;
+  }
+  for (; (p < end) && (*p >= '0') && (*p <= '9'); p++) {
+    any = 1;
+    if (digits < 19) {
+      mantissa = (mantissa * 10) + (unsigned long)(*p - '0');
+      digits += mantissa != 0;
+    } else {
+      fast = 0;
+    }
+  }
+  if ((p < end) && (*p == '.')) {
+    for (p++; (p < end) && (*p >= '0') && (*p <= '9'); p++) {
+      any = 1;
+      if (digits < 19) {
+        mantissa = (mantissa * 10) + (unsigned long)(*p - '0');
+        digits += mantissa != 0;
+        exp10 -= 1;
+      } else {
+        fast = 0;
+      }
+    }
+  }
+  if (any && (p < end) && ((*p == 'e') || (*p == 'E'))) {
+    const char* e = p + 1;
+    int exp_negative = 0;
+    long exp = 0;
+    if ((e < end) && ((*e == '-') || (*e == '+'))) {
+      exp_negative = *e == '-';
+      e++;
+    }
+    if ((e < end) && (*e >= '0') && (*e <= '9')) {
+      for (; (e < end) && (*e >= '0') && (*e <= '9'); e++) {
+        exp = exp < 100000 ? (exp * 10) + (*e - '0') : exp;
+      }
+      exp10 += exp_negative ? -exp : exp;
+      p = e;
+    }
+  }
+
+  int terminated = (p == end) || is_separator(*p) || is_eol(*p);
+  if (any && fast && terminated && (mantissa < MAX_FAST_MANTISSA)
+      && (exp10 >= -22) && (exp10 <= 22)) {
+    double value = (double)mantissa;
+    if (exp10 < 0) {
+      value /= pow10_exact[-exp10];
+    } else {
+      value *= pow10_exact[exp10];
+    }
+    *out = negative ? -value : value;
+    return p;
+  }
+  if (any && fast && terminated && (exp10 >= POW5_MIN_EXP10)
+      && (exp10 <= POW5_MAX_EXP10)
+      && parse_eisel_lemire(mantissa, exp10, negative, out)) {
+    return p;
+  }
+
+  // Too many digits, out of range, inf, nan, hex or garbage, strtod needs a
+  // terminated copy since the mapping isn't
+  char field[MAX_FALLBACK_FIELD];
+  unsigned long len = 0;
+  for (p = start; (p < end) && !is_separator(*p) && !is_eol(*p)
+      && (len < (MAX_FALLBACK_FIELD - 1)); p++) {
+    field[len++] = *p;
+  }
+  field[len] = 0;
+  char* field_end;
+  *out = strtod(field, &field_end);
+  return start + (field_end - field);
+}
+
+static void add_stat(NeuralNetCsvStats* stat, unsigned long n, double x) {
+  // Welford's update, n counts x
+  double delta = x - stat->mean;
+  stat->mean += delta / (double)n;
+  stat->m2 += delta * (x - stat->mean);
+  stat->min = x < stat->min ? x : stat->min;
+  stat->max = x > stat->max ? x : stat->max;
+}
+
+/** Merge the statistics of nb more values into a, which has na */
+static void merge_stat(NeuralNetCsvStats* a, unsigned long na,
+    NeuralNetCsvStats* b, unsigned long nb) {
+  if (nb == 0) {
+    return;
+  }
+  if (na == 0) {
+    *a = *b;
+    return;
+  }
+  double n = (double)(na + nb);
+  double delta = b->mean - a->mean;
+  a->mean += delta * ((double)nb / n);
+  a->m2 += b->m2 + (delta * delta * (((double)na * (double)nb) / n));
+  a->min = b->min < a->min ? b->min : a->min;
+  a->max = b->max > a->max ? b->max : a->max;
+}
+
+static double* chunk_row(Chunk* c) {
+  unsigned long cols = c->loader->data->cols;
+  if (c->rows == c->cap) {
+    unsigned long cap = (c->cap == 0) ? 1024 : c->cap * 2;
+    double* values = realloc(c->values, cap * cols * sizeof(double));
+    if (values == NULL) {
+      return NULL;
+    }
+    c->values = values;
+    c->cap = cap;
+  }
+  return &c->values[c->rows * cols];
+}
+
+static void parse_chunk(void* arg, unsigned long worker) {
+  Chunk* c = arg;
+  Loader* ld = c->loader;
+  unsigned long cols = ld->data->cols;
+  const char* base = ld->base;
+  const char* file_end = base + ld->size;
+  const char* p = base + c->begin;
+  const char* end = base + c->end;
+  unused(worker);
+
+  // A line straddling begin belongs to the previous chunk
+  if ((c->begin == 0) ? ld->spec->header : (base[c->begin - 1] != '\n')) {
+    while ((p < file_end) && (*p != '\n')) {
+      p++;
+    }
+    p += p < file_end;
+  }
+
+  c->status = STATUS_OK;
+  while (p < end) {
+    const char* line = p;
+    double* row = chunk_row(c);
+    if (row == NULL) {
+      c->status = STATUS_OOM;
+      return;
+    }
+
+    unsigned long fields = 0;
+    int bad = 0;
+    for (;;) {
+      while ((p < file_end) && is_separator(*p)) {
+        p++;
+      }
+      if ((p == file_end) || is_eol(*p)) {
+        break;
+      }
+      double value;
+      const char* next = parse_double(p, file_end, &value);
+      if ((next == p) || (fields == cols)
+          || ((next < file_end) && !is_separator(*next) && !is_eol(*next))) {
+        bad = 1;
+        break;
+      }
+      row[fields++] = value;
+      p = next;
+    }
+
+    // Blank lines are skipped, anything else short or long is an error
+    if (bad || ((fields != 0) && (fields != cols))) {
+      c->status = STATUS_ERR;
+      c->err_offset = (unsigned long)(line - base);
+      return;
+    }
+    if (fields == cols) {
+      c->rows += 1;
+      for (unsigned long i = 0; i < cols; i++) {
+        add_stat(&c->stats[i], c->rows, row[i]);
+      }
+    }
+
+    while ((p < file_end) && (*p == '\r')) {
+      p++;
+    }
+    p += (p < file_end) && (*p == '\n');
+  }
+}
+
+static void normalize_chunk(void* arg, unsigned long worker) {
+  Chunk* c = arg;
+  NeuralNetCsvData* data = c->loader->data;
+  unsigned long cols = data->cols;
+  double* dst = &data->values[c->first_row * cols];
+  unused(worker);
+
+  memcpy(dst, c->values, c->rows * cols * sizeof(double));
+  if (data->normalize == NEURAL_NET_CSV_NORM_NONE) {
+    return;
+  }
+
+  for (unsigned long r = 0; r < c->rows; r++, dst += cols) {
+    for (unsigned long i = 0; i < data->input_count; i++) {
+      NeuralNetCsvStats* stat = &data->stats[i];
+      if (data->normalize == NEURAL_NET_CSV_NORM_ZSCORE) {
+        dst[i] = (stat->stddev > 0.0) ? (dst[i] - stat->mean) / stat->stddev : 0.0;
+      } else {
+        double range = stat->max - stat->min;
+        dst[i] = (range > 0.0) ? (dst[i] - stat->min) / range : 0.0;
+      }
+    }
+  }
+}
+
+static void data_deinit(NeuralNetCsvData* data) {
+  free(data->values);
+  free(data->stats);
+  data->values = NULL;
+  data->stats = NULL;
+  data->rows = 0;
+}
+
+Status NeuralNetCsv_load(NeuralNetCsvData* data, char* path, NeuralNetCsvSpec* spec) {
+  Status status;
+  ThreadPool pool;
+  Loader loader;
+  Chunk* chunks = NULL;
+  unsigned long chunk_count = 0;
+  void* map = MAP_FAILED;
+  int pool_started = 0;
+  int fd = -1;
+
+  dbg("NeuralNetCsv_load:+%p path=%s\n", (void*)data, path);
+
+  double start = now_secs();
+  memset(data, 0, sizeof(*data));
+  data->input_count = spec->input_count;
+  data->target_count = spec->target_count;
+  data->cols = spec->input_count + spec->target_count;
+  data->normalize = spec->normalize;
+  data->deinit = data_deinit;
+
+  if ((data->cols == 0) || (spec->normalize > NEURAL_NET_CSV_NORM_MINMAX)) {
+    status = STATUS_BAD_PARAM;
+    goto done;
+  }
+
+  fd = open(path, O_RDONLY);
+  struct stat st;
+  if ((fd < 0) || (fstat(fd, &st) != 0)) {
+    printf("NeuralNetCsv_load: could not open '%s' err=%s\n", path, strerror(errno));
+    status = STATUS_ERR;
+    goto done;
+  }
+  data->bytes = (unsigned long)st.st_size;
+  if (data->bytes != 0) {
+    map = mmap(NULL, data->bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      status = STATUS_OOM;
+      goto done;
+    }
+    madvise(map, data->bytes, MADV_SEQUENTIAL);
+  }
+
+  data->stats = calloc(data->cols, sizeof(NeuralNetCsvStats));
+  if (data->stats == NULL) {
+    status = STATUS_OOM;
+    goto done;
+  }
+
+  loader.data = data;
+  loader.spec = spec;
+  loader.base = (map == MAP_FAILED) ? "" : map;
+  loader.size = data->bytes;
+
+  unsigned long chunk_bytes = spec->chunk_bytes ? spec->chunk_bytes : NEURAL_NET_CSV_CHUNK_BYTES;
+  chunk_count = (data->bytes + chunk_bytes - 1) / chunk_bytes;
+  chunk_count = chunk_count ? chunk_count : 1;
+  chunks = calloc(chunk_count, sizeof(Chunk));
+  if (chunks == NULL) {
+    status = STATUS_OOM;
+    goto done;
+  }
+  data->chunks = chunk_count;
+
+  status = ThreadPool_init(&pool, spec->workers);
+  if (StatusErr(status)) goto done;
+  pool_started = 1;
+
+  for (unsigned long i = 0; i < chunk_count; i++) {
+    Chunk* c = &chunks[i];
+    c->loader = &loader;
+    c->begin = i * chunk_bytes;
+    c->end = (i + 1) * chunk_bytes;
+    c->end = c->end < data->bytes ? c->end : data->bytes;
+    c->stats = calloc(data->cols, sizeof(NeuralNetCsvStats));
+    if (c->stats == NULL) {
+      status = STATUS_OOM;
+      goto done;
+    }
+    status = pool.submit(&pool, parse_chunk, c);
+    if (StatusErr(status)) goto done;
+  }
+  pool.wait(&pool);
+
+  // Merge the chunks' statistics in file order and place their rows
+  for (unsigned long i = 0; i < chunk_count; i++) {
+    Chunk* c = &chunks[i];
+    if (StatusErr(c->status)) {
+      if (c->status == STATUS_ERR) {
+        printf("NeuralNetCsv_load: '%s' expected %ld fields in the line at byte %ld\n",
+            path, data->cols, c->err_offset);
+      }
+      status = c->status;
+      goto done;
+    }
+    for (unsigned long col = 0; col < data->cols; col++) {
+      merge_stat(&data->stats[col], data->rows, &c->stats[col], c->rows);
+    }
+    c->first_row = data->rows;
+    data->rows += c->rows;
+  }
+  for (unsigned long col = 0; col < data->cols; col++) {
+    NeuralNetCsvStats* stat = &data->stats[col];
+    stat->stddev = data->rows ? sqrt(stat->m2 / (double)data->rows) : 0.0;
+  }
+
+  data->values = calloc(data->rows * data->cols, sizeof(double));
+  if ((data->values == NULL) && (data->rows != 0)) {
+    status = STATUS_OOM;
+    goto done;
+  }
+  for (unsigned long i = 0; i < chunk_count; i++) {
+    status = pool.submit(&pool, normalize_chunk, &chunks[i]);
+    if (StatusErr(status)) goto done;
+  }
+  pool.wait(&pool);
+
+  data->parse_secs = now_secs() - start;
+  status = STATUS_OK;
+
+done:
+  if (pool_started) {
+    pool.wait(&pool);
+    pool.deinit(&pool);
+  }
+  if (chunks != NULL) {
+    for (unsigned long i = 0; i < chunk_count; i++) {
+      free(chunks[i].values);
+      free(chunks[i].stats);
+    }
+    free(chunks);
+  }
+  if (map != MAP_FAILED) {
+    munmap(map, data->bytes);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (StatusErr(status)) {
+    data_deinit(data);
+  }
+  dbg("NeuralNetCsv_load:-%p status=%d rows=%ld\n", (void*)data, StatusVal(status), data->rows);
+  return status;
+}
+
+// Batcher
+
+static void shuffle_rows(NeuralNetCsvBatcher* batcher) {
+  unsigned long rows = batcher->data->rows;
+  for (unsigned long p = 0; p < rows; p++) {
+    batcher->perm[p] = (unsigned int)p;
+  }
+  if (!batcher->shuffle) {
+    return;
+  }
+  for (unsigned long p = 0; p < rows; p++) {
+    unsigned long rp = p + (unsigned long)(rand0_1() * (double)(rows - p));
+    unsigned int t = batcher->perm[p];
+    batcher->perm[p] = batcher->perm[rp];
+    batcher->perm[rp] = t;
+  }
+}
+
+static void fill_batch(NeuralNetCsvBatcher* batcher, NeuralNetCsvBatch* batch) {
+  NeuralNetCsvData* data = batcher->data;
+
+  if (batcher->pos == data->rows) {
+    batcher->pos = 0;
+    batcher->epoch += 1;
+    shuffle_rows(batcher);
+  }
+
+  unsigned long count = data->rows - batcher->pos;
+  count = count < batcher->batch_size ? count : batcher->batch_size;
+  for (unsigned long i = 0; i < count; i++) {
+    double* row = &data->values[batcher->perm[batcher->pos + i] * data->cols];
+    memcpy(batch->inputs[i]->data, row, data->input_count * sizeof(double));
+    memcpy(batch->targets[i]->data, &row[data->input_count],
+        data->target_count * sizeof(double));
+  }
+  batch->count = count;
+  batch->epoch = batcher->epoch;
+  batcher->pos += count;
+}
+
+static void* prefetch_thread(void* arg) {
+  NeuralNetCsvBatcher* batcher = arg;
+  unsigned long fill = 0;
+
+  rand0_1_seed((unsigned int)batcher->seed);
+  shuffle_rows(batcher);
+
+  pthread_mutex_lock(&batcher->lock);
+  for (;;) {
+    while (batcher->batches[fill].filled && !batcher->quit) {
+      pthread_cond_wait(&batcher->cond, &batcher->lock);
+    }
+    if (batcher->quit) {
+      break;
+    }
+    pthread_mutex_unlock(&batcher->lock);
+
+    fill_batch(batcher, &batcher->batches[fill]);
+
+    pthread_mutex_lock(&batcher->lock);
+    batcher->batches[fill].filled = 1;
+    pthread_cond_broadcast(&batcher->cond);
+    fill ^= 1;
+  }
+  pthread_mutex_unlock(&batcher->lock);
+
+  return NULL;
+}
+
+static NeuralNetCsvBatch* next_batch(NeuralNetCsvBatcher* batcher) {
+  pthread_mutex_lock(&batcher->lock);
+  if (batcher->held) {
+    // Hand the previous batch back to be refilled
+    batcher->batches[batcher->current].filled = 0;
+    batcher->current ^= 1;
+    pthread_cond_broadcast(&batcher->cond);
+  }
+  if (!batcher->batches[batcher->current].filled) {
+    batcher->waits += 1;
+    while (!batcher->batches[batcher->current].filled) {
+      pthread_cond_wait(&batcher->cond, &batcher->lock);
+    }
+  }
+  batcher->held = 1;
+  NeuralNetCsvBatch* batch = &batcher->batches[batcher->current];
+  pthread_mutex_unlock(&batcher->lock);
+
+  return batch;
+}
+
+static void batcher_deinit(NeuralNetCsvBatcher* batcher) {
+  dbg("NeuralNetCsvBatcher.deinit:+%p\n", (void*)batcher);
+
+  if (batcher->started) {
+    pthread_mutex_lock(&batcher->lock);
+    batcher->quit = 1;
+    pthread_cond_broadcast(&batcher->cond);
+    pthread_mutex_unlock(&batcher->lock);
+    pthread_join(batcher->thread, NULL);
+    batcher->started = 0;
+    pthread_cond_destroy(&batcher->cond);
+    pthread_mutex_destroy(&batcher->lock);
+  }
+  for (unsigned long b = 0; b < 2; b++) {
+    NeuralNetCsvBatch* batch = &batcher->batches[b];
+    for (unsigned long i = 0; (batch->inputs != NULL) && (i < batcher->batch_size); i++) {
+      free(batch->inputs[i]);
+      free(batch->targets[i]);
+    }
+    free(batch->inputs);
+    free(batch->targets);
+    batch->inputs = NULL;
+    batch->targets = NULL;
+  }
+  free(batcher->perm);
+  batcher->perm = NULL;
+
+  dbg("NeuralNetCsvBatcher.deinit:-%p\n", (void*)batcher);
+}
+
+Status NeuralNetCsvBatcher_init(NeuralNetCsvBatcher* batcher,
+    NeuralNetCsvData* data, unsigned long batch_size, unsigned long shuffle,
+    unsigned long seed) {
+  Status status;
+
+  dbg("NeuralNetCsvBatcher_init:+%p rows=%ld batch_size=%ld\n",
+      (void*)batcher, data->rows, batch_size);
+
+  memset(batcher, 0, sizeof(*batcher));
+  batcher->data = data;
+  batcher->batch_size = batch_size;
+  batcher->shuffle = shuffle;
+  batcher->seed = seed;
+  batcher->deinit = batcher_deinit;
+  batcher->next = next_batch;
+
+  if ((batch_size == 0) || (data->rows == 0)) {
+    status = STATUS_BAD_PARAM;
+    goto done;
+  }
+
+  batcher->perm = calloc(data->rows, sizeof(unsigned int));
+  if (batcher->perm == NULL) {
+    status = STATUS_OOM;
+    goto done;
+  }
+  for (unsigned long b = 0; b < 2; b++) {
+    NeuralNetCsvBatch* batch = &batcher->batches[b];
+    batch->inputs = calloc(batch_size, sizeof(Pattern*));
+    batch->targets = calloc(batch_size, sizeof(Pattern*));
+    if ((batch->inputs == NULL) || (batch->targets == NULL)) {
+      status = STATUS_OOM;
+      goto done;
+    }
+    for (unsigned long i = 0; i < batch_size; i++) {
+      batch->inputs[i] = Pattern_create(data->input_count);
+      batch->targets[i] = Pattern_create(data->target_count);
+      if ((batch->inputs[i] == NULL) || (batch->targets[i] == NULL)) {
+        status = STATUS_OOM;
+        goto done;
+      }
+    }
+  }
+
+  pthread_mutex_init(&batcher->lock, NULL);
+  pthread_cond_init(&batcher->cond, NULL);
+  if (pthread_create(&batcher->thread, NULL, prefetch_thread, batcher) != 0) {
+    pthread_cond_destroy(&batcher->cond);
+    pthread_mutex_destroy(&batcher->lock);
+    status = STATUS_ERR;
+    goto done;
+  }
+  batcher->started = 1;
+
+  status = STATUS_OK;
+
+done:
+  if (StatusErr(status)) {
+    batcher_deinit(batcher);
+  }
+  dbg("NeuralNetCsvBatcher_init:-%p status=%d\n", (void*)batcher, StatusVal(status));
+  return status;
+}
@@ -0,0 +1,280 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "NeuralNet.h"
+#include "NeuralNetDelta.h"
+#include "dbg.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+static double sigmoid(double x) {
+  return 1.0 / (1.0 + exp(-x));
+}
+
+/** sums += column * d for each of the count changes */
+static void apply_columns(NeuralNetDelta* delta, unsigned long l, unsigned long count) {
+  unsigned long neurons = delta->counts[l];
+  double* sums = delta->sums[l];
+
+  for (unsigned long k = 0; k < count; k++) {
+    double* column = &delta->columns[l][(delta->changed[k] + 1) * neurons];
+    double d = delta->deltas[k];
+    for (unsigned long n = 0; n < neurons; n++) {
+      sums[n] += column[n] * d;
+    }
+  }
+  delta->counters.updates += count;
+  delta->counters.macs += count * neurons;
+}
+
+/** The output layer's outputs from its sums */
+static void finish(NeuralNetDelta* delta) {
+  unsigned long count = delta->counts[delta->out_layer];
+  double* sums = delta->sums[delta->out_layer];
+  double* outputs = delta->outputs;
+
+  if (delta->output_type == NEURAL_NET_OUTPUT_SOFTMAX) {
+    double max = sums[0];
+    for (unsigned long n = 1; n < count; n++) {
+      max = sums[n] > max ? sums[n] : max;
+    }
+    double sum = 0.0;
+    for (unsigned long n = 0; n < count; n++) {
+      outputs[n] = exp(sums[n] - max);
+      sum += outputs[n];
+    }
+    double scale = 1.0 / sum;
+    for (unsigned long n = 0; n < count; n++) {
+      outputs[n] *= scale;
+    }
+  } else {
+    for (unsigned long n = 0; n < count; n++) {
+      outputs[n] = sigmoid(sums[n]);
+    }
+  }
+}
+
+static void copy_outputs(NeuralNetDelta* delta, Pattern* output) {
+  unsigned long count = delta->counts[delta->out_layer];
+  for (unsigned long n = 0; (n < count) && (n < output->count); n++) {
+    output->data[n] = delta->outputs[n];
+  }
+}
+
+static void full(NeuralNetDelta* delta, Pattern* input, Pattern* output) {
+  for (unsigned long i = 0; i < delta->counts[0]; i++) {
+    delta->seen[0][i] = input->data[i];
+  }
+
+  // Same order of summation as NeuralNet process, the bias then each input
+  for (unsigned long l = 1; l <= delta->out_layer; l++) {
+    unsigned long neurons = delta->counts[l];
+    unsigned long inputs = delta->counts[l - 1];
+    double* sums = delta->sums[l];
+    double* in = delta->seen[l - 1];
+
+    memcpy(sums, delta->columns[l], neurons * sizeof(double));
+    for (unsigned long i = 0; i < inputs; i++) {
+      double* column = &delta->columns[l][(i + 1) * neurons];
+      for (unsigned long n = 0; n < neurons; n++) {
+        sums[n] += column[n] * in[i];
+      }
+    }
+    delta->counters.macs += inputs * neurons;
+    if (l < delta->out_layer) {
+      for (unsigned long n = 0; n < neurons; n++) {
+        delta->seen[l][n] = sigmoid(sums[n]);
+      }
+    }
+  }
+  finish(delta);
+  copy_outputs(delta, output);
+
+  delta->since_full = 1;
+  delta->counters.full += 1;
+}
+
+static void process(NeuralNetDelta* delta, Pattern* input, Pattern* output) {
+  delta->counters.queries += 1;
+  delta->counters.full_macs += delta->full_macs;
+
+  if ((delta->since_full == 0)
+      || ((delta->refresh != 0) && (delta->since_full >= delta->refresh))) {
+    full(delta, input, output);
+    return;
+  }
+  delta->since_full += 1;
+
+  // Changed inputs
+  unsigned long count = 0;
+  for (unsigned long i = 0; i < delta->counts[0]; i++) {
+    double d = input->data[i] - delta->seen[0][i];
+    if (fabs(d) > 0.0) {
+      delta->changed[count] = i;
+      delta->deltas[count] = d;
+      delta->seen[0][i] = input->data[i];
+      count += 1;
+    }
+  }
+
+  // Pass the changes forward until a layer's outputs settle
+  for (unsigned long l = 1; (l <= delta->out_layer) && (count > 0); l++) {
+    apply_columns(delta, l, count);
+    if (l == delta->out_layer) {
+      finish(delta);
+      break;
+    }
+
+    count = 0;
+    for (unsigned long n = 0; n < delta->counts[l]; n++) {
+      double d = sigmoid(delta->sums[l][n]) - delta->seen[l][n];
+      if (fabs(d) > delta->epsilon) {
+        delta->changed[count] = n;
+        delta->deltas[count] = d;
+        delta->seen[l][n] += d;
+        count += 1;
+      } else if (fabs(d) > 0.0) {
+        delta->counters.suppressed += 1;
+      }
+    }
+  }
+  copy_outputs(delta, output);
+}
+
+static Status sync(NeuralNetDelta* delta) {
+  NeuralNet* nn = delta->nn;
+
+  dbg("NeuralNetDelta_sync:+%p\n", (void*)delta);
+
+  for (unsigned long l = 1; l <= delta->out_layer; l++) {
+    NeuronLayer* layer = &nn->layers[l];
+    unsigned long neurons = delta->counts[l];
+    unsigned long cols = delta->counts[l - 1] + 1;
+    for (unsigned long n = 0; n < neurons; n++) {
+      for (unsigned long i = 0; i < cols; i++) {
+        delta->columns[l][(i * neurons) + n] = NeuronLayer_weight(layer, n, i);
+      }
+    }
+  }
+  delta->since_full = 0;
+
+  dbg("NeuralNetDelta_sync:-%p\n", (void*)delta);
+  return STATUS_OK;
+}
+
+static void stats(NeuralNetDelta* delta, NeuralNetDeltaStats* stats) {
+  *stats = delta->counters;
+}
+
+static void deinit(NeuralNetDelta* delta) {
+  dbg("NeuralNetDelta_deinit:+%p\n", (void*)delta);
+
+  for (unsigned long l = 0; l <= delta->out_layer; l++) {
+    if (delta->columns != NULL) free(delta->columns[l]);
+    if (delta->sums != NULL) free(delta->sums[l]);
+    if (delta->seen != NULL) free(delta->seen[l]);
+  }
+  free(delta->columns);
+  free(delta->sums);
+  free(delta->seen);
+  free(delta->counts);
+  free(delta->outputs);
+  free(delta->deltas);
+  free(delta->changed);
+  delta->columns = NULL;
+  delta->sums = NULL;
+  delta->seen = NULL;
+  delta->counts = NULL;
+  delta->outputs = NULL;
+  delta->deltas = NULL;
+  delta->changed = NULL;
+
+  dbg("NeuralNetDelta_deinit:-%p\n", (void*)delta);
+}
+
+Status NeuralNetDelta_init(NeuralNetDelta* delta, NeuralNet* nn,
+    double epsilon, unsigned long refresh) {
+  Status status;
+
+  dbg("NeuralNetDelta_init:+%p nn=%p epsilon=%lf refresh=%ld\n", (void*)delta,
+      (void*)nn, epsilon, refresh);
+
+  memset(delta, 0, sizeof(*delta));
+  delta->nn = nn;
+  delta->epsilon = epsilon;
+  delta->refresh = refresh;
+  delta->out_layer = nn->out_layer;
+  delta->output_type = nn->output_type;
+  delta->deinit = deinit;
+  delta->sync = sync;
+  delta->process = process;
+  delta->full = full;
+  delta->stats = stats;
+
+  if ((nn->layers == NULL) || (nn->out_layer == 0) || (epsilon < 0.0)) {
+    status = STATUS_BAD_PARAM;
+    goto done;
+  }
+
+  unsigned long layers = nn->out_layer + 1;
+  delta->counts = calloc(layers, sizeof(unsigned long));
+  delta->columns = calloc(layers, sizeof(double*));
+  delta->sums = calloc(layers, sizeof(double*));
+  delta->seen = calloc(layers, sizeof(double*));
+  if ((delta->counts == NULL) || (delta->columns == NULL)
+      || (delta->sums == NULL) || (delta->seen == NULL)) {
+    status = STATUS_OOM;
+    goto done;
+  }
+
+  unsigned long max_width = 0;
+  for (unsigned long l = 0; l < layers; l++) {
+    unsigned long count = nn->layers[l].count;
+    delta->counts[l] = count;
+    max_width = count > max_width ? count : max_width;
+    delta->seen[l] = calloc(count, sizeof(double));
+    if (delta->seen[l] == NULL) { status = STATUS_OOM; goto done; }
+    if (l == 0) {
+      continue;
+    }
+    delta->full_macs += count * nn->layers[l - 1].count;
+    delta->columns[l] = calloc((nn->layers[l - 1].count + 1) * count, sizeof(double));
+    delta->sums[l] = calloc(count, sizeof(double));
+    if ((delta->columns[l] == NULL) || (delta->sums[l] == NULL)) {
+      status = STATUS_OOM;
+      goto done;
+    }
+  }
+  delta->outputs = calloc(delta->counts[nn->out_layer], sizeof(double));
+  delta->deltas = calloc(max_width, sizeof(double));
+  delta->changed = calloc(max_width, sizeof(unsigned long));
+  if ((delta->outputs == NULL) || (delta->deltas == NULL) || (delta->changed == NULL)) {
+    status = STATUS_OOM;
+    goto done;
+  }
+
+  status = delta->sync(delta);
+
+done:
+  if (StatusErr(status)) {
+    deinit(delta);
+  }
+  dbg("NeuralNetDelta_init:-%p status=%d\n", (void*)delta, StatusVal(status));
+  return status;
+}
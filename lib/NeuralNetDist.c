@@ -0,0 +1,598 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "NeuralNet.h"
+#include "NeuralNetDist.h"
+#include "NeuralNetHalf.h"
+#include "NeuralNetSkip.h"
+#include "NeuralNetTrain.h"
+#include "dbg.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define DIST_ALIGN 64
+
+/** Spins before a rank sleeps on the barrier's futex */
+#define DIST_SPINS 256
+
+static unsigned long round_up(unsigned long value, unsigned long align) {
+  return (value + align - 1) & ~(align - 1);
+}
+
+/**
+ * Fill offsets with where each weighted layer's gradient starts and
+ * return the total, 0 if nn has a layer that isn't dense and double.
+ */
+static unsigned long layer_offsets(NeuralNet* nn, unsigned long* offsets) {
+  unsigned long params = 0;
+
+  for (unsigned long l = 1; l <= nn->out_layer; l++) {
+    NeuronLayer* layer = &nn->layers[l];
+    if ((layer->conv != NULL) || (layer->half != NULL) || (layer->sparse != NULL)
+        || (layer->mask != NULL)) {
+      return 0;
+    }
+    if (offsets != NULL) {
+      offsets[l - 1] = params;
+    }
+    params += layer->count * (nn->layers[l-1].count + 1);
+  }
+  if (offsets != NULL) {
+    offsets[nn->out_layer] = params;
+  }
+  return params;
+}
+
+static unsigned long payload_bytes(unsigned long compress, unsigned long params,
+    unsigned long top_k) {
+  switch (compress) {
+    case NEURAL_NET_DIST_FP16: return params * sizeof(uint16_t);
+    case NEURAL_NET_DIST_TOPK: return top_k * sizeof(NeuralNetDistPair);
+    default: return params * sizeof(double);
+  }
+}
+
+static NeuralNetDistSlot* slot_at(NeuralNetDistHeader* h, unsigned long rank) {
+  char* base = (char*)h + h->slot_offset;
+  return (NeuralNetDistSlot*)(void*)(base + (rank * h->slot_bytes));
+}
+
+static double* result_at(NeuralNetDistHeader* h) {
+  return (double*)(void*)((char*)h + h->result_offset);
+}
+
+static void futex_wait(atomic_uint* word, unsigned int value) {
+  syscall(SYS_futex, (void*)(uintptr_t)word, FUTEX_WAIT, value, NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_uint* word) {
+  syscall(SYS_futex, (void*)(uintptr_t)word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/**
+ * Wait for every rank to arrive. The last one to arrive resets the
+ * count and opens the barrier by bumping generation, the others spin
+ * a little then sleep on generation until it changes.
+ */
+static void barrier(NeuralNetDistHeader* h) {
+  unsigned int gen = atomic_load_explicit(&h->generation, memory_order_acquire);
+  unsigned int arrived = atomic_fetch_add_explicit(&h->arrived, 1, memory_order_acq_rel) + 1;
+
+  if (arrived == h->ranks) {
+    atomic_store_explicit(&h->arrived, 0, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->generation, 1, memory_order_release);
+    futex_wake(&h->generation);
+    return;
+  }
+  for (unsigned long spins = 0; spins < DIST_SPINS; spins++) {
+    if (atomic_load_explicit(&h->generation, memory_order_acquire) != gen) {
+      return;
+    }
+    atomic_signal_fence(memory_order_seq_cst);
+  }
+  while (atomic_load_explicit(&h->generation, memory_order_acquire) == gen) {
+    futex_wait(&h->generation, gen);
+  }
+}
+
+/** The first of the params reduced by rank */
+static unsigned long chunk_start(NeuralNetDist* dist, unsigned long rank) {
+  return (dist->params * rank) / dist->ranks;
+}
+
+static void swap(double* a, double* b) {
+  double t = *a;
+  *a = *b;
+  *b = t;
+}
+
+/** The k'th largest of the count values, 1 <= k <= count, reorders values */
+static double kth_largest(double* values, unsigned long count, unsigned long k) {
+  unsigned long lo = 0;
+  unsigned long hi = count - 1;
+  unsigned long want = k - 1;
+
+  while (lo < hi) {
+    // Median of three pivot, then partition into >= pivot and < pivot
+    unsigned long mid = lo + ((hi - lo) / 2);
+    if (values[mid] > values[lo]) swap(&values[mid], &values[lo]);
+    if (values[hi] > values[lo]) swap(&values[hi], &values[lo]);
+    if (values[mid] > values[hi]) swap(&values[mid], &values[hi]);
+    double pivot = values[hi];
+    unsigned long store = lo;
+    for (unsigned long i = lo; i < hi; i++) {
+      if (values[i] > pivot) {
+        swap(&values[i], &values[store]);
+        store += 1;
+      }
+    }
+    swap(&values[store], &values[hi]);
+    if (store == want) {
+      break;
+    } else if (store < want) {
+      lo = store + 1;
+    } else {
+      hi = store - 1;
+    }
+  }
+  return values[want];
+}
+
+/** Add the gradient of one sample to dist->grads, returns its loss */
+static double accumulate(NeuralNetDist* dist, Pattern* input, Pattern* target) {
+  NeuralNet* nn = dist->nn;
+  Pattern* output = dist->output;
+  NeuronLayer* out_layer = &nn->layers[nn->out_layer];
+  double error = 0.0;
+
+  nn->set_inputs(nn, input);
+  nn->process(nn);
+  nn->get_outputs(nn, output);
+
+  // The output layer's pd_error, the same as adjust_weights
+  for (unsigned long n = 0; n < out_layer->count; n++) {
+    double y = target->data[n];
+    if (nn->logits != NULL) {
+      out_layer->neurons[n].pd_error = y - output->data[n];
+      error += y * (nn->lse - nn->logits[n]);
+    } else {
+      double err = y - output->data[n];
+      out_layer->neurons[n].pd_error = err * output->data[n] * (1.0 - output->data[n]);
+      error += 0.5 * err * err;
+    }
+  }
+
+  // Back propagate the pd_error to the hidden layers
+  for (unsigned long l = nn->out_layer; l > 1; l--) {
+    NeuronLayer* cur_layer = &nn->layers[l];
+    NeuronLayer* prev_layer = &nn->layers[l-1];
+    for (unsigned long npl = 0; npl < prev_layer->count; npl++) {
+      double sum_weighted_pd_err = 0.0;
+      for (unsigned long ncl = 0; ncl < cur_layer->count; ncl++) {
+        sum_weighted_pd_err += cur_layer->neurons[ncl].pd_error
+          * cur_layer->neurons[ncl].weights[npl + 1];
+      }
+      double prev_out = prev_layer->neurons[npl].output;
+      prev_layer->neurons[npl].pd_error = sum_weighted_pd_err * prev_out * (1.0 - prev_out);
+    }
+  }
+
+  // Sum the gradient, it's applied once every rank's is in
+  for (unsigned long l = 1; l <= nn->out_layer; l++) {
+    NeuronLayer* layer = &nn->layers[l];
+    Neuron* inputs = nn->layers[l-1].neurons;
+    unsigned long in_count = nn->layers[l-1].count;
+    double* g = &dist->grads[dist->offsets[l - 1]];
+    for (unsigned long n = 0; n < layer->count; n++, g += in_count + 1) {
+      double pd_err = layer->neurons[n].pd_error;
+      g[0] += pd_err;
+      for (unsigned long i = 0; i < in_count; i++) {
+        g[i + 1] += pd_err * inputs[i].output;
+      }
+    }
+  }
+
+  return error;
+}
+
+/** Write this rank's gradient to its slot, compressed if asked */
+static void publish(NeuralNetDist* dist, double loss, unsigned long samples) {
+  NeuralNetDistHeader* h = dist->header;
+  NeuralNetDistSlot* slot = slot_at(h, dist->rank);
+  double* grads = dist->grads;
+  unsigned long params = dist->params;
+
+  slot->loss = loss;
+  slot->samples = samples;
+  slot->scale = 1.0;
+  slot->count = 0;
+
+  if (h->compress == NEURAL_NET_DIST_NONE) {
+    memcpy(slot + 1, grads, params * sizeof(double));
+    return;
+  }
+
+  // Add what previous steps didn't send
+  for (unsigned long j = 0; j < params; j++) {
+    grads[j] += dist->residuals[j];
+  }
+
+  if (h->compress == NEURAL_NET_DIST_FP16) {
+    // Scale to [-1, 1] so the largest values keep the most precision
+    uint16_t* halves = (uint16_t*)(void*)(slot + 1);
+    double max = 0.0;
+    for (unsigned long j = 0; j < params; j++) {
+      max = fabs(grads[j]) > max ? fabs(grads[j]) : max;
+    }
+    double scale = (max > 0.0) ? max : 1.0;
+    slot->scale = scale;
+    for (unsigned long j = 0; j < params; j++) {
+      halves[j] = NeuronLayerHalf_to_fp16((float)(grads[j] / scale));
+      dist->residuals[j] = grads[j] - (scale * (double)NeuronLayerHalf_from_fp16(halves[j]));
+    }
+    return;
+  }
+
+  // Keep the top_k magnitudes then ties in index order
+  NeuralNetDistPair* pairs = (NeuralNetDistPair*)(void*)(slot + 1);
+  unsigned long top_k = h->top_k;
+  for (unsigned long j = 0; j < params; j++) {
+    dist->mags[j] = fabs(grads[j]);
+  }
+  double kth = kth_largest(dist->mags, params, top_k);
+  unsigned long above = 0;
+  for (unsigned long j = 0; j < params; j++) {
+    above += fabs(grads[j]) > kth;
+  }
+  unsigned long ties = top_k - above;
+  unsigned long count = 0;
+  for (unsigned long j = 0; j < params; j++) {
+    double a = fabs(grads[j]);
+    int keep = (a > kth) || ((ties > 0) && !(a < kth));
+    if (keep && !(a > kth)) {
+      ties -= 1;
+    }
+    if (keep && (a > 0.0)) {
+      pairs[count].index = (uint32_t)j;
+      pairs[count].value = (float)grads[j];
+      dist->residuals[j] = grads[j] - (double)pairs[count].value;
+      count += 1;
+    } else {
+      dist->residuals[j] = grads[j];
+    }
+  }
+  slot->count = count;
+}
+
+/** Sum this rank's chunk of every slot, in rank order, into the result */
+static void reduce_chunk(NeuralNetDist* dist) {
+  NeuralNetDistHeader* h = dist->header;
+  double* result = result_at(h);
+  unsigned long lo = chunk_start(dist, dist->rank);
+  unsigned long hi = chunk_start(dist, dist->rank + 1);
+
+  memset(&result[lo], 0, (hi - lo) * sizeof(double));
+  for (unsigned long r = 0; r < dist->ranks; r++) {
+    NeuralNetDistSlot* slot = slot_at(h, r);
+    if (h->compress == NEURAL_NET_DIST_NONE) {
+      double* grads = (double*)(void*)(slot + 1);
+      for (unsigned long j = lo; j < hi; j++) {
+        result[j] += grads[j];
+      }
+    } else if (h->compress == NEURAL_NET_DIST_FP16) {
+      uint16_t* halves = (uint16_t*)(void*)(slot + 1);
+      for (unsigned long j = lo; j < hi; j++) {
+        result[j] += slot->scale * (double)NeuronLayerHalf_from_fp16(halves[j]);
+      }
+    } else {
+      // The pairs are in index order, find the first in the chunk
+      NeuralNetDistPair* pairs = (NeuralNetDistPair*)(void*)(slot + 1);
+      unsigned long a = 0;
+      unsigned long b = slot->count;
+      while (a < b) {
+        unsigned long mid = a + ((b - a) / 2);
+        if (pairs[mid].index < lo) {
+          a = mid + 1;
+        } else {
+          b = mid;
+        }
+      }
+      for (; (a < slot->count) && (pairs[a].index < hi); a++) {
+        result[pairs[a].index] += (double)pairs[a].value;
+      }
+    }
+  }
+}
+
+/** Apply the averaged gradient with momentum, like NeuralNetPipeline */
+static void apply(NeuralNetDist* dist, double* result, unsigned long samples) {
+  NeuralNet* nn = dist->nn;
+  double scale = nn->learning_rate / (double)samples;
+  double momentum_factor = nn->momentum_factor;
+
+  for (unsigned long l = 1; l <= nn->out_layer; l++) {
+    NeuronLayer* layer = &nn->layers[l];
+    unsigned long stride = nn->layers[l-1].count + 1;
+    double* g = &result[dist->offsets[l - 1]];
+    for (unsigned long n = 0; n < layer->count; n++, g += stride) {
+      double* weights = layer->neurons[n].weights;
+      double* momentums = layer->neurons[n].momentums;
+      for (unsigned long i = 0; i < stride; i++) {
+        momentums[i] = (scale * g[i]) + (momentum_factor * momentums[i]);
+        weights[i] += momentums[i];
+      }
+    }
+  }
+}
+
+static double step(NeuralNetDist* dist, Pattern** inputs, Pattern** targets,
+    unsigned long count) {
+  NeuralNetDistHeader* h = dist->header;
+  double loss = 0.0;
+
+  dbg("NeuralNetDist.step:+%p rank=%ld count=%ld\n", (void*)dist, dist->rank, count);
+
+  // The ranks update the weights themselves
+  NeuralNet_skip_flush(dist->nn);
+
+  memset(dist->grads, 0, dist->params * sizeof(double));
+  for (unsigned long s = 0; s < count; s++) {
+    loss += accumulate(dist, inputs[s], targets[s]);
+  }
+  publish(dist, loss, count);
+  barrier(h);
+
+  // Every rank sums the same values in the same order. It must be
+  // before the next barrier, past it a faster rank's next publish can
+  // overwrite its slot.
+  reduce_chunk(dist);
+  loss = 0.0;
+  dist->samples = 0;
+  for (unsigned long r = 0; r < dist->ranks; r++) {
+    NeuralNetDistSlot* slot = slot_at(h, r);
+    loss += slot->loss;
+    dist->samples += slot->samples;
+  }
+  barrier(h);
+
+  if (dist->samples > 0) {
+    apply(dist, result_at(h), dist->samples);
+  }
+  dist->nn->error = loss;
+
+  dbg("NeuralNetDist.step:-%p loss=%lf\n", (void*)dist, loss);
+  return loss;
+}
+
+/** Copy rank 0's weights, or momentums, to every rank through the result */
+static void broadcast(NeuralNetDist* dist, int momentums) {
+  NeuralNet* nn = dist->nn;
+  double* result = result_at(dist->header);
+
+  barrier(dist->header);
+  for (unsigned long l = 1; (dist->rank == 0) && (l <= nn->out_layer); l++) {
+    NeuronLayer* layer = &nn->layers[l];
+    unsigned long stride = nn->layers[l-1].count + 1;
+    double* p = &result[dist->offsets[l - 1]];
+    for (unsigned long n = 0; n < layer->count; n++, p += stride) {
+      Neuron* neuron = &layer->neurons[n];
+      memcpy(p, momentums ? neuron->momentums : neuron->weights, stride * sizeof(double));
+    }
+  }
+  barrier(dist->header);
+  for (unsigned long l = 1; (dist->rank != 0) && (l <= nn->out_layer); l++) {
+    NeuronLayer* layer = &nn->layers[l];
+    unsigned long stride = nn->layers[l-1].count + 1;
+    double* p = &result[dist->offsets[l - 1]];
+    for (unsigned long n = 0; n < layer->count; n++, p += stride) {
+      Neuron* neuron = &layer->neurons[n];
+      memcpy(momentums ? neuron->momentums : neuron->weights, p, stride * sizeof(double));
+    }
+  }
+}
+
+static Status sync_ranks(NeuralNetDist* dist) {
+  dbg("NeuralNetDist.sync:+%p rank=%ld\n", (void*)dist, dist->rank);
+
+  NeuralNet_skip_flush(dist->nn);
+  broadcast(dist, 0);
+  broadcast(dist, 1);
+  if (dist->residuals != NULL) {
+    memset(dist->residuals, 0, dist->params * sizeof(double));
+  }
+
+  dbg("NeuralNetDist.sync:-%p\n", (void*)dist);
+  return STATUS_OK;
+}
+
+static void deinit(NeuralNetDist* dist) {
+  dbg("NeuralNetDist.deinit:+%p\n", (void*)dist);
+
+  if (dist->header != NULL) {
+    munmap(dist->header, dist->map_size);
+    dist->header = NULL;
+  }
+  free(dist->offsets);
+  free(dist->grads);
+  free(dist->residuals);
+  free(dist->mags);
+  free(dist->output);
+  dist->offsets = NULL;
+  dist->grads = NULL;
+  dist->residuals = NULL;
+  dist->mags = NULL;
+  dist->output = NULL;
+
+  dbg("NeuralNetDist.deinit:-%p\n", (void*)dist);
+}
+
+Status NeuralNetDist_create(char* name, NeuralNet* nn, unsigned long ranks,
+    unsigned long compress, unsigned long top_k) {
+  Status status;
+  int fd = -1;
+
+  dbg("NeuralNetDist_create:+%s ranks=%ld compress=%ld top_k=%ld\n", name,
+      ranks, compress, top_k);
+
+  unsigned long params = layer_offsets(nn, NULL);
+  if ((params == 0) || (ranks == 0) || (ranks > INT_MAX)
+      || (compress > NEURAL_NET_DIST_TOPK)) {
+    status = STATUS_BAD_PARAM;
+    goto done;
+  }
+  if ((compress == NEURAL_NET_DIST_TOPK)
+      && ((top_k == 0) || (top_k > params) || (params > UINT32_MAX))) {
+    status = STATUS_BAD_PARAM;
+    goto done;
+  }
+
+  unsigned long slot_offset = round_up(sizeof(NeuralNetDistHeader), DIST_ALIGN);
+  unsigned long slot_bytes = round_up(sizeof(NeuralNetDistSlot)
+      + payload_bytes(compress, params, top_k), DIST_ALIGN);
+  unsigned long result_offset = slot_offset + (ranks * slot_bytes);
+  unsigned long size = result_offset + (params * sizeof(double));
+
+  fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+  if (fd < 0) {
+    printf("NeuralNetDist_create: could not open '%s' err=%s\n", name, strerror(errno));
+    status = STATUS_ERR;
+    goto done;
+  }
+  if (ftruncate(fd, (off_t)size) != 0) {
+    printf("NeuralNetDist_create: could not size '%s' err=%s\n", name, strerror(errno));
+    status = STATUS_ERR;
+    goto done;
+  }
+  void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    status = STATUS_OOM;
+    goto done;
+  }
+
+  // The object is zero filled so the barrier starts empty
+  NeuralNetDistHeader* h = map;
+  h->ranks = ranks;
+  h->params = params;
+  h->compress = compress;
+  h->top_k = top_k;
+  h->slot_offset = slot_offset;
+  h->slot_bytes = slot_bytes;
+  h->result_offset = result_offset;
+
+  // Ranks check the magic last
+  atomic_thread_fence(memory_order_release);
+  memcpy(h->magic, NEURAL_NET_DIST_MAGIC, sizeof(h->magic));
+  munmap(map, size);
+
+  status = STATUS_OK;
+
+done:
+  if (fd >= 0) {
+    close(fd);
+  }
+  dbg("NeuralNetDist_create:-%s status=%d\n", name, StatusVal(status));
+  return status;
+}
+
+void NeuralNetDist_remove(char* name) {
+  shm_unlink(name);
+}
+
+Status NeuralNetDist_init(NeuralNetDist* dist, NeuralNet* nn, char* name,
+    unsigned long rank) {
+  Status status;
+  struct stat st;
+  int fd = -1;
+
+  dbg("NeuralNetDist_init:+%p name=%s rank=%ld\n", (void*)dist, name, rank);
+
+  memset(dist, 0, sizeof(*dist));
+  dist->nn = nn;
+  dist->rank = rank;
+  dist->deinit = deinit;
+  dist->sync = sync_ranks;
+  dist->step = step;
+
+  fd = shm_open(name, O_RDWR, 0);
+  if ((fd < 0) || (fstat(fd, &st) != 0)
+      || ((unsigned long)st.st_size < sizeof(NeuralNetDistHeader))) {
+    status = STATUS_ERR;
+    goto done;
+  }
+  void* map = mmap(NULL, (unsigned long)st.st_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    status = STATUS_OOM;
+    goto done;
+  }
+  dist->header = map;
+  dist->map_size = (unsigned long)st.st_size;
+
+  NeuralNetDistHeader* h = dist->header;
+  if (memcmp(h->magic, NEURAL_NET_DIST_MAGIC, sizeof(h->magic)) != 0) {
+    status = STATUS_ERR;
+    goto done;
+  }
+  atomic_thread_fence(memory_order_acquire);
+
+  dist->offsets = calloc(nn->out_layer + 1, sizeof(unsigned long));
+  if (dist->offsets == NULL) { status = STATUS_OOM; goto done; }
+  dist->params = layer_offsets(nn, dist->offsets);
+  dist->ranks = h->ranks;
+  if ((dist->params != h->params) || (rank >= h->ranks)
+      || ((h->result_offset + (h->params * sizeof(double))) > dist->map_size)) {
+    status = STATUS_BAD_PARAM;
+    goto done;
+  }
+
+  dist->grads = calloc(dist->params, sizeof(double));
+  dist->output = Pattern_create(nn->layers[nn->out_layer].count);
+  if ((dist->grads == NULL) || (dist->output == NULL)) {
+    status = STATUS_OOM;
+    goto done;
+  }
+  if (h->compress != NEURAL_NET_DIST_NONE) {
+    dist->residuals = calloc(dist->params, sizeof(double));
+    if (dist->residuals == NULL) { status = STATUS_OOM; goto done; }
+  }
+  if (h->compress == NEURAL_NET_DIST_TOPK) {
+    dist->mags = calloc(dist->params, sizeof(double));
+    if (dist->mags == NULL) { status = STATUS_OOM; goto done; }
+  }
+
+  status = STATUS_OK;
+
+done:
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (StatusErr(status)) {
+    deinit(dist);
+  }
+  dbg("NeuralNetDist_init:-%p status=%d\n", (void*)dist, StatusVal(status));
+  return status;
+}
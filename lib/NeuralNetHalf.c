@@ -0,0 +1,479 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "NeuralNet.h"
+#include "NeuralNetHalf.h"
+#include "dbg.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define HALF_ALIGN 64
+#define HALF_LANES 16
+
+static uint32_t float_bits(float f) {
+  uint32_t u;
+  memcpy(&u, &f, sizeof(u));
+  return u;
+}
+
+static float bits_float(uint32_t u) {
+  float f;
+  memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+static float bf16_to_float(uint16_t h) {
+  return bits_float((uint32_t)h << 16);
+}
+
+static uint16_t float_to_bf16(float f) {
+  uint32_t u = float_bits(f);
+  if ((u & 0x7fffffff) > 0x7f800000) {
+    // Keep NaNs quiet rather than letting rounding make them infinite
+    return (uint16_t)((u >> 16) | 0x40);
+  }
+  u += 0x7fff + ((u >> 16) & 1);
+  return (uint16_t)(u >> 16);
+}
+
+static float fp16_to_float(uint16_t h) {
+  uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+  uint32_t exp = (h >> 10) & 0x1f;
+  uint32_t mant = h & 0x3ff;
+
+  if (exp == 0) {
+    // Zero or subnormal, mant * 2^-24
+    float f = (float)mant * 5.9604644775390625e-8f;
+    return sign ? -f : f;
+  }
+  if (exp == 0x1f) {
+    return bits_float(sign | 0x7f800000 | (mant << 13));
+  }
+  return bits_float(sign | ((exp + 112) << 23) | (mant << 13));
+}
+
+static uint16_t float_to_fp16(float f) {
+  uint32_t x = float_bits(f);
+  uint16_t sign = (uint16_t)((x >> 16) & 0x8000);
+
+  x &= 0x7fffffff;
+  if (x >= 0x7f800000) {
+    return sign | 0x7c00 | ((x > 0x7f800000) ? 0x200 : 0);
+  }
+  if (x >= 0x477ff000) {
+    // 65520 and up round to infinity
+    return sign | 0x7c00;
+  }
+  if (x < 0x38800000) {
+    // Subnormal, scaling by 2^24 is exact and lrintf rounds to even
+    long m = lrintf(bits_float(x) * 16777216.0f);
+    return sign | (uint16_t)m;
+  }
+
+  // Rebias the exponent and round the 13 dropped bits to even, a carry
+  // out of the mantissa correctly bumps the exponent
+  x += 0xc8000fff + ((x >> 13) & 1);
+  return sign | (uint16_t)(x >> 13);
+}
+
+uint16_t NeuronLayerHalf_to_fp16(float f) {
+  return float_to_fp16(f);
+}
+
+float NeuronLayerHalf_from_fp16(uint16_t h) {
+  return fp16_to_float(h);
+}
+
+// Portable kernels
+
+static float dot_bf16_c(const uint16_t* w, const float* x, unsigned long n) {
+  float sum = 0.0f;
+  for (unsigned long i = 0; i < n; i++) {
+    sum += bf16_to_float(w[i]) * x[i];
+  }
+  return sum;
+}
+
+static float dot_fp16_c(const uint16_t* w, const float* x, unsigned long n) {
+  float sum = 0.0f;
+  for (unsigned long i = 0; i < n; i++) {
+    sum += fp16_to_float(w[i]) * x[i];
+  }
+  return sum;
+}
+
+static void axpy_bf16_c(float a, const uint16_t* w, float* y, unsigned long n) {
+  for (unsigned long i = 0; i < n; i++) {
+    y[i] += a * bf16_to_float(w[i]);
+  }
+}
+
+static void axpy_fp16_c(float a, const uint16_t* w, float* y, unsigned long n) {
+  for (unsigned long i = 0; i < n; i++) {
+    y[i] += a * fp16_to_float(w[i]);
+  }
+}
+
+static void round_bf16_c(const float* src, uint16_t* dst, unsigned long n) {
+  for (unsigned long i = 0; i < n; i++) {
+    dst[i] = float_to_bf16(src[i]);
+  }
+}
+
+static void round_fp16_c(const float* src, uint16_t* dst, unsigned long n) {
+  for (unsigned long i = 0; i < n; i++) {
+    dst[i] = float_to_fp16(src[i]);
+  }
+}
+
+#if defined(__x86_64__)
+
+// AVX2 kernels, F16C converts fp16 and bf16 is a shift of the bits
+
+#define AVX2 __attribute__((target("avx2,fma,f16c")))
+
+AVX2 static float hsum_avx2(__m256 v) {
+  __m128 lo = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+  lo = _mm_add_ss(lo, _mm_shuffle_ps(lo, lo, 1));
+  return _mm_cvtss_f32(lo);
+}
+
+AVX2 static __m256 load_bf16_avx2(const uint16_t* w) {
+  __m128i h = _mm_loadu_si128((const __m128i*)(const void*)w);
+  return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(h), 16));
+}
+
+AVX2 static __m256 load_fp16_avx2(const uint16_t* w) {
+  return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(const void*)w));
+}
+
+AVX2 static float dot_bf16_avx2(const uint16_t* w, const float* x, unsigned long n) {
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  for (unsigned long i = 0; i < n; i += HALF_LANES) {
+    acc0 = _mm256_fmadd_ps(load_bf16_avx2(&w[i]), _mm256_loadu_ps(&x[i]), acc0);
+    acc1 = _mm256_fmadd_ps(load_bf16_avx2(&w[i + 8]), _mm256_loadu_ps(&x[i + 8]), acc1);
+  }
+  return hsum_avx2(_mm256_add_ps(acc0, acc1));
+}
+
+AVX2 static float dot_fp16_avx2(const uint16_t* w, const float* x, unsigned long n) {
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  for (unsigned long i = 0; i < n; i += HALF_LANES) {
+    acc0 = _mm256_fmadd_ps(load_fp16_avx2(&w[i]), _mm256_loadu_ps(&x[i]), acc0);
+    acc1 = _mm256_fmadd_ps(load_fp16_avx2(&w[i + 8]), _mm256_loadu_ps(&x[i + 8]), acc1);
+  }
+  return hsum_avx2(_mm256_add_ps(acc0, acc1));
+}
+
+AVX2 static void axpy_bf16_avx2(float a, const uint16_t* w, float* y, unsigned long n) {
+  __m256 va = _mm256_set1_ps(a);
+  for (unsigned long i = 0; i < n; i += 8) {
+    _mm256_storeu_ps(&y[i], _mm256_fmadd_ps(va, load_bf16_avx2(&w[i]), _mm256_loadu_ps(&y[i])));
+  }
+}
+
+AVX2 static void axpy_fp16_avx2(float a, const uint16_t* w, float* y, unsigned long n) {
+  __m256 va = _mm256_set1_ps(a);
+  for (unsigned long i = 0; i < n; i += 8) {
+    _mm256_storeu_ps(&y[i], _mm256_fmadd_ps(va, load_fp16_avx2(&w[i]), _mm256_loadu_ps(&y[i])));
+  }
+}
+
+/** Round to nearest even like float_to_bf16, NaNs are kept quiet */
+AVX2 static void round_bf16_avx2(const float* src, uint16_t* dst, unsigned long n) {
+  __m256i bias = _mm256_set1_epi32(0x7fff);
+  __m256i one = _mm256_set1_epi32(1);
+  __m256i quiet = _mm256_set1_epi32(0x40);
+  for (unsigned long i = 0; i < n; i += 8) {
+    __m256 v = _mm256_loadu_ps(&src[i]);
+    __m256i u = _mm256_castps_si256(v);
+    __m256i lsb = _mm256_and_si256(_mm256_srli_epi32(u, 16), one);
+    __m256i r = _mm256_srli_epi32(_mm256_add_epi32(u, _mm256_add_epi32(bias, lsb)), 16);
+    __m256i nan = _mm256_or_si256(_mm256_srli_epi32(u, 16), quiet);
+    r = _mm256_blendv_epi8(r, nan, _mm256_castps_si256(_mm256_cmp_ps(v, v, _CMP_UNORD_Q)));
+    r = _mm256_permute4x64_epi64(_mm256_packus_epi32(r, r), 0xd8);
+    _mm_storeu_si128((__m128i*)(void*)&dst[i], _mm256_castsi256_si128(r));
+  }
+}
+
+AVX2 static void round_fp16_avx2(const float* src, uint16_t* dst, unsigned long n) {
+  for (unsigned long i = 0; i < n; i += 8) {
+    __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(&src[i]), _MM_FROUND_TO_NEAREST_INT);
+    _mm_storeu_si128((__m128i*)(void*)&dst[i], h);
+  }
+}
+
+// AVX-512 kernels, a row of 16 weights per instruction
+
+#define AVX512 __attribute__((target("avx512f")))
+
+AVX512 static __m512 load_bf16_avx512(const uint16_t* w) {
+  __m256i h = _mm256_loadu_si256((const __m256i*)(const void*)w);
+  return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(h), 16));
+}
+
+AVX512 static __m512 load_fp16_avx512(const uint16_t* w) {
+  return _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)(const void*)w));
+}
+
+AVX512 static float dot_bf16_avx512(const uint16_t* w, const float* x, unsigned long n) {
+  __m512 acc = _mm512_setzero_ps();
+  for (unsigned long i = 0; i < n; i += HALF_LANES) {
+    acc = _mm512_fmadd_ps(load_bf16_avx512(&w[i]), _mm512_loadu_ps(&x[i]), acc);
+  }
+  return _mm512_reduce_add_ps(acc);
+}
+
+AVX512 static float dot_fp16_avx512(const uint16_t* w, const float* x, unsigned long n) {
+  __m512 acc = _mm512_setzero_ps();
+  for (unsigned long i = 0; i < n; i += HALF_LANES) {
+    acc = _mm512_fmadd_ps(load_fp16_avx512(&w[i]), _mm512_loadu_ps(&x[i]), acc);
+  }
+  return _mm512_reduce_add_ps(acc);
+}
+
+AVX512 static void axpy_bf16_avx512(float a, const uint16_t* w, float* y, unsigned long n) {
+  __m512 va = _mm512_set1_ps(a);
+  for (unsigned long i = 0; i < n; i += HALF_LANES) {
+    _mm512_storeu_ps(&y[i], _mm512_fmadd_ps(va, load_bf16_avx512(&w[i]), _mm512_loadu_ps(&y[i])));
+  }
+}
+
+AVX512 static void axpy_fp16_avx512(float a, const uint16_t* w, float* y, unsigned long n) {
+  __m512 va = _mm512_set1_ps(a);
+  for (unsigned long i = 0; i < n; i += HALF_LANES) {
+    _mm512_storeu_ps(&y[i], _mm512_fmadd_ps(va, load_fp16_avx512(&w[i]), _mm512_loadu_ps(&y[i])));
+  }
+}
+
+AVX512 static void round_bf16_avx512(const float* src, uint16_t* dst, unsigned long n) {
+  __m512i bias = _mm512_set1_epi32(0x7fff);
+  __m512i one = _mm512_set1_epi32(1);
+  __m512i quiet = _mm512_set1_epi32(0x40);
+  for (unsigned long i = 0; i < n; i += HALF_LANES) {
+    __m512 v = _mm512_loadu_ps(&src[i]);
+    __m512i u = _mm512_castps_si512(v);
+    __m512i lsb = _mm512_and_si512(_mm512_srli_epi32(u, 16), one);
+    __m512i r = _mm512_srli_epi32(_mm512_add_epi32(u, _mm512_add_epi32(bias, lsb)), 16);
+    __m512i nan = _mm512_or_si512(_mm512_srli_epi32(u, 16), quiet);
+    r = _mm512_mask_blend_epi32(_mm512_cmp_ps_mask(v, v, _CMP_UNORD_Q), r, nan);
+    _mm256_storeu_si256((__m256i*)(void*)&dst[i], _mm512_cvtepi32_epi16(r));
+  }
+}
+
+AVX512 static void round_fp16_avx512(const float* src, uint16_t* dst, unsigned long n) {
+  for (unsigned long i = 0; i < n; i += HALF_LANES) {
+    __m256i h = _mm512_cvtps_ph(_mm512_loadu_ps(&src[i]), _MM_FROUND_TO_NEAREST_INT);
+    _mm256_storeu_si256((__m256i*)(void*)&dst[i], h);
+  }
+}
+
+#endif
+
+static void select_kernels(NeuronLayerHalf* half) {
+  int bf16 = half->format == NEURAL_NET_WEIGHTS_BF16;
+
+  half->isa = "c";
+  half->dot = bf16 ? dot_bf16_c : dot_fp16_c;
+  half->axpy = bf16 ? axpy_bf16_c : axpy_fp16_c;
+  half->round = bf16 ? round_bf16_c : round_fp16_c;
+
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    half->isa = "avx512f";
+    half->dot = bf16 ? dot_bf16_avx512 : dot_fp16_avx512;
+    half->axpy = bf16 ? axpy_bf16_avx512 : axpy_fp16_avx512;
+    half->round = bf16 ? round_bf16_avx512 : round_fp16_avx512;
+  } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")
+      && __builtin_cpu_supports("f16c")) {
+    half->isa = "avx2";
+    half->dot = bf16 ? dot_bf16_avx2 : dot_fp16_avx2;
+    half->axpy = bf16 ? axpy_bf16_avx2 : axpy_fp16_avx2;
+    half->round = bf16 ? round_bf16_avx2 : round_fp16_avx2;
+  }
+#endif
+}
+
+static void* alloc_aligned(unsigned long bytes) {
+  bytes = (bytes + HALF_ALIGN - 1) & ~(unsigned long)(HALF_ALIGN - 1);
+  void* p = aligned_alloc(HALF_ALIGN, bytes);
+  if (p != NULL) {
+    memset(p, 0, bytes);
+  }
+  return p;
+}
+
+static void half_free(NeuronLayerHalf* half) {
+  if (half != NULL) {
+    free(half->weights);
+    free(half->master);
+    free(half->momentums);
+    free(half->inputs);
+    free(half->acc);
+    free(half);
+  }
+}
+
+NeuronLayerHalf* NeuronLayerHalf_create(NeuronLayer* layer, unsigned long format) {
+  if (((format != NEURAL_NET_WEIGHTS_BF16) && (format != NEURAL_NET_WEIGHTS_FP16))
+      || (layer->count == 0) || (layer->neurons[0].inputs == NULL)
+      || (layer->sparse != NULL) || (layer->conv != NULL)) {
+    return NULL;
+  }
+  NeuronLayerHalf* half = calloc(1, sizeof(NeuronLayerHalf));
+  if (half == NULL) {
+    return NULL;
+  }
+  half->format = format;
+  half->rows = layer->count;
+  half->cols = layer->neurons[0].inputs->count + 1;
+  half->stride = (half->cols + HALF_LANES - 1) & ~(unsigned long)(HALF_LANES - 1);
+  half->weights = alloc_aligned(half->rows * half->stride * sizeof(uint16_t));
+  half->master = alloc_aligned(half->rows * half->stride * sizeof(float));
+  half->momentums = alloc_aligned(half->rows * half->stride * sizeof(float));
+  half->inputs = alloc_aligned(half->stride * sizeof(float));
+  half->acc = alloc_aligned(half->stride * sizeof(float));
+  if ((half->weights == NULL) || (half->master == NULL) || (half->momentums == NULL)
+      || (half->inputs == NULL) || (half->acc == NULL)) {
+    half_free(half);
+    return NULL;
+  }
+  select_kernels(half);
+
+  for (unsigned long n = 0; n < half->rows; n++) {
+    Neuron* neuron = &layer->neurons[n];
+    for (unsigned long i = 0; i < half->cols; i++) {
+      half->master[(n * half->stride) + i] = (float)neuron->weights[i];
+      half->momentums[(n * half->stride) + i] = (float)neuron->momentums[i];
+    }
+  }
+  NeuronLayerHalf_sync(half, half->rows);
+
+  // The bias input is always 1.0
+  half->inputs[0] = 1.0f;
+
+  dbg("NeuronLayerHalf_create: %p format=%ld rows=%ld cols=%ld isa=%s\n",
+      (void*)half, format, half->rows, half->cols, half->isa);
+  return half;
+}
+
+void NeuronLayerHalf_attach(NeuronLayer* layer, NeuronLayerHalf* half) {
+  for (unsigned long n = 0; n < layer->count; n++) {
+    Neuron* neuron = &layer->neurons[n];
+    if (!layer->in_arena) {
+      free(neuron->weights);
+      free(neuron->momentums);
+    }
+    neuron->weights = NULL;
+    neuron->momentums = NULL;
+  }
+  layer->half = half;
+}
+
+void NeuronLayerHalf_deinit(NeuronLayer* layer) {
+  half_free(layer->half);
+  layer->half = NULL;
+}
+
+void NeuronLayerHalf_sync(NeuronLayerHalf* half, unsigned long n) {
+  if (n < half->rows) {
+    half->round(&half->master[n * half->stride], &half->weights[n * half->stride],
+        half->stride);
+  } else {
+    half->round(half->master, half->weights, half->rows * half->stride);
+  }
+}
+
+double NeuronLayerHalf_weight(NeuronLayerHalf* half, unsigned long n, unsigned long i) {
+  uint16_t w = half->weights[(n * half->stride) + i];
+  if (half->format == NEURAL_NET_WEIGHTS_BF16) {
+    return (double)bf16_to_float(w);
+  }
+  return (double)fp16_to_float(w);
+}
+
+void NeuronLayerHalf_process(NeuronLayer* layer, double* logits) {
+  NeuronLayerHalf* half = layer->half;
+  NeuronLayer* in_layer = layer->neurons[0].inputs;
+  float* x = half->inputs;
+
+  for (unsigned long i = 0; i < in_layer->count; i++) {
+    x[i + 1] = (float)in_layer->neurons[i].output;
+  }
+
+  for (unsigned long n = 0; n < half->rows; n++) {
+    double weighted_sum = (double)half->dot(&half->weights[n * half->stride], x,
+        half->stride);
+
+    if (logits != NULL) {
+      logits[n] = weighted_sum;
+      continue;
+    }
+
+    // Calcuate the output using a Sigmoidal Activation function
+    layer->neurons[n].output = 1.0 / (1.0 + exp(-weighted_sum));
+  }
+}
+
+void NeuronLayerHalf_backprop(NeuronLayer* layer, NeuronLayer* prev_layer) {
+  NeuronLayerHalf* half = layer->half;
+  float* acc = half->acc;
+
+  // acc[i + 1] collects the pd_error weighted by the edges to input i
+  memset(acc, 0, half->stride * sizeof(float));
+  for (unsigned long n = 0; n < half->rows; n++) {
+    half->axpy((float)layer->neurons[n].pd_error, &half->weights[n * half->stride],
+        acc, half->stride);
+  }
+
+  for (unsigned long npl = 0; npl < prev_layer->count; npl++) {
+    double prev_out = prev_layer->neurons[npl].output;
+    double pd_prev_out = prev_out * (1.0 - prev_out);
+    prev_layer->neurons[npl].pd_error = (double)acc[npl + 1] * pd_prev_out;
+  }
+}
+
+void NeuronLayerHalf_adjust_weights(NeuronLayer* layer,
+    double learning_rate, double momentum_factor) {
+  NeuronLayerHalf* half = layer->half;
+  float* x = half->inputs;
+  float mf = (float)momentum_factor;
+
+  // The inputs are those of the forward pass, the padding
+  // inputs are 0 so the padding weights stay 0
+  for (unsigned long n = 0; n < half->rows; n++) {
+    float scale = (float)(learning_rate * layer->neurons[n].pd_error);
+    float* master = &half->master[n * half->stride];
+    float* momentums = &half->momentums[n * half->stride];
+    for (unsigned long i = 0; i < half->stride; i++) {
+      momentums[i] = (scale * x[i]) + (mf * momentums[i]);
+      master[i] += momentums[i];
+    }
+    NeuronLayerHalf_sync(half, n);
+  }
+}
@@ -96,6 +96,24 @@ static Status close_file(NeuralNetIoWriter* writer, unsigned long epochs) {
   Status status;
 
   if (writer->out_file != NULL) {
+    // Append the footer so readers can find the frames without
+    // knowing the network
+    NeuralNetIoFooter footer;
+    memset(&footer, 0, sizeof(footer));
+    memcpy(footer.magic, NEURAL_NET_IO_FOOTER_MAGIC, sizeof(footer.magic));
+    footer.data_offset = writer->data_offset;
+    footer.frame_bytes = writer->frame_bytes;
+    footer.frame_count = writer->frames;
+    footer.first_seq = writer->first_seq;
+    footer.epochs = epochs;
+    footer.footer_bytes = sizeof(footer);
+    memcpy(footer.end_magic, NEURAL_NET_IO_FOOTER_MAGIC, sizeof(footer.end_magic));
+    fseek(writer->out_file, 0, SEEK_END);
+    fwrite(&footer, sizeof(footer), 1, writer->out_file);
+    if (ferror(writer->out_file)) {
+       printf("NeuralNetIo.close_file: %s\n", strerror(errno));
+    }
+
     fseek(writer->out_file, 0, 0);
     writer->write_int(writer, epochs);
 
@@ -112,8 +130,9 @@ static Status close_file(NeuralNetIoWriter* writer, unsigned long epochs) {
 static Status begin_epoch(NeuralNetIoWriter* writer, size_t epoch) {
   Status status;
 
-  unused(writer);
-  unused(epoch);
+  if (writer->frames == 0) {
+    writer->first_seq = epoch;
+  }
 
   status = STATUS_OK;
 
@@ -132,7 +151,7 @@ static Status write_point_val(NeuralNetIoWriter* writer, double* point) {
   return status;
 }
 
-static Status write_epoch(NeuralNetIoWriter* writer) {
+Status NeuralNetIo_write_epoch(NeuralNetIoWriter* writer) {
   Status status;
 
   NeuralNet* nn = writer->nn;
@@ -202,13 +221,12 @@ static Status write_epoch(NeuralNetIoWriter* writer) {
       // Get the next neuron
       Neuron* neuron = &layer->neurons[n];
 
-      // Point at the first of the neuron's inputs and weights arrays
-      double* weights = neuron->weights;
-
       // Loop thought all of the neuron's output the weights
-      // which includes the bias, hence the <= test.
+      // which includes the bias, hence the <= test. Pruned
+      // weights of a sparse layer are written as 0.0.
       for (unsigned long i = 0; i <= neuron->inputs->count; i++) {
-        double point[4] = { xaxis, yaxis, weights[i], weights[i] };
+        double weight = NeuronLayer_weight(layer, n, i);
+        double point[4] = { xaxis, yaxis, weight, weight };
         status = writer->write_point_val(writer, point);
         if (StatusErr(status)) {
           printf("NeuralNetIoWriter_init: unable to write weights\n");
@@ -237,6 +255,7 @@ static Status write_epoch(NeuralNetIoWriter* writer) {
     yaxis += yaxis_offset;
   }
 
+  writer->frames += 1;
   status = STATUS_OK;
 
 done:
@@ -261,11 +280,21 @@ Status NeuralNetIoWriter_init(NeuralNetIoWriter* writer, NeuralNet* nn,
   writer->out_file = NULL;
   writer->out_path = out_path;
   writer->nn = nn;
+  writer->data_offset = 0;
+  writer->frame_bytes = points_per_epoch * 4 * sizeof(double);
+  writer->frames = 0;
+  writer->first_seq = 0;
+  writer->shm = NULL;
+  writer->slot = NULL;
+  writer->shm_bytes = 0;
+  writer->shm_slot_count = 0;
+  writer->slot_pos = 0;
+  writer->npy = NULL;
   writer->deinit = deinit;
   writer->open_file = open_file;
   writer->close_file = close_file;
   writer->begin_epoch = begin_epoch;
-  writer->write_epoch = write_epoch;
+  writer->write_epoch = NeuralNetIo_write_epoch;
   writer->end_epoch = end_epoch;
   writer->write_str = write_str;
   writer->write_int = write_int;
@@ -305,6 +334,14 @@ Status NeuralNetIoWriter_init(NeuralNetIoWriter* writer, NeuralNet* nn,
     goto done;
   }
 
+  // The frames follow the header directly
+  long pos = ftell(writer->out_file);
+  if (pos < 0) {
+    status = STATUS_ERR;
+    goto done;
+  }
+  writer->data_offset = (unsigned long)pos;
+
   status = STATUS_OK;
 
 done:
@@ -0,0 +1,282 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "NeuralNet.h"
+#include "NeuralNetIo.h"
+#include "NeuralNetIoNpy.h"
+#include "dbg.h"
+#include "unused.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define NPY_ORDER ">"
+#else
+#define NPY_ORDER "<"
+#endif
+
+static char* npy_names[NEURAL_NET_IO_NPY_ARRAYS] = { "weights", "outputs", "error", "seq" };
+static char* npy_descrs[NEURAL_NET_IO_NPY_ARRAYS] = {
+  NPY_ORDER "f8", NPY_ORDER "f8", NPY_ORDER "f8", NPY_ORDER "u8"
+};
+
+/** Write the header of array a as having rows rows, leaves f at the data */
+static Status write_header(NeuralNetIoNpy* npy, unsigned long a, unsigned long rows) {
+  char header[NEURAL_NET_IO_NPY_HEADER_BYTES];
+  unsigned long prefix = 10;
+  unsigned long dict_bytes = NEURAL_NET_IO_NPY_HEADER_BYTES - prefix;
+
+  // Magic, version 1.0 and the little endian length of the dict
+  memcpy(header, "\x93NUMPY\x01\x00", 8);
+  header[8] = (char)(dict_bytes & 0xff);
+  header[9] = (char)(dict_bytes >> 8);
+
+  // The dict is padded with spaces and ends in a newline
+  int len = snprintf(&header[prefix], dict_bytes,
+      "{'descr': '%s', 'fortran_order': False, 'shape': (%lu, %lu), }",
+      npy_descrs[a], rows, npy->columns[a]);
+  if ((len < 0) || ((unsigned long)len >= dict_bytes)) {
+    return STATUS_BAD_CODE;
+  }
+  memset(&header[prefix + (unsigned long)len], ' ', dict_bytes - (unsigned long)len - 1);
+  header[NEURAL_NET_IO_NPY_HEADER_BYTES - 1] = '\n';
+
+  FILE* f = npy->files[a];
+  if ((fseek(f, 0, SEEK_SET) != 0) || (fwrite(header, sizeof(header), 1, f) != 1)) {
+    printf("NeuralNetIoNpy.write_header: %s: %s\n", npy->paths[a], strerror(errno));
+    return STATUS_ERR;
+  }
+  return STATUS_OK;
+}
+
+static Status npy_open_file(NeuralNetIoWriter* writer) {
+  Status status;
+  NeuralNetIoNpy* npy = writer->npy;
+
+  for (unsigned long a = 0; a < NEURAL_NET_IO_NPY_ARRAYS; a++) {
+    npy->files[a] = fopen(npy->paths[a], "w");
+    if (npy->files[a] == NULL) {
+      printf("NeuralNetIoNpy.open_file: could not open file: '%s' err=%s\n",
+          npy->paths[a], strerror(errno));
+      status = STATUS_ERR;
+      goto done;
+    }
+    status = write_header(npy, a, 0);
+    if (StatusErr(status)) goto done;
+  }
+
+  status = STATUS_OK;
+
+done:
+  return status;
+}
+
+static Status npy_close_file(NeuralNetIoWriter* writer, unsigned long epochs) {
+  Status status = STATUS_OK;
+  NeuralNetIoNpy* npy = writer->npy;
+
+  unused(epochs);
+
+  if (npy == NULL) {
+    return STATUS_OK;
+  }
+  for (unsigned long a = 0; a < NEURAL_NET_IO_NPY_ARRAYS; a++) {
+    if (npy->files[a] == NULL) {
+      continue;
+    }
+
+    // Now the number of rows is known
+    Status s = write_header(npy, a, writer->frames);
+    if (ferror(npy->files[a]) || (fclose(npy->files[a]) != 0)) {
+      printf("NeuralNetIoNpy.close_file: %s: %s\n", npy->paths[a], strerror(errno));
+      s = STATUS_ERR;
+    }
+    npy->files[a] = NULL;
+    status = StatusOk(status) ? s : status;
+  }
+  return status;
+}
+
+static void npy_deinit(NeuralNetIoWriter* writer, unsigned long epochs) {
+  NeuralNetIoNpy* npy = writer->npy;
+
+  if (npy != NULL) {
+    writer->close_file(writer, epochs);
+    for (unsigned long a = 0; a < NEURAL_NET_IO_NPY_ARRAYS; a++) {
+      free(npy->paths[a]);
+    }
+    free(npy->row);
+    free(npy);
+    writer->npy = NULL;
+  }
+}
+
+static Status npy_begin_epoch(NeuralNetIoWriter* writer, size_t epoch) {
+  if (writer->frames == 0) {
+    writer->first_seq = epoch;
+  }
+  writer->npy->seq = epoch;
+  return STATUS_OK;
+}
+
+static Status write_row(NeuralNetIoNpy* npy, unsigned long a, const void* row) {
+  if (fwrite(row, sizeof(double), npy->columns[a], npy->files[a]) != npy->columns[a]) {
+    printf("NeuralNetIoNpy.write_epoch: %s: %s\n", npy->paths[a], strerror(errno));
+    return STATUS_ERR;
+  }
+  return STATUS_OK;
+}
+
+static Status npy_write_epoch(NeuralNetIoWriter* writer) {
+  Status status;
+  NeuralNetIoNpy* npy = writer->npy;
+  NeuralNet* nn = writer->nn;
+  double* row = npy->row;
+
+  // Weights, through NeuronLayer_weight so every storage is handled
+  unsigned long c = 0;
+  for (unsigned long l = 1; l <= nn->out_layer; l++) {
+    NeuronLayer* layer = &nn->layers[l];
+    unsigned long count = nn->layers[l-1].count + 1;
+    for (unsigned long n = 0; n < layer->count; n++) {
+      for (unsigned long i = 0; i < count; i++) {
+        row[c++] = NeuronLayer_weight(layer, n, i);
+      }
+    }
+  }
+  status = write_row(npy, NEURAL_NET_IO_NPY_WEIGHTS, row);
+  if (StatusErr(status)) goto done;
+
+  NeuronLayer* out_layer = &nn->layers[nn->out_layer];
+  for (unsigned long n = 0; n < out_layer->count; n++) {
+    row[n] = out_layer->neurons[n].output;
+  }
+  status = write_row(npy, NEURAL_NET_IO_NPY_OUTPUTS, row);
+  if (StatusErr(status)) goto done;
+
+  status = write_row(npy, NEURAL_NET_IO_NPY_ERROR, &nn->error);
+  if (StatusErr(status)) goto done;
+
+  unsigned long seq = npy->seq;
+  status = write_row(npy, NEURAL_NET_IO_NPY_SEQ, &seq);
+  if (StatusErr(status)) goto done;
+
+  writer->frames += 1;
+
+done:
+  return status;
+}
+
+static Status npy_end_epoch(NeuralNetIoWriter* writer) {
+  unused(writer);
+  return STATUS_OK;
+}
+
+static Status npy_write_str(NeuralNetIoWriter* writer, char* s) {
+  // The arrays only hold frames
+  unused(writer);
+  unused(s);
+  return STATUS_BAD_PARAM;
+}
+
+static Status npy_write_int(NeuralNetIoWriter* writer, unsigned long i) {
+  unused(writer);
+  unused(i);
+  return STATUS_BAD_PARAM;
+}
+
+static Status npy_write_double(NeuralNetIoWriter* writer, double d) {
+  unused(writer);
+  unused(d);
+  return STATUS_BAD_PARAM;
+}
+
+static Status npy_write_point_val(NeuralNetIoWriter* writer, double* point) {
+  unused(writer);
+  unused(point);
+  return STATUS_BAD_PARAM;
+}
+
+Status NeuralNetIoNpyWriter_init(NeuralNetIoWriter* writer, NeuralNet* nn,
+    char* prefix) {
+  Status status;
+  NeuralNetIoNpy* npy;
+
+  dbg("NeuralNetIoNpyWriter_init:+%p prefix=%s\n", (void*)writer, prefix);
+
+  memset(writer, 0, sizeof(*writer));
+  writer->out_path = prefix;
+  writer->nn = nn;
+  writer->deinit = npy_deinit;
+  writer->open_file = npy_open_file;
+  writer->close_file = npy_close_file;
+  writer->begin_epoch = npy_begin_epoch;
+  writer->write_epoch = npy_write_epoch;
+  writer->end_epoch = npy_end_epoch;
+  writer->write_str = npy_write_str;
+  writer->write_int = npy_write_int;
+  writer->write_float = npy_write_double;
+  writer->write_double = npy_write_double;
+  writer->write_point_val = npy_write_point_val;
+
+  if ((nn == NULL) || (prefix == NULL)) {
+    status = STATUS_BAD_PARAM;
+    goto done;
+  }
+
+  npy = calloc(1, sizeof(NeuralNetIoNpy));
+  if (npy == NULL) { status = STATUS_OOM; goto done; }
+  writer->npy = npy;
+
+  for (unsigned long l = 1; l <= nn->out_layer; l++) {
+    npy->columns[NEURAL_NET_IO_NPY_WEIGHTS] += nn->layers[l].count
+      * (nn->layers[l-1].count + 1);
+  }
+  npy->columns[NEURAL_NET_IO_NPY_OUTPUTS] = nn->layers[nn->out_layer].count;
+  npy->columns[NEURAL_NET_IO_NPY_ERROR] = 1;
+  npy->columns[NEURAL_NET_IO_NPY_SEQ] = 1;
+  writer->frame_bytes = 0;
+  for (unsigned long a = 0; a < NEURAL_NET_IO_NPY_ARRAYS; a++) {
+    writer->frame_bytes += npy->columns[a] * sizeof(double);
+  }
+
+  unsigned long widest = npy->columns[NEURAL_NET_IO_NPY_WEIGHTS];
+  if (npy->columns[NEURAL_NET_IO_NPY_OUTPUTS] > widest) {
+    widest = npy->columns[NEURAL_NET_IO_NPY_OUTPUTS];
+  }
+  npy->row = calloc(widest, sizeof(double));
+  if (npy->row == NULL) { status = STATUS_OOM; goto done; }
+
+  unsigned long len = strlen(prefix) + 16;
+  for (unsigned long a = 0; a < NEURAL_NET_IO_NPY_ARRAYS; a++) {
+    npy->paths[a] = malloc(len);
+    if (npy->paths[a] == NULL) { status = STATUS_OOM; goto done; }
+    snprintf(npy->paths[a], len, "%s.%s.npy", prefix, npy_names[a]);
+  }
+  writer->data_offset = NEURAL_NET_IO_NPY_HEADER_BYTES;
+
+  status = writer->open_file(writer);
+
+done:
+  if (StatusErr(status)) {
+    npy_deinit(writer, 0);
+  }
+  dbg("NeuralNetIoNpyWriter_init:-%p status=%d\n", (void*)writer, StatusVal(status));
+  return status;
+}
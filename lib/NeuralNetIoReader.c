@@ -0,0 +1,220 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "NeuralNet.h"
+#include "NeuralNetIo.h"
+#include "NeuralNetIoReader.h"
+#include "dbg.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void deinit(NeuralNetIoReader* reader) {
+  if (reader->map != NULL) {
+    munmap(reader->map, reader->map_size);
+    reader->map = NULL;
+    reader->map_size = 0;
+  }
+  free(reader->window);
+  reader->window = NULL;
+  reader->frame_count = 0;
+}
+
+static const double* frames(NeuralNetIoReader* reader, unsigned long first,
+    unsigned long* count) {
+  if (first >= reader->frame_count) {
+    *count = 0;
+    return NULL;
+  }
+  if (*count > (reader->frame_count - first)) {
+    *count = reader->frame_count - first;
+  }
+  if (*count > reader->window_frames) {
+    *count = reader->window_frames;
+  }
+  memcpy(reader->window, &reader->map[reader->data_offset + (first * reader->frame_bytes)],
+      *count * reader->frame_bytes);
+  return reader->window;
+}
+
+static const double* frame(NeuralNetIoReader* reader, unsigned long n) {
+  unsigned long count = 1;
+  return frames(reader, n, &count);
+}
+
+static Status for_each(NeuralNetIoReader* reader, unsigned long first,
+    unsigned long count, NeuralNetIoReader_FrameCb cb, void* ctx) {
+  Status status = STATUS_OK;
+
+  if (first >= reader->frame_count) {
+    goto done;
+  }
+  if (count > (reader->frame_count - first)) {
+    count = reader->frame_count - first;
+  }
+
+  // Tell the kernel we're about to read the range in order
+  unsigned long page = (unsigned long)sysconf(_SC_PAGESIZE);
+  unsigned long begin = reader->data_offset + (first * reader->frame_bytes);
+  unsigned long end = begin + (count * reader->frame_bytes);
+  begin &= ~(page - 1);
+  madvise(&reader->map[begin], end - begin, MADV_WILLNEED);
+
+  // A window of frames at a time
+  unsigned long doubles = reader->frame_bytes / sizeof(double);
+  while (count > 0) {
+    unsigned long chunk = count;
+    const double* points = frames(reader, first, &chunk);
+    for (unsigned long n = 0; n < chunk; n++) {
+      status = cb(ctx, first + n, &points[n * doubles]);
+      if (StatusErr(status)) {
+        goto done;
+      }
+    }
+    first += chunk;
+    count -= chunk;
+  }
+
+done:
+  return status;
+}
+
+/** Locate the frames from the footer, returns 0 if there isn't a valid one */
+static int read_footer(NeuralNetIoReader* reader) {
+  NeuralNetIoFooter footer;
+
+  if (reader->map_size < (reader->data_offset + sizeof(footer))) {
+    return 0;
+  }
+  memcpy(&footer, &reader->map[reader->map_size - sizeof(footer)], sizeof(footer));
+  if ((memcmp(footer.magic, NEURAL_NET_IO_FOOTER_MAGIC, sizeof(footer.magic)) != 0)
+      || (memcmp(footer.end_magic, NEURAL_NET_IO_FOOTER_MAGIC, sizeof(footer.end_magic)) != 0)
+      || (footer.footer_bytes != sizeof(footer))
+      || (footer.data_offset != reader->data_offset)
+      || (footer.frame_bytes != reader->frame_bytes)) {
+    return 0;
+  }
+  unsigned long data_bytes = reader->map_size - sizeof(footer) - reader->data_offset;
+  if ((reader->frame_bytes == 0)
+      || (footer.frame_count != (data_bytes / reader->frame_bytes))) {
+    return 0;
+  }
+
+  reader->frame_count = footer.frame_count;
+  reader->first_seq = footer.first_seq;
+  return 1;
+}
+
+Status NeuralNetIoReader_init(NeuralNetIoReader* reader, char* in_path) {
+  Status status;
+  int fd = -1;
+  struct stat st;
+
+  dbg("NeuralNetIoReader_init:+%p in_path=%s\n", (void*)reader, in_path);
+
+  memset(reader, 0, sizeof(*reader));
+  reader->deinit = deinit;
+  reader->frame = frame;
+  reader->frames = frames;
+  reader->for_each = for_each;
+
+  fd = open(in_path, O_RDONLY);
+  if ((fd < 0) || (fstat(fd, &st) != 0)) {
+    printf("NeuralNetIoReader_init: could not open file: '%s' err=%s\n",
+        in_path, strerror(errno));
+    status = STATUS_ERR;
+    goto done;
+  }
+  reader->map_size = (unsigned long)st.st_size;
+  if (reader->map_size < (2 * sizeof(unsigned long))) {
+    printf("NeuralNetIoReader_init: '%s' is too short\n", in_path);
+    status = STATUS_ERR;
+    goto done;
+  }
+
+  void* map = mmap(NULL, reader->map_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    printf("NeuralNetIoReader_init: could not map file: '%s' err=%s\n",
+        in_path, strerror(errno));
+    status = STATUS_ERR;
+    goto done;
+  }
+  reader->map = map;
+
+  // Frames are accessed in any order when scrubbing
+  madvise(reader->map, reader->map_size, MADV_RANDOM);
+
+  // Parse the header, the frames follow the newline of its text line
+  memcpy(&reader->epochs, &reader->map[0], sizeof(unsigned long));
+  memcpy(&reader->points_per_epoch, &reader->map[sizeof(unsigned long)],
+      sizeof(unsigned long));
+  unsigned long pos = 2 * sizeof(unsigned long);
+  while ((pos < reader->map_size) && (reader->map[pos] != '\n')) {
+    pos += 1;
+  }
+  pos += 1;
+  if (pos > reader->map_size) {
+    printf("NeuralNetIoReader_init: '%s' has an incomplete header\n", in_path);
+    status = STATUS_ERR;
+    goto done;
+  }
+  reader->data_offset = pos;
+  reader->frame_bytes = reader->points_per_epoch * 4 * sizeof(double);
+  if (reader->frame_bytes == 0) {
+    status = STATUS_ERR;
+    goto done;
+  }
+
+  // frame_bytes is a multiple of 32 so the window is a multiple of the alignment
+  reader->window_frames = NEURAL_NET_IO_READER_WINDOW_BYTES / reader->frame_bytes;
+  if (reader->window_frames == 0) {
+    reader->window_frames = 1;
+  }
+  reader->window = aligned_alloc(NEURAL_NET_IO_DATA_ALIGN,
+      reader->window_frames * reader->frame_bytes);
+  if (reader->window == NULL) {
+    status = STATUS_OOM;
+    goto done;
+  }
+
+  if (!read_footer(reader)) {
+    // No footer, count the complete frames that made it to the file
+    reader->truncated = 1;
+    reader->first_seq = 0;
+    reader->frame_count = (reader->map_size - reader->data_offset)
+        / reader->frame_bytes;
+  }
+  dbg("NeuralNetIoReader_init: %p frames=%ld truncated=%ld\n",
+      (void*)reader, reader->frame_count, reader->truncated);
+
+  status = STATUS_OK;
+
+done:
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (StatusErr(status)) {
+    deinit(reader);
+  }
+  dbg("NeuralNetIoReader_init:-%p status=%d\n", (void*)reader, StatusVal(status));
+  return status;
+}
@@ -0,0 +1,354 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "NeuralNet.h"
+#include "NeuralNetIo.h"
+#include "NeuralNetIoShm.h"
+#include "dbg.h"
+#include "unused.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SHM_ALIGN 64
+
+static unsigned long round_up(unsigned long value, unsigned long align) {
+  return (value + align - 1) & ~(align - 1);
+}
+
+static NeuralNetIoShmSlot* slot_at(NeuralNetIoShmHeader* h, unsigned long frame) {
+  char* base = (char*)h + h->data_offset;
+  return (NeuralNetIoShmSlot*)(void*)(base + ((frame % h->slot_count) * h->slot_bytes));
+}
+
+static double* slot_points(NeuralNetIoShmSlot* slot) {
+  return (double*)(void*)(slot + 1);
+}
+
+// Writer methods
+
+static Status shm_open_file(NeuralNetIoWriter* writer) {
+  Status status;
+  int fd = -1;
+  unsigned long slot_count = writer->shm_slot_count;
+  NeuralNetIoShmHeader* h;
+
+  unsigned long data_offset = round_up(sizeof(NeuralNetIoShmHeader), SHM_ALIGN);
+  unsigned long slot_bytes = round_up(sizeof(NeuralNetIoShmSlot) + writer->frame_bytes, SHM_ALIGN);
+  unsigned long size = data_offset + (slot_count * slot_bytes);
+
+  fd = shm_open(writer->out_path, O_CREAT | O_RDWR | O_TRUNC, 0644);
+  if (fd < 0) {
+    printf("NeuralNetIoShm.open_file: could not open '%s' err=%s\n",
+        writer->out_path, strerror(errno));
+    status = STATUS_ERR;
+    goto done;
+  }
+  if (ftruncate(fd, (off_t)size) != 0) {
+    printf("NeuralNetIoShm.open_file: could not size '%s' err=%s\n",
+        writer->out_path, strerror(errno));
+    status = STATUS_ERR;
+    goto done;
+  }
+  void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    status = STATUS_OOM;
+    goto done;
+  }
+
+  // The object is zero filled so every slot starts with an even seq
+  h = map;
+  h->slot_count = slot_count;
+  h->slot_bytes = slot_bytes;
+  h->data_offset = data_offset;
+  h->points_per_epoch = writer->frame_bytes / (4 * sizeof(double));
+  h->frame_bytes = writer->frame_bytes;
+  atomic_store_explicit(&h->head, 0, memory_order_relaxed);
+  atomic_store_explicit(&h->closed, 0, memory_order_relaxed);
+
+  // Readers check the magic last
+  atomic_thread_fence(memory_order_release);
+  memcpy(h->magic, NEURAL_NET_IO_SHM_MAGIC, sizeof(h->magic));
+
+  writer->shm = h;
+  writer->shm_bytes = size;
+  status = STATUS_OK;
+
+done:
+  if (fd >= 0) {
+    close(fd);
+  }
+  return status;
+}
+
+static Status shm_close_file(NeuralNetIoWriter* writer, unsigned long epochs) {
+  unused(epochs);
+
+  if (writer->shm != NULL) {
+    atomic_store_explicit(&writer->shm->closed, 1, memory_order_release);
+    munmap(writer->shm, writer->shm_bytes);
+    writer->shm = NULL;
+
+    // Readers that have it mapped keep their view
+    shm_unlink(writer->out_path);
+  }
+  return STATUS_OK;
+}
+
+static void shm_deinit(NeuralNetIoWriter* writer, unsigned long epochs) {
+  writer->close_file(writer, epochs);
+}
+
+static Status shm_begin_epoch(NeuralNetIoWriter* writer, size_t epoch) {
+  NeuralNetIoShmHeader* h = writer->shm;
+
+  if (writer->frames == 0) {
+    writer->first_seq = epoch;
+  }
+
+  // Make the slot's seq odd before touching its contents
+  NeuralNetIoShmSlot* slot = slot_at(h, writer->frames);
+  unsigned long seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+  atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  slot->frame = writer->frames;
+  slot->epoch = epoch;
+  writer->slot = slot;
+  writer->slot_pos = 0;
+
+  return STATUS_OK;
+}
+
+static Status shm_write_double(NeuralNetIoWriter* writer, double d) {
+  if ((writer->slot == NULL)
+      || (((writer->slot_pos + 1) * sizeof(double)) > writer->frame_bytes)) {
+    return STATUS_ERR;
+  }
+  slot_points(writer->slot)[writer->slot_pos++] = d;
+  return STATUS_OK;
+}
+
+static Status shm_write_point_val(NeuralNetIoWriter* writer, double* point) {
+  if ((writer->slot == NULL)
+      || (((writer->slot_pos + 4) * sizeof(double)) > writer->frame_bytes)) {
+    return STATUS_ERR;
+  }
+  memcpy(&slot_points(writer->slot)[writer->slot_pos], point, 4 * sizeof(double));
+  writer->slot_pos += 4;
+  return STATUS_OK;
+}
+
+static Status shm_write_str(NeuralNetIoWriter* writer, char* s) {
+  // The ring only holds frames
+  unused(writer);
+  unused(s);
+  return STATUS_BAD_PARAM;
+}
+
+static Status shm_write_int(NeuralNetIoWriter* writer, unsigned long i) {
+  unused(writer);
+  unused(i);
+  return STATUS_BAD_PARAM;
+}
+
+static Status shm_end_epoch(NeuralNetIoWriter* writer) {
+  NeuralNetIoShmHeader* h = writer->shm;
+  NeuralNetIoShmSlot* slot = writer->slot;
+
+  if (slot == NULL) {
+    return STATUS_ERR;
+  }
+
+  // Publish, seq even again then advance head past this frame
+  unsigned long seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+  atomic_store_explicit(&slot->seq, seq + 1, memory_order_release);
+  atomic_store_explicit(&h->head, slot->frame + 1, memory_order_release);
+  writer->slot = NULL;
+
+  return STATUS_OK;
+}
+
+Status NeuralNetIoShmWriter_init(NeuralNetIoWriter* writer, NeuralNet* nn,
+    unsigned long points_per_epoch, char* name, unsigned long slot_count) {
+  Status status;
+
+  dbg("NeuralNetIoShmWriter_init:+%p name=%s slot_count=%ld\n",
+      (void*)writer, name, slot_count);
+
+  memset(writer, 0, sizeof(*writer));
+  writer->out_path = name;
+  writer->nn = nn;
+  writer->frame_bytes = points_per_epoch * 4 * sizeof(double);
+  writer->shm_slot_count = slot_count;
+  writer->deinit = shm_deinit;
+  writer->open_file = shm_open_file;
+  writer->close_file = shm_close_file;
+  writer->begin_epoch = shm_begin_epoch;
+  writer->write_epoch = NeuralNetIo_write_epoch;
+  writer->end_epoch = shm_end_epoch;
+  writer->write_str = shm_write_str;
+  writer->write_int = shm_write_int;
+  writer->write_float = shm_write_double;
+  writer->write_double = shm_write_double;
+  writer->write_point_val = shm_write_point_val;
+
+  if ((nn == NULL) || (slot_count == 0) || (points_per_epoch == 0)) {
+    status = STATUS_BAD_PARAM;
+    goto done;
+  }
+
+  status = writer->open_file(writer);
+
+done:
+  dbg("NeuralNetIoShmWriter_init:-%p status=%d\n", (void*)writer, StatusVal(status));
+  return status;
+}
+
+// Reader methods
+
+static void reader_deinit(NeuralNetIoShmReader* reader) {
+  if (reader->header != NULL) {
+    munmap(reader->header, reader->map_size);
+    reader->header = NULL;
+  }
+}
+
+static Status reader_peek(NeuralNetIoShmReader* reader, NeuralNetIoShmView* view) {
+  NeuralNetIoShmHeader* h = reader->header;
+  unsigned long stuck_seq = 0;
+  unsigned long stuck = 0;
+
+  for (;;) {
+    unsigned long head = atomic_load_explicit(&h->head, memory_order_acquire);
+    if (head == 0) {
+      return STATUS_ERR;
+    }
+    NeuralNetIoShmSlot* slot = slot_at(h, head - 1);
+    unsigned long seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    if ((seq & 1) != 0) {
+      // The writer has lapped us and is refilling it, look again. If
+      // it closed or the same seq stays odd it died mid-publish.
+      if (atomic_load_explicit(&h->closed, memory_order_acquire) != 0) {
+        return STATUS_ERR;
+      }
+      if ((stuck == 0) || (seq != stuck_seq)) {
+        stuck_seq = seq;
+        stuck = 1;
+      } else if (++stuck >= NEURAL_NET_IO_SHM_PEEK_TRIES) {
+        return STATUS_ERR;
+      }
+      sched_yield();
+      continue;
+    }
+    view->slot = slot;
+    view->seq = seq;
+    view->frame = slot->frame;
+    view->epoch = slot->epoch;
+    view->points = slot_points(slot);
+    return STATUS_OK;
+  }
+}
+
+static int reader_valid(NeuralNetIoShmReader* reader, NeuralNetIoShmView* view) {
+  unused(reader);
+
+  // Order our reads of the slot before the second look at seq
+  atomic_thread_fence(memory_order_acquire);
+  return atomic_load_explicit(&view->slot->seq, memory_order_relaxed) == view->seq;
+}
+
+static Status reader_latest(NeuralNetIoShmReader* reader, double* points,
+    NeuralNetIoShmView* view) {
+  for (;;) {
+    Status status = reader_peek(reader, view);
+    if (StatusErr(status)) {
+      return status;
+    }
+    memcpy(points, view->points, reader->header->frame_bytes);
+    if (reader_valid(reader, view)) {
+      view->points = points;
+      return STATUS_OK;
+    }
+  }
+}
+
+Status NeuralNetIoShmReader_init(NeuralNetIoShmReader* reader, char* name) {
+  Status status;
+  struct stat st;
+  void* map = MAP_FAILED;
+  int fd;
+
+  dbg("NeuralNetIoShmReader_init:+%p name=%s\n", (void*)reader, name);
+
+  memset(reader, 0, sizeof(*reader));
+  reader->deinit = reader_deinit;
+  reader->peek = reader_peek;
+  reader->valid = reader_valid;
+  reader->latest = reader_latest;
+
+  fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0) {
+    status = STATUS_ERR;
+    goto done;
+  }
+  if ((fstat(fd, &st) != 0) || ((unsigned long)st.st_size < sizeof(NeuralNetIoShmHeader))) {
+    close(fd);
+    status = STATUS_ERR;
+    goto done;
+  }
+  reader->map_size = (unsigned long)st.st_size;
+  map = mmap(NULL, reader->map_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    status = STATUS_ERR;
+    goto done;
+  }
+  reader->header = map;
+
+  NeuralNetIoShmHeader* h = reader->header;
+  if (memcmp(h->magic, NEURAL_NET_IO_SHM_MAGIC, sizeof(h->magic)) != 0) {
+    // Not ours or the writer hasn't finished initializing it
+    status = STATUS_ERR;
+    goto done;
+  }
+  atomic_thread_fence(memory_order_acquire);
+  if ((h->slot_count == 0)
+      || (h->data_offset + (h->slot_count * h->slot_bytes) > reader->map_size)
+      || ((sizeof(NeuralNetIoShmSlot) + h->frame_bytes) > h->slot_bytes)) {
+    status = STATUS_ERR;
+    goto done;
+  }
+  reader->points_per_epoch = h->points_per_epoch;
+
+  status = STATUS_OK;
+
+done:
+  if (StatusErr(status)) {
+    reader_deinit(reader);
+  }
+  dbg("NeuralNetIoShmReader_init:-%p status=%d\n", (void*)reader, StatusVal(status));
+  return status;
+}
@@ -0,0 +1,503 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "NeuralNet.h"
+#include "NeuralNetKernels.h"
+#include "ThreadPool.h"
+#include "dbg.h"
+#include "unused.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/** Copy the outputs of the layer's inputs to x */
+static void gather(NeuronLayer* layer, double* x) {
+  NeuronLayer* in = layer->neurons[0].inputs;
+  for (unsigned long i = 0; i < in->count; i++) {
+    x[i] = in->neurons[i].output;
+  }
+}
+
+static double dot_c(const double* w, const double* x, unsigned long n) {
+  double s0 = 0.0;
+  double s1 = 0.0;
+  double s2 = 0.0;
+  double s3 = 0.0;
+  unsigned long i = 0;
+  for (; (i + 4) <= n; i += 4) {
+    s0 += w[i] * x[i];
+    s1 += w[i+1] * x[i+1];
+    s2 += w[i+2] * x[i+2];
+    s3 += w[i+3] * x[i+3];
+  }
+  for (; i < n; i++) {
+    s0 += w[i] * x[i];
+  }
+  return (s0 + s1) + (s2 + s3);
+}
+
+static void axpy_c(double a, const double* w, double* y, unsigned long n) {
+  for (unsigned long i = 0; i < n; i++) {
+    y[i] += a * w[i];
+  }
+}
+
+static void update_c(double* w, double* m, const double* x, double a,
+    double momentum_factor, unsigned long n) {
+  for (unsigned long i = 0; i < n; i++) {
+    m[i] = (a * x[i]) + (momentum_factor * m[i]);
+    w[i] += m[i];
+  }
+}
+
+#if defined(__x86_64__)
+
+#define AVX2 __attribute__((target("avx2,fma")))
+
+AVX2 static double dot_avx2(const double* w, const double* x, unsigned long n) {
+  __m256d s0 = _mm256_setzero_pd();
+  __m256d s1 = _mm256_setzero_pd();
+  unsigned long i = 0;
+  for (; (i + 8) <= n; i += 8) {
+    s0 = _mm256_fmadd_pd(_mm256_loadu_pd(&w[i]), _mm256_loadu_pd(&x[i]), s0);
+    s1 = _mm256_fmadd_pd(_mm256_loadu_pd(&w[i+4]), _mm256_loadu_pd(&x[i+4]), s1);
+  }
+  for (; (i + 4) <= n; i += 4) {
+    s0 = _mm256_fmadd_pd(_mm256_loadu_pd(&w[i]), _mm256_loadu_pd(&x[i]), s0);
+  }
+  s0 = _mm256_add_pd(s0, s1);
+  __m128d h = _mm_add_pd(_mm256_castpd256_pd128(s0), _mm256_extractf128_pd(s0, 1));
+  double s = _mm_cvtsd_f64(_mm_add_sd(h, _mm_unpackhi_pd(h, h)));
+  for (; i < n; i++) {
+    s += w[i] * x[i];
+  }
+  return s;
+}
+
+AVX2 static void axpy_avx2(double a, const double* w, double* y, unsigned long n) {
+  __m256d va = _mm256_set1_pd(a);
+  unsigned long i = 0;
+  for (; (i + 4) <= n; i += 4) {
+    __m256d vy = _mm256_fmadd_pd(va, _mm256_loadu_pd(&w[i]), _mm256_loadu_pd(&y[i]));
+    _mm256_storeu_pd(&y[i], vy);
+  }
+  for (; i < n; i++) {
+    y[i] += a * w[i];
+  }
+}
+
+AVX2 static void update_avx2(double* w, double* m, const double* x, double a,
+    double momentum_factor, unsigned long n) {
+  __m256d va = _mm256_set1_pd(a);
+  __m256d vf = _mm256_set1_pd(momentum_factor);
+  unsigned long i = 0;
+  for (; (i + 4) <= n; i += 4) {
+    __m256d vm = _mm256_mul_pd(vf, _mm256_loadu_pd(&m[i]));
+    vm = _mm256_fmadd_pd(va, _mm256_loadu_pd(&x[i]), vm);
+    _mm256_storeu_pd(&m[i], vm);
+    _mm256_storeu_pd(&w[i], _mm256_add_pd(_mm256_loadu_pd(&w[i]), vm));
+  }
+  for (; i < n; i++) {
+    m[i] = (a * x[i]) + (momentum_factor * m[i]);
+    w[i] += m[i];
+  }
+}
+
+#define AVX512 __attribute__((target("avx512f")))
+
+AVX512 static double dot_avx512(const double* w, const double* x, unsigned long n) {
+  __m512d s0 = _mm512_setzero_pd();
+  __m512d s1 = _mm512_setzero_pd();
+  unsigned long i = 0;
+  for (; (i + 16) <= n; i += 16) {
+    s0 = _mm512_fmadd_pd(_mm512_loadu_pd(&w[i]), _mm512_loadu_pd(&x[i]), s0);
+    s1 = _mm512_fmadd_pd(_mm512_loadu_pd(&w[i+8]), _mm512_loadu_pd(&x[i+8]), s1);
+  }
+  if (i < n) {
+    // The tail is done with masked loads which read zeros past n
+    __mmask8 k = (__mmask8)((1u << (n - i > 8 ? 8 : n - i)) - 1u);
+    s0 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(k, &w[i]), _mm512_maskz_loadu_pd(k, &x[i]), s0);
+    i += 8;
+    if (i < n) {
+      k = (__mmask8)((1u << (n - i)) - 1u);
+      s1 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(k, &w[i]), _mm512_maskz_loadu_pd(k, &x[i]), s1);
+    }
+  }
+  return _mm512_reduce_add_pd(_mm512_add_pd(s0, s1));
+}
+
+AVX512 static void axpy_avx512(double a, const double* w, double* y, unsigned long n) {
+  __m512d va = _mm512_set1_pd(a);
+  for (unsigned long i = 0; i < n; i += 8) {
+    __mmask8 k = (n - i) >= 8 ? (__mmask8)0xff : (__mmask8)((1u << (n - i)) - 1u);
+    __m512d vy = _mm512_fmadd_pd(va, _mm512_maskz_loadu_pd(k, &w[i]),
+        _mm512_maskz_loadu_pd(k, &y[i]));
+    _mm512_mask_storeu_pd(&y[i], k, vy);
+  }
+}
+
+AVX512 static void update_avx512(double* w, double* m, const double* x, double a,
+    double momentum_factor, unsigned long n) {
+  __m512d va = _mm512_set1_pd(a);
+  __m512d vf = _mm512_set1_pd(momentum_factor);
+  for (unsigned long i = 0; i < n; i += 8) {
+    __mmask8 k = (n - i) >= 8 ? (__mmask8)0xff : (__mmask8)((1u << (n - i)) - 1u);
+    __m512d vm = _mm512_mul_pd(vf, _mm512_maskz_loadu_pd(k, &m[i]));
+    vm = _mm512_fmadd_pd(va, _mm512_maskz_loadu_pd(k, &x[i]), vm);
+    _mm512_mask_storeu_pd(&m[i], k, vm);
+    _mm512_mask_storeu_pd(&w[i], k, _mm512_add_pd(_mm512_maskz_loadu_pd(k, &w[i]), vm));
+  }
+}
+
+#endif
+
+static int cpu_has(const char* cpu) {
+  if (cpu == NULL) {
+    return 1;
+  }
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (strcmp(cpu, "avx2") == 0) {
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  }
+  if (strcmp(cpu, "avx512f") == 0) {
+    return __builtin_cpu_supports("avx512f");
+  }
+#endif
+  return 0;
+}
+
+/** The rows first..last of the forward pass using the gathered inputs x */
+static void forward_rows(NeuronLayer* layer, double* logits, const double* x,
+    unsigned long first, unsigned long last, NeuralNetKernel_Dot dot) {
+  unsigned long count = layer->neurons[0].inputs->count;
+
+  for (unsigned long n = first; n < last; n++) {
+    Neuron* neuron = &layer->neurons[n];
+    double weighted_sum = neuron->weights[0] + dot(&neuron->weights[1], x, count);
+    if (logits != NULL) {
+      logits[n] = weighted_sum;
+    } else {
+      neuron->output = 1.0 / (1.0 + exp(-weighted_sum));
+    }
+  }
+}
+
+/** The rows first..last of the weight update using the gathered inputs x */
+static void adjust_rows(NeuronLayer* layer, double learning_rate,
+    double momentum_factor, const double* x, unsigned long first,
+    unsigned long last, NeuralNetKernel_Update update) {
+  unsigned long count = layer->neurons[0].inputs->count;
+
+  for (unsigned long n = first; n < last; n++) {
+    Neuron* neuron = &layer->neurons[n];
+    double pd_err = neuron->pd_error;
+    double* weights = neuron->weights;
+    double* momentums = neuron->momentums;
+
+    momentums[0] = (learning_rate * pd_err) + (momentum_factor * momentums[0]);
+    weights[0] += momentums[0];
+    update(&weights[1], &momentums[1], x, learning_rate * pd_err,
+        momentum_factor, count);
+  }
+}
+
+/** pd_error of prev_layer, summing each row of weights into the accumulator */
+static void backward_rows(NeuronLayer* layer, NeuronLayer* prev_layer,
+    NeuralNetKernel_Axpy axpy) {
+  double* acc = layer->tuned->acc;
+  unsigned long count = prev_layer->count;
+
+  memset(acc, 0, count * sizeof(double));
+  for (unsigned long n = 0; n < layer->count; n++) {
+    Neuron* neuron = &layer->neurons[n];
+    axpy(neuron->pd_error, &neuron->weights[1], acc, count);
+  }
+  for (unsigned long npl = 0; npl < count; npl++) {
+    double prev_out = prev_layer->neurons[npl].output;
+    prev_layer->neurons[npl].pd_error = acc[npl] * prev_out * (1.0 - prev_out);
+  }
+}
+
+// The default loops of NeuralNet.c
+
+static void forward_loop(NeuronLayer* layer, double* logits) {
+  for (unsigned long n = 0; n < layer->count; n++) {
+    Neuron* neuron = &layer->neurons[n];
+    Neuron* inputs = neuron->inputs->neurons;
+    double* weights = neuron->weights;
+    double weighted_sum = weights[0];
+    for (unsigned long i = 0; i < neuron->inputs->count; i++) {
+      weighted_sum += weights[i + 1] * inputs[i].output;
+    }
+    if (logits != NULL) {
+      logits[n] = weighted_sum;
+    } else {
+      neuron->output = 1.0 / (1.0 + exp(-weighted_sum));
+    }
+  }
+}
+
+static void backward_loop(NeuronLayer* layer, NeuronLayer* prev_layer) {
+  for (unsigned long npl = 0; npl < prev_layer->count; npl++) {
+    double sum_weighted_pd_err = 0.0;
+    for (unsigned long ncl = 0; ncl < layer->count; ncl++) {
+      sum_weighted_pd_err += layer->neurons[ncl].pd_error
+        * layer->neurons[ncl].weights[npl + 1];
+    }
+    double prev_out = prev_layer->neurons[npl].output;
+    prev_layer->neurons[npl].pd_error = sum_weighted_pd_err * (prev_out * (1.0 - prev_out));
+  }
+}
+
+static void adjust_loop(NeuronLayer* layer, double learning_rate,
+    double momentum_factor) {
+  for (unsigned long n = 0; n < layer->count; n++) {
+    Neuron* neuron = &layer->neurons[n];
+    NeuronLayer* inputs = neuron->inputs;
+    double* weights = &neuron->weights[1];
+    double* momentums = &neuron->momentums[1];
+    double pd_err = neuron->pd_error;
+
+    momentums[-1] = (learning_rate * pd_err) + (momentum_factor * momentums[-1]);
+    weights[-1] = weights[-1] + momentums[-1];
+    for (unsigned long i = 0; i < inputs->count; i++) {
+      double input = inputs->neurons[i].output;
+      momentums[i] = (learning_rate * input * pd_err) + (momentum_factor * momentums[i]);
+      weights[i] = weights[i] + momentums[i];
+    }
+  }
+}
+
+static void forward_gather(NeuronLayer* layer, double* logits) {
+  gather(layer, layer->tuned->inputs);
+  forward_rows(layer, logits, layer->tuned->inputs, 0, layer->count, dot_c);
+}
+
+static void backward_rows_c(NeuronLayer* layer, NeuronLayer* prev_layer) {
+  backward_rows(layer, prev_layer, axpy_c);
+}
+
+static void adjust_gather(NeuronLayer* layer, double learning_rate,
+    double momentum_factor) {
+  gather(layer, layer->tuned->inputs);
+  adjust_rows(layer, learning_rate, momentum_factor, layer->tuned->inputs,
+      0, layer->count, update_c);
+}
+
+#if defined(__x86_64__)
+
+static void forward_avx2(NeuronLayer* layer, double* logits) {
+  gather(layer, layer->tuned->inputs);
+  forward_rows(layer, logits, layer->tuned->inputs, 0, layer->count, dot_avx2);
+}
+
+static void backward_avx2(NeuronLayer* layer, NeuronLayer* prev_layer) {
+  backward_rows(layer, prev_layer, axpy_avx2);
+}
+
+static void adjust_avx2(NeuronLayer* layer, double learning_rate,
+    double momentum_factor) {
+  gather(layer, layer->tuned->inputs);
+  adjust_rows(layer, learning_rate, momentum_factor, layer->tuned->inputs,
+      0, layer->count, update_avx2);
+}
+
+static void forward_avx512(NeuronLayer* layer, double* logits) {
+  gather(layer, layer->tuned->inputs);
+  forward_rows(layer, logits, layer->tuned->inputs, 0, layer->count, dot_avx512);
+}
+
+static void backward_avx512(NeuronLayer* layer, NeuronLayer* prev_layer) {
+  backward_rows(layer, prev_layer, axpy_avx512);
+}
+
+static void adjust_avx512(NeuronLayer* layer, double learning_rate,
+    double momentum_factor) {
+  gather(layer, layer->tuned->inputs);
+  adjust_rows(layer, learning_rate, momentum_factor, layer->tuned->inputs,
+      0, layer->count, update_avx512);
+}
+
+#endif
+
+static void task_run(void* arg, unsigned long worker) {
+  NeuronLayerTunedTask* task = arg;
+  NeuronLayerTuned* tuned = task->layer->tuned;
+  unused(worker);
+
+  if (task->op == NEURAL_NET_KERNEL_FORWARD) {
+    forward_rows(task->layer, task->logits, tuned->inputs, task->first,
+        task->last, tuned->dot);
+  } else {
+    adjust_rows(task->layer, task->learning_rate, task->momentum_factor,
+        tuned->inputs, task->first, task->last, tuned->update);
+  }
+}
+
+/** Split the rows of layer over the pool's workers and wait for them */
+static void fan_out(NeuronLayer* layer, unsigned long op, double* logits,
+    double learning_rate, double momentum_factor) {
+  NeuronLayerTuned* tuned = layer->tuned;
+  unsigned long per = (layer->count + tuned->task_count - 1) / tuned->task_count;
+
+  gather(layer, tuned->inputs);
+  for (unsigned long t = 0; t < tuned->task_count; t++) {
+    NeuronLayerTunedTask* task = &tuned->tasks[t];
+    task->layer = layer;
+    task->logits = logits;
+    task->learning_rate = learning_rate;
+    task->momentum_factor = momentum_factor;
+    task->op = op;
+    task->first = t * per < layer->count ? t * per : layer->count;
+    task->last = (t + 1) * per < layer->count ? (t + 1) * per : layer->count;
+    if (task->first == task->last) {
+      continue;
+    }
+    if (StatusErr(tuned->pool->submit(tuned->pool, task_run, task))) {
+      task_run(task, 0);
+    }
+  }
+  tuned->pool->wait(tuned->pool);
+}
+
+static void forward_pool(NeuronLayer* layer, double* logits) {
+  fan_out(layer, NEURAL_NET_KERNEL_FORWARD, logits, 0.0, 0.0);
+}
+
+static void adjust_pool(NeuronLayer* layer, double learning_rate,
+    double momentum_factor) {
+  fan_out(layer, NEURAL_NET_KERNEL_ADJUST, NULL, learning_rate, momentum_factor);
+}
+
+static const NeuralNetKernel kernels[] = {
+  { "loop", NEURAL_NET_KERNEL_FORWARD, NULL, 0, forward_loop, NULL, NULL },
+  { "gather", NEURAL_NET_KERNEL_FORWARD, NULL, 0, forward_gather, NULL, NULL },
+  { "pool", NEURAL_NET_KERNEL_FORWARD, NULL, 1, forward_pool, NULL, NULL },
+  { "loop", NEURAL_NET_KERNEL_BACKWARD, NULL, 0, NULL, backward_loop, NULL },
+  { "rows", NEURAL_NET_KERNEL_BACKWARD, NULL, 0, NULL, backward_rows_c, NULL },
+  { "loop", NEURAL_NET_KERNEL_ADJUST, NULL, 0, NULL, NULL, adjust_loop },
+  { "gather", NEURAL_NET_KERNEL_ADJUST, NULL, 0, NULL, NULL, adjust_gather },
+  { "pool", NEURAL_NET_KERNEL_ADJUST, NULL, 1, NULL, NULL, adjust_pool },
+#if defined(__x86_64__)
+  { "avx2", NEURAL_NET_KERNEL_FORWARD, "avx2", 0, forward_avx2, NULL, NULL },
+  { "avx512", NEURAL_NET_KERNEL_FORWARD, "avx512f", 0, forward_avx512, NULL, NULL },
+  { "avx2", NEURAL_NET_KERNEL_BACKWARD, "avx2", 0, NULL, backward_avx2, NULL },
+  { "avx512", NEURAL_NET_KERNEL_BACKWARD, "avx512f", 0, NULL, backward_avx512, NULL },
+  { "avx2", NEURAL_NET_KERNEL_ADJUST, "avx2", 0, NULL, NULL, adjust_avx2 },
+  { "avx512", NEURAL_NET_KERNEL_ADJUST, "avx512f", 0, NULL, NULL, adjust_avx512 },
+#endif
+};
+
+const NeuralNetKernel* NeuralNetKernel_list(unsigned long* count) {
+  *count = sizeof(kernels) / sizeof(kernels[0]);
+  return kernels;
+}
+
+int NeuralNetKernel_usable(const NeuralNetKernel* kernel, ThreadPool* pool) {
+  if (kernel->threaded && (pool == NULL)) {
+    return 0;
+  }
+  return cpu_has(kernel->cpu);
+}
+
+const NeuralNetKernel* NeuralNetKernel_find(unsigned long op, const char* name) {
+  for (unsigned long k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+    if ((kernels[k].op == op) && (strcmp(kernels[k].name, name) == 0)) {
+      return &kernels[k];
+    }
+  }
+  return NULL;
+}
+
+static void tuned_free(NeuronLayerTuned* tuned) {
+  if (tuned != NULL) {
+    free(tuned->inputs);
+    free(tuned->acc);
+    free(tuned->tasks);
+    free(tuned);
+  }
+}
+
+Status NeuronLayerTuned_attach(NeuronLayer* layer, ThreadPool* pool) {
+  Status status;
+  NeuronLayerTuned* tuned = NULL;
+
+  dbg("NeuronLayerTuned_attach:+%p pool=%p\n", (void*)layer, (void*)pool);
+
+  if ((layer->count == 0) || (layer->neurons[0].inputs == NULL)
+      || (layer->conv != NULL) || (layer->half != NULL)) {
+    status = STATUS_BAD_PARAM;
+    goto done;
+  }
+  unsigned long in_count = layer->neurons[0].inputs->count;
+
+  tuned = calloc(1, sizeof(NeuronLayerTuned));
+  if (tuned == NULL) { status = STATUS_OOM; goto done; }
+  tuned->inputs = calloc(in_count, sizeof(double));
+  tuned->acc = calloc(in_count, sizeof(double));
+  if ((tuned->inputs == NULL) || (tuned->acc == NULL)) {
+    status = STATUS_OOM;
+    goto done;
+  }
+  if (pool != NULL) {
+    tuned->pool = pool;
+    tuned->task_count = pool->count;
+    tuned->tasks = calloc(pool->count, sizeof(NeuronLayerTunedTask));
+    if (tuned->tasks == NULL) { status = STATUS_OOM; goto done; }
+  }
+
+  tuned->dot = dot_c;
+  tuned->axpy = axpy_c;
+  tuned->update = update_c;
+#if defined(__x86_64__)
+  if (cpu_has("avx512f")) {
+    tuned->dot = dot_avx512;
+    tuned->axpy = axpy_avx512;
+    tuned->update = update_avx512;
+  } else if (cpu_has("avx2")) {
+    tuned->dot = dot_avx2;
+    tuned->axpy = axpy_avx2;
+    tuned->update = update_avx2;
+  }
+#endif
+
+  for (unsigned long op = 0; op < NEURAL_NET_KERNEL_OPS; op++) {
+    tuned->kernels[op] = NeuralNetKernel_find(op, "loop");
+  }
+
+  NeuronLayerTuned_deinit(layer);
+  layer->tuned = tuned;
+  tuned = NULL;
+
+  status = STATUS_OK;
+
+done:
+  tuned_free(tuned);
+  dbg("NeuronLayerTuned_attach:-%p status=%d\n", (void*)layer, StatusVal(status));
+  return status;
+}
+
+void NeuronLayerTuned_deinit(NeuronLayer* layer) {
+  tuned_free(layer->tuned);
+  layer->tuned = NULL;
+}
@@ -0,0 +1,515 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "NeuralNet.h"
+#include "NeuralNetLbfgs.h"
+#include "NeuralNetSkip.h"
+#include "ThreadPool.h"
+#include "dbg.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ARMIJO_C1 1e-4
+#define MAX_BACKTRACKS 40
+
+static double sigmoid(double z) {
+  return 1.0 / (1.0 + exp(-z));
+}
+
+static double dot(const double* a, const double* b, unsigned long count) {
+  double sum = 0.0;
+  for (unsigned long i = 0; i < count; i++) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+/** Forward and backward pass of sample p, accumulating into the chunk */
+static void sample_gradient(NeuralNetLbfgsChunk* chunk, unsigned long p) {
+  NeuralNetLbfgs* opt = chunk->opt;
+  NeuralNet* nn = opt->nn;
+  unsigned long out_layer = nn->out_layer;
+  int softmax = (nn->output_type == NEURAL_NET_OUTPUT_SOFTMAX);
+  Pattern* input = opt->inputs[p];
+  Pattern* target = opt->targets[p];
+  double* acts = chunk->acts;
+  double* deltas = chunk->deltas;
+
+  memcpy(acts, input->data, nn->layers[0].count * sizeof(double));
+
+  // Forward, the same sums as process
+  for (unsigned long l = 1; l <= out_layer; l++) {
+    unsigned long count = nn->layers[l].count;
+    unsigned long inputs = nn->layers[l - 1].count;
+    const double* w = &chunk->x[opt->weight_offsets[l]];
+    double* in = &acts[opt->act_offsets[l - 1]];
+    double* out = &acts[opt->act_offsets[l]];
+    for (unsigned long n = 0; n < count; n++) {
+      double sum = w[0];
+      for (unsigned long i = 0; i < inputs; i++) {
+        sum += w[i + 1] * in[i];
+      }
+      out[n] = (softmax && (l == out_layer)) ? sum : sigmoid(sum);
+      w += inputs + 1;
+    }
+  }
+
+  // Loss and dLoss/dsum of the output layer
+  unsigned long outputs = nn->layers[out_layer].count;
+  double* out = &acts[opt->act_offsets[out_layer]];
+  double* delta = &deltas[opt->act_offsets[out_layer]];
+  if (softmax) {
+    double max = out[0];
+    for (unsigned long n = 1; n < outputs; n++) {
+      max = out[n] > max ? out[n] : max;
+    }
+    // The exponentials wait in delta, so normalizing, the loss and
+    // the gradient are one pass with one exp per output
+    double sum = 0.0;
+    for (unsigned long n = 0; n < outputs; n++) {
+      delta[n] = exp(out[n] - max);
+      sum += delta[n];
+    }
+    double lse = max + log(sum);
+    double scale = 1.0 / sum;
+    for (unsigned long n = 0; n < outputs; n++) {
+      chunk->loss += target->data[n] * (lse - out[n]);
+      delta[n] = (delta[n] * scale) - target->data[n];
+    }
+  } else {
+    for (unsigned long n = 0; n < outputs; n++) {
+      double err = target->data[n] - out[n];
+      chunk->loss += 0.5 * err * err;
+      delta[n] = -err * out[n] * (1.0 - out[n]);
+    }
+  }
+
+  // Backward, accumulating the gradient
+  for (unsigned long l = out_layer; l >= 1; l--) {
+    unsigned long count = nn->layers[l].count;
+    unsigned long inputs = nn->layers[l - 1].count;
+    const double* w = &chunk->x[opt->weight_offsets[l]];
+    double* grad = &chunk->grad[opt->weight_offsets[l]];
+    double* in = &acts[opt->act_offsets[l - 1]];
+    double* prev = &deltas[opt->act_offsets[l - 1]];
+    delta = &deltas[opt->act_offsets[l]];
+
+    if (l > 1) {
+      memset(prev, 0, inputs * sizeof(double));
+    }
+    for (unsigned long n = 0; n < count; n++) {
+      double dn = delta[n];
+      grad[0] += dn;
+      for (unsigned long i = 0; i < inputs; i++) {
+        grad[i + 1] += dn * in[i];
+      }
+      if (l > 1) {
+        for (unsigned long i = 0; i < inputs; i++) {
+          prev[i] += w[i + 1] * dn;
+        }
+      }
+      w += inputs + 1;
+      grad += inputs + 1;
+    }
+    if (l > 1) {
+      for (unsigned long i = 0; i < inputs; i++) {
+        prev[i] *= in[i] * (1.0 - in[i]);
+      }
+    }
+  }
+}
+
+static void chunk_gradient(void* arg, unsigned long worker) {
+  NeuralNetLbfgsChunk* chunk = arg;
+  (void)worker;
+
+  chunk->loss = 0.0;
+  memset(chunk->grad, 0, chunk->opt->param_count * sizeof(double));
+  for (unsigned long p = chunk->first; p < chunk->end; p++) {
+    sample_gradient(chunk, p);
+  }
+}
+
+static double evaluate(NeuralNetLbfgs* opt, const double* x, double* g) {
+  for (unsigned long c = 0; c < opt->chunk_count; c++) {
+    opt->chunks[c].x = x;
+  }
+  if (opt->pool.workers != NULL) {
+    for (unsigned long c = 0; c < opt->chunk_count; c++) {
+      if (StatusErr(opt->pool.submit(&opt->pool, chunk_gradient, &opt->chunks[c]))) {
+        chunk_gradient(&opt->chunks[c], 0);
+      }
+    }
+    opt->pool.wait(&opt->pool);
+  } else {
+    chunk_gradient(&opt->chunks[0], 0);
+  }
+
+  // Sum in chunk order so the result doesn't depend on the schedule
+  double loss = 0.0;
+  memset(g, 0, opt->param_count * sizeof(double));
+  for (unsigned long c = 0; c < opt->chunk_count; c++) {
+    loss += opt->chunks[c].loss;
+    for (unsigned long i = 0; i < opt->param_count; i++) {
+      g[i] += opt->chunks[c].grad[i];
+    }
+  }
+  opt->evaluations += 1;
+  return loss;
+}
+
+static double max_abs(const double* v, unsigned long count) {
+  double max = 0.0;
+  for (unsigned long i = 0; i < count; i++) {
+    max = fabs(v[i]) > max ? fabs(v[i]) : max;
+  }
+  return max;
+}
+
+/** Copy x to the weights of nn, or the weights to x */
+static void copy_weights(NeuralNetLbfgs* opt, int to_nn) {
+  NeuralNet* nn = opt->nn;
+  for (unsigned long l = 1; l <= nn->out_layer; l++) {
+    NeuronLayer* layer = &nn->layers[l];
+    unsigned long cols = nn->layers[l - 1].count + 1;
+    double* x = &opt->x[opt->weight_offsets[l]];
+    for (unsigned long n = 0; n < layer->count; n++) {
+      if (to_nn) {
+        memcpy(layer->neurons[n].weights, &x[n * cols], cols * sizeof(double));
+      } else {
+        memcpy(&x[n * cols], layer->neurons[n].weights, cols * sizeof(double));
+      }
+    }
+  }
+}
+
+/** d = -H g by the two loop recursion over the stored corrections */
+static void direction(NeuralNetLbfgs* opt) {
+  unsigned long count = opt->param_count;
+  double* d = opt->d;
+
+  memcpy(d, opt->g, count * sizeof(double));
+  for (unsigned long k = 0; k < opt->stored; k++) {
+    unsigned long j = (opt->newest + opt->history - k) % opt->history;
+    opt->alpha[j] = opt->rho[j] * dot(&opt->s[j * count], d, count);
+    double* y = &opt->y[j * count];
+    for (unsigned long i = 0; i < count; i++) {
+      d[i] -= opt->alpha[j] * y[i];
+    }
+  }
+
+  // Scale by y.s / y.y of the newest correction, or make the
+  // first step of unit length
+  double gamma;
+  if (opt->stored > 0) {
+    double* y = &opt->y[opt->newest * count];
+    gamma = 1.0 / (opt->rho[opt->newest] * dot(y, y, count));
+  } else {
+    double norm = sqrt(dot(d, d, count));
+    gamma = (norm > 0.0) ? 1.0 / norm : 1.0;
+  }
+  for (unsigned long i = 0; i < count; i++) {
+    d[i] *= gamma;
+  }
+
+  for (unsigned long k = opt->stored; k > 0; k--) {
+    unsigned long j = (opt->newest + opt->history - (k - 1)) % opt->history;
+    double beta = opt->rho[j] * dot(&opt->y[j * count], d, count);
+    double* s = &opt->s[j * count];
+    for (unsigned long i = 0; i < count; i++) {
+      d[i] += s[i] * (opt->alpha[j] - beta);
+    }
+  }
+  for (unsigned long i = 0; i < count; i++) {
+    d[i] = -d[i];
+  }
+}
+
+/** Backtrack from a unit step along d until the loss drops enough */
+static int line_search(NeuralNetLbfgs* opt, double* loss_new) {
+  unsigned long count = opt->param_count;
+  double dg = dot(opt->d, opt->g, count);
+  double t = 1.0;
+
+  if (!(dg < 0.0)) {
+    return 0;
+  }
+  for (unsigned long b = 0; b < MAX_BACKTRACKS; b++) {
+    for (unsigned long i = 0; i < count; i++) {
+      opt->x_new[i] = opt->x[i] + (t * opt->d[i]);
+    }
+    *loss_new = opt->evaluate(opt, opt->x_new, opt->g_new);
+    if (*loss_new <= opt->loss + (ARMIJO_C1 * t * dg)) {
+      return 1;
+    }
+    t *= 0.5;
+  }
+  return 0;
+}
+
+static Status step(NeuralNetLbfgs* opt) {
+  Status status;
+  unsigned long count = opt->param_count;
+  double loss_new = 0.0;
+
+  dbg("NeuralNetLbfgs_step:+%p iteration=%ld loss=%lf\n", (void*)opt,
+      opt->iterations, opt->loss);
+
+  if (opt->done) {
+    status = STATUS_OK;
+    goto done;
+  }
+
+  direction(opt);
+  if (!line_search(opt, &loss_new)) {
+    // Forget the curvature and try the steepest descent
+    if (opt->stored == 0) {
+      opt->done = 1;
+      status = STATUS_ERR;
+      goto done;
+    }
+    opt->stored = 0;
+    opt->restarts += 1;
+    direction(opt);
+    if (!line_search(opt, &loss_new)) {
+      opt->done = 1;
+      status = STATUS_ERR;
+      goto done;
+    }
+  }
+
+  // Keep the correction if it has positive curvature, the test is done
+  // before writing it so a rejected pair doesn't clobber the oldest
+  double sy = 0.0;
+  double yy = 0.0;
+  for (unsigned long i = 0; i < count; i++) {
+    double si = opt->x_new[i] - opt->x[i];
+    double yi = opt->g_new[i] - opt->g[i];
+    sy += si * yi;
+    yy += yi * yi;
+  }
+  if (sy > (1e-10 * yy)) {
+    unsigned long j = (opt->stored == 0) ? 0 : (opt->newest + 1) % opt->history;
+    double* s = &opt->s[j * count];
+    double* y = &opt->y[j * count];
+    for (unsigned long i = 0; i < count; i++) {
+      s[i] = opt->x_new[i] - opt->x[i];
+      y[i] = opt->g_new[i] - opt->g[i];
+    }
+    opt->rho[j] = 1.0 / sy;
+    opt->newest = j;
+    opt->stored += (opt->stored < opt->history) ? 1 : 0;
+  }
+
+  double* t = opt->x;
+  opt->x = opt->x_new;
+  opt->x_new = t;
+  t = opt->g;
+  opt->g = opt->g_new;
+  opt->g_new = t;
+  opt->loss = loss_new;
+  opt->grad_max = max_abs(opt->g, count);
+  opt->iterations += 1;
+  copy_weights(opt, 1);
+
+  if ((opt->loss < opt->error_threshold) || (opt->grad_max < opt->grad_tolerance)) {
+    opt->done = 1;
+  }
+  status = STATUS_OK;
+
+done:
+  dbg("NeuralNetLbfgs_step:-%p status=%d loss=%lf\n", (void*)opt,
+      StatusVal(status), opt->loss);
+  return status;
+}
+
+static Status run(NeuralNetLbfgs* opt, unsigned long max_iterations) {
+  Status status = STATUS_OK;
+  unsigned long first = opt->iterations;
+
+  if ((opt->loss < opt->error_threshold) || (opt->grad_max < opt->grad_tolerance)) {
+    opt->done = 1;
+  }
+  while (!opt->done && ((max_iterations == 0)
+        || ((opt->iterations - first) < max_iterations))) {
+    status = opt->step(opt);
+    if (StatusErr(status)) {
+      break;
+    }
+  }
+  return status;
+}
+
+static void deinit(NeuralNetLbfgs* opt) {
+  dbg("NeuralNetLbfgs_deinit:+%p\n", (void*)opt);
+
+  if (opt->pool.workers != NULL) {
+    opt->pool.deinit(&opt->pool);
+    opt->pool.workers = NULL;
+  }
+  for (unsigned long c = 0; (opt->chunks != NULL) && (c < opt->chunk_count); c++) {
+    free(opt->chunks[c].grad);
+    free(opt->chunks[c].acts);
+    free(opt->chunks[c].deltas);
+  }
+  free(opt->chunks);
+  free(opt->weight_offsets);
+  free(opt->act_offsets);
+  free(opt->x);
+  free(opt->g);
+  free(opt->d);
+  free(opt->x_new);
+  free(opt->g_new);
+  free(opt->s);
+  free(opt->y);
+  free(opt->rho);
+  free(opt->alpha);
+  opt->chunks = NULL;
+  opt->weight_offsets = NULL;
+  opt->act_offsets = NULL;
+  opt->x = NULL;
+  opt->g = NULL;
+  opt->d = NULL;
+  opt->x_new = NULL;
+  opt->g_new = NULL;
+  opt->s = NULL;
+  opt->y = NULL;
+  opt->rho = NULL;
+  opt->alpha = NULL;
+
+  dbg("NeuralNetLbfgs_deinit:-%p\n", (void*)opt);
+}
+
+Status NeuralNetLbfgs_init(NeuralNetLbfgs* opt, NeuralNet* nn, Pattern** inputs,
+    Pattern** targets, unsigned long count, unsigned long history,
+    unsigned long threads) {
+  Status status;
+
+  dbg("NeuralNetLbfgs_init:+%p nn=%p count=%ld history=%ld threads=%ld\n",
+      (void*)opt, (void*)nn, count, history, threads);
+
+  memset(opt, 0, sizeof(*opt));
+  opt->nn = nn;
+  opt->inputs = inputs;
+  opt->targets = targets;
+  opt->count = count;
+  opt->error_threshold = 0.0;
+  opt->grad_tolerance = 1e-12;
+  opt->history = (history == 0) ? NEURAL_NET_LBFGS_HISTORY : history;
+  opt->deinit = deinit;
+  opt->evaluate = evaluate;
+  opt->step = step;
+  opt->run = run;
+
+  if ((nn->layers == NULL) || (nn->out_layer == 0) || (count == 0)) {
+    status = STATUS_BAD_PARAM;
+    goto done;
+  }
+  for (unsigned long l = 1; l <= nn->out_layer; l++) {
+    NeuronLayer* layer = &nn->layers[l];
+    if ((layer->conv != NULL) || (layer->half != NULL) || (layer->sparse != NULL)
+        || (layer->mask != NULL)) {
+      status = STATUS_BAD_PARAM;
+      goto done;
+    }
+  }
+
+  // Lay out the parameters and activations
+  opt->weight_offsets = calloc(nn->out_layer + 1, sizeof(unsigned long));
+  opt->act_offsets = calloc(nn->out_layer + 1, sizeof(unsigned long));
+  if ((opt->weight_offsets == NULL) || (opt->act_offsets == NULL)) {
+    status = STATUS_OOM;
+    goto done;
+  }
+  for (unsigned long l = 0; l <= nn->out_layer; l++) {
+    opt->act_offsets[l] = opt->act_count;
+    opt->act_count += nn->layers[l].count;
+    opt->weight_offsets[l] = opt->param_count;
+    if (l > 0) {
+      opt->param_count += nn->layers[l].count * (nn->layers[l - 1].count + 1);
+    }
+  }
+
+  unsigned long p = opt->param_count;
+  opt->x = calloc(p, sizeof(double));
+  opt->g = calloc(p, sizeof(double));
+  opt->d = calloc(p, sizeof(double));
+  opt->x_new = calloc(p, sizeof(double));
+  opt->g_new = calloc(p, sizeof(double));
+  opt->s = calloc(p * opt->history, sizeof(double));
+  opt->y = calloc(p * opt->history, sizeof(double));
+  opt->rho = calloc(opt->history, sizeof(double));
+  opt->alpha = calloc(opt->history, sizeof(double));
+  if ((opt->x == NULL) || (opt->g == NULL) || (opt->d == NULL) || (opt->x_new == NULL)
+      || (opt->g_new == NULL) || (opt->s == NULL) || (opt->y == NULL)
+      || (opt->rho == NULL) || (opt->alpha == NULL)) {
+    status = STATUS_OOM;
+    goto done;
+  }
+
+  // A chunk per thread, but small data sets aren't worth the handoff
+  if (threads == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = (cpus > 0) ? (unsigned long)cpus : 1;
+  }
+  unsigned long chunks = (count + NEURAL_NET_LBFGS_MIN_CHUNK - 1) / NEURAL_NET_LBFGS_MIN_CHUNK;
+  opt->chunk_count = (chunks < threads) ? chunks : threads;
+  opt->chunks = calloc(opt->chunk_count, sizeof(NeuralNetLbfgsChunk));
+  if (opt->chunks == NULL) { status = STATUS_OOM; goto done; }
+  for (unsigned long c = 0; c < opt->chunk_count; c++) {
+    NeuralNetLbfgsChunk* chunk = &opt->chunks[c];
+    chunk->opt = opt;
+    chunk->first = (c * count) / opt->chunk_count;
+    chunk->end = ((c + 1) * count) / opt->chunk_count;
+    chunk->grad = calloc(p, sizeof(double));
+    chunk->acts = calloc(opt->act_count, sizeof(double));
+    chunk->deltas = calloc(opt->act_count, sizeof(double));
+    if ((chunk->grad == NULL) || (chunk->acts == NULL) || (chunk->deltas == NULL)) {
+      status = STATUS_OOM;
+      goto done;
+    }
+  }
+  if (opt->chunk_count > 1) {
+    status = ThreadPool_init(&opt->pool, opt->chunk_count);
+    if (StatusErr(status)) goto done;
+  }
+
+  // Settle skipped neurons, then start from nn's weights without momentum
+  NeuralNet_skip_flush(nn);
+  copy_weights(opt, 0);
+  for (unsigned long l = 1; l <= nn->out_layer; l++) {
+    NeuronLayer* layer = &nn->layers[l];
+    for (unsigned long n = 0; n < layer->count; n++) {
+      memset(layer->neurons[n].momentums, 0,
+          (nn->layers[l - 1].count + 1) * sizeof(double));
+    }
+  }
+  opt->loss = opt->evaluate(opt, opt->x, opt->g);
+  opt->grad_max = max_abs(opt->g, p);
+  status = STATUS_OK;
+
+done:
+  if (StatusErr(status)) {
+    deinit(opt);
+  }
+  dbg("NeuralNetLbfgs_init:-%p status=%d params=%ld chunks=%ld\n", (void*)opt,
+      StatusVal(status), opt->param_count, opt->chunk_count);
+  return status;
+}
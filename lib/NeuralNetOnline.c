@@ -0,0 +1,148 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "NeuralNet.h"
+#include "NeuralNetOnline.h"
+#include "NeuralNetQueue.h"
+#include "NeuralNetTrain.h"
+#include "dbg.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void* trainer_thread(void* arg) {
+  NeuralNetOnlineTrainer* t = arg;
+  NeuralNetOnline* online = t->online;
+  NeuralNetQueue* queue = online->queue;
+  NeuralNet* nn = online->nn;
+
+  while (StatusOk(queue->pop(queue, t->input, t->target))) {
+    pthread_mutex_lock(&online->lock);
+    nn->set_inputs(nn, t->input);
+    nn->process(nn);
+    nn->get_outputs(nn, t->output);
+    double error = nn->adjust_weights(nn, t->output, t->target);
+
+    if (online->samples == 0) {
+      online->error = error;
+    } else {
+      online->error = (online->error_decay * online->error)
+        + ((1.0 - online->error_decay) * error);
+    }
+    online->samples += 1;
+    pthread_mutex_unlock(&online->lock);
+    t->samples += 1;
+  }
+
+  return NULL;
+}
+
+static void wait_trainers(NeuralNetOnline* online) {
+  dbg("NeuralNetOnline.wait:+%p\n", (void*)online);
+
+  for (unsigned long i = 0; i < online->count; i++) {
+    NeuralNetOnlineTrainer* t = &online->trainers[i];
+    if (t->started) {
+      pthread_join(t->thread, NULL);
+      t->started = 0;
+    }
+  }
+
+  dbg("NeuralNetOnline.wait:-%p\n", (void*)online);
+}
+
+static void deinit(NeuralNetOnline* online) {
+  dbg("NeuralNetOnline.deinit:+%p\n", (void*)online);
+
+  if (online->trainers != NULL) {
+    // Trainers only stop once the queue is closed
+    if ((online->count != 0) && online->trainers[0].started) {
+      online->queue->close(online->queue);
+    }
+    wait_trainers(online);
+    for (unsigned long i = 0; i < online->count; i++) {
+      NeuralNetOnlineTrainer* t = &online->trainers[i];
+      free(t->input);
+      free(t->target);
+      free(t->output);
+    }
+    free(online->trainers);
+    online->trainers = NULL;
+    pthread_mutex_destroy(&online->lock);
+  }
+
+  dbg("NeuralNetOnline.deinit:-%p\n", (void*)online);
+}
+
+Status NeuralNetOnline_init(NeuralNetOnline* online, NeuralNetQueue* queue,
+    NeuralNet* nn, unsigned long count) {
+  Status status;
+
+  dbg("NeuralNetOnline_init:+%p queue=%p count=%ld\n", (void*)online,
+      (void*)queue, count);
+
+  memset(online, 0, sizeof(*online));
+  online->queue = queue;
+  online->nn = nn;
+  online->error_decay = NEURAL_NET_ONLINE_ERROR_DECAY;
+  online->deinit = deinit;
+  online->wait = wait_trainers;
+
+  if ((count == 0) || (nn->layers[0].count != queue->input_count)
+      || (nn->layers[nn->out_layer].count != queue->target_count)) {
+    status = STATUS_BAD_PARAM;
+    goto done;
+  }
+  online->trainers = calloc(count, sizeof(NeuralNetOnlineTrainer));
+  if (online->trainers == NULL) {
+    status = STATUS_OOM;
+    goto done;
+  }
+  online->count = count;
+  pthread_mutex_init(&online->lock, NULL);
+
+  for (unsigned long i = 0; i < count; i++) {
+    NeuralNetOnlineTrainer* t = &online->trainers[i];
+    t->online = online;
+    t->input = Pattern_create(queue->input_count);
+    t->target = Pattern_create(queue->target_count);
+    t->output = Pattern_create(queue->target_count);
+    if ((t->input == NULL) || (t->target == NULL) || (t->output == NULL)) {
+      status = STATUS_OOM;
+      goto done;
+    }
+  }
+
+  for (unsigned long i = 0; i < count; i++) {
+    NeuralNetOnlineTrainer* t = &online->trainers[i];
+    if (pthread_create(&t->thread, NULL, trainer_thread, t) != 0) {
+      status = STATUS_ERR;
+      goto done;
+    }
+    t->started = 1;
+  }
+
+  status = STATUS_OK;
+
+done:
+  if (StatusErr(status)) {
+    deinit(online);
+  }
+  dbg("NeuralNetOnline_init:-%p status=%d\n", (void*)online, StatusVal(status));
+  return status;
+}
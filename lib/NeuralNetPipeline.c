@@ -0,0 +1,590 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "NeuralNet.h"
+#include "NeuralNetPipeline.h"
+#include "NeuralNetSkip.h"
+#include "dbg.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Spin briefly, then yield, then sleep while waiting on the other stage */
+static void backoff(unsigned long* spins) {
+  if (*spins < 64) {
+    atomic_signal_fence(memory_order_seq_cst);
+  } else if (*spins < 128) {
+    sched_yield();
+  } else {
+    struct timespec ts = { .tv_sec = 0, .tv_nsec = 20000 };
+    nanosleep(&ts, NULL);
+  }
+  *spins += 1;
+}
+
+static Status ring_init(NeuralNetPipelineRing* ring, unsigned long capacity) {
+  unsigned long cap = 1;
+  while (cap < capacity) {
+    cap <<= 1;
+  }
+  atomic_init(&ring->tail, 0);
+  atomic_init(&ring->head, 0);
+  ring->mask = cap - 1;
+  ring->slots = calloc(cap, sizeof(unsigned long));
+  return (ring->slots == NULL) ? STATUS_OOM : STATUS_OK;
+}
+
+static void ring_push(NeuralNetPipelineRing* ring, unsigned long value) {
+  unsigned long tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  unsigned long spins = 0;
+  while ((tail - atomic_load_explicit(&ring->head, memory_order_acquire)) > ring->mask) {
+    backoff(&spins);
+  }
+  ring->slots[tail & ring->mask] = value;
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+static unsigned long ring_pop(NeuralNetPipelineRing* ring) {
+  unsigned long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  unsigned long spins = 0;
+  while (atomic_load_explicit(&ring->tail, memory_order_acquire) == head) {
+    backoff(&spins);
+  }
+  unsigned long value = ring->slots[head & ring->mask];
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+  return value;
+}
+
+static unsigned long layer_params(NeuralNet* nn, unsigned long l) {
+  return nn->layers[l].count * (nn->layers[l-1].count + 1);
+}
+
+/** Copy the stage's weights and momentums from nn into its packed arrays */
+static void stage_pack(NeuralNetPipelineStage* stage) {
+  NeuralNet* nn = stage->pipe->nn;
+
+  for (unsigned long l = stage->first_layer; l <= stage->last_layer; l++) {
+    NeuronLayer* layer = &nn->layers[l];
+    unsigned long stride = nn->layers[l-1].count + 1;
+    unsigned long off = stage->offsets[l - stage->first_layer];
+    for (unsigned long n = 0; n < layer->count; n++) {
+      memcpy(&stage->weights[off + (n * stride)], layer->neurons[n].weights,
+          stride * sizeof(double));
+      memcpy(&stage->momentums[off + (n * stride)], layer->neurons[n].momentums,
+          stride * sizeof(double));
+    }
+  }
+  memset(stage->grads, 0,
+      stage->offsets[stage->last_layer - stage->first_layer + 1] * sizeof(double));
+}
+
+/** Copy the packed weights and momentums back to nn */
+static void stage_unpack(NeuralNetPipelineStage* stage) {
+  NeuralNet* nn = stage->pipe->nn;
+
+  for (unsigned long l = stage->first_layer; l <= stage->last_layer; l++) {
+    NeuronLayer* layer = &nn->layers[l];
+    unsigned long stride = nn->layers[l-1].count + 1;
+    unsigned long off = stage->offsets[l - stage->first_layer];
+    for (unsigned long n = 0; n < layer->count; n++) {
+      memcpy(layer->neurons[n].weights, &stage->weights[off + (n * stride)],
+          stride * sizeof(double));
+      memcpy(layer->neurons[n].momentums, &stage->momentums[off + (n * stride)],
+          stride * sizeof(double));
+    }
+  }
+}
+
+/**
+ * Output layer loss and pd_error of one sample, out holds the weighted
+ * sums on entry and the outputs on return.
+ */
+static double output_error(NeuralNet* nn, double* out, double* pd,
+    Pattern* target, unsigned long count) {
+  double error = 0.0;
+
+  if (nn->output_type == NEURAL_NET_OUTPUT_SOFTMAX) {
+    double max = out[0];
+    for (unsigned long n = 1; n < count; n++) {
+      max = out[n] > max ? out[n] : max;
+    }
+    // The exponentials wait in pd, so normalizing, the loss and the
+    // gradient are one pass with one exp per output
+    double sum = 0.0;
+    for (unsigned long n = 0; n < count; n++) {
+      pd[n] = exp(out[n] - max);
+      sum += pd[n];
+    }
+    double lse = max + log(sum);
+    double scale = 1.0 / sum;
+    for (unsigned long n = 0; n < count; n++) {
+      double y = target->data[n];
+      error += y * (lse - out[n]);
+      out[n] = pd[n] * scale;
+      pd[n] = y - out[n];
+    }
+  } else {
+    for (unsigned long n = 0; n < count; n++) {
+      out[n] = 1.0 / (1.0 + exp(-out[n]));
+      double err = target->data[n] - out[n];
+      pd[n] = err * out[n] * (1.0 - out[n]);
+      error += 0.5 * err * err;
+    }
+  }
+  return error;
+}
+
+static void stage_forward(NeuralNetPipelineStage* stage, unsigned long m,
+    unsigned long first_sample, unsigned long samples) {
+  NeuralNetPipeline* pipe = stage->pipe;
+  NeuralNet* nn = pipe->nn;
+
+  for (unsigned long b = 0; b < samples; b++) {
+    unsigned long row = (m * pipe->micro_batch_size) + b;
+    unsigned long sample = first_sample + b;
+
+    if (stage->first_layer == 1) {
+      unsigned long in_count = nn->layers[0].count;
+      memcpy(&pipe->outs[0][row * in_count], pipe->inputs[sample]->data,
+          in_count * sizeof(double));
+    }
+
+    for (unsigned long l = stage->first_layer; l <= stage->last_layer; l++) {
+      unsigned long count = nn->layers[l].count;
+      unsigned long in_count = nn->layers[l-1].count;
+      unsigned long stride = in_count + 1;
+      double* in = &pipe->outs[l-1][row * in_count];
+      double* out = &pipe->outs[l][row * count];
+      double* w = &stage->weights[stage->offsets[l - stage->first_layer]];
+
+      for (unsigned long n = 0; n < count; n++, w += stride) {
+        double weighted_sum = w[0];
+        for (unsigned long i = 0; i < in_count; i++) {
+          weighted_sum += w[i + 1] * in[i];
+        }
+        out[n] = weighted_sum;
+      }
+
+      if (l == nn->out_layer) {
+        stage->error += output_error(nn, out, &pipe->errs[l][row * count],
+            pipe->targets[sample], count);
+      } else {
+        for (unsigned long n = 0; n < count; n++) {
+          out[n] = 1.0 / (1.0 + exp(-out[n]));
+        }
+      }
+    }
+  }
+}
+
+static void stage_backward(NeuralNetPipelineStage* stage, unsigned long m,
+    unsigned long samples) {
+  NeuralNetPipeline* pipe = stage->pipe;
+  NeuralNet* nn = pipe->nn;
+
+  for (unsigned long b = 0; b < samples; b++) {
+    unsigned long row = (m * pipe->micro_batch_size) + b;
+
+    for (unsigned long l = stage->last_layer; l >= stage->first_layer; l--) {
+      unsigned long count = nn->layers[l].count;
+      unsigned long in_count = nn->layers[l-1].count;
+      unsigned long stride = in_count + 1;
+      unsigned long off = stage->offsets[l - stage->first_layer];
+      double* in = &pipe->outs[l-1][row * in_count];
+      double* pd = &pipe->errs[l][row * count];
+
+      // Sum the gradient, it's applied at the end of the mini batch
+      double* g = &stage->grads[off];
+      for (unsigned long n = 0; n < count; n++, g += stride) {
+        double pd_err = pd[n];
+        g[0] += pd_err;
+        for (unsigned long i = 0; i < in_count; i++) {
+          g[i + 1] += pd_err * in[i];
+        }
+      }
+
+      if (l == 1) {
+        // The input layer has no pd_error
+        break;
+      }
+
+      // Propagate the pd_error to the previous layer using the weights
+      // the forward pass used
+      double* prev_pd = &pipe->errs[l-1][row * in_count];
+      double* w = &stage->weights[off];
+      memset(prev_pd, 0, in_count * sizeof(double));
+      for (unsigned long n = 0; n < count; n++, w += stride) {
+        double pd_err = pd[n];
+        for (unsigned long i = 0; i < in_count; i++) {
+          prev_pd[i] += pd_err * w[i + 1];
+        }
+      }
+      for (unsigned long i = 0; i < in_count; i++) {
+        prev_pd[i] *= in[i] * (1.0 - in[i]);
+      }
+    }
+  }
+}
+
+/** Apply the averaged gradient of a mini batch of samples */
+static void stage_update(NeuralNetPipelineStage* stage, unsigned long samples) {
+  NeuralNet* nn = stage->pipe->nn;
+  unsigned long params = stage->offsets[stage->last_layer - stage->first_layer + 1];
+  double scale = nn->learning_rate / (double)samples;
+  double momentum_factor = nn->momentum_factor;
+
+  for (unsigned long j = 0; j < params; j++) {
+    stage->momentums[j] = (scale * stage->grads[j])
+      + (momentum_factor * stage->momentums[j]);
+    stage->weights[j] += stage->momentums[j];
+    stage->grads[j] = 0.0;
+  }
+}
+
+static void stage_run(NeuralNetPipelineStage* stage) {
+  NeuralNetPipeline* pipe = stage->pipe;
+  unsigned long s = stage->index;
+  unsigned long last = pipe->stage_count - 1;
+  unsigned long batch = pipe->micro_batches * pipe->micro_batch_size;
+
+  stage->error = 0.0;
+  stage_pack(stage);
+
+  for (unsigned long start = 0; start < pipe->count; start += batch) {
+    unsigned long samples = pipe->count - start;
+    samples = samples < batch ? samples : batch;
+    unsigned long micro = (samples + pipe->micro_batch_size - 1) / pipe->micro_batch_size;
+
+    // GPipe runs every forward before the first backward. 1F1B only
+    // lets as many micro batches be in flight as there are stages after
+    // this one, which bounds the activations held and lets the last
+    // stage start backward immediately.
+    unsigned long in_flight;
+    if (pipe->schedule == NEURAL_NET_PIPELINE_GPIPE) {
+      in_flight = micro;
+    } else {
+      in_flight = last - s + 1;
+    }
+
+    unsigned long forwards = 0;
+    unsigned long backwards = 0;
+    while (backwards < micro) {
+      if ((forwards < micro) && ((forwards - backwards) < in_flight)) {
+        unsigned long m = (s == 0) ? forwards : ring_pop(&pipe->forward[s - 1]);
+        unsigned long first = m * pipe->micro_batch_size;
+        unsigned long count = samples - first;
+        count = count < pipe->micro_batch_size ? count : pipe->micro_batch_size;
+        stage_forward(stage, m, start + first, count);
+        if (s != last) {
+          ring_push(&pipe->forward[s], m);
+        }
+        forwards += 1;
+      } else {
+        unsigned long m = (s == last) ? backwards : ring_pop(&pipe->backward[s]);
+        unsigned long first = m * pipe->micro_batch_size;
+        unsigned long count = samples - first;
+        count = count < pipe->micro_batch_size ? count : pipe->micro_batch_size;
+        stage_backward(stage, m, count);
+        if (s != 0) {
+          ring_push(&pipe->backward[s - 1], m);
+        }
+        backwards += 1;
+      }
+    }
+
+    // The next mini batch is only forwarded after this, so every stage
+    // sees the same weights for all of a mini batch
+    stage_update(stage, samples);
+  }
+
+  stage_unpack(stage);
+}
+
+static void* stage_thread(void* arg) {
+  NeuralNetPipelineStage* stage = arg;
+  NeuralNetPipeline* pipe = stage->pipe;
+
+  if (pipe->pin) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(stage->index % (unsigned long)(cpus > 0 ? cpus : 1), &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+
+  pthread_mutex_lock(&pipe->lock);
+  for (;;) {
+    while ((stage->seen == pipe->generation) && !pipe->quit) {
+      pthread_cond_wait(&pipe->start_cond, &pipe->lock);
+    }
+    if (pipe->quit) {
+      break;
+    }
+    stage->seen = pipe->generation;
+    pthread_mutex_unlock(&pipe->lock);
+
+    stage_run(stage);
+
+    pthread_mutex_lock(&pipe->lock);
+    pipe->pending -= 1;
+    if (pipe->pending == 0) {
+      pthread_cond_signal(&pipe->done_cond);
+    }
+  }
+  pthread_mutex_unlock(&pipe->lock);
+
+  return NULL;
+}
+
+static double train(NeuralNetPipeline* pipe, Pattern** inputs,
+    Pattern** targets, unsigned long count) {
+  dbg("NeuralNetPipeline.train:+%p count=%ld\n", (void*)pipe, count);
+
+  // The stages train their own copies of the weights
+  NeuralNet_skip_flush(pipe->nn);
+
+  pthread_mutex_lock(&pipe->lock);
+  pipe->inputs = inputs;
+  pipe->targets = targets;
+  pipe->count = count;
+  pipe->pending = pipe->stage_count;
+  pipe->generation += 1;
+  pthread_cond_broadcast(&pipe->start_cond);
+  while (pipe->pending != 0) {
+    pthread_cond_wait(&pipe->done_cond, &pipe->lock);
+  }
+  pthread_mutex_unlock(&pipe->lock);
+
+  double error = pipe->stages[pipe->stage_count - 1].error;
+  pipe->nn->error = error;
+
+  dbg("NeuralNetPipeline.train:-%p error=%lf\n", (void*)pipe, error);
+  return error;
+}
+
+static void deinit(NeuralNetPipeline* pipe) {
+  dbg("NeuralNetPipeline.deinit:+%p\n", (void*)pipe);
+
+  if (pipe->stages != NULL) {
+    pthread_mutex_lock(&pipe->lock);
+    pipe->quit = 1;
+    pthread_cond_broadcast(&pipe->start_cond);
+    pthread_mutex_unlock(&pipe->lock);
+
+    for (unsigned long s = 0; s < pipe->stage_count; s++) {
+      NeuralNetPipelineStage* stage = &pipe->stages[s];
+      if (stage->started) {
+        pthread_join(stage->thread, NULL);
+        stage->started = 0;
+      }
+      free(stage->offsets);
+      free(stage->weights);
+      free(stage->momentums);
+      free(stage->grads);
+    }
+    free(pipe->stages);
+    pipe->stages = NULL;
+    pthread_cond_destroy(&pipe->done_cond);
+    pthread_cond_destroy(&pipe->start_cond);
+    pthread_mutex_destroy(&pipe->lock);
+  }
+  if (pipe->forward != NULL) {
+    for (unsigned long s = 0; s + 1 < pipe->stage_count; s++) {
+      free(pipe->forward[s].slots);
+      free(pipe->backward[s].slots);
+    }
+  }
+  free(pipe->forward);
+  free(pipe->backward);
+  pipe->forward = NULL;
+  pipe->backward = NULL;
+  if (pipe->outs != NULL) {
+    for (unsigned long l = 0; l <= pipe->nn->out_layer; l++) {
+      free(pipe->outs[l]);
+      free(pipe->errs[l]);
+    }
+  }
+  free(pipe->outs);
+  free(pipe->errs);
+  pipe->outs = NULL;
+  pipe->errs = NULL;
+
+  dbg("NeuralNetPipeline.deinit:-%p\n", (void*)pipe);
+}
+
+/**
+ * Split layers 1..out_layer into stage_count contiguous groups, cutting
+ * where the running parameter count passes the next equal share.
+ */
+static void partition(NeuralNetPipeline* pipe) {
+  NeuralNet* nn = pipe->nn;
+  unsigned long layers = nn->out_layer;
+  unsigned long total = 0;
+
+  for (unsigned long l = 1; l <= layers; l++) {
+    total += layer_params(nn, l);
+  }
+
+  unsigned long s = 0;
+  unsigned long sum = 0;
+  pipe->stages[0].first_layer = 1;
+  for (unsigned long l = 1; l <= layers; l++) {
+    sum += layer_params(nn, l);
+    unsigned long stages_left = pipe->stage_count - s - 1;
+    if ((stages_left > 0)
+        && (((sum * pipe->stage_count) >= (total * (s + 1))) || ((layers - l) == stages_left))) {
+      pipe->stages[s].last_layer = l;
+      s += 1;
+      pipe->stages[s].first_layer = l + 1;
+    }
+  }
+  pipe->stages[s].last_layer = layers;
+}
+
+Status NeuralNetPipeline_init(NeuralNetPipeline* pipe, NeuralNet* nn,
+    unsigned long stage_count, unsigned long micro_batches,
+    unsigned long micro_batch_size, unsigned long schedule) {
+  Status status;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+  dbg("NeuralNetPipeline_init:+%p nn=%p stage_count=%ld micro_batches=%ld"
+      " micro_batch_size=%ld schedule=%ld\n", (void*)pipe, (void*)nn,
+      stage_count, micro_batches, micro_batch_size, schedule);
+
+  memset(pipe, 0, sizeof(*pipe));
+  pipe->nn = nn;
+  pipe->micro_batches = micro_batches;
+  pipe->micro_batch_size = micro_batch_size;
+  pipe->schedule = schedule;
+  pipe->deinit = deinit;
+  pipe->train = train;
+
+  if ((micro_batches == 0) || (micro_batch_size == 0)
+      || (schedule > NEURAL_NET_PIPELINE_1F1B) || (nn->layers == NULL)) {
+    status = STATUS_BAD_PARAM;
+    goto done;
+  }
+  for (unsigned long l = 1; l <= nn->out_layer; l++) {
+    if ((nn->layers[l].conv != NULL) || (nn->layers[l].sparse != NULL)
+        || (nn->layers[l].half != NULL) || (nn->layers[l].mask != NULL)) {
+      status = STATUS_BAD_PARAM;
+      goto done;
+    }
+  }
+
+  if (stage_count == 0) {
+    stage_count = (cpus > 0) ? (unsigned long)cpus : 1;
+  }
+  if (stage_count > nn->out_layer) {
+    stage_count = nn->out_layer;
+  }
+  pipe->stage_count = stage_count;
+  pipe->pin = (cpus > 1) && (stage_count <= (unsigned long)cpus);
+
+  // Activation and pd_error storage for every sample of a mini batch
+  unsigned long rows = micro_batches * micro_batch_size;
+  pipe->outs = calloc(nn->out_layer + 1, sizeof(double*));
+  pipe->errs = calloc(nn->out_layer + 1, sizeof(double*));
+  if ((pipe->outs == NULL) || (pipe->errs == NULL)) {
+    status = STATUS_OOM;
+    goto done;
+  }
+  for (unsigned long l = 0; l <= nn->out_layer; l++) {
+    pipe->outs[l] = calloc(rows * nn->layers[l].count, sizeof(double));
+    pipe->errs[l] = calloc(rows * nn->layers[l].count, sizeof(double));
+    if ((pipe->outs[l] == NULL) || (pipe->errs[l] == NULL)) {
+      status = STATUS_OOM;
+      goto done;
+    }
+  }
+
+  if (stage_count > 1) {
+    pipe->forward = calloc(stage_count - 1, sizeof(NeuralNetPipelineRing));
+    pipe->backward = calloc(stage_count - 1, sizeof(NeuralNetPipelineRing));
+    if ((pipe->forward == NULL) || (pipe->backward == NULL)) {
+      status = STATUS_OOM;
+      goto done;
+    }
+    for (unsigned long s = 0; s + 1 < stage_count; s++) {
+      if (StatusErr(ring_init(&pipe->forward[s], micro_batches))
+          || StatusErr(ring_init(&pipe->backward[s], micro_batches))) {
+        status = STATUS_OOM;
+        goto done;
+      }
+    }
+  }
+
+  pipe->stages = calloc(stage_count, sizeof(NeuralNetPipelineStage));
+  if (pipe->stages == NULL) {
+    status = STATUS_OOM;
+    goto done;
+  }
+  pthread_mutex_init(&pipe->lock, NULL);
+  pthread_cond_init(&pipe->start_cond, NULL);
+  pthread_cond_init(&pipe->done_cond, NULL);
+  partition(pipe);
+
+  for (unsigned long s = 0; s < stage_count; s++) {
+    NeuralNetPipelineStage* stage = &pipe->stages[s];
+    unsigned long layers = stage->last_layer - stage->first_layer + 1;
+    stage->pipe = pipe;
+    stage->index = s;
+    stage->offsets = calloc(layers + 1, sizeof(unsigned long));
+    if (stage->offsets == NULL) {
+      status = STATUS_OOM;
+      goto done;
+    }
+    for (unsigned long i = 0; i < layers; i++) {
+      stage->offsets[i + 1] = stage->offsets[i]
+        + layer_params(nn, stage->first_layer + i);
+    }
+    stage->weights = calloc(stage->offsets[layers], sizeof(double));
+    stage->momentums = calloc(stage->offsets[layers], sizeof(double));
+    stage->grads = calloc(stage->offsets[layers], sizeof(double));
+    if ((stage->weights == NULL) || (stage->momentums == NULL)
+        || (stage->grads == NULL)) {
+      status = STATUS_OOM;
+      goto done;
+    }
+    dbg("NeuralNetPipeline_init: %p stage=%ld layers %ld..%ld params=%ld\n",
+        (void*)pipe, s, stage->first_layer, stage->last_layer, stage->offsets[layers]);
+  }
+
+  for (unsigned long s = 0; s < stage_count; s++) {
+    NeuralNetPipelineStage* stage = &pipe->stages[s];
+    if (pthread_create(&stage->thread, NULL, stage_thread, stage) != 0) {
+      status = STATUS_ERR;
+      goto done;
+    }
+    stage->started = 1;
+  }
+
+  status = STATUS_OK;
+
+done:
+  if (StatusErr(status)) {
+    deinit(pipe);
+  }
+  dbg("NeuralNetPipeline_init:-%p status=%d\n", (void*)pipe, StatusVal(status));
+  return status;
+}
@@ -0,0 +1,536 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "NeuralNet.h"
+#include "NeuralNetPop.h"
+#include "dbg.h"
+#include "rand0_1.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+// Alignment of the interleaved arrays, a cache line
+#define POP_ALIGN 64
+
+/**
+ * exp(x) in plain arithmetic so the lane loops vectorize, libm's exp
+ * is a call per lane. x = n*ln2 + r with |r| <= ln2/2, exp(r) is its
+ * degree 13 Taylor polynomial and 2^n is built in the exponent bits.
+ * Within 1 ulp of exp for x in [-708, 709], where 2^n stays normal, the
+ * caller clamps x in its own loop as a compare here stops vectorization.
+ */
+static inline double pop_exp(double x) {
+  const double round_shift = 6755399441055744.0; // 1.5 * 2^52
+  // n in the low bits of t, ln2 split so n * ln2_hi is exact
+  double t = (x * 1.4426950408889634) + round_shift;
+  double n = t - round_shift;
+  double r = (x - (n * 6.93147180369123816490e-01)) - (n * 1.90821492927058770002e-10);
+
+  double p = 1.0 / 6227020800.0;
+  p = (p * r) + (1.0 / 479001600.0);
+  p = (p * r) + (1.0 / 39916800.0);
+  p = (p * r) + (1.0 / 3628800.0);
+  p = (p * r) + (1.0 / 362880.0);
+  p = (p * r) + (1.0 / 40320.0);
+  p = (p * r) + (1.0 / 5040.0);
+  p = (p * r) + (1.0 / 720.0);
+  p = (p * r) + (1.0 / 120.0);
+  p = (p * r) + (1.0 / 24.0);
+  p = (p * r) + (1.0 / 6.0);
+  p = (p * r) + 0.5;
+  p = (p * r) + 1.0;
+  p = (p * r) + 1.0;
+
+  uint64_t bits;
+  memcpy(&bits, &t, sizeof(bits));
+  bits = (bits << 52) + ((uint64_t)1023 << 52);
+  double scale;
+  memcpy(&scale, &bits, sizeof(scale));
+  return p * scale;
+}
+
+// Forward declarations
+static NeuralNetPop_Step pop_step_select(void);
+static void NeuralNetPop_deinit(NeuralNetPop* pop);
+static unsigned long NeuralNetPop_train_epoch(NeuralNetPop* pop,
+    Pattern** inputs, Pattern** targets, unsigned int pattern_count);
+static Status NeuralNetPop_extract(NeuralNetPop* pop, unsigned long k,
+    NeuralNet* nn);
+
+static void* pop_alloc(unsigned long count, unsigned long size) {
+  // Round up so aligned_alloc gets a multiple of the alignment
+  unsigned long bytes = ((count * size) + POP_ALIGN - 1) & ~(unsigned long)(POP_ALIGN - 1);
+  if (bytes == 0) {
+    bytes = POP_ALIGN;
+  }
+  void* p = aligned_alloc(POP_ALIGN, bytes);
+  if (p != NULL) {
+    memset(p, 0, bytes);
+  }
+  return p;
+}
+
+/**
+ * Per network data order generator, splitmix64 returning
+ * a double >= 0.0 and < 1.0.
+ */
+static double pop_rand0_1(unsigned long* state) {
+  unsigned long z = (*state += 0x9E3779B97F4A7C15UL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9UL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBUL;
+  z = z ^ (z >> 31);
+  return (double)(z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+Status NeuralNetPop_init(NeuralNetPop* pop, unsigned long width,
+    unsigned long num_layers, unsigned long* counts, unsigned long seed) {
+  Status status;
+
+  dbg("NeuralNetPop_init:+%p width=%ld num_layers=%ld seed=%ld\n",
+      (void*)pop, width, num_layers, seed);
+
+  memset(pop, 0, sizeof(*pop));
+  pop->deinit = NeuralNetPop_deinit;
+  pop->train_epoch = NeuralNetPop_train_epoch;
+  pop->extract = NeuralNetPop_extract;
+  pop->step = pop_step_select();
+
+  if ((width == 0) || (num_layers < 2) || (counts == NULL)) {
+    status = STATUS_BAD_PARAM;
+    goto done;
+  }
+
+  pop->width = width;
+  pop->stride = ((width + NEURAL_NET_POP_LANES - 1) / NEURAL_NET_POP_LANES)
+      * NEURAL_NET_POP_LANES;
+  pop->num_layers = num_layers;
+  pop->learning_rate = 0.5;
+  pop->momentum_factor = 0.9;
+  pop->error_threshold = 0.0004;
+
+  pop->counts = calloc(num_layers, sizeof(unsigned long));
+  pop->neuron_base = calloc(num_layers, sizeof(unsigned long));
+  pop->weight_base = calloc(num_layers, sizeof(unsigned long));
+  if ((pop->counts == NULL) || (pop->neuron_base == NULL)
+      || (pop->weight_base == NULL)) {
+    status = STATUS_OOM;
+    goto done;
+  }
+
+  // Compute where each layer's neurons and weights start
+  for (unsigned long l = 0; l < num_layers; l++) {
+    if (counts[l] == 0) {
+      status = STATUS_BAD_PARAM;
+      goto done;
+    }
+    pop->counts[l] = counts[l];
+    pop->neuron_base[l] = pop->num_neurons;
+    pop->weight_base[l] = pop->num_weights;
+    pop->num_neurons += counts[l];
+    if (l > 0) {
+      // Each neuron has a weight per input plus the bias
+      pop->num_weights += counts[l] * (counts[l-1] + 1);
+    }
+  }
+
+  unsigned long stride = pop->stride;
+  pop->weights = pop_alloc(pop->num_weights * stride, sizeof(double));
+  pop->momentums = pop_alloc(pop->num_weights * stride, sizeof(double));
+  pop->outputs = pop_alloc(pop->num_neurons * stride, sizeof(double));
+  pop->pd_errors = pop_alloc(pop->num_neurons * stride, sizeof(double));
+  pop->scratch = pop_alloc(stride, sizeof(double));
+  pop->sample_errors = pop_alloc(stride, sizeof(double));
+  pop->errors = pop_alloc(stride, sizeof(double));
+  pop->epochs = pop_alloc(stride, sizeof(unsigned long));
+  pop->rand_state = pop_alloc(stride, sizeof(unsigned long));
+  pop->lane_pattern = pop_alloc(stride, sizeof(unsigned int));
+  pop->active = pop_alloc(stride, sizeof(unsigned char));
+  if ((pop->weights == NULL) || (pop->momentums == NULL)
+      || (pop->outputs == NULL) || (pop->pd_errors == NULL)
+      || (pop->scratch == NULL) || (pop->sample_errors == NULL)
+      || (pop->errors == NULL) || (pop->epochs == NULL)
+      || (pop->rand_state == NULL) || (pop->lane_pattern == NULL)
+      || (pop->active == NULL)) {
+    status = STATUS_OOM;
+    goto done;
+  }
+
+  // Initialize weights >= -0.5 and < 0.5 in the same order
+  // NeuralNet_start would for each network in turn.
+  for (unsigned long k = 0; k < width; k++) {
+    for (unsigned long w = 0; w < pop->num_weights; w++) {
+      pop->weights[(w * stride) + k] = rand0_1() - 0.5;
+    }
+    pop->rand_state[k] = seed + (k * 0x632BE59BD9B4E019UL);
+    pop->active[k] = 1;
+  }
+
+  status = STATUS_OK;
+
+done:
+  if (StatusErr(status)) {
+    NeuralNetPop_deinit(pop);
+  }
+  dbg("NeuralNetPop_init:-%p status=%d\n", (void*)pop, StatusVal(status));
+  return status;
+}
+
+static void NeuralNetPop_deinit(NeuralNetPop* pop) {
+  dbg("NeuralNetPop_deinit:+%p\n", (void*)pop);
+
+  free(pop->counts);
+  free(pop->neuron_base);
+  free(pop->weight_base);
+  free(pop->weights);
+  free(pop->momentums);
+  free(pop->outputs);
+  free(pop->pd_errors);
+  free(pop->scratch);
+  free(pop->sample_errors);
+  free(pop->errors);
+  free(pop->epochs);
+  free(pop->rand_state);
+  free(pop->perms);
+  free(pop->lane_pattern);
+  free(pop->active);
+  pop->counts = NULL;
+  pop->neuron_base = NULL;
+  pop->weight_base = NULL;
+  pop->weights = NULL;
+  pop->momentums = NULL;
+  pop->outputs = NULL;
+  pop->pd_errors = NULL;
+  pop->scratch = NULL;
+  pop->sample_errors = NULL;
+  pop->errors = NULL;
+  pop->epochs = NULL;
+  pop->rand_state = NULL;
+  pop->perms = NULL;
+  pop->lane_pattern = NULL;
+  pop->active = NULL;
+  pop->width = 0;
+  pop->num_layers = 0;
+
+  dbg("NeuralNetPop_deinit:-%p\n", (void*)pop);
+}
+
+/**
+ * Shuffle each active network's data order the same way
+ * test-nn does, reset to sequential then swap each position
+ * with a random later one.
+ */
+static void pop_shuffle(NeuralNetPop* pop) {
+  unsigned long count = pop->perm_count;
+
+  for (unsigned long k = 0; k < pop->width; k++) {
+    if (!pop->active[k]) {
+      continue;
+    }
+    unsigned int* perm = &pop->perms[k * count];
+    for (unsigned long p = 0; p < count; p++) {
+      perm[p] = (unsigned int)p;
+    }
+    for (unsigned long p = 0; p < count; p++) {
+      double r0_1 = pop_rand0_1(&pop->rand_state[k]);
+      unsigned long rp = p + (unsigned long)(r0_1 * (double)(count - p));
+      unsigned int t = perm[p];
+      perm[p] = perm[rp];
+      perm[rp] = t;
+    }
+  }
+}
+
+static void pop_process(NeuralNetPop* pop) {
+  unsigned long stride = pop->stride;
+  double* restrict sum = pop->scratch;
+
+  for (unsigned long l = 1; l < pop->num_layers; l++) {
+    unsigned long in_count = pop->counts[l-1];
+    double* in = &pop->outputs[pop->neuron_base[l-1] * stride];
+    double* out = &pop->outputs[pop->neuron_base[l] * stride];
+    double* w = &pop->weights[pop->weight_base[l] * stride];
+
+    for (unsigned long n = 0; n < pop->counts[l]; n++) {
+      // Start with the bias
+      for (unsigned long k = 0; k < stride; k++) {
+        sum[k] = w[k];
+      }
+      w += stride;
+
+      for (unsigned long i = 0; i < in_count; i++) {
+        double* restrict x = &in[i * stride];
+        double* restrict wi = w;
+        for (unsigned long k = 0; k < stride; k++) {
+          sum[k] += wi[k] * x[k];
+        }
+        w += stride;
+      }
+
+      // Calcuate the output using a Sigmoidal Activation function
+      for (unsigned long k = 0; k < stride; k++) {
+        double x = -sum[k];
+        x = x < -708.0 ? -708.0 : x;
+        sum[k] = x > 709.0 ? 709.0 : x;
+      }
+      double* restrict o = &out[n * stride];
+      for (unsigned long k = 0; k < stride; k++) {
+        o[k] = 1.0 / (1.0 + pop_exp(sum[k]));
+      }
+    }
+  }
+}
+
+static void pop_backprop(NeuralNetPop* pop, Pattern** targets) {
+  unsigned long stride = pop->stride;
+  unsigned long out_layer = pop->num_layers - 1;
+  double* restrict sample_errors = pop->sample_errors;
+
+  // Output layer pd_error and the error of this pattern
+  for (unsigned long k = 0; k < stride; k++) {
+    sample_errors[k] = 0.0;
+  }
+  for (unsigned long n = 0; n < pop->counts[out_layer]; n++) {
+    double* restrict o = &pop->outputs[(pop->neuron_base[out_layer] + n) * stride];
+    double* restrict pd = &pop->pd_errors[(pop->neuron_base[out_layer] + n) * stride];
+    for (unsigned long k = 0; k < pop->width; k++) {
+      double err = targets[pop->lane_pattern[k]]->data[n] - o[k];
+      pd[k] = err * o[k] * (1.0 - o[k]);
+      sample_errors[k] = sample_errors[k] + (0.5 * err * err);
+    }
+  }
+
+  // Back propagate the pd_error to the hidden layers
+  for (unsigned long l = out_layer; l > 1; l--) {
+    unsigned long prev_count = pop->counts[l-1];
+    double* restrict sum = pop->scratch;
+
+    for (unsigned long npl = 0; npl < prev_count; npl++) {
+      for (unsigned long k = 0; k < stride; k++) {
+        sum[k] = 0.0;
+      }
+      for (unsigned long ncl = 0; ncl < pop->counts[l]; ncl++) {
+        double* restrict pd = &pop->pd_errors[(pop->neuron_base[l] + ncl) * stride];
+        double* restrict w = &pop->weights[(pop->weight_base[l]
+            + (ncl * (prev_count + 1)) + npl + 1) * stride];
+        for (unsigned long k = 0; k < stride; k++) {
+          sum[k] += pd[k] * w[k];
+        }
+      }
+      double* restrict o = &pop->outputs[(pop->neuron_base[l-1] + npl) * stride];
+      double* restrict pd_prev = &pop->pd_errors[(pop->neuron_base[l-1] + npl) * stride];
+      for (unsigned long k = 0; k < stride; k++) {
+        pd_prev[k] = sum[k] * (o[k] * (1.0 - o[k]));
+      }
+    }
+  }
+}
+
+static void pop_adjust_weights(NeuralNetPop* pop) {
+  unsigned long stride = pop->stride;
+  double eta = pop->learning_rate;
+  double alpha = pop->momentum_factor;
+  unsigned char* restrict active = pop->active;
+
+  for (unsigned long l = 1; l < pop->num_layers; l++) {
+    unsigned long in_count = pop->counts[l-1];
+    double* in = &pop->outputs[pop->neuron_base[l-1] * stride];
+    double* w = &pop->weights[pop->weight_base[l] * stride];
+    double* m = &pop->momentums[pop->weight_base[l] * stride];
+
+    for (unsigned long n = 0; n < pop->counts[l]; n++) {
+      double* restrict pd = &pop->pd_errors[(pop->neuron_base[l] + n) * stride];
+
+      // Update the bias, converged networks are left unchanged
+      double* restrict wb = w;
+      double* restrict mb = m;
+      for (unsigned long k = 0; k < stride; k++) {
+        double momentum = (eta * pd[k]) + (alpha * mb[k]);
+        mb[k] = active[k] ? momentum : mb[k];
+        wb[k] = active[k] ? wb[k] + momentum : wb[k];
+      }
+      w += stride;
+      m += stride;
+
+      for (unsigned long i = 0; i < in_count; i++) {
+        double* restrict x = &in[i * stride];
+        double* restrict wi = w;
+        double* restrict mi = m;
+        for (unsigned long k = 0; k < stride; k++) {
+          double momentum = (eta * x[k] * pd[k]) + (alpha * mi[k]);
+          mi[k] = active[k] ? momentum : mi[k];
+          wi[k] = active[k] ? wi[k] + momentum : wi[k];
+        }
+        w += stride;
+        m += stride;
+      }
+    }
+  }
+}
+
+/**
+ * One pattern through the lane loops. The loops are the same for
+ * each variant, flatten inlines them so the compiler vectorizes
+ * them as wide as the variant's target allows.
+ */
+__attribute__((flatten))
+static void pop_step_c(NeuralNetPop* pop, Pattern** targets) {
+  pop_process(pop);
+  pop_backprop(pop, targets);
+  pop_adjust_weights(pop);
+}
+
+#if defined(__x86_64__)
+
+#define AVX2 __attribute__((target("avx2,fma")))
+
+AVX2 __attribute__((flatten))
+static void pop_step_avx2(NeuralNetPop* pop, Pattern** targets) {
+  pop_process(pop);
+  pop_backprop(pop, targets);
+  pop_adjust_weights(pop);
+}
+
+// avx512bw turns the active bytes into lane masks, without it the
+// masked updates are done a lane at a time
+#define AVX512 __attribute__((target("avx512f,avx512bw")))
+
+AVX512 __attribute__((flatten))
+static void pop_step_avx512(NeuralNetPop* pop, Pattern** targets) {
+  pop_process(pop);
+  pop_backprop(pop, targets);
+  pop_adjust_weights(pop);
+}
+
+#endif
+
+/** The widest pop_step_* the CPU supports */
+static NeuralNetPop_Step pop_step_select(void) {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+    return pop_step_avx512;
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return pop_step_avx2;
+  }
+#endif
+  return pop_step_c;
+}
+
+static unsigned long NeuralNetPop_train_epoch(NeuralNetPop* pop,
+    Pattern** inputs, Pattern** targets, unsigned int pattern_count) {
+  unsigned long stride = pop->stride;
+  unsigned long remaining = 0;
+
+  dbg("NeuralNetPop_train_epoch:+%p pattern_count=%d\n", (void*)pop, pattern_count);
+
+  if (pattern_count != pop->perm_count) {
+    free(pop->perms);
+    pop->perm_count = 0;
+    pop->perms = pop_alloc(stride * pattern_count, sizeof(unsigned int));
+    if (pop->perms == NULL) {
+      goto done;
+    }
+    pop->perm_count = pattern_count;
+  }
+
+  pop_shuffle(pop);
+  for (unsigned long k = 0; k < pop->width; k++) {
+    if (pop->active[k]) {
+      pop->errors[k] = 0.0;
+    }
+  }
+
+  for (unsigned long t = 0; t < pattern_count; t++) {
+    // Each network sets its inputs from the pattern its own order selects
+    for (unsigned long k = 0; k < pop->width; k++) {
+      pop->lane_pattern[k] = pop->perms[(k * pattern_count) + t];
+    }
+    for (unsigned long i = 0; i < pop->counts[0]; i++) {
+      double* x = &pop->outputs[i * stride];
+      for (unsigned long k = 0; k < pop->width; k++) {
+        x[k] = inputs[pop->lane_pattern[k]]->data[i];
+      }
+    }
+
+    pop->step(pop, targets);
+
+    for (unsigned long k = 0; k < pop->width; k++) {
+      if (pop->active[k]) {
+        pop->errors[k] += pop->sample_errors[k];
+      }
+    }
+  }
+
+  // Networks that reached the error_threshold stop training
+  for (unsigned long k = 0; k < pop->width; k++) {
+    if (pop->active[k]) {
+      pop->epochs[k] += 1;
+      if (pop->errors[k] < pop->error_threshold) {
+        pop->active[k] = 0;
+      } else {
+        remaining += 1;
+      }
+    }
+  }
+
+done:
+  dbg("NeuralNetPop_train_epoch:-%p remaining=%ld\n", (void*)pop, remaining);
+  return remaining;
+}
+
+static Status NeuralNetPop_extract(NeuralNetPop* pop, unsigned long k,
+    NeuralNet* nn) {
+  Status status;
+
+  dbg("NeuralNetPop_extract:+%p k=%ld nn=%p\n", (void*)pop, k, (void*)nn);
+
+  if ((k >= pop->width) || ((nn->out_layer + 1) != pop->num_layers)) {
+    status = STATUS_BAD_PARAM;
+    goto done;
+  }
+  for (unsigned long l = 0; l < pop->num_layers; l++) {
+    if ((nn->layers[l].count != pop->counts[l]) || (nn->layers[l].sparse != NULL)
+        || (nn->layers[l].half != NULL) || (nn->layers[l].conv != NULL)
+        || (nn->layers[l].mask != NULL)) {
+      status = STATUS_BAD_PARAM;
+      goto done;
+    }
+  }
+
+  // Copy network k's weights and momentums into nn
+  for (unsigned long l = 1; l < pop->num_layers; l++) {
+    unsigned long w = pop->weight_base[l];
+    for (unsigned long n = 0; n < pop->counts[l]; n++) {
+      Neuron* neuron = &nn->layers[l].neurons[n];
+      for (unsigned long i = 0; i <= pop->counts[l-1]; i++) {
+        neuron->weights[i] = pop->weights[(w * pop->stride) + k];
+        neuron->momentums[i] = pop->momentums[(w * pop->stride) + k];
+        w += 1;
+      }
+    }
+  }
+  nn->error = pop->errors[k];
+
+  status = STATUS_OK;
+
+done:
+  dbg("NeuralNetPop_extract:-%p status=%d\n", (void*)pop, StatusVal(status));
+  return status;
+}
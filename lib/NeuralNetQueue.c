@@ -0,0 +1,351 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "NeuralNet.h"
+#include "NeuralNetQueue.h"
+#include "dbg.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CACHE_LINE 64
+#define READ_BUF_BYTES (64 * 1024)
+#define CLOSED (1UL << 63)    // Set in tail by close
+
+/**
+ * Header of a slot, it's followed by the input then the target values.
+ * seq == pos when the slot is free for the push at pos and
+ * seq == pos + 1 when it holds the sample for the pop at pos.
+ */
+typedef struct Slot {
+  atomic_ulong seq;
+  unsigned long time_ns;      // When it was pushed
+} Slot;
+
+static unsigned long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((unsigned long)ts.tv_sec * 1000000000UL) + (unsigned long)ts.tv_nsec;
+}
+
+static Slot* slot_at(NeuralNetQueue* q, unsigned long pos) {
+  Slot* slots = (Slot*)(void*)q->slots;
+  return &slots[(pos & q->mask) * (q->slot_bytes / sizeof(Slot))];
+}
+
+static double* slot_data(Slot* slot) {
+  return (double*)(void*)(slot + 1);
+}
+
+/** Spin briefly, then yield, then sleep while waiting on the other side */
+static void backoff(unsigned long* spins) {
+  if (*spins < 64) {
+    atomic_signal_fence(memory_order_seq_cst);
+  } else if (*spins < 128) {
+    sched_yield();
+  } else {
+    struct timespec ts = { .tv_sec = 0, .tv_nsec = 50000 };
+    nanosleep(&ts, NULL);
+  }
+  *spins += 1;
+}
+
+/**
+ * Claim the next position to push, NULL if the queue is full or closed.
+ * Closing changes tail, so the claim can't succeed after a close.
+ */
+static Slot* claim_push(NeuralNetQueue* q, unsigned long* pos_out) {
+  unsigned long pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+  for (;;) {
+    if (pos & CLOSED) {
+      return NULL;
+    }
+    Slot* slot = slot_at(q, pos);
+    unsigned long seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    long dif = (long)(seq - pos);
+    if (dif == 0) {
+      if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1,
+            memory_order_relaxed, memory_order_relaxed)) {
+        *pos_out = pos;
+        return slot;
+      }
+    } else if (dif < 0) {
+      return NULL;
+    } else {
+      pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    }
+  }
+}
+
+/** Claim the next position to pop, NULL if the queue is empty */
+static Slot* claim_pop(NeuralNetQueue* q, unsigned long* pos_out) {
+  unsigned long pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+  for (;;) {
+    Slot* slot = slot_at(q, pos);
+    unsigned long seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    long dif = (long)(seq - (pos + 1));
+    if (dif == 0) {
+      if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1,
+            memory_order_relaxed, memory_order_relaxed)) {
+        *pos_out = pos;
+        return slot;
+      }
+    } else if (dif < 0) {
+      return NULL;
+    } else {
+      pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    }
+  }
+}
+
+static Status push_data(NeuralNetQueue* q, const double* input,
+    const double* target, int wait) {
+  unsigned long spins = 0;
+  unsigned long pos;
+  Slot* slot;
+
+  for (;;) {
+    slot = claim_push(q, &pos);
+    if (slot != NULL) {
+      break;
+    }
+    if (atomic_load_explicit(&q->tail, memory_order_relaxed) & CLOSED) {
+      return STATUS_ERR;
+    }
+    if (!wait) {
+      return STATUS_ERR;
+    }
+    if (spins == 0) {
+      atomic_fetch_add_explicit(&q->full_waits, 1, memory_order_relaxed);
+    }
+    backoff(&spins);
+  }
+
+  double* data = slot_data(slot);
+  memcpy(data, input, q->input_count * sizeof(double));
+  memcpy(&data[q->input_count], target, q->target_count * sizeof(double));
+  slot->time_ns = now_ns();
+  atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+  atomic_fetch_add_explicit(&q->pushed, 1, memory_order_relaxed);
+
+  return STATUS_OK;
+}
+
+static Status pop_data(NeuralNetQueue* q, Pattern* input, Pattern* target,
+    int wait) {
+  unsigned long spins = 0;
+  unsigned long pos;
+  Slot* slot;
+
+  for (;;) {
+    slot = claim_pop(q, &pos);
+    if (slot != NULL) {
+      break;
+    }
+    if (!wait) {
+      return STATUS_ERR;
+    }
+    unsigned long tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+    if ((tail & CLOSED)
+        && (atomic_load_explicit(&q->head, memory_order_relaxed) == (tail & ~CLOSED))) {
+      // Every position claimed before the close has been popped
+      return STATUS_ERR;
+    }
+    if (spins == 0) {
+      atomic_fetch_add_explicit(&q->empty_waits, 1, memory_order_relaxed);
+    }
+    backoff(&spins);
+  }
+
+  double* data = slot_data(slot);
+  memcpy(input->data, data, q->input_count * sizeof(double));
+  memcpy(target->data, &data[q->input_count], q->target_count * sizeof(double));
+  unsigned long lag = now_ns() - slot->time_ns;
+  atomic_store_explicit(&slot->seq, pos + q->mask + 1, memory_order_release);
+
+  atomic_fetch_add_explicit(&q->popped, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&q->lag_ns_sum, lag, memory_order_relaxed);
+  unsigned long max = atomic_load_explicit(&q->lag_ns_max, memory_order_relaxed);
+  while ((lag > max) && !atomic_compare_exchange_weak_explicit(&q->lag_ns_max,
+        &max, lag, memory_order_relaxed, memory_order_relaxed)) {
+  }
+
+  return STATUS_OK;
+}
+
+static int counts_ok(NeuralNetQueue* q, Pattern* input, Pattern* target) {
+  return (input->count == q->input_count) && (target->count == q->target_count);
+}
+
+static Status push(NeuralNetQueue* q, Pattern* input, Pattern* target) {
+  if (!counts_ok(q, input, target)) {
+    return STATUS_BAD_PARAM;
+  }
+  return push_data(q, input->data, target->data, 1);
+}
+
+static Status try_push(NeuralNetQueue* q, Pattern* input, Pattern* target) {
+  if (!counts_ok(q, input, target)) {
+    return STATUS_BAD_PARAM;
+  }
+  return push_data(q, input->data, target->data, 0);
+}
+
+static Status pop(NeuralNetQueue* q, Pattern* input, Pattern* target) {
+  if (!counts_ok(q, input, target)) {
+    return STATUS_BAD_PARAM;
+  }
+  return pop_data(q, input, target, 1);
+}
+
+static Status try_pop(NeuralNetQueue* q, Pattern* input, Pattern* target) {
+  if (!counts_ok(q, input, target)) {
+    return STATUS_BAD_PARAM;
+  }
+  return pop_data(q, input, target, 0);
+}
+
+static void close_queue(NeuralNetQueue* q) {
+  dbg("NeuralNetQueue.close:+-%p\n", (void*)q);
+  atomic_fetch_or_explicit(&q->tail, CLOSED, memory_order_release);
+}
+
+static void stats(NeuralNetQueue* q, NeuralNetQueueStats* s) {
+  s->pushed = atomic_load_explicit(&q->pushed, memory_order_relaxed);
+  s->popped = atomic_load_explicit(&q->popped, memory_order_relaxed);
+  s->depth = (s->pushed > s->popped) ? s->pushed - s->popped : 0;
+  s->full_waits = atomic_load_explicit(&q->full_waits, memory_order_relaxed);
+  s->empty_waits = atomic_load_explicit(&q->empty_waits, memory_order_relaxed);
+  s->lag_ns_max = atomic_load_explicit(&q->lag_ns_max, memory_order_relaxed);
+  unsigned long lag_sum = atomic_load_explicit(&q->lag_ns_sum, memory_order_relaxed);
+  s->lag_ns_avg = (s->popped != 0) ? (double)lag_sum / (double)s->popped : 0.0;
+  s->elapsed_sec = (double)(now_ns() - q->start_ns) / 1.0e9;
+  s->throughput = (s->elapsed_sec > 0.0) ? (double)s->popped / s->elapsed_sec : 0.0;
+}
+
+static void deinit(NeuralNetQueue* q) {
+  dbg("NeuralNetQueue.deinit:+%p\n", (void*)q);
+  free(q->slots);
+  q->slots = NULL;
+  dbg("NeuralNetQueue.deinit:-%p\n", (void*)q);
+}
+
+Status NeuralNetQueue_init(NeuralNetQueue* q, unsigned long capacity,
+    unsigned long input_count, unsigned long target_count) {
+  Status status;
+
+  dbg("NeuralNetQueue_init:+%p capacity=%ld input_count=%ld target_count=%ld\n",
+      (void*)q, capacity, input_count, target_count);
+
+  memset(q, 0, sizeof(*q));
+  q->deinit = deinit;
+  q->push = push;
+  q->try_push = try_push;
+  q->pop = pop;
+  q->try_pop = try_pop;
+  q->close = close_queue;
+  q->stats = stats;
+
+  if ((capacity == 0) || (input_count == 0)) {
+    status = STATUS_BAD_PARAM;
+    goto done;
+  }
+
+  q->cap = 1;
+  while (q->cap < capacity) {
+    q->cap <<= 1;
+  }
+  q->mask = q->cap - 1;
+  q->input_count = input_count;
+  q->target_count = target_count;
+
+  // Round slots up to whole cache lines so neighbouring
+  // producers and consumers don't share one
+  q->slot_bytes = sizeof(Slot) + ((input_count + target_count) * sizeof(double));
+  q->slot_bytes = (q->slot_bytes + CACHE_LINE - 1) & ~(unsigned long)(CACHE_LINE - 1);
+  q->slots = aligned_alloc(CACHE_LINE, q->cap * q->slot_bytes);
+  if (q->slots == NULL) {
+    status = STATUS_OOM;
+    goto done;
+  }
+  for (unsigned long pos = 0; pos < q->cap; pos++) {
+    atomic_init(&slot_at(q, pos)->seq, pos);
+  }
+  q->start_ns = now_ns();
+
+  status = STATUS_OK;
+
+done:
+  dbg("NeuralNetQueue_init:-%p status=%d\n", (void*)q, StatusVal(status));
+  return status;
+}
+
+Status NeuralNetQueue_read_fd(NeuralNetQueue* q, int fd) {
+  Status status;
+  unsigned long row_count = q->input_count + q->target_count;
+  unsigned long row_bytes = row_count * sizeof(double);
+  unsigned long rows = READ_BUF_BYTES / row_bytes;
+  unsigned long have = 0;
+  double* buf;
+
+  dbg("NeuralNetQueue_read_fd:+%p fd=%d\n", (void*)q, fd);
+
+  if (rows == 0) {
+    rows = 1;
+  }
+  buf = malloc(rows * row_bytes);
+  if (buf == NULL) {
+    status = STATUS_OOM;
+    goto done;
+  }
+
+  for (;;) {
+    ssize_t got = read(fd, (char*)buf + have, (rows * row_bytes) - have);
+    if (got < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      status = STATUS_ERR;
+      goto done;
+    }
+    if (got == 0) {
+      // End of file, there must not be a partial row left over
+      status = (have == 0) ? STATUS_OK : STATUS_ERR;
+      goto done;
+    }
+    have += (unsigned long)got;
+
+    unsigned long complete = have / row_bytes;
+    for (unsigned long r = 0; r < complete; r++) {
+      double* row = &buf[r * row_count];
+      status = push_data(q, row, &row[q->input_count], 1);
+      if (StatusErr(status)) goto done;
+    }
+    have -= complete * row_bytes;
+    memmove(buf, &buf[complete * row_count], have);
+  }
+
+done:
+  free(buf);
+  dbg("NeuralNetQueue_read_fd:-%p status=%d\n", (void*)q, StatusVal(status));
+  return status;
+}
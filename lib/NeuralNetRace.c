@@ -0,0 +1,401 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "NeuralNet.h"
+#include "NeuralNetRace.h"
+#include "NeuralNetTrain.h"
+#include "dbg.h"
+#include "rand0_1.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static char* state_names[] = { "running", "won", "lost", "spent", "failed" };
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + ((double)ts.tv_nsec / 1.0e9);
+}
+
+/** Start a fresh run of the racer's network seeded with r->seed */
+static Status run_start(NeuralNetRacer* r) {
+  Status status;
+  NeuralNetRaceSpec* spec = &r->race->spec;
+
+  if (r->started) {
+    r->nn.deinit(&r->nn);
+    r->started = 0;
+  }
+
+  rand0_1_seed((unsigned int)r->seed);
+  status = NeuralNet_init(&r->nn, spec->inputs[0]->count, 1, spec->targets[0]->count);
+  if (StatusErr(status)) goto done;
+  r->started = 1;
+  r->nn.alloc_mode = spec->alloc_mode;
+  r->nn.weight_type = spec->weight_type;
+  status = r->nn.add_hidden(&r->nn, spec->hidden);
+  if (StatusErr(status)) goto done;
+  status = r->nn.start(&r->nn);
+  if (StatusErr(status)) goto done;
+  r->nn.learning_rate = spec->learning_rate;
+  r->nn.momentum_factor = spec->momentum_factor;
+
+  atomic_store_explicit(&r->epochs, 0, memory_order_relaxed);
+  atomic_store_explicit(&r->error, (double)INFINITY, memory_order_relaxed);
+  atomic_store_explicit(&r->run, r->runs, memory_order_release);
+  r->runs += 1;
+
+  status = STATUS_OK;
+
+done:
+  return status;
+}
+
+/** Train one run, returns 1 if it finished the race and 0 if it was abandoned */
+static int run_train(NeuralNetRacer* r) {
+  NeuralNetRace* race = r->race;
+  NeuralNetRaceSpec* spec = &race->spec;
+  unsigned long run = r->runs - 1;
+  unsigned long epochs = 0;
+  double window_error = (double)INFINITY;
+
+  for (;;) {
+    if (atomic_load_explicit(&race->won, memory_order_acquire) >= 0) {
+      atomic_store_explicit(&r->state, NEURAL_NET_RACE_LOST, memory_order_release);
+      return 1;
+    }
+
+    double error = NeuralNet_train_epoch(&r->nn, spec->inputs, spec->targets,
+        r->output, r->perm, (unsigned int)spec->pattern_count);
+    epochs += 1;
+    r->total_epochs += 1;
+    atomic_store_explicit(&r->error, error, memory_order_relaxed);
+    atomic_store_explicit(&r->epochs, epochs, memory_order_relaxed);
+
+    if (error < spec->error_threshold) {
+      long none = -1;
+      if (atomic_compare_exchange_strong(&race->won, &none, (long)r->index)) {
+        atomic_store_explicit(&r->state, NEURAL_NET_RACE_WON, memory_order_release);
+      } else {
+        atomic_store_explicit(&r->state, NEURAL_NET_RACE_LOST, memory_order_release);
+      }
+      return 1;
+    }
+
+    // A run has to improve by stall_improvement every window
+    if ((spec->stall_epochs > 0) && ((epochs % spec->stall_epochs) == 0)) {
+      if (!(error < (window_error * (1.0 - spec->stall_improvement)))) {
+        r->stalls += 1;
+        return 0;
+      }
+      window_error = error;
+    }
+    if ((spec->max_epochs > 0) && (epochs >= spec->max_epochs)) {
+      r->stalls += 1;
+      return 0;
+    }
+    if (atomic_load_explicit(&r->abandon, memory_order_relaxed) == run + 1) {
+      r->straggles += 1;
+      return 0;
+    }
+  }
+}
+
+static void* racer_thread(void* arg) {
+  NeuralNetRacer* r = arg;
+  NeuralNetRace* race = r->race;
+  NeuralNetRaceSpec* spec = &race->spec;
+
+  double start = now_sec();
+  r->status = run_start(r);
+  while (StatusOk(r->status)) {
+    if (run_train(r)) {
+      break;
+    }
+    if (atomic_fetch_add(&race->restarts, 1) >= spec->max_restarts) {
+      atomic_store_explicit(&r->state, NEURAL_NET_RACE_SPENT, memory_order_release);
+      break;
+    }
+    r->seed = atomic_fetch_add(&race->next_seed, 1);
+    r->status = run_start(r);
+  }
+  if (StatusErr(r->status)) {
+    atomic_store_explicit(&r->state, NEURAL_NET_RACE_FAILED, memory_order_release);
+  }
+  r->time_sec = now_sec() - start;
+
+  pthread_mutex_lock(&race->lock);
+  race->finished += 1;
+  pthread_cond_signal(&race->cond);
+  pthread_mutex_unlock(&race->lock);
+
+  return NULL;
+}
+
+/**
+ * Flag the runs that are straggling: at least half as far along as the
+ * best running run but with straggler_ratio times its error. epochs and
+ * error are read separately so this is only a heuristic, a flag set on
+ * a run that has since restarted is ignored because it names the run.
+ */
+static void check_stragglers(NeuralNetRace* race) {
+  NeuralNetRaceSpec* spec = &race->spec;
+  unsigned long warmup = spec->stall_epochs > 0 ? spec->stall_epochs : 1;
+  unsigned long best_epochs = 0;
+  double best_error = (double)INFINITY;
+  unsigned long best = race->count;
+
+  for (unsigned long i = 0; i < race->count; i++) {
+    NeuralNetRacer* r = &race->racers[i];
+    if (atomic_load_explicit(&r->state, memory_order_acquire) != NEURAL_NET_RACE_RUNNING) {
+      continue;
+    }
+    unsigned long epochs = atomic_load_explicit(&r->epochs, memory_order_relaxed);
+    double error = atomic_load_explicit(&r->error, memory_order_relaxed);
+    if ((epochs >= warmup) && (error < best_error)) {
+      best = i;
+      best_epochs = epochs;
+      best_error = error;
+    }
+  }
+  if (best == race->count) {
+    return;
+  }
+
+  for (unsigned long i = 0; i < race->count; i++) {
+    NeuralNetRacer* r = &race->racers[i];
+    if ((i == best) || (atomic_load_explicit(&r->state, memory_order_acquire)
+          != NEURAL_NET_RACE_RUNNING)) {
+      continue;
+    }
+    unsigned long run = atomic_load_explicit(&r->run, memory_order_acquire);
+    unsigned long epochs = atomic_load_explicit(&r->epochs, memory_order_relaxed);
+    double error = atomic_load_explicit(&r->error, memory_order_relaxed);
+    if ((epochs >= warmup) && ((epochs * 2) >= best_epochs)
+        && (error > (spec->straggler_ratio * best_error))) {
+      dbg("NeuralNetRace: racer %ld run %ld straggling error=%lg best=%lg\n",
+          i, run, error, best_error);
+      atomic_store_explicit(&r->abandon, run + 1, memory_order_relaxed);
+    }
+  }
+}
+
+/** Stop any racers that are still going and wait for them */
+static void stop_racers(NeuralNetRace* race) {
+  long none = -1;
+  atomic_compare_exchange_strong(&race->won, &none, (long)race->count);
+
+  for (unsigned long i = 0; i < race->count; i++) {
+    NeuralNetRacer* r = &race->racers[i];
+    if (r->running) {
+      pthread_join(r->thread, NULL);
+      r->running = 0;
+    }
+  }
+}
+
+static Status run(NeuralNetRace* race) {
+  Status status;
+  NeuralNetRaceSpec* spec = &race->spec;
+
+  dbg("NeuralNetRace.run:+%p racers=%ld\n", (void*)race, race->count);
+
+  double start = now_sec();
+  for (unsigned long i = 0; i < race->count; i++) {
+    NeuralNetRacer* r = &race->racers[i];
+    if (pthread_create(&r->thread, NULL, racer_thread, r) != 0) {
+      status = STATUS_ERR;
+      goto done;
+    }
+    r->running = 1;
+  }
+
+  // Watch the trajectories until every racer has stopped
+  pthread_mutex_lock(&race->lock);
+  while (race->finished < race->count) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += (long)(spec->poll_ms % 1000) * 1000000L;
+    deadline.tv_sec += (time_t)(spec->poll_ms / 1000) + (deadline.tv_nsec / 1000000000L);
+    deadline.tv_nsec %= 1000000000L;
+    pthread_cond_timedwait(&race->cond, &race->lock, &deadline);
+
+    if ((race->finished < race->count) && (spec->straggler_ratio > 0.0)) {
+      pthread_mutex_unlock(&race->lock);
+      check_stragglers(race);
+      pthread_mutex_lock(&race->lock);
+    }
+  }
+  pthread_mutex_unlock(&race->lock);
+
+  status = STATUS_OK;
+  for (unsigned long i = 0; i < race->count; i++) {
+    if (StatusErr(race->racers[i].status)) {
+      status = race->racers[i].status;
+    }
+  }
+
+done:
+  stop_racers(race);
+  race->time_sec = now_sec() - start;
+
+  long won = atomic_load(&race->won);
+  if ((won >= 0) && ((unsigned long)won < race->count)) {
+    race->winner = &race->racers[won];
+  }
+
+  dbg("NeuralNetRace.run:-%p status=%d\n", (void*)race, StatusVal(status));
+  return status;
+}
+
+static Status take(NeuralNetRace* race, NeuralNet* nn) {
+  NeuralNetRacer* w = race->winner;
+
+  if ((w == NULL) || !w->started) {
+    return STATUS_ERR;
+  }
+
+  // The network owns all of its storage so it can be moved
+  *nn = w->nn;
+  memset(&w->nn, 0, sizeof(w->nn));
+  w->started = 0;
+
+  return STATUS_OK;
+}
+
+static void print(NeuralNetRace* race, FILE* f) {
+  unsigned long runs = 0;
+  unsigned long epochs = 0;
+
+  fprintf(f, "racer  state    runs stalls straggles  seed       epochs   total_epochs     error  time\n");
+  for (unsigned long i = 0; i < race->count; i++) {
+    NeuralNetRacer* r = &race->racers[i];
+    unsigned long state = atomic_load(&r->state);
+    fprintf(f, "%5ld  %-7s %5ld %6ld %9ld %5ld %'12ld %'14ld %9.3lg %5.2lfs\n",
+        i, state_names[state], r->runs, r->stalls, r->straggles, r->seed,
+        atomic_load(&r->epochs), r->total_epochs, atomic_load(&r->error),
+        r->time_sec);
+    runs += r->runs;
+    epochs += r->total_epochs;
+  }
+
+  if (race->winner != NULL) {
+    NeuralNetRacer* w = race->winner;
+    fprintf(f, "\nWinner racer=%ld seed=%ld epochs=%'ld error=%.3lg",
+        w->index, w->seed, atomic_load(&w->epochs), atomic_load(&w->error));
+  } else {
+    fprintf(f, "\nNo run reached error_threshold=%lg", race->spec.error_threshold);
+  }
+  fprintf(f, " runs=%ld total_epochs=%'ld time=%.3lfs\n", runs, epochs,
+      race->time_sec);
+}
+
+static void deinit(NeuralNetRace* race) {
+  dbg("NeuralNetRace.deinit:+%p\n", (void*)race);
+
+  if (race->racers != NULL) {
+    stop_racers(race);
+    for (unsigned long i = 0; i < race->count; i++) {
+      NeuralNetRacer* r = &race->racers[i];
+      if (r->started) {
+        r->nn.deinit(&r->nn);
+        r->started = 0;
+      }
+      free(r->perm);
+      free(r->output);
+    }
+    free(race->racers);
+    race->racers = NULL;
+    pthread_cond_destroy(&race->cond);
+    pthread_mutex_destroy(&race->lock);
+  }
+  race->winner = NULL;
+
+  dbg("NeuralNetRace.deinit:-%p\n", (void*)race);
+}
+
+Status NeuralNetRace_init(NeuralNetRace* race, NeuralNetRaceSpec* spec) {
+  Status status;
+
+  dbg("NeuralNetRace_init:+%p racers=%ld\n", (void*)race, spec->racers);
+
+  memset(race, 0, sizeof(*race));
+  race->spec = *spec;
+  race->deinit = deinit;
+  race->run = run;
+  race->take = take;
+  race->print = print;
+
+  if ((spec->inputs == NULL) || (spec->targets == NULL)
+      || (spec->pattern_count == 0) || (spec->hidden == 0)
+      || (spec->stall_improvement < 0.0) || (spec->stall_improvement >= 1.0)
+      || ((spec->straggler_ratio > 0.0) && (spec->straggler_ratio < 1.0))) {
+    status = STATUS_BAD_PARAM;
+    goto done;
+  }
+  if (race->spec.racers == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    race->spec.racers = cpus > 0 ? (unsigned long)cpus : 1;
+  }
+  if (race->spec.poll_ms == 0) {
+    race->spec.poll_ms = 10;
+  }
+
+  race->racers = calloc(race->spec.racers, sizeof(NeuralNetRacer));
+  if (race->racers == NULL) {
+    status = STATUS_OOM;
+    goto done;
+  }
+  race->count = race->spec.racers;
+  pthread_mutex_init(&race->lock, NULL);
+  pthread_cond_init(&race->cond, NULL);
+  atomic_init(&race->won, -1);
+  atomic_init(&race->next_seed, spec->first_seed + race->count);
+  atomic_init(&race->restarts, 0);
+
+  for (unsigned long i = 0; i < race->count; i++) {
+    NeuralNetRacer* r = &race->racers[i];
+    r->race = race;
+    r->index = i;
+    r->seed = spec->first_seed + i;
+    atomic_init(&r->run, 0);
+    atomic_init(&r->epochs, 0);
+    atomic_init(&r->error, (double)INFINITY);
+    atomic_init(&r->abandon, 0);
+    atomic_init(&r->state, NEURAL_NET_RACE_RUNNING);
+    r->perm = calloc(spec->pattern_count, sizeof(unsigned int));
+    r->output = Pattern_create(spec->targets[0]->count);
+    if ((r->perm == NULL) || (r->output == NULL)) {
+      status = STATUS_OOM;
+      goto done;
+    }
+  }
+
+  status = STATUS_OK;
+
+done:
+  if (StatusErr(status)) {
+    deinit(race);
+  }
+  dbg("NeuralNetRace_init:-%p status=%d\n", (void*)race, StatusVal(status));
+  return status;
+}
@@ -0,0 +1,196 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "NeuralNet.h"
+#include "NeuralNetSkip.h"
+#include "dbg.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+NeuronLayerSkip* NeuronLayerSkip_create(unsigned long count, double threshold) {
+  NeuronLayerSkip* skip = calloc(1, sizeof(NeuronLayerSkip));
+  if (skip == NULL) {
+    return NULL;
+  }
+  skip->threshold = threshold;
+  skip->pending = calloc(count, sizeof(unsigned long));
+  skip->active = calloc(count, sizeof(unsigned long));
+  if ((skip->pending == NULL) || (skip->active == NULL)) {
+    free(skip->pending);
+    free(skip->active);
+    free(skip);
+    return NULL;
+  }
+  return skip;
+}
+
+void NeuronLayerSkip_deinit(NeuronLayer* layer) {
+  if (layer->skip != NULL) {
+    free(layer->skip->pending);
+    free(layer->skip->active);
+    free(layer->skip);
+    layer->skip = NULL;
+  }
+}
+
+/** The decay of the momentum and the drift of the weights over k steps */
+static void owed(unsigned long k, double momentum_factor, double* decay,
+    double* drift) {
+  *decay = pow(momentum_factor, (double)k);
+  *drift = (momentum_factor < 1.0)
+      ? momentum_factor * (1.0 - *decay) / (1.0 - momentum_factor)
+      : (double)k;
+}
+
+/** Apply k steps of momentum with a zero pd_error to neuron */
+static void catch_up(Neuron* neuron, unsigned long k, double momentum_factor) {
+  double decay;
+  double drift;
+
+  owed(k, momentum_factor, &decay, &drift);
+  for (unsigned long i = 0; i <= neuron->inputs->count; i++) {
+    neuron->weights[i] += neuron->momentums[i] * drift;
+    neuron->momentums[i] *= decay;
+  }
+}
+
+void NeuronLayerSkip_settled(NeuronLayer* layer, unsigned long n,
+    unsigned long i, double momentum_factor, double* weight, double* momentum) {
+  Neuron* neuron = &layer->neurons[n];
+  double w = neuron->weights[i];
+  double m = neuron->momentums[i];
+
+  if ((layer->skip != NULL) && (layer->skip->pending[n] > 0)) {
+    double decay;
+    double drift;
+    owed(layer->skip->pending[n], momentum_factor, &decay, &drift);
+    w += m * drift;
+    m *= decay;
+  }
+  if (weight != NULL) {
+    *weight = w;
+  }
+  if (momentum != NULL) {
+    *momentum = m;
+  }
+}
+
+/** Find this step's active neurons, catching up those that were skipped */
+static void select_active(NeuronLayer* layer, double momentum_factor) {
+  NeuronLayerSkip* skip = layer->skip;
+
+  skip->active_count = 0;
+  for (unsigned long n = 0; n < layer->count; n++) {
+    Neuron* neuron = &layer->neurons[n];
+    if (fabs(neuron->pd_error) < skip->threshold) {
+      skip->pending[n] += 1;
+      continue;
+    }
+    if (skip->pending[n] > 0) {
+      catch_up(neuron, skip->pending[n], momentum_factor);
+      skip->pending[n] = 0;
+    }
+    skip->active[skip->active_count++] = n;
+  }
+  skip->updates += layer->count;
+  skip->skipped += layer->count - skip->active_count;
+  skip->momentum_factor = momentum_factor;
+  skip->selected = 1;
+}
+
+void NeuronLayerSkip_backprop(NeuronLayer* layer, NeuronLayer* prev_layer,
+    double momentum_factor) {
+  NeuronLayerSkip* skip = layer->skip;
+  Neuron* neurons = layer->neurons;
+
+  select_active(layer, momentum_factor);
+
+  for (unsigned long npl = 0; npl < prev_layer->count; npl++) {
+    double sum_weighted_pd_err = 0.0;
+    for (unsigned long a = 0; a < skip->active_count; a++) {
+      Neuron* neuron = &neurons[skip->active[a]];
+      sum_weighted_pd_err += neuron->pd_error * neuron->weights[npl+1];
+    }
+
+    double prev_out = prev_layer->neurons[npl].output;
+    double pd_prev_out = prev_out * (1.0 - prev_out);
+    prev_layer->neurons[npl].pd_error = sum_weighted_pd_err * pd_prev_out;
+  }
+}
+
+void NeuronLayerSkip_adjust_weights(NeuronLayer* layer,
+    double learning_rate, double momentum_factor) {
+  NeuronLayerSkip* skip = layer->skip;
+
+  // The first hidden layer isn't back propagated through
+  if (!skip->selected) {
+    select_active(layer, momentum_factor);
+  }
+  skip->selected = 0;
+
+  for (unsigned long a = 0; a < skip->active_count; a++) {
+    Neuron* neuron = &layer->neurons[skip->active[a]];
+    Neuron* inputs = neuron->inputs->neurons;
+    double* weights = neuron->weights;
+    double* momentums = neuron->momentums;
+    double pd_err = neuron->pd_error;
+
+    // The bias
+    momentums[0] = (learning_rate * pd_err) + (momentum_factor * momentums[0]);
+    weights[0] = weights[0] + momentums[0];
+
+    for (unsigned long i = 0; i < neuron->inputs->count; i++) {
+      double input = inputs[i].output;
+      double momentum = momentum_factor * momentums[i+1];
+      momentums[i+1] = (learning_rate * input * pd_err) + momentum;
+      weights[i+1] = weights[i+1] + momentums[i+1];
+    }
+  }
+}
+
+void NeuralNet_skip_flush(NeuralNet* nn) {
+  dbg("NeuralNet_skip_flush:+%p\n", (void*)nn);
+
+  for (unsigned long l = 1; l <= nn->out_layer; l++) {
+    NeuronLayer* layer = &nn->layers[l];
+    if (layer->skip == NULL) {
+      continue;
+    }
+    for (unsigned long n = 0; n < layer->count; n++) {
+      if (layer->skip->pending[n] > 0) {
+        catch_up(&layer->neurons[n], layer->skip->pending[n], nn->momentum_factor);
+        layer->skip->pending[n] = 0;
+      }
+    }
+  }
+
+  dbg("NeuralNet_skip_flush:-%p\n", (void*)nn);
+}
+
+void NeuralNet_skip_stats(NeuralNet* nn, unsigned long* updates,
+    unsigned long* skipped) {
+  *updates = 0;
+  *skipped = 0;
+  for (unsigned long l = 1; l <= nn->out_layer; l++) {
+    NeuronLayerSkip* skip = nn->layers[l].skip;
+    if (skip != NULL) {
+      *updates += skip->updates;
+      *skipped += skip->skipped;
+    }
+  }
+}
@@ -0,0 +1,355 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "NeuralNet.h"
+#include "NeuralNetSnapshot.h"
+#include "dbg.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_LINE 64
+
+/** A version with its counts and weights in one allocation */
+static NeuralNetVersion* version_create(NeuralNetSnapshot* snap, NeuralNet* nn) {
+  NeuralNetVersion* v = calloc(1, snap->version_bytes);
+  if (v == NULL) {
+    return NULL;
+  }
+  v->out_layer = nn->out_layer;
+  v->output_type = nn->output_type;
+  v->counts = (unsigned long*)(void*)(v + 1);
+  v->weights = (double*)(void*)(v->counts + nn->out_layer + 1);
+  for (unsigned long l = 0; l <= nn->out_layer; l++) {
+    v->counts[l] = nn->layers[l].count;
+  }
+  return v;
+}
+
+static void version_free_list(NeuralNetVersion* v) {
+  while (v != NULL) {
+    NeuralNetVersion* next = v->next;
+    free(v);
+    v = next;
+  }
+}
+
+/** Copy nn's weights into v, densifying layers that aren't plain doubles */
+static void version_fill(NeuralNetVersion* v, NeuralNet* nn) {
+  double* dst = v->weights;
+  for (unsigned long l = 1; l <= nn->out_layer; l++) {
+    NeuronLayer* layer = &nn->layers[l];
+    unsigned long cols = nn->layers[l - 1].count + 1;
+    int dense = (layer->conv == NULL) && (layer->half == NULL) && (layer->sparse == NULL)
+      && (layer->skip == NULL);
+    for (unsigned long n = 0; n < layer->count; n++) {
+      if (dense) {
+        memcpy(dst, layer->neurons[n].weights, cols * sizeof(double));
+      } else {
+        for (unsigned long i = 0; i < cols; i++) {
+          dst[i] = NeuronLayer_weight(layer, n, i);
+        }
+      }
+      dst += cols;
+    }
+  }
+}
+
+/**
+ * Free the retired versions no reader can still be using, those
+ * replaced in an epoch at or before the oldest epoch a reader is in.
+ */
+static void reclaim(NeuralNetSnapshot* snap) {
+  unsigned long oldest = ULONG_MAX;
+  for (unsigned long r = 0; r < snap->max_readers; r++) {
+    unsigned long e = atomic_load(&snap->slots[r].epoch);
+    if ((e != 0) && (e < oldest)) {
+      oldest = e;
+    }
+  }
+
+  NeuralNetVersion** link = &snap->retired;
+  while (*link != NULL) {
+    NeuralNetVersion* v = *link;
+    if (v->retired_epoch <= oldest) {
+      *link = v->next;
+      v->next = snap->free_list;
+      snap->free_list = v;
+      snap->retired_count -= 1;
+      snap->reclaimed += 1;
+    } else {
+      link = &v->next;
+    }
+  }
+}
+
+static Status publish(NeuralNetSnapshot* snap, NeuralNet* nn) {
+  Status status;
+  NeuralNetVersion* v;
+
+  dbg("NeuralNetSnapshot_publish:+%p nn=%p\n", (void*)snap, (void*)nn);
+
+  // The shape is fixed by init
+  unsigned long weight_count = 0;
+  for (unsigned long l = 1; l <= nn->out_layer; l++) {
+    weight_count += nn->layers[l].count * (nn->layers[l - 1].count + 1);
+  }
+  if (weight_count != snap->weight_count) {
+    status = STATUS_BAD_PARAM;
+    goto done;
+  }
+
+  // Reuse a reclaimed version so a steady publisher doesn't allocate
+  if (snap->free_list != NULL) {
+    v = snap->free_list;
+    snap->free_list = v->next;
+  } else {
+    v = version_create(snap, nn);
+    if (v == NULL) { status = STATUS_OOM; goto done; }
+  }
+  version_fill(v, nn);
+  v->next = NULL;
+  v->retired_epoch = 0;
+  v->version = ++snap->published;
+
+  // Swap it in, then bump the epoch so the version replaced is tagged
+  // with an epoch newer than any reader that could have loaded it
+  NeuralNetVersion* prior = atomic_exchange(&snap->current, v);
+  unsigned long epoch = atomic_fetch_add(&snap->epoch, 1) + 1;
+  if (prior != NULL) {
+    prior->retired_epoch = epoch;
+    prior->next = snap->retired;
+    snap->retired = prior;
+    snap->retired_count += 1;
+  }
+  reclaim(snap);
+
+  status = STATUS_OK;
+
+done:
+  dbg("NeuralNetSnapshot_publish:-%p status=%d version=%ld\n", (void*)snap,
+      StatusVal(status), snap->published);
+  return status;
+}
+
+static void stats(NeuralNetSnapshot* snap, NeuralNetSnapshotStats* stats) {
+  stats->published = snap->published;
+  stats->reclaimed = snap->reclaimed;
+  stats->retired = snap->retired_count;
+  stats->predictions = 0;
+  for (unsigned long r = 0; r < snap->max_readers; r++) {
+    stats->predictions += atomic_load_explicit(&snap->slots[r].predictions,
+        memory_order_relaxed);
+  }
+}
+
+static void deinit(NeuralNetSnapshot* snap) {
+  dbg("NeuralNetSnapshot_deinit:+%p\n", (void*)snap);
+
+  // The readers must be done
+  free(atomic_load(&snap->current));
+  atomic_store(&snap->current, NULL);
+  version_free_list(snap->retired);
+  version_free_list(snap->free_list);
+  snap->retired = NULL;
+  snap->free_list = NULL;
+  free(snap->slots);
+  snap->slots = NULL;
+
+  dbg("NeuralNetSnapshot_deinit:-%p\n", (void*)snap);
+}
+
+Status NeuralNetSnapshot_init(NeuralNetSnapshot* snap, NeuralNet* nn,
+    unsigned long max_readers) {
+  Status status;
+
+  dbg("NeuralNetSnapshot_init:+%p nn=%p max_readers=%ld\n", (void*)snap,
+      (void*)nn, max_readers);
+
+  memset(snap, 0, sizeof(*snap));
+  atomic_init(&snap->current, NULL);
+  atomic_init(&snap->epoch, 1);
+  snap->max_readers = max_readers;
+  snap->deinit = deinit;
+  snap->publish = publish;
+  snap->stats = stats;
+
+  if ((max_readers == 0) || (nn->layers == NULL) || (nn->out_layer == 0)) {
+    status = STATUS_BAD_PARAM;
+    goto done;
+  }
+
+  for (unsigned long l = 0; l <= nn->out_layer; l++) {
+    if (nn->layers[l].count > snap->max_width) {
+      snap->max_width = nn->layers[l].count;
+    }
+    if (l > 0) {
+      snap->weight_count += nn->layers[l].count * (nn->layers[l - 1].count + 1);
+    }
+  }
+  snap->version_bytes = sizeof(NeuralNetVersion)
+      + ((nn->out_layer + 1) * sizeof(unsigned long))
+      + (snap->weight_count * sizeof(double));
+
+  snap->slots = aligned_alloc(CACHE_LINE, max_readers * sizeof(NeuralNetSnapshotSlot));
+  if (snap->slots == NULL) { status = STATUS_OOM; goto done; }
+  for (unsigned long r = 0; r < max_readers; r++) {
+    atomic_init(&snap->slots[r].epoch, 0);
+    atomic_init(&snap->slots[r].claimed, 0);
+    atomic_init(&snap->slots[r].predictions, 0);
+  }
+
+  status = STATUS_OK;
+
+done:
+  dbg("NeuralNetSnapshot_init:-%p status=%d weights=%ld\n", (void*)snap,
+      StatusVal(status), snap->weight_count);
+  return status;
+}
+
+/** Forward pass of v on input, the same arithmetic as NeuralNet process */
+static void forward(NeuralNetSnapshotReader* reader, NeuralNetVersion* v,
+    Pattern* input, Pattern* output) {
+  double* in = reader->acts[0];
+  double* out = reader->acts[1];
+  double* weights = v->weights;
+
+  for (unsigned long i = 0; i < v->counts[0]; i++) {
+    in[i] = (i < input->count) ? input->data[i] : 0.0;
+  }
+  for (unsigned long l = 1; l <= v->out_layer; l++) {
+    unsigned long inputs = v->counts[l - 1];
+    int logits = (l == v->out_layer) && (v->output_type == NEURAL_NET_OUTPUT_SOFTMAX);
+    for (unsigned long n = 0; n < v->counts[l]; n++) {
+      double weighted_sum = weights[0];
+      for (unsigned long i = 0; i < inputs; i++) {
+        weighted_sum += weights[i + 1] * in[i];
+      }
+      out[n] = logits ? weighted_sum : 1.0 / (1.0 + exp(-weighted_sum));
+      weights += inputs + 1;
+    }
+    double* t = in;
+    in = out;
+    out = t;
+  }
+
+  unsigned long count = v->counts[v->out_layer];
+  if (v->output_type == NEURAL_NET_OUTPUT_SOFTMAX) {
+    double max = in[0];
+    for (unsigned long n = 1; n < count; n++) {
+      max = in[n] > max ? in[n] : max;
+    }
+    double sum = 0.0;
+    for (unsigned long n = 0; n < count; n++) {
+      in[n] = exp(in[n] - max);
+      sum += in[n];
+    }
+    double scale = 1.0 / sum;
+    for (unsigned long n = 0; n < count; n++) {
+      in[n] *= scale;
+    }
+  }
+  for (unsigned long n = 0; (n < count) && (n < output->count); n++) {
+    output->data[n] = in[n];
+  }
+}
+
+static Status predict(NeuralNetSnapshotReader* reader, Pattern* input,
+    Pattern* output, unsigned long* version) {
+  NeuralNetSnapshot* snap = reader->snap;
+  Status status;
+
+  // Enter the current epoch before loading current, both sequentially
+  // consistent so publish either sees this slot or we see its version
+  atomic_store(&reader->slot->epoch, atomic_load(&snap->epoch));
+  NeuralNetVersion* v = atomic_load(&snap->current);
+  if (v == NULL) {
+    status = STATUS_ERR;
+  } else {
+    forward(reader, v, input, output);
+    if (version != NULL) {
+      *version = v->version;
+    }
+    status = STATUS_OK;
+  }
+  atomic_store_explicit(&reader->slot->epoch, 0, memory_order_release);
+
+  // Only this reader writes its count
+  unsigned long predictions = atomic_load_explicit(&reader->slot->predictions,
+      memory_order_relaxed);
+  atomic_store_explicit(&reader->slot->predictions, predictions + 1,
+      memory_order_relaxed);
+  return status;
+}
+
+static void reader_deinit(NeuralNetSnapshotReader* reader) {
+  dbg("NeuralNetSnapshotReader_deinit:+%p\n", (void*)reader);
+
+  if (reader->slot != NULL) {
+    atomic_store(&reader->slot->claimed, 0);
+    reader->slot = NULL;
+  }
+  free(reader->acts[0]);
+  free(reader->acts[1]);
+  reader->acts[0] = NULL;
+  reader->acts[1] = NULL;
+
+  dbg("NeuralNetSnapshotReader_deinit:-%p\n", (void*)reader);
+}
+
+Status NeuralNetSnapshotReader_init(NeuralNetSnapshotReader* reader,
+    NeuralNetSnapshot* snap) {
+  Status status;
+
+  dbg("NeuralNetSnapshotReader_init:+%p snap=%p\n", (void*)reader, (void*)snap);
+
+  memset(reader, 0, sizeof(*reader));
+  reader->snap = snap;
+  reader->deinit = reader_deinit;
+  reader->predict = predict;
+
+  for (unsigned long r = 0; r < snap->max_readers; r++) {
+    unsigned long expected = 0;
+    if (atomic_compare_exchange_strong(&snap->slots[r].claimed, &expected, 1)) {
+      reader->slot = &snap->slots[r];
+      break;
+    }
+  }
+  if (reader->slot == NULL) {
+    status = STATUS_ERR;
+    goto done;
+  }
+
+  reader->acts[0] = calloc(snap->max_width, sizeof(double));
+  reader->acts[1] = calloc(snap->max_width, sizeof(double));
+  if ((reader->acts[0] == NULL) || (reader->acts[1] == NULL)) {
+    status = STATUS_OOM;
+    goto done;
+  }
+
+  status = STATUS_OK;
+
+done:
+  if (StatusErr(status)) {
+    reader_deinit(reader);
+  }
+  dbg("NeuralNetSnapshotReader_init:-%p status=%d\n", (void*)reader, StatusVal(status));
+  return status;
+}
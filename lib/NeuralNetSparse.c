@@ -0,0 +1,421 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "NeuralNet.h"
+#include "NeuralNetSparse.h"
+#include "dbg.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+/**
+ * Expand row n of layer into dense arrays of cols entries. stored[i]
+ * is set if weight i is still present, for a dense layer that is all
+ * of them but the masked ones.
+ */
+static void gather_row(NeuronLayer* layer, unsigned long n, unsigned long cols,
+    double* weights, double* momentums, unsigned char* stored) {
+  NeuronLayerSparse* sparse = layer->sparse;
+
+  if (sparse == NULL) {
+    Neuron* neuron = &layer->neurons[n];
+    for (unsigned long i = 0; i < cols; i++) {
+      weights[i] = neuron->weights[i];
+      momentums[i] = neuron->momentums[i];
+      stored[i] = 1;
+    }
+    NeuronLayerMask* mask = layer->mask;
+    if (mask != NULL) {
+      for (unsigned long k = mask->row_start[n]; k < mask->row_start[n+1]; k++) {
+        stored[mask->cols[k]] = 0;
+      }
+    }
+  } else {
+    for (unsigned long i = 0; i < cols; i++) {
+      weights[i] = 0.0;
+      momentums[i] = 0.0;
+      stored[i] = 0;
+    }
+    for (unsigned long k = sparse->row_start[n]; k < sparse->row_start[n+1]; k++) {
+      weights[sparse->cols[k]] = sparse->weights[k];
+      momentums[sparse->cols[k]] = sparse->momentums[k];
+      stored[sparse->cols[k]] = 1;
+    }
+  }
+}
+
+static int compare_descending(const void* a, const void* b) {
+  double da = *(const double*)a;
+  double db = *(const double*)b;
+  return (da < db) - (da > db);
+}
+
+/**
+ * Decide which weights of a row survive, returns the number kept.
+ * mags is scratch space of cols entries.
+ */
+static unsigned long select_row(double* weights, unsigned char* stored,
+    unsigned char* keep, double* mags, unsigned long cols, double threshold,
+    unsigned long top_k) {
+  unsigned long candidates = 0;
+
+  // The bias is always kept
+  keep[0] = 1;
+  for (unsigned long i = 1; i < cols; i++) {
+    keep[i] = stored[i] && (fabs(weights[i]) >= threshold);
+    if (keep[i]) {
+      mags[candidates++] = fabs(weights[i]);
+    }
+  }
+
+  if ((top_k > 0) && (candidates > top_k)) {
+    // Keep the weights larger than the top_k'th magnitude and
+    // then ties in column order until we have top_k
+    qsort(mags, candidates, sizeof(double), compare_descending);
+    double kth = mags[top_k - 1];
+    unsigned long kept = 0;
+    for (unsigned long i = 1; i < cols; i++) {
+      if (keep[i] && (fabs(weights[i]) > kth)) {
+        kept += 1;
+      }
+    }
+    for (unsigned long i = 1; i < cols; i++) {
+      if (keep[i] && !(fabs(weights[i]) > kth)) {
+        if ((kept < top_k) && !(fabs(weights[i]) < kth)) {
+          kept += 1;
+        } else {
+          keep[i] = 0;
+        }
+      }
+    }
+    candidates = kept;
+  }
+
+  return candidates + 1;
+}
+
+NeuronLayerSparse* NeuronLayerSparse_create(unsigned long rows, unsigned long nnz) {
+  NeuronLayerSparse* sparse = calloc(1, sizeof(NeuronLayerSparse));
+  if (sparse == NULL) {
+    return NULL;
+  }
+  sparse->rows = rows;
+  sparse->nnz = nnz;
+  sparse->row_start = calloc(rows + 1, sizeof(unsigned long));
+  sparse->cols = calloc(nnz, sizeof(unsigned int));
+  sparse->weights = calloc(nnz, sizeof(double));
+  sparse->momentums = calloc(nnz, sizeof(double));
+  if ((sparse->row_start == NULL) || (sparse->cols == NULL)
+      || (sparse->weights == NULL) || (sparse->momentums == NULL)) {
+    NeuronLayerSparse_free(sparse);
+    return NULL;
+  }
+  return sparse;
+}
+
+void NeuronLayerSparse_free(NeuronLayerSparse* sparse) {
+  if (sparse != NULL) {
+    free(sparse->row_start);
+    free(sparse->cols);
+    free(sparse->weights);
+    free(sparse->momentums);
+    free(sparse);
+  }
+}
+
+void NeuronLayerSparse_attach(NeuronLayer* layer, NeuronLayerSparse* sparse) {
+  if (layer->sparse != NULL) {
+    NeuronLayerSparse_deinit(layer);
+  } else {
+    NeuronLayerMask_deinit(layer);
+    for (unsigned long n = 0; n < layer->count; n++) {
+      Neuron* neuron = &layer->neurons[n];
+      if (!layer->in_arena) {
+        free(neuron->weights);
+        free(neuron->momentums);
+      }
+      neuron->weights = NULL;
+      neuron->momentums = NULL;
+    }
+  }
+  layer->sparse = sparse;
+}
+
+void NeuronLayerSparse_deinit(NeuronLayer* layer) {
+  NeuronLayerSparse_free(layer->sparse);
+  layer->sparse = NULL;
+}
+
+NeuronLayerMask* NeuronLayerMask_create(unsigned long rows, unsigned long count) {
+  NeuronLayerMask* mask = calloc(1, sizeof(NeuronLayerMask));
+  if (mask == NULL) {
+    return NULL;
+  }
+  mask->rows = rows;
+  mask->count = count;
+  mask->row_start = calloc(rows + 1, sizeof(unsigned long));
+  mask->cols = calloc(count, sizeof(unsigned int));
+  if ((mask->row_start == NULL) || ((mask->cols == NULL) && (count > 0))) {
+    NeuronLayerMask_free(mask);
+    return NULL;
+  }
+  return mask;
+}
+
+void NeuronLayerMask_free(NeuronLayerMask* mask) {
+  if (mask != NULL) {
+    free(mask->row_start);
+    free(mask->cols);
+    free(mask);
+  }
+}
+
+void NeuronLayerMask_deinit(NeuronLayer* layer) {
+  NeuronLayerMask_free(layer->mask);
+  layer->mask = NULL;
+}
+
+void NeuronLayerMask_apply(NeuronLayer* layer) {
+  NeuronLayerMask* mask = layer->mask;
+  for (unsigned long n = 0; n < mask->rows; n++) {
+    double* weights = layer->neurons[n].weights;
+    double* momentums = layer->neurons[n].momentums;
+    for (unsigned long k = mask->row_start[n]; k < mask->row_start[n+1]; k++) {
+      weights[mask->cols[k]] = 0.0;
+      momentums[mask->cols[k]] = 0.0;
+    }
+  }
+}
+
+/**
+ * Keep a dense layer dense, masking the weights not in keep.
+ * nnz is the number of weights kept.
+ */
+static Status mask_layer(NeuronLayer* layer, unsigned char* keep,
+    unsigned long rows, unsigned long cols, unsigned long nnz) {
+  if (nnz == (rows * cols)) {
+    // Nothing was pruned
+    NeuronLayerMask_deinit(layer);
+    return STATUS_OK;
+  }
+
+  NeuronLayerMask* mask = NeuronLayerMask_create(rows, (rows * cols) - nnz);
+  if (mask == NULL) {
+    return STATUS_OOM;
+  }
+  unsigned long k = 0;
+  for (unsigned long n = 0; n < rows; n++) {
+    mask->row_start[n] = k;
+    for (unsigned long i = 0; i < cols; i++) {
+      if (!keep[(n * cols) + i]) {
+        mask->cols[k++] = (unsigned int)i;
+      }
+    }
+  }
+  mask->row_start[rows] = k;
+
+  NeuronLayerMask_deinit(layer);
+  layer->mask = mask;
+  NeuronLayerMask_apply(layer);
+  return STATUS_OK;
+}
+
+Status NeuronLayer_prune(NeuronLayer* layer, double threshold,
+    unsigned long top_k, double max_density) {
+  Status status;
+  double* weights = NULL;
+  double* momentums = NULL;
+  double* mags = NULL;
+  unsigned char* stored = NULL;
+  unsigned char* keep = NULL;
+  NeuronLayerSparse* sparse = NULL;
+
+  dbg("NeuronLayer_prune:+%p threshold=%lf top_k=%ld max_density=%lf\n",
+      (void*)layer, threshold, top_k, max_density);
+
+  if ((layer->count == 0) || (layer->neurons[0].inputs == NULL)) {
+    status = STATUS_BAD_PARAM;
+    goto done;
+  }
+
+  unsigned long rows = layer->count;
+  unsigned long cols = layer->neurons[0].inputs->count + 1;
+
+  weights = calloc(cols, sizeof(double));
+  momentums = calloc(cols, sizeof(double));
+  mags = calloc(cols, sizeof(double));
+  stored = calloc(cols, sizeof(unsigned char));
+  keep = calloc(rows * cols, sizeof(unsigned char));
+  if ((weights == NULL) || (momentums == NULL) || (mags == NULL)
+      || (stored == NULL) || (keep == NULL)) {
+    status = STATUS_OOM;
+    goto done;
+  }
+
+  // Select the surviving weights of every row
+  unsigned long nnz = 0;
+  for (unsigned long n = 0; n < rows; n++) {
+    gather_row(layer, n, cols, weights, momentums, stored);
+    nnz += select_row(weights, stored, &keep[n * cols], mags, cols,
+        threshold, top_k);
+  }
+  double density = (double)nnz / (double)(rows * cols);
+  dbg("NeuronLayer_prune: %p nnz=%ld density=%lf\n", (void*)layer, nnz, density);
+
+  if ((layer->sparse == NULL) && (density > max_density)) {
+    // Too dense for CSR to pay off, the dense loops are faster
+    status = mask_layer(layer, keep, rows, cols, nnz);
+    goto done;
+  }
+
+  // Build the CSR representation
+  sparse = NeuronLayerSparse_create(rows, nnz);
+  if (sparse == NULL) { status = STATUS_OOM; goto done; }
+
+  unsigned long k = 0;
+  for (unsigned long n = 0; n < rows; n++) {
+    gather_row(layer, n, cols, weights, momentums, stored);
+    sparse->row_start[n] = k;
+    for (unsigned long i = 0; i < cols; i++) {
+      if (keep[(n * cols) + i]) {
+        sparse->cols[k] = (unsigned int)i;
+        sparse->weights[k] = weights[i];
+        sparse->momentums[k] = momentums[i];
+        k += 1;
+      }
+    }
+  }
+  sparse->row_start[rows] = k;
+
+  // Release the previous storage and switch the layer over
+  NeuronLayerSparse_attach(layer, sparse);
+  sparse = NULL;
+
+  status = STATUS_OK;
+
+done:
+  NeuronLayerSparse_free(sparse);
+  free(weights);
+  free(momentums);
+  free(mags);
+  free(stored);
+  free(keep);
+
+  dbg("NeuronLayer_prune:-%p status=%d\n", (void*)layer, StatusVal(status));
+  return status;
+}
+
+double NeuronLayerSparse_weight(NeuronLayerSparse* sparse, unsigned long n,
+    unsigned long i) {
+  // Binary search the row, the columns are in ascending order
+  unsigned long lo = sparse->row_start[n];
+  unsigned long hi = sparse->row_start[n+1];
+  while (lo < hi) {
+    unsigned long mid = lo + ((hi - lo) / 2);
+    if (sparse->cols[mid] < i) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if ((lo < sparse->row_start[n+1]) && (sparse->cols[lo] == i)) {
+    return sparse->weights[lo];
+  }
+  return 0.0;
+}
+
+void NeuronLayerSparse_process(NeuronLayer* layer, double* logits) {
+  NeuronLayerSparse* sparse = layer->sparse;
+  Neuron* inputs = layer->neurons[0].inputs->neurons;
+  unsigned int* cols = sparse->cols;
+  double* weights = sparse->weights;
+
+  for (unsigned long n = 0; n < layer->count; n++) {
+    Neuron* neuron = &layer->neurons[n];
+    unsigned long k = sparse->row_start[n];
+    unsigned long end = sparse->row_start[n+1];
+
+    // The first entry of a row is always the bias
+    double weighted_sum = weights[k];
+    for (k += 1; k < end; k++) {
+      weighted_sum += weights[k] * inputs[cols[k] - 1].output;
+    }
+
+    if (logits != NULL) {
+      logits[n] = weighted_sum;
+      continue;
+    }
+
+    // Calcuate the output using a Sigmoidal Activation function
+    neuron->output = 1.0 / (1.0 + exp(-weighted_sum));
+  }
+}
+
+void NeuronLayerSparse_backprop(NeuronLayer* layer, NeuronLayer* prev_layer) {
+  NeuronLayerSparse* sparse = layer->sparse;
+  Neuron* prev = prev_layer->neurons;
+  unsigned int* cols = sparse->cols;
+  double* weights = sparse->weights;
+
+  for (unsigned long npl = 0; npl < prev_layer->count; npl++) {
+    prev[npl].pd_error = 0.0;
+  }
+
+  // Scatter each neuron's weighted pd_error into the inputs it is
+  // connected to, the bias entry is skipped.
+  for (unsigned long n = 0; n < layer->count; n++) {
+    double pd_err = layer->neurons[n].pd_error;
+    unsigned long end = sparse->row_start[n+1];
+    for (unsigned long k = sparse->row_start[n] + 1; k < end; k++) {
+      prev[cols[k] - 1].pd_error += pd_err * weights[k];
+    }
+  }
+
+  for (unsigned long npl = 0; npl < prev_layer->count; npl++) {
+    double prev_out = prev[npl].output;
+    double pd_prev_out = prev_out * (1.0 - prev_out);
+    prev[npl].pd_error = prev[npl].pd_error * pd_prev_out;
+  }
+}
+
+void NeuronLayerSparse_adjust_weights(NeuronLayer* layer,
+    double learning_rate, double momentum_factor) {
+  NeuronLayerSparse* sparse = layer->sparse;
+  Neuron* inputs = layer->neurons[0].inputs->neurons;
+  unsigned int* cols = sparse->cols;
+  double* weights = sparse->weights;
+  double* momentums = sparse->momentums;
+
+  for (unsigned long n = 0; n < layer->count; n++) {
+    double pd_err = layer->neurons[n].pd_error;
+    unsigned long k = sparse->row_start[n];
+    unsigned long end = sparse->row_start[n+1];
+
+    // Update the bias
+    double momentum = momentum_factor * momentums[k];
+    momentums[k] = (learning_rate * pd_err) + momentum;
+    weights[k] = weights[k] + momentums[k];
+
+    // Update the surviving input weights
+    for (k += 1; k < end; k++) {
+      double input = inputs[cols[k] - 1].output;
+      momentum = momentum_factor * momentums[k];
+      momentums[k] = (learning_rate * input * pd_err) + momentum;
+      weights[k] = weights[k] + momentums[k];
+    }
+  }
+}
@@ -0,0 +1,337 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "NeuralNet.h"
+#include "NeuralNetSweep.h"
+#include "NeuralNetTrain.h"
+#include "ThreadPool.h"
+#include "dbg.h"
+#include "rand0_1.h"
+#include "unused.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + ((double)ts.tv_nsec / 1.0e9);
+}
+
+static Status config_start(NeuralNetSweepConfig* c) {
+  Status status;
+  NeuralNetSweepSpec* spec = &c->sweep->spec;
+
+  rand0_1_seed((unsigned int)c->seed);
+  status = NeuralNet_init(&c->nn, spec->inputs[0]->count, 1, spec->targets[0]->count);
+  if (StatusErr(status)) goto done;
+  c->started = 1;
+  status = c->nn.add_hidden(&c->nn, c->hidden);
+  if (StatusErr(status)) goto done;
+  status = c->nn.start(&c->nn);
+  if (StatusErr(status)) goto done;
+  c->nn.learning_rate = c->learning_rate;
+  c->nn.momentum_factor = c->momentum_factor;
+
+  c->perm = calloc(spec->pattern_count, sizeof(unsigned int));
+  c->output = Pattern_create(spec->targets[0]->count);
+  if ((c->perm == NULL) || (c->output == NULL)) {
+    status = STATUS_OOM;
+    goto done;
+  }
+
+  status = STATUS_OK;
+
+done:
+  return status;
+}
+
+/** Train a configuration up to the budget of the current rung */
+static void config_train(void* arg, unsigned long worker) {
+  NeuralNetSweepConfig* c = arg;
+  NeuralNetSweepSpec* spec = &c->sweep->spec;
+  unused(worker);
+
+  if (StatusErr(c->status)) {
+    return;
+  }
+
+  double start = now_sec();
+  if (!c->started) {
+    c->status = config_start(c);
+    if (StatusErr(c->status)) {
+      c->error = (double)INFINITY;
+      return;
+    }
+  } else {
+    // Continue the generator from where the last rung left it,
+    // this rung may be running on a different thread.
+    rand0_1_restore(&c->rand_state);
+  }
+
+  while ((c->epochs < c->target_epochs) && !c->converged) {
+    c->error = NeuralNet_train_epoch(&c->nn, spec->inputs, spec->targets,
+        c->output, c->perm, (unsigned int)spec->pattern_count);
+    c->epochs += 1;
+    if (c->error < spec->error_threshold) {
+      c->converged = 1;
+    }
+  }
+
+  rand0_1_save(&c->rand_state);
+  c->time_sec += now_sec() - start;
+}
+
+/** Order best first: converged in fewer epochs, then lower error */
+static int config_compare(const NeuralNetSweepConfig* a,
+    const NeuralNetSweepConfig* b) {
+  if (a->converged != b->converged) {
+    return a->converged ? -1 : 1;
+  }
+  if (a->converged && (a->epochs != b->epochs)) {
+    return (a->epochs < b->epochs) ? -1 : 1;
+  }
+  if (a->error < b->error) {
+    return -1;
+  }
+  if (a->error > b->error) {
+    return 1;
+  }
+  return 0;
+}
+
+static int compare_alive(const void* a, const void* b) {
+  return config_compare(*(const NeuralNetSweepConfig* const*)a,
+      *(const NeuralNetSweepConfig* const*)b);
+}
+
+/** Final ranking, those that survived more rungs first */
+static int compare_ranked(const void* a, const void* b) {
+  const NeuralNetSweepConfig* ca = a;
+  const NeuralNetSweepConfig* cb = b;
+  if (ca->rung != cb->rung) {
+    return (ca->rung > cb->rung) ? -1 : 1;
+  }
+  return config_compare(ca, cb);
+}
+
+static Status run(NeuralNetSweep* sweep) {
+  Status status;
+  NeuralNetSweepSpec* spec = &sweep->spec;
+
+  dbg("NeuralNetSweep.run:+%p configs=%ld\n", (void*)sweep, sweep->config_count);
+
+  double start = now_sec();
+  unsigned long budget = spec->min_epochs;
+  unsigned long rung = 0;
+  for (;;) {
+    for (unsigned long i = 0; i < sweep->alive_count; i++) {
+      NeuralNetSweepConfig* c = sweep->alive[i];
+      c->target_epochs = budget;
+      c->rung = rung;
+      status = sweep->pool.submit(&sweep->pool, config_train, c);
+      if (StatusErr(status)) {
+        sweep->pool.wait(&sweep->pool);
+        goto done;
+      }
+    }
+    sweep->pool.wait(&sweep->pool);
+    qsort(sweep->alive, sweep->alive_count, sizeof(NeuralNetSweepConfig*),
+        compare_alive);
+    dbg("NeuralNetSweep.run: %p rung=%ld budget=%ld alive=%ld\n",
+        (void*)sweep, rung, budget, sweep->alive_count);
+
+    if (budget >= spec->max_epochs) {
+      break;
+    }
+    unsigned long converged = 0;
+    for (unsigned long i = 0; i < sweep->alive_count; i++) {
+      converged += sweep->alive[i]->converged;
+    }
+    if (converged == sweep->alive_count) {
+      break;
+    }
+
+    // Keep the best 1/eta, the rest stop here
+    sweep->alive_count = (sweep->alive_count + spec->eta - 1) / spec->eta;
+    budget = (budget > (spec->max_epochs / spec->eta)) ? spec->max_epochs
+        : budget * spec->eta;
+    rung += 1;
+  }
+  sweep->time_sec = now_sec() - start;
+
+  // Rank everything, this reorders configs so alive is no longer valid
+  sweep->alive_count = 0;
+  qsort(sweep->configs, sweep->config_count, sizeof(NeuralNetSweepConfig),
+      compare_ranked);
+
+  status = STATUS_OK;
+
+done:
+  dbg("NeuralNetSweep.run:-%p status=%d\n", (void*)sweep, StatusVal(status));
+  return status;
+}
+
+static void print(NeuralNetSweep* sweep, FILE* f) {
+  unsigned long total_epochs = 0;
+
+  fprintf(f, "%-5s %13s %9s %7s %11s %12s %10s %5s %5s %9s\n", "Rank",
+      "learning_rate", "momentum", "hidden", "seed", "epochs", "error",
+      "conv", "rung", "time");
+  for (unsigned long i = 0; i < sweep->config_count; i++) {
+    NeuralNetSweepConfig* c = &sweep->configs[i];
+    total_epochs += c->epochs;
+    if (StatusErr(c->status)) {
+      fprintf(f, "%-5ld %13.6lg %9.4lf %7ld %11ld failed status=%d\n", i + 1,
+          c->learning_rate, c->momentum_factor, c->hidden, c->seed, c->status);
+      continue;
+    }
+    fprintf(f, "%-5ld %13.6lg %9.4lf %7ld %11ld %12ld %10.3lg %5s %5ld %8.3lfs\n",
+        i + 1, c->learning_rate, c->momentum_factor, c->hidden, c->seed,
+        c->epochs, c->error, c->converged ? "yes" : "no", c->rung, c->time_sec);
+  }
+  fprintf(f, "\nconfigs=%ld workers=%ld time=%.3lfs epochs=%ld eps=%ld\n",
+      sweep->config_count, sweep->pool.count, sweep->time_sec, total_epochs,
+      (unsigned long)((double)total_epochs / sweep->time_sec));
+}
+
+static void deinit(NeuralNetSweep* sweep) {
+  dbg("NeuralNetSweep.deinit:+%p\n", (void*)sweep);
+
+  if (sweep->pool.workers != NULL) {
+    sweep->pool.deinit(&sweep->pool);
+  }
+  if (sweep->configs != NULL) {
+    for (unsigned long i = 0; i < sweep->config_count; i++) {
+      NeuralNetSweepConfig* c = &sweep->configs[i];
+      if (c->started) {
+        c->nn.deinit(&c->nn);
+      }
+      free(c->perm);
+      free(c->output);
+    }
+    free(sweep->configs);
+    sweep->configs = NULL;
+  }
+  free(sweep->alive);
+  sweep->alive = NULL;
+  sweep->config_count = 0;
+  sweep->alive_count = 0;
+
+  dbg("NeuralNetSweep.deinit:-%p\n", (void*)sweep);
+}
+
+static double list_min(double* list, unsigned long count) {
+  double v = list[0];
+  for (unsigned long i = 1; i < count; i++) {
+    v = (list[i] < v) ? list[i] : v;
+  }
+  return v;
+}
+
+static double list_max(double* list, unsigned long count) {
+  double v = list[0];
+  for (unsigned long i = 1; i < count; i++) {
+    v = (list[i] > v) ? list[i] : v;
+  }
+  return v;
+}
+
+static unsigned long pick(unsigned long count) {
+  unsigned long i = (unsigned long)(rand0_1() * (double)count);
+  return (i < count) ? i : count - 1;
+}
+
+Status NeuralNetSweep_init(NeuralNetSweep* sweep, NeuralNetSweepSpec* spec) {
+  Status status;
+  Rand0_1State caller_state;
+
+  dbg("NeuralNetSweep_init:+%p\n", (void*)sweep);
+
+  memset(sweep, 0, sizeof(*sweep));
+  sweep->spec = *spec;
+  sweep->deinit = deinit;
+  sweep->run = run;
+  sweep->print = print;
+  spec = &sweep->spec;
+
+  if ((spec->learning_rate_count == 0) || (spec->momentum_factor_count == 0)
+      || (spec->hidden_count == 0) || (spec->seed_count == 0)
+      || (spec->pattern_count == 0) || (spec->min_epochs == 0)
+      || (spec->max_epochs < spec->min_epochs) || (spec->eta < 2)) {
+    status = STATUS_BAD_PARAM;
+    goto done;
+  }
+
+  if (spec->random_samples == 0) {
+    sweep->config_count = spec->learning_rate_count * spec->momentum_factor_count
+        * spec->hidden_count * spec->seed_count;
+  } else {
+    sweep->config_count = spec->random_samples;
+  }
+  sweep->configs = calloc(sweep->config_count, sizeof(NeuralNetSweepConfig));
+  sweep->alive = calloc(sweep->config_count, sizeof(NeuralNetSweepConfig*));
+  if ((sweep->configs == NULL) || (sweep->alive == NULL)) {
+    status = STATUS_OOM;
+    goto done;
+  }
+
+  // Drawing random samples uses rand0_1, don't disturb the caller's stream
+  rand0_1_save(&caller_state);
+  rand0_1_seed((unsigned int)spec->random_seed);
+  double lr_min = log(list_min(spec->learning_rates, spec->learning_rate_count));
+  double lr_max = log(list_max(spec->learning_rates, spec->learning_rate_count));
+  double mf_min = list_min(spec->momentum_factors, spec->momentum_factor_count);
+  double mf_max = list_max(spec->momentum_factors, spec->momentum_factor_count);
+  for (unsigned long i = 0; i < sweep->config_count; i++) {
+    NeuralNetSweepConfig* c = &sweep->configs[i];
+    if (spec->random_samples == 0) {
+      unsigned long idx = i;
+      c->learning_rate = spec->learning_rates[idx % spec->learning_rate_count];
+      idx /= spec->learning_rate_count;
+      c->momentum_factor = spec->momentum_factors[idx % spec->momentum_factor_count];
+      idx /= spec->momentum_factor_count;
+      c->hidden = spec->hidden[idx % spec->hidden_count];
+      idx /= spec->hidden_count;
+      c->seed = spec->seeds[idx % spec->seed_count];
+    } else {
+      c->learning_rate = exp(lr_min + (rand0_1() * (lr_max - lr_min)));
+      c->momentum_factor = mf_min + (rand0_1() * (mf_max - mf_min));
+      c->hidden = spec->hidden[pick(spec->hidden_count)];
+      c->seed = spec->seeds[pick(spec->seed_count)];
+    }
+    c->sweep = sweep;
+    c->status = STATUS_OK;
+    sweep->alive[i] = c;
+  }
+  sweep->alive_count = sweep->config_count;
+  rand0_1_restore(&caller_state);
+
+  status = ThreadPool_init(&sweep->pool, spec->workers);
+  if (StatusErr(status)) goto done;
+
+  status = STATUS_OK;
+
+done:
+  if (StatusErr(status)) {
+    deinit(sweep);
+  }
+  dbg("NeuralNetSweep_init:-%p status=%d\n", (void*)sweep, StatusVal(status));
+  return status;
+}
@@ -0,0 +1,318 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "NeuralNet.h"
+#include "NeuralNetSynth.h"
+#include "NeuralNetTrain.h"
+#include "dbg.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Independent streams derived from the seed
+#define STREAM_SAMPLE  0
+#define STREAM_CENTERS 1
+#define STREAM_TEACHER 2
+
+/** splitmix64, a tiny generator whose state can start anywhere */
+static uint64_t next64(uint64_t* state) {
+  uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/** The state of item index of stream */
+static uint64_t stream(NeuralNetSynth* synth, uint64_t id, uint64_t index) {
+  uint64_t state = synth->spec.seed ^ (id * 0xd1b54a32d192ed03ULL);
+  state = next64(&state) ^ index;
+  next64(&state);
+  return state;
+}
+
+/** Uniform in [0, 1) */
+static double uniform(uint64_t* state) {
+  return (double)(next64(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/** Standard normal, Box-Muller */
+static double normal(uint64_t* state) {
+  double u1 = 1.0 - uniform(state);
+  double u2 = uniform(state);
+  return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+static double sigmoid(double x) {
+  return 1.0 / (1.0 + exp(-x));
+}
+
+static void sample_parity(NeuralNetSynth* synth, unsigned long index,
+    Pattern* input, Pattern* target) {
+  unsigned long n = synth->spec.input_count;
+  unsigned long ones = 0;
+  uint64_t state = stream(synth, STREAM_SAMPLE, index);
+  uint64_t bits = 0;
+
+  for (unsigned long i = 0; i < n; i++) {
+    unsigned long bit;
+    if (n < 64) {
+      // All patterns in order when enumerating, random ones otherwise
+      if ((i & 63) == 0) {
+        bits = (synth->spec.samples == (1UL << n)) ? index : next64(&state);
+      }
+      bit = (bits >> (n - 1 - i)) & 1;
+    } else {
+      if ((i & 63) == 0) {
+        bits = next64(&state);
+      }
+      bit = (bits >> (i & 63)) & 1;
+    }
+    input->data[i] = (double)bit;
+    ones += bit;
+  }
+  target->data[0] = (double)(ones & 1);
+}
+
+static void sample_gaussian(NeuralNetSynth* synth, unsigned long index,
+    Pattern* input, Pattern* target) {
+  unsigned long n = synth->spec.input_count;
+  unsigned long classes = synth->spec.target_count;
+  uint64_t state = stream(synth, STREAM_SAMPLE, index);
+  unsigned long c = (unsigned long)(next64(&state) % classes);
+  double* center = &synth->centers[c * n];
+
+  for (unsigned long i = 0; i < n; i++) {
+    input->data[i] = center[i] + (synth->spec.spread * normal(&state));
+  }
+  for (unsigned long t = 0; t < classes; t++) {
+    target->data[t] = (t == c) ? 1.0 : 0.0;
+  }
+}
+
+static void sample_teacher(NeuralNetSynth* synth, unsigned long index,
+    Pattern* input, Pattern* target) {
+  unsigned long n = synth->spec.input_count;
+  unsigned long hidden = synth->spec.hidden;
+  unsigned long outputs = synth->spec.target_count;
+  uint64_t state = stream(synth, STREAM_SAMPLE, index);
+  double* w = synth->teacher;
+  double* out_w = &synth->teacher[hidden * (n + 1)];
+
+  for (unsigned long i = 0; i < n; i++) {
+    input->data[i] = uniform(&state);
+  }
+
+  // Accumulate the output sums in target as each hidden output is made
+  for (unsigned long t = 0; t < outputs; t++) {
+    target->data[t] = out_w[t * (hidden + 1)];
+  }
+  for (unsigned long h = 0; h < hidden; h++, w += n + 1) {
+    double sum = w[0];
+    for (unsigned long i = 0; i < n; i++) {
+      sum += w[i + 1] * input->data[i];
+    }
+    double out = sigmoid(sum);
+    for (unsigned long t = 0; t < outputs; t++) {
+      target->data[t] += out_w[(t * (hidden + 1)) + h + 1] * out;
+    }
+  }
+  for (unsigned long t = 0; t < outputs; t++) {
+    double y = sigmoid(target->data[t]) + (synth->spec.spread * normal(&state));
+    target->data[t] = y < 0.0 ? 0.0 : (y > 1.0 ? 1.0 : y);
+  }
+}
+
+static void sample_bars(NeuralNetSynth* synth, unsigned long index,
+    Pattern* input, Pattern* target) {
+  unsigned long side = synth->side;
+  uint64_t state = stream(synth, STREAM_SAMPLE, index);
+  unsigned long vertical = (unsigned long)(next64(&state) & 1);
+  unsigned long len = (side + 1) / 2;
+  unsigned long line = (unsigned long)(next64(&state) % side);
+  unsigned long first = (unsigned long)(next64(&state) % (side - len + 1));
+
+  // A bar of half the side anywhere in the image over noise, only its
+  // direction tells the classes apart so a small shared kernel can
+  for (unsigned long i = 0; i < side * side; i++) {
+    input->data[i] = synth->spec.spread * normal(&state);
+  }
+  for (unsigned long j = first; j < first + len; j++) {
+    input->data[vertical ? (j * side) + line : (line * side) + j] += 1.0;
+  }
+  target->data[0] = vertical ? 0.0 : 1.0;
+  target->data[1] = vertical ? 1.0 : 0.0;
+}
+
+static void sample(NeuralNetSynth* synth, unsigned long index, Pattern* input,
+    Pattern* target) {
+  switch (synth->spec.kind) {
+    case NEURAL_NET_SYNTH_PARITY: sample_parity(synth, index, input, target); break;
+    case NEURAL_NET_SYNTH_GAUSSIAN: sample_gaussian(synth, index, input, target); break;
+    case NEURAL_NET_SYNTH_BARS: sample_bars(synth, index, input, target); break;
+    default: sample_teacher(synth, index, input, target); break;
+  }
+}
+
+static Status write_csv(NeuralNetSynth* synth, char* path) {
+  Status status;
+  unsigned long n = synth->spec.input_count;
+  unsigned long targets = synth->spec.target_count;
+  Pattern* input = NULL;
+  Pattern* target = NULL;
+  FILE* f = NULL;
+
+  dbg("NeuralNetSynth.write:+%p path=%s\n", (void*)synth, path);
+
+  input = Pattern_create(n);
+  target = Pattern_create(targets);
+  if ((input == NULL) || (target == NULL)) { status = STATUS_OOM; goto done; }
+
+  f = fopen(path, "w");
+  if (f == NULL) {
+    printf("NeuralNetSynth.write: could not open file: '%s' err=%s\n", path, strerror(errno));
+    status = STATUS_ERR;
+    goto done;
+  }
+
+  // %.17g so the values read back exactly
+  for (unsigned long s = 0; s < synth->spec.samples; s++) {
+    sample(synth, s, input, target);
+    for (unsigned long i = 0; i < n; i++) {
+      fprintf(f, "%.17g,", input->data[i]);
+    }
+    for (unsigned long t = 0; t < targets; t++) {
+      fprintf(f, (t + 1 < targets) ? "%.17g," : "%.17g\n", target->data[t]);
+    }
+  }
+  if (ferror(f)) {
+    printf("NeuralNetSynth.write: %s: %s\n", path, strerror(errno));
+    status = STATUS_ERR;
+    goto done;
+  }
+
+  status = STATUS_OK;
+
+done:
+  if ((f != NULL) && (fclose(f) != 0) && StatusOk(status)) {
+    status = STATUS_ERR;
+  }
+  free(input);
+  free(target);
+  dbg("NeuralNetSynth.write:-%p status=%d\n", (void*)synth, StatusVal(status));
+  return status;
+}
+
+static void deinit(NeuralNetSynth* synth) {
+  free(synth->centers);
+  free(synth->teacher);
+  synth->centers = NULL;
+  synth->teacher = NULL;
+}
+
+Status NeuralNetSynth_init(NeuralNetSynth* synth, NeuralNetSynthSpec* spec) {
+  Status status;
+
+  dbg("NeuralNetSynth_init:+%p kind=%ld inputs=%ld\n", (void*)synth, spec->kind,
+      spec->input_count);
+
+  memset(synth, 0, sizeof(*synth));
+  synth->spec = *spec;
+  synth->deinit = deinit;
+  synth->sample = sample;
+  synth->write = write_csv;
+
+  NeuralNetSynthSpec* s = &synth->spec;
+  if ((s->input_count == 0) || (s->kind > NEURAL_NET_SYNTH_BARS)) {
+    status = STATUS_BAD_PARAM;
+    goto done;
+  }
+
+  if (s->kind == NEURAL_NET_SYNTH_PARITY) {
+    s->target_count = 1;
+    if (s->samples == 0) {
+      if (s->input_count >= 64) {
+        status = STATUS_BAD_PARAM;
+        goto done;
+      }
+      s->samples = 1UL << s->input_count;
+    }
+  } else if (s->kind == NEURAL_NET_SYNTH_BARS) {
+    s->target_count = 2;
+    while ((synth->side + 1) * (synth->side + 1) <= s->input_count) {
+      synth->side += 1;
+    }
+    if ((synth->side * synth->side != s->input_count) || (s->samples == 0)) {
+      status = STATUS_BAD_PARAM;
+      goto done;
+    }
+  } else if ((s->target_count == 0) || (s->samples == 0)) {
+    status = STATUS_BAD_PARAM;
+    goto done;
+  }
+
+  if (s->kind == NEURAL_NET_SYNTH_GAUSSIAN) {
+    // Cluster centers uniform in the unit cube
+    synth->centers = calloc(s->target_count * s->input_count, sizeof(double));
+    if (synth->centers == NULL) { status = STATUS_OOM; goto done; }
+    uint64_t state = stream(synth, STREAM_CENTERS, 0);
+    for (unsigned long j = 0; j < s->target_count * s->input_count; j++) {
+      synth->centers[j] = uniform(&state);
+    }
+  } else if (s->kind == NEURAL_NET_SYNTH_TEACHER) {
+    // Weights scaled by the fan in so the sums stay in the sigmoid's
+    // sensitive range, with inputs in [0, 1) centered by the bias
+    if (s->hidden == 0) {
+      s->hidden = s->input_count;
+    }
+    unsigned long n = s->input_count;
+    unsigned long count = (s->hidden * (n + 1)) + (s->target_count * (s->hidden + 1));
+    synth->teacher = calloc(count, sizeof(double));
+    if (synth->teacher == NULL) { status = STATUS_OOM; goto done; }
+    uint64_t state = stream(synth, STREAM_TEACHER, 0);
+    double* w = synth->teacher;
+    for (unsigned long h = 0; h < s->hidden; h++, w += n + 1) {
+      double scale = 4.0 / sqrt((double)n);
+      double sum = 0.0;
+      for (unsigned long i = 0; i < n; i++) {
+        w[i + 1] = scale * normal(&state);
+        sum += w[i + 1];
+      }
+      w[0] = -0.5 * sum;
+    }
+    for (unsigned long t = 0; t < s->target_count; t++, w += s->hidden + 1) {
+      double scale = 4.0 / sqrt((double)s->hidden);
+      double sum = 0.0;
+      for (unsigned long h = 0; h < s->hidden; h++) {
+        w[h + 1] = scale * normal(&state);
+        sum += w[h + 1];
+      }
+      w[0] = -0.5 * sum;
+    }
+  }
+
+  status = STATUS_OK;
+
+done:
+  if (StatusErr(status)) {
+    deinit(synth);
+  }
+  dbg("NeuralNetSynth_init:-%p status=%d\n", (void*)synth, StatusVal(status));
+  return status;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "NeuralNet.h"
+#include "NeuralNetTrain.h"
+#include "rand0_1.h"
+
+#include <stdlib.h>
+
+Pattern* Pattern_create(unsigned long count) {
+  Pattern* p = calloc(1, sizeof(Pattern) + (count * sizeof(double)));
+  if (p != NULL) {
+    p->count = count;
+  }
+  return p;
+}
+
+void NeuralNet_shuffle(unsigned int* perm, unsigned int count) {
+  // Shuffle by swapping the current position with a random
+  // location after the current position, starting from
+  // sequential order.
+  for (unsigned int p = 0; p < count; p++) {
+    perm[p] = p;
+  }
+  for (unsigned int p = 0; p < count; p++) {
+    double r0_1 = rand0_1();
+    unsigned int rp = p + (unsigned int)(r0_1 * (count - p));
+    unsigned int t = perm[p];
+    perm[p] = perm[rp];
+    perm[rp] = t;
+  }
+}
+
+double NeuralNet_train_epoch(NeuralNet* nn, Pattern** inputs,
+    Pattern** targets, Pattern* output, unsigned int* perm,
+    unsigned int pattern_count) {
+  return NeuralNet_train_epoch_each(nn, inputs, targets, output, perm,
+      pattern_count, NULL, NULL);
+}
+
+double NeuralNet_train_epoch_each(NeuralNet* nn, Pattern** inputs,
+    Pattern** targets, Pattern* output, unsigned int* perm,
+    unsigned int pattern_count, NeuralNet_SampleDone done, void* arg) {
+  double error = 0.0;
+
+  NeuralNet_shuffle(perm, pattern_count);
+
+  // Process the patterns and accumulate the error
+  for (unsigned int rp = 0; rp < pattern_count; rp++) {
+    unsigned int p = perm[rp];
+    nn->set_inputs(nn, inputs[p]);
+    nn->process(nn);
+    nn->get_outputs(nn, output);
+    error += nn->adjust_weights(nn, output, targets[p]);
+    if (done != NULL) {
+      done(arg, rp);
+    }
+  }
+
+  return error;
+}
@@ -0,0 +1,185 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "NeuralNet.h"
+#include "NeuralNetTrain.h"
+#include "NeuralNetTrainer.h"
+#include "dbg.h"
+#include "rand0_1.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((double)ts.tv_sec * 1.0e9) + (double)ts.tv_nsec;
+}
+
+/** Train the sample at the cursor, returns 1 when that finished the trainer */
+static int train_sample(NeuralNetTrainer* t) {
+  NeuralNet* nn = t->nn;
+
+  if (t->cursor == 0) {
+    NeuralNet_shuffle(t->perm, (unsigned int)t->pattern_count);
+  }
+
+  unsigned int p = t->perm[t->cursor];
+  nn->set_inputs(nn, t->inputs[p]);
+  nn->process(nn);
+  nn->get_outputs(nn, t->output);
+  t->epoch_error += nn->adjust_weights(nn, t->output, t->targets[p]);
+  t->cursor += 1;
+  t->samples += 1;
+
+  if (t->cursor == t->pattern_count) {
+    t->last_error = t->epoch_error;
+    t->epoch_error = 0.0;
+    t->cursor = 0;
+    t->epoch += 1;
+    if ((t->last_error < t->error_threshold)
+        || ((t->max_epochs > 0) && (t->epoch >= t->max_epochs))) {
+      t->done = 1;
+    }
+  }
+
+  return (int)t->done;
+}
+
+static unsigned long step(NeuralNetTrainer* t, unsigned long max_samples,
+    unsigned long budget_ns) {
+  unsigned long run = 0;
+  Rand0_1State caller_state;
+
+  if (t->done) {
+    return 0;
+  }
+  if ((max_samples == 0) && (budget_ns == 0)) {
+    max_samples = t->pattern_count - t->cursor;
+  }
+
+  // Swap in the trainer's generator, the caller's is left as it was
+  rand0_1_save(&caller_state);
+  rand0_1_restore(&t->rand_state);
+
+  if (budget_ns == 0) {
+    while ((max_samples == 0) || (run < max_samples)) {
+      run += 1;
+      if (train_sample(t)) break;
+    }
+  } else {
+    // Only read the clock every batch samples, sized from the measured
+    // cost so a read happens about every NEURAL_NET_TRAINER_CHECK_NS and
+    // the next batch is not expected to run past the deadline.
+    double last = now_ns();
+    double deadline = last + (double)budget_ns;
+    unsigned long batch = 1;
+    while (!t->done && ((max_samples == 0) || (run < max_samples))) {
+      unsigned long n = batch;
+      if ((max_samples > 0) && (n > (max_samples - run))) {
+        n = max_samples - run;
+      }
+      unsigned long first = run;
+      for (unsigned long i = 0; i < n; i++) {
+        run += 1;
+        if (train_sample(t)) break;
+      }
+
+      double now = now_ns();
+      double cost = (now - last) / (double)(run - first);
+      t->ns_per_sample = (t->ns_per_sample > 0.0)
+        ? ((0.875 * t->ns_per_sample) + (0.125 * cost)) : cost;
+      last = now;
+
+      double remaining = deadline - now;
+      if (remaining < t->ns_per_sample) {
+        break;
+      }
+      double fit = fmin(remaining, NEURAL_NET_TRAINER_CHECK_NS) / t->ns_per_sample;
+      batch = fit < 1.0 ? 1 : (unsigned long)fit;
+    }
+  }
+
+  rand0_1_save(&t->rand_state);
+  rand0_1_restore(&caller_state);
+
+  return run;
+}
+
+static void progress(NeuralNetTrainer* t, NeuralNetTrainerProgress* p) {
+  p->epoch = t->epoch;
+  p->cursor = t->cursor;
+  p->samples = t->samples;
+  p->done = t->done;
+  p->epoch_error = t->epoch_error;
+  p->last_error = t->last_error;
+  p->fraction = (double)t->cursor / (double)t->pattern_count;
+  p->ns_per_sample = t->ns_per_sample;
+}
+
+static void deinit(NeuralNetTrainer* t) {
+  dbg("NeuralNetTrainer.deinit:+%p\n", (void*)t);
+
+  free(t->perm);
+  t->perm = NULL;
+  free(t->output);
+  t->output = NULL;
+
+  dbg("NeuralNetTrainer.deinit:-%p\n", (void*)t);
+}
+
+Status NeuralNetTrainer_init(NeuralNetTrainer* t, NeuralNet* nn,
+    Pattern** inputs, Pattern** targets, unsigned long pattern_count) {
+  Status status;
+
+  dbg("NeuralNetTrainer_init:+%p nn=%p pattern_count=%ld\n", (void*)t,
+      (void*)nn, pattern_count);
+
+  memset(t, 0, sizeof(*t));
+  t->nn = nn;
+  t->inputs = inputs;
+  t->targets = targets;
+  t->pattern_count = pattern_count;
+  t->last_error = (double)INFINITY;
+  t->deinit = deinit;
+  t->step = step;
+  t->progress = progress;
+
+  if ((nn == NULL) || (inputs == NULL) || (targets == NULL) || (pattern_count == 0)) {
+    status = STATUS_BAD_PARAM;
+    goto done;
+  }
+
+  t->perm = calloc(pattern_count, sizeof(unsigned int));
+  t->output = Pattern_create(nn->layers[nn->out_layer].count);
+  if ((t->perm == NULL) || (t->output == NULL)) {
+    status = STATUS_OOM;
+    goto done;
+  }
+  rand0_1_save(&t->rand_state);
+
+  status = STATUS_OK;
+
+done:
+  if (StatusErr(status)) {
+    deinit(t);
+  }
+  dbg("NeuralNetTrainer_init:-%p status=%d\n", (void*)t, StatusVal(status));
+  return status;
+}
@@ -0,0 +1,412 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "NeuralNet.h"
+#include "NeuralNetKernels.h"
+#include "NeuralNetTune.h"
+#include "ThreadPool.h"
+#include "dbg.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static char* op_names[NEURAL_NET_KERNEL_OPS] = { "forward", "backward", "adjust" };
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((double)ts.tv_sec * 1.0e9) + (double)ts.tv_nsec;
+}
+
+static const char* host_isa(void) {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return "avx512f";
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return "avx2";
+  }
+#endif
+  return "c";
+}
+
+static void run_kernel(NeuralNet* nn, unsigned long l, const NeuralNetKernel* k) {
+  NeuronLayer* layer = &nn->layers[l];
+  double* logits = (l == nn->out_layer) ? nn->logits : NULL;
+
+  switch (k->op) {
+    case NEURAL_NET_KERNEL_FORWARD:
+      k->forward(layer, logits);
+      break;
+    case NEURAL_NET_KERNEL_BACKWARD:
+      k->backward(layer, &nn->layers[l - 1]);
+      break;
+    default:
+      k->adjust(layer, nn->learning_rate, nn->momentum_factor);
+      break;
+  }
+}
+
+/** @return the fastest of NEURAL_NET_TUNE_TRIALS timings of k in ns per call */
+static double time_kernel(NeuralNet* nn, unsigned long l, const NeuralNetKernel* k) {
+  unsigned long reps = 1;
+  double best = (double)INFINITY;
+
+  // Warm up and find how many calls take NEURAL_NET_TUNE_MIN_NS
+  for (;;) {
+    double start = now_ns();
+    for (unsigned long r = 0; r < reps; r++) {
+      run_kernel(nn, l, k);
+    }
+    double elapsed = now_ns() - start;
+    if (elapsed >= NEURAL_NET_TUNE_MIN_NS) {
+      best = elapsed / (double)reps;
+      break;
+    }
+    reps *= 2;
+  }
+
+  for (unsigned long t = 1; t < NEURAL_NET_TUNE_TRIALS; t++) {
+    double start = now_ns();
+    for (unsigned long r = 0; r < reps; r++) {
+      run_kernel(nn, l, k);
+    }
+    double ns = (now_ns() - start) / (double)reps;
+    best = ns < best ? ns : best;
+  }
+
+  return best;
+}
+
+/** Save or restore the weights and momentums the adjust candidates change */
+static void copy_layer(NeuronLayer* layer, double* saved, int save) {
+  unsigned long cols = layer->neurons[0].inputs->count + 1;
+  for (unsigned long n = 0; n < layer->count; n++) {
+    Neuron* neuron = &layer->neurons[n];
+    double* w = &saved[n * cols * 2];
+    double* m = &w[cols];
+    if (save) {
+      memcpy(w, neuron->weights, cols * sizeof(double));
+      memcpy(m, neuron->momentums, cols * sizeof(double));
+    } else {
+      memcpy(neuron->weights, w, cols * sizeof(double));
+      memcpy(neuron->momentums, m, cols * sizeof(double));
+    }
+  }
+}
+
+/** Benchmark every usable candidate on layer l and fill in entry */
+static Status tune_layer(NeuralNet* nn, unsigned long l, NeuralNetTuneEntry* entry) {
+  Status status;
+  NeuronLayer* layer = &nn->layers[l];
+  NeuronLayerTuned* tuned = layer->tuned;
+  unsigned long count;
+  const NeuralNetKernel* list = NeuralNetKernel_list(&count);
+  unsigned long cols = layer->neurons[0].inputs->count + 1;
+  double* saved = calloc(layer->count * cols * 2, sizeof(double));
+
+  if (saved == NULL) {
+    status = STATUS_OOM;
+    goto done;
+  }
+  copy_layer(layer, saved, 1);
+
+  for (unsigned long op = 0; op < NEURAL_NET_KERNEL_OPS; op++) {
+    tuned->ns[op] = (double)INFINITY;
+    for (unsigned long k = 0; k < count; k++) {
+      if ((list[k].op != op) || !NeuralNetKernel_usable(&list[k], tuned->pool)) {
+        continue;
+      }
+      double ns = time_kernel(nn, l, &list[k]);
+      dbg("NeuralNetTune: layer %ld %s %s %.1lfns\n", l, op_names[op], list[k].name, ns);
+      if (ns < tuned->ns[op]) {
+        tuned->ns[op] = ns;
+        tuned->kernels[op] = &list[k];
+      }
+    }
+    snprintf(entry->names[op], sizeof(entry->names[op]), "%s", tuned->kernels[op]->name);
+    entry->ns[op] = tuned->ns[op];
+  }
+
+  copy_layer(layer, saved, 0);
+  status = STATUS_OK;
+
+done:
+  free(saved);
+  return status;
+}
+
+static NeuralNetTuneEntry* find_entry(NeuralNetTune* tune, NeuralNetTuneEntry* key) {
+  for (unsigned long e = 0; e < tune->entry_count; e++) {
+    NeuralNetTuneEntry* entry = &tune->entries[e];
+    if ((entry->inputs == key->inputs) && (entry->neurons == key->neurons)
+        && (entry->logits == key->logits) && (entry->workers == key->workers)) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+static Status add_entry(NeuralNetTune* tune, NeuralNetTuneEntry* entry) {
+  NeuralNetTuneEntry* found = find_entry(tune, entry);
+  if (found != NULL) {
+    *found = *entry;
+    return STATUS_OK;
+  }
+  NeuralNetTuneEntry* entries = realloc(tune->entries,
+      (tune->entry_count + 1) * sizeof(NeuralNetTuneEntry));
+  if (entries == NULL) {
+    return STATUS_OOM;
+  }
+  tune->entries = entries;
+  tune->entries[tune->entry_count++] = *entry;
+  return STATUS_OK;
+}
+
+/** Load the cache, a missing file or one from another kind of host is empty */
+static Status load_cache(NeuralNetTune* tune, const char* path) {
+  Status status = STATUS_OK;
+  char line[256];
+  char host[32];
+
+  FILE* f = fopen(path, "r");
+  if (f == NULL) {
+    return STATUS_OK;
+  }
+
+  if ((fgets(line, sizeof(line), f) == NULL)
+      || (strncmp(line, NEURAL_NET_TUNE_MAGIC, strlen(NEURAL_NET_TUNE_MAGIC)) != 0)
+      || (fgets(line, sizeof(line), f) == NULL)
+      || (sscanf(line, "host %31s", host) != 1)
+      || (strcmp(host, tune->host) != 0)) {
+    dbg("NeuralNetTune: ignoring cache '%s'\n", path);
+    goto done;
+  }
+
+  while (fgets(line, sizeof(line), f) != NULL) {
+    NeuralNetTuneEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    if (sscanf(line, "%lu %lu %lu %lu %15s %15s %15s %lf %lf %lf",
+          &entry.inputs, &entry.neurons, &entry.logits, &entry.workers,
+          entry.names[0], entry.names[1], entry.names[2],
+          &entry.ns[0], &entry.ns[1], &entry.ns[2]) != 10) {
+      continue;
+    }
+    status = add_entry(tune, &entry);
+    if (StatusErr(status)) goto done;
+  }
+
+done:
+  fclose(f);
+  return status;
+}
+
+/** Write the cache to a temporary file and rename it over path */
+static Status save_cache(NeuralNetTune* tune, const char* path) {
+  Status status;
+  char tmp[4096];
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  FILE* f = fopen(tmp, "w");
+  if (f == NULL) {
+    printf("NeuralNetTune: could not create '%s' err=%s\n", tmp, strerror(errno));
+    return STATUS_ERR;
+  }
+
+  fprintf(f, "%s\n", NEURAL_NET_TUNE_MAGIC);
+  fprintf(f, "host %s\n", tune->host);
+  for (unsigned long e = 0; e < tune->entry_count; e++) {
+    NeuralNetTuneEntry* entry = &tune->entries[e];
+    fprintf(f, "%lu %lu %lu %lu %s %s %s %.1lf %.1lf %.1lf\n",
+        entry->inputs, entry->neurons, entry->logits, entry->workers,
+        entry->names[0], entry->names[1], entry->names[2],
+        entry->ns[0], entry->ns[1], entry->ns[2]);
+  }
+
+  if ((fclose(f) != 0) || (rename(tmp, path) != 0)) {
+    printf("NeuralNetTune: could not write '%s' err=%s\n", path, strerror(errno));
+    unlink(tmp);
+    status = STATUS_ERR;
+  } else {
+    status = STATUS_OK;
+  }
+  return status;
+}
+
+/** Set the layer's kernels from entry, returns 0 if a name is unknown or unusable */
+static int use_entry(NeuronLayerTuned* tuned, NeuralNetTuneEntry* entry) {
+  const NeuralNetKernel* kernels[NEURAL_NET_KERNEL_OPS];
+
+  for (unsigned long op = 0; op < NEURAL_NET_KERNEL_OPS; op++) {
+    kernels[op] = NeuralNetKernel_find(op, entry->names[op]);
+    if ((kernels[op] == NULL) || !NeuralNetKernel_usable(kernels[op], tuned->pool)) {
+      return 0;
+    }
+  }
+  for (unsigned long op = 0; op < NEURAL_NET_KERNEL_OPS; op++) {
+    tuned->kernels[op] = kernels[op];
+    tuned->ns[op] = entry->ns[op];
+  }
+  return 1;
+}
+
+static void pool_free(NeuralNetTune* tune) {
+  if (tune->pool != NULL) {
+    tune->pool->deinit(tune->pool);
+    free(tune->pool);
+    tune->pool = NULL;
+  }
+}
+
+void NeuralNetTune_deinit(NeuralNet* nn) {
+  dbg("NeuralNetTune_deinit:+%p\n", (void*)nn);
+
+  if (nn->layers != NULL) {
+    for (unsigned long l = 0; l < nn->max_layers; l++) {
+      NeuronLayerTuned_deinit(&nn->layers[l]);
+    }
+  }
+  if (nn->tune != NULL) {
+    pool_free(nn->tune);
+    free(nn->tune->entries);
+    free(nn->tune);
+    nn->tune = NULL;
+  }
+
+  dbg("NeuralNetTune_deinit:-%p\n", (void*)nn);
+}
+
+Status NeuralNetTune_start(NeuralNet* nn, unsigned long workers) {
+  Status status;
+  NeuralNetTune* tune;
+
+  dbg("NeuralNetTune_start:+%p mode=%ld workers=%ld\n", (void*)nn,
+      nn->tune_mode, workers);
+
+  NeuralNetTune_deinit(nn);
+  tune = nn->tune = calloc(1, sizeof(NeuralNetTune));
+  if (tune == NULL) { status = STATUS_OOM; goto done; }
+  tune->host = host_isa();
+
+  double start = now_ns();
+  if (workers == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    workers = cpus > 0 ? (unsigned long)cpus : 1;
+  }
+  tune->workers = workers;
+  if (workers > 1) {
+    tune->pool = calloc(1, sizeof(ThreadPool));
+    if (tune->pool == NULL) { status = STATUS_OOM; goto done; }
+    status = ThreadPool_init(tune->pool, workers);
+    if (StatusErr(status)) {
+      free(tune->pool);
+      tune->pool = NULL;
+      goto done;
+    }
+  }
+
+  // Forced tuning still loads the cache to keep the other shapes
+  if (nn->tune_cache != NULL) {
+    status = load_cache(tune, nn->tune_cache);
+    if (StatusErr(status)) goto done;
+  }
+
+  int threaded = 0;
+  for (unsigned long l = 1; l <= nn->out_layer; l++) {
+    NeuronLayer* layer = &nn->layers[l];
+    if ((layer->conv != NULL) || (layer->half != NULL) || (layer->sparse != NULL)) {
+      continue;
+    }
+    status = NeuronLayerTuned_attach(layer, tune->pool);
+    if (StatusErr(status)) goto done;
+
+    NeuralNetTuneEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.inputs = nn->layers[l - 1].count;
+    entry.neurons = layer->count;
+    entry.logits = (l == nn->out_layer) && (nn->logits != NULL);
+    entry.workers = workers;
+
+    NeuralNetTuneEntry* cached = find_entry(tune, &entry);
+    if ((nn->tune_mode == NEURAL_NET_TUNE_CACHE) && (cached != NULL)
+        && use_entry(layer->tuned, cached)) {
+      tune->cached += 1;
+    } else {
+      status = tune_layer(nn, l, &entry);
+      if (StatusErr(status)) goto done;
+      status = add_entry(tune, &entry);
+      if (StatusErr(status)) goto done;
+      tune->tuned += 1;
+    }
+    for (unsigned long op = 0; op < NEURAL_NET_KERNEL_OPS; op++) {
+      threaded |= (int)layer->tuned->kernels[op]->threaded;
+    }
+  }
+
+  // Don't keep idle workers around if nothing fans out
+  if (!threaded) {
+    for (unsigned long l = 1; l <= nn->out_layer; l++) {
+      if (nn->layers[l].tuned != NULL) {
+        nn->layers[l].tuned->pool = NULL;
+      }
+    }
+    pool_free(tune);
+  }
+
+  if ((nn->tune_cache != NULL) && (tune->tuned > 0)) {
+    status = save_cache(tune, nn->tune_cache);
+    if (StatusErr(status)) goto done;
+  }
+  tune->time_sec = (now_ns() - start) / 1.0e9;
+
+  status = STATUS_OK;
+
+done:
+  if (StatusErr(status)) {
+    NeuralNetTune_deinit(nn);
+  }
+  dbg("NeuralNetTune_start:-%p status=%d\n", (void*)nn, StatusVal(status));
+  return status;
+}
+
+void NeuralNetTune_print(NeuralNet* nn, FILE* f) {
+  NeuralNetTune* tune = nn->tune;
+
+  if (tune == NULL) {
+    fprintf(f, "Kernels: default loops\n");
+    return;
+  }
+  fprintf(f, "Kernels: host=%s workers=%ld tuned=%ld cached=%ld time=%.3lfs\n",
+      tune->host, tune->workers, tune->tuned, tune->cached, tune->time_sec);
+  for (unsigned long l = 1; l <= nn->out_layer; l++) {
+    NeuronLayerTuned* tuned = nn->layers[l].tuned;
+    if (tuned == NULL) {
+      continue;
+    }
+    fprintf(f, "  layer %ld %ldx%ld", l, nn->layers[l].count, nn->layers[l - 1].count);
+    for (unsigned long op = 0; op < NEURAL_NET_KERNEL_OPS; op++) {
+      fprintf(f, " %s=%s(%.0lfns)", op_names[op], tuned->kernels[op]->name, tuned->ns[op]);
+    }
+    fprintf(f, "\n");
+  }
+}
@@ -0,0 +1,280 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "NeuralNet.h"
+#include "ThreadPool.h"
+#include "dbg.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DEQUE_INITIAL_CAP 64
+
+// The worker the current thread is, NULL if it isn't one
+static _Thread_local ThreadPoolWorker* current_worker;
+
+static Status deque_push(ThreadPoolDeque* d, ThreadPoolTask task) {
+  Status status = STATUS_OK;
+
+  pthread_mutex_lock(&d->lock);
+  if ((d->tail - d->head) == d->cap) {
+    // Grow, copying the tasks to the start of the new ring
+    unsigned long cap = d->cap * 2;
+    ThreadPoolTask* tasks = calloc(cap, sizeof(ThreadPoolTask));
+    if (tasks == NULL) {
+      status = STATUS_OOM;
+      goto done;
+    }
+    for (unsigned long i = d->head; i < d->tail; i++) {
+      tasks[i - d->head] = d->tasks[i % d->cap];
+    }
+    free(d->tasks);
+    d->tasks = tasks;
+    d->tail -= d->head;
+    d->head = 0;
+    d->cap = cap;
+  }
+  d->tasks[d->tail % d->cap] = task;
+  d->tail += 1;
+
+done:
+  pthread_mutex_unlock(&d->lock);
+  return status;
+}
+
+/** Pop the newest task, for the owner */
+static int deque_pop(ThreadPoolDeque* d, ThreadPoolTask* task) {
+  int got = 0;
+
+  pthread_mutex_lock(&d->lock);
+  if (d->tail != d->head) {
+    d->tail -= 1;
+    *task = d->tasks[d->tail % d->cap];
+    got = 1;
+  }
+  pthread_mutex_unlock(&d->lock);
+  return got;
+}
+
+/** Take the oldest task, for thieves */
+static int deque_steal(ThreadPoolDeque* d, ThreadPoolTask* task) {
+  int got = 0;
+
+  if (pthread_mutex_trylock(&d->lock) != 0) {
+    // Someone else is working on this deque, try another
+    return 0;
+  }
+  if (d->tail != d->head) {
+    *task = d->tasks[d->head % d->cap];
+    d->head += 1;
+    got = 1;
+  }
+  pthread_mutex_unlock(&d->lock);
+  return got;
+}
+
+static int find_task(ThreadPoolWorker* w, ThreadPoolTask* task) {
+  ThreadPool* pool = w->pool;
+
+  if (deque_pop(&w->deque, task)) {
+    return 1;
+  }
+  for (unsigned long i = 1; i < pool->count; i++) {
+    ThreadPoolWorker* victim = &pool->workers[(w->index + i) % pool->count];
+    if (deque_steal(&victim->deque, task)) {
+      w->stolen += 1;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void* worker_thread(void* arg) {
+  ThreadPoolWorker* w = arg;
+  ThreadPool* pool = w->pool;
+  ThreadPoolTask task;
+
+  current_worker = w;
+  for (;;) {
+    if (find_task(w, &task)) {
+      pthread_mutex_lock(&pool->lock);
+      pool->queued -= 1;
+      pthread_mutex_unlock(&pool->lock);
+
+      task.fn(task.arg, w->index);
+      w->executed += 1;
+
+      pthread_mutex_lock(&pool->lock);
+      pool->pending -= 1;
+      if (pool->pending == 0) {
+        pthread_cond_broadcast(&pool->idle);
+      }
+      pthread_mutex_unlock(&pool->lock);
+      continue;
+    }
+
+    // Nothing to do, sleep until a task is queued. A trylock miss in
+    // find_task can leave queued > 0, in which case we just look again.
+    pthread_mutex_lock(&pool->lock);
+    while ((pool->queued == 0) && !pool->stopping) {
+      pthread_cond_wait(&pool->work, &pool->lock);
+    }
+    int stop = (pool->queued == 0) && pool->stopping;
+    pthread_mutex_unlock(&pool->lock);
+    if (stop) {
+      break;
+    }
+  }
+  current_worker = NULL;
+
+  return NULL;
+}
+
+static Status submit(ThreadPool* pool, ThreadPool_Fn fn, void* arg) {
+  Status status;
+  ThreadPoolWorker* w;
+  ThreadPoolTask task = { .fn = fn, .arg = arg };
+
+  if ((current_worker != NULL) && (current_worker->pool == pool)) {
+    // From a task, keep it local to this worker
+    w = current_worker;
+  } else {
+    pthread_mutex_lock(&pool->lock);
+    w = &pool->workers[pool->next];
+    pool->next = (pool->next + 1) % pool->count;
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  // Count it before it can be run so pending can't reach 0 early
+  pthread_mutex_lock(&pool->lock);
+  pool->pending += 1;
+  pthread_mutex_unlock(&pool->lock);
+
+  status = deque_push(&w->deque, task);
+
+  pthread_mutex_lock(&pool->lock);
+  if (StatusOk(status)) {
+    pool->queued += 1;
+    pthread_cond_signal(&pool->work);
+  } else {
+    pool->pending -= 1;
+    if (pool->pending == 0) {
+      pthread_cond_broadcast(&pool->idle);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return status;
+}
+
+static void wait_idle(ThreadPool* pool) {
+  pthread_mutex_lock(&pool->lock);
+  while (pool->pending != 0) {
+    pthread_cond_wait(&pool->idle, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+static void deinit(ThreadPool* pool) {
+  dbg("ThreadPool.deinit:+%p\n", (void*)pool);
+
+  if (pool->workers != NULL) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+
+    // Join them all before destroying any deque, the ones still
+    // running may try to steal from it
+    for (unsigned long i = 0; i < pool->count; i++) {
+      ThreadPoolWorker* w = &pool->workers[i];
+      if (w->pool != NULL) {
+        pthread_join(w->thread, NULL);
+      }
+    }
+    for (unsigned long i = 0; i < pool->count; i++) {
+      ThreadPoolWorker* w = &pool->workers[i];
+      pthread_mutex_destroy(&w->deque.lock);
+      free(w->deque.tasks);
+    }
+    free(pool->workers);
+    pool->workers = NULL;
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->idle);
+    pthread_mutex_destroy(&pool->lock);
+  }
+
+  dbg("ThreadPool.deinit:-%p\n", (void*)pool);
+}
+
+Status ThreadPool_init(ThreadPool* pool, unsigned long count) {
+  Status status;
+
+  dbg("ThreadPool_init:+%p count=%ld\n", (void*)pool, count);
+
+  memset(pool, 0, sizeof(*pool));
+  pool->deinit = deinit;
+  pool->submit = submit;
+  pool->wait = wait_idle;
+
+  if (count == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    count = (cpus > 0) ? (unsigned long)cpus : 1;
+  }
+
+  pool->workers = calloc(count, sizeof(ThreadPoolWorker));
+  if (pool->workers == NULL) {
+    status = STATUS_OOM;
+    goto done;
+  }
+  pool->count = count;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work, NULL);
+  pthread_cond_init(&pool->idle, NULL);
+
+  for (unsigned long i = 0; i < count; i++) {
+    ThreadPoolWorker* w = &pool->workers[i];
+    w->index = i;
+    pthread_mutex_init(&w->deque.lock, NULL);
+    w->deque.cap = DEQUE_INITIAL_CAP;
+    w->deque.tasks = calloc(w->deque.cap, sizeof(ThreadPoolTask));
+    if (w->deque.tasks == NULL) {
+      status = STATUS_OOM;
+      goto done;
+    }
+  }
+  for (unsigned long i = 0; i < count; i++) {
+    ThreadPoolWorker* w = &pool->workers[i];
+    w->pool = pool;
+    if (pthread_create(&w->thread, NULL, worker_thread, w) != 0) {
+      w->pool = NULL;
+      status = STATUS_ERR;
+      goto done;
+    }
+  }
+
+  status = STATUS_OK;
+
+done:
+  if (StatusErr(status)) {
+    deinit(pool);
+  }
+  dbg("ThreadPool_init:-%p status=%d\n", (void*)pool, StatusVal(status));
+  return status;
+}
@@ -16,11 +16,55 @@
 
 #include "dbg.h"
 #include "rand0_1.h"
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define debugging 0
 
+/**
+ * Each thread has its own generator so its stream can be saved and
+ * restored, it is the same additive feedback generator rand() uses
+ * so a given seed produces the same sequence as srand(seed).
+ */
+typedef struct Rand0_1Generator {
+    struct random_data data;
+    char state[RAND0_1_STATE_SIZE];
+    int seeded;
+    int pad;
+} Rand0_1Generator;
+
+static _Thread_local Rand0_1Generator generator;
+
+void rand0_1_seed(unsigned int seed) {
+    memset(&generator, 0, sizeof(generator));
+    initstate_r(seed, generator.state, sizeof(generator.state), &generator.data);
+    generator.seeded = 1;
+}
+
+static Rand0_1Generator* rand0_1_generator(void) {
+    if (!generator.seeded) {
+        // Same default as rand() when srand() hasn't been called
+        rand0_1_seed(1);
+    }
+    return &generator;
+}
+
+void rand0_1_save(Rand0_1State* s) {
+    Rand0_1Generator* g = rand0_1_generator();
+    memcpy(s->state, g->state, sizeof(s->state));
+    s->fptr = g->data.fptr - g->data.state;
+    s->rptr = g->data.rptr - g->data.state;
+}
+
+void rand0_1_restore(Rand0_1State* s) {
+    Rand0_1Generator* g = rand0_1_generator();
+    memcpy(g->state, s->state, sizeof(g->state));
+    g->data.fptr = g->data.state + s->fptr;
+    g->data.rptr = g->data.state + s->rptr;
+}
+
 #if debugging
 static int rand_idx = 0;
 static double rand_nums[] = {
@@ -47,7 +91,8 @@ static double rand_nums[] = {
 double rand0_1(void) {
     double v;
 #if !debugging
-    double r = rand();
+    int32_t r;
+    random_r(&rand0_1_generator()->data, &r);
     v = r/((double)RAND_MAX+1);
 #else
     v = rand_nums[rand_idx++];
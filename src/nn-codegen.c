@@ -0,0 +1,232 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#if !defined(DBG)
+#define DBG 0
+#endif
+
+#include "NeuralNet.h"
+#include "NeuralNetCheckpoint.h"
+#include "NeuralNetCodegen.h"
+#include "NeuralNetSynth.h"
+#include "NeuralNetTrain.h"
+#include "dbg.h"
+#include "rand0_1.h"
+
+#include <limits.h>
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_PATH 256
+
+static void usage(char* name) {
+  printf("Usage: %s [options]\n", name);
+  printf("  Write standalone C inference code and a test harness for a net\n");
+  printf("  trained on synthetic data or restored from a checkpoint\n");
+  printf("  -k <kind>:   parity, gaussian or teacher, default gaussian\n");
+  printf("  -i <n>:      inputs, default 16\n");
+  printf("  -t <n>:      outputs, default 4\n");
+  printf("  -H <n>:      neurons per hidden layer, default 32\n");
+  printf("  -L <n>:      hidden layers, default 1\n");
+  printf("  -x:          softmax outputs\n");
+  printf("  -n <n>:      training samples, default 10000\n");
+  printf("  -e <n>:      epochs, default 5\n");
+  printf("  -s <n>:      seed, default 1\n");
+  printf("  -c <file>:   restore this checkpoint of the same topology, don't train\n");
+  printf("  -p <prefix>: prefix of the generated names and files, default nn\n");
+  printf("  -u:          unroll, write the weights as literals in the code\n");
+  printf("  -N <n>:      test inputs in the harness, default 100\n");
+  printf("  -E <x>:      tolerance of the harness, default 1e-12\n");
+}
+
+static Status write_file(char* path, NeuralNet* nn, char* prefix, unsigned long unroll,
+    Pattern** tests, unsigned long test_count, double tolerance) {
+  Status status;
+  FILE* out = fopen(path, "w");
+  if (out == NULL) {
+    printf("Unable to create '%s'\n", path);
+    return STATUS_ERR;
+  }
+  if (tests == NULL) {
+    status = NeuralNetCodegen_write(nn, prefix, unroll, out);
+  } else {
+    status = NeuralNetCodegen_write_test(nn, prefix, tests, test_count, tolerance, out);
+  }
+  if (fclose(out) != 0) {
+    status = STATUS_ERR;
+  }
+  if (StatusOk(status)) {
+    printf("wrote %s\n", path);
+  }
+  return status;
+}
+
+int main(int argc, char** argv) {
+  Status status;
+  NeuralNet nn;
+  NeuralNetSynth synth;
+  NeuralNetSynthSpec spec = {
+    .kind = NEURAL_NET_SYNTH_GAUSSIAN,
+    .input_count = 16,
+    .target_count = 4,
+    .samples = 10000,
+    .hidden = 0,
+    .seed = 1,
+    .spread = 0.1,
+  };
+  char* kind_names[] = { "parity", "gaussian", "teacher" };
+  unsigned long hidden = 32;
+  unsigned long hidden_layers = 1;
+  unsigned long softmax = 0;
+  unsigned long epochs = 5;
+  unsigned long unroll = 0;
+  unsigned long test_count = 100;
+  double tolerance = 1e-12;
+  char* checkpoint_path = NULL;
+  char* prefix = "nn";
+  char path[MAX_PATH];
+  Pattern** tests = NULL;
+  Pattern* input = NULL;
+  Pattern* target = NULL;
+  Pattern* output = NULL;
+  unsigned int* perm = NULL;
+  int opt;
+
+  setlocale(LC_NUMERIC, "");
+  memset(&nn, 0, sizeof(nn));
+  memset(&synth, 0, sizeof(synth));
+
+  while ((opt = getopt(argc, argv, "k:i:t:H:L:xn:e:s:c:p:uN:E:")) != -1) {
+    switch (opt) {
+      case 'k':
+        for (spec.kind = 0; spec.kind <= NEURAL_NET_SYNTH_TEACHER; spec.kind++) {
+          if (strcmp(optarg, kind_names[spec.kind]) == 0) break;
+        }
+        if (spec.kind > NEURAL_NET_SYNTH_TEACHER) {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'i': spec.input_count = strtoul(optarg, NULL, 0); break;
+      case 't': spec.target_count = strtoul(optarg, NULL, 0); break;
+      case 'H': hidden = strtoul(optarg, NULL, 0); break;
+      case 'L': hidden_layers = strtoul(optarg, NULL, 0); break;
+      case 'x': softmax = 1; break;
+      case 'n': spec.samples = strtoul(optarg, NULL, 0); break;
+      case 'e': epochs = strtoul(optarg, NULL, 0); break;
+      case 's': spec.seed = strtoul(optarg, NULL, 0); break;
+      case 'c': checkpoint_path = optarg; break;
+      case 'p': prefix = optarg; break;
+      case 'u': unroll = 1; break;
+      case 'N': test_count = strtoul(optarg, NULL, 0); break;
+      case 'E': tolerance = strtod(optarg, NULL); break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if ((spec.samples == 0) || (spec.samples > UINT_MAX) || (test_count == 0)
+      || (strlen(prefix) + 8 >= MAX_PATH)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  status = NeuralNetSynth_init(&synth, &spec);
+  if (StatusErr(status)) {
+    usage(argv[0]);
+    goto donedone;
+  }
+  input = Pattern_create(synth.spec.input_count);
+  target = Pattern_create(synth.spec.target_count);
+  output = Pattern_create(synth.spec.target_count);
+  tests = calloc(test_count, sizeof(Pattern*));
+  perm = calloc(synth.spec.samples, sizeof(unsigned int));
+  if ((input == NULL) || (target == NULL) || (output == NULL) || (tests == NULL)
+      || (perm == NULL)) {
+    status = STATUS_OOM;
+    goto donedone;
+  }
+
+  rand0_1_seed(1);
+  status = NeuralNet_init(&nn, synth.spec.input_count, hidden_layers,
+      synth.spec.target_count);
+  if (StatusErr(status)) goto donedone;
+  nn.output_type = softmax ? NEURAL_NET_OUTPUT_SOFTMAX : NEURAL_NET_OUTPUT_SIGMOID;
+  for (unsigned long l = 0; l < hidden_layers; l++) {
+    status = nn.add_hidden(&nn, hidden);
+    if (StatusErr(status)) goto done;
+  }
+  status = nn.start(&nn);
+  if (StatusErr(status)) goto done;
+
+  if (checkpoint_path != NULL) {
+    unsigned long epoch;
+    status = NeuralNetCheckpoint_load(checkpoint_path, &nn, &epoch, NULL, NULL, 0);
+    if (StatusErr(status)) {
+      printf("Unable to restore '%s', is the topology the same?\n", checkpoint_path);
+      goto done;
+    }
+    printf("restored %s at epoch=%ld\n", checkpoint_path, epoch);
+  } else {
+    for (unsigned long epoch = 0; epoch < epochs; epoch++) {
+      double error = 0.0;
+      NeuralNet_shuffle(perm, (unsigned int)synth.spec.samples);
+      for (unsigned long s = 0; s < synth.spec.samples; s++) {
+        synth.sample(&synth, perm[s], input, target);
+        nn.set_inputs(&nn, input);
+        nn.process(&nn);
+        nn.get_outputs(&nn, output);
+        error += nn.adjust_weights(&nn, output, target);
+      }
+      printf("epoch=%ld error=%lf\n", epoch + 1, error / (double)synth.spec.samples);
+    }
+  }
+
+  // Test on samples past those trained on
+  for (unsigned long p = 0; p < test_count; p++) {
+    tests[p] = Pattern_create(synth.spec.input_count);
+    if (tests[p] == NULL) { status = STATUS_OOM; goto done; }
+    synth.sample(&synth, synth.spec.samples + p, tests[p], target);
+  }
+
+  snprintf(path, sizeof(path), "%s.c", prefix);
+  status = write_file(path, &nn, prefix, unroll, NULL, 0, 0.0);
+  if (StatusErr(status)) goto done;
+  snprintf(path, sizeof(path), "%s_test.c", prefix);
+  status = write_file(path, &nn, prefix, unroll, tests, test_count, tolerance);
+  if (StatusErr(status)) goto done;
+  printf("build and check with: cc -O2 %s.c %s_test.c -lm && ./a.out\n", prefix, prefix);
+
+done:
+  nn.deinit(&nn);
+
+donedone:
+  synth.deinit(&synth);
+  for (unsigned long p = 0; (tests != NULL) && (p < test_count); p++) {
+    free(tests[p]);
+  }
+  free(tests);
+  free(input);
+  free(target);
+  free(output);
+  free(perm);
+  dbg("nn-codegen:- status=%d\n", status);
+  return StatusOk(status) ? 0 : 1;
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if !defined(DBG)
+#define DBG 0
+#endif
+
+#include "NeuralNet.h"
+#include "NeuralNetCsv.h"
+#include "NeuralNetTrain.h"
+#include "dbg.h"
+#include "rand0_1.h"
+
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+static void usage(char* name) {
+  printf("Usage: %s [options] file.csv\n", name);
+  printf("  Train on a CSV file, each line is the inputs then the targets\n");
+  printf("  -i <n>: inputs, default 2\n");
+  printf("  -o <n>: outputs, default 1\n");
+  printf("  -H <n>: hidden layer neurons, default 4\n");
+  printf("  -l <n>: learning rate, default 0.5\n");
+  printf("  -m <n>: momentum factor, default 0.9\n");
+  printf("  -e <n>: epochs, default 10\n");
+  printf("  -b <n>: prefetch batch size, default 256\n");
+  printf("  -n <s>: input normalization none, zscore or minmax, default none\n");
+  printf("  -w <n>: parser threads, default one per cpu\n");
+  printf("  -h:     skip the header line\n");
+  printf("  -v:     print the column statistics\n");
+}
+
+int main(int argc, char** argv) {
+  Status status;
+  NeuralNet nn;
+  NeuralNetCsvSpec spec;
+  NeuralNetCsvData data;
+  NeuralNetCsvBatcher batcher;
+  Pattern* output = NULL;
+  char* norm_names[] = { "none", "zscore", "minmax" };
+  unsigned long hidden = 4;
+  unsigned long epochs = 10;
+  unsigned long batch_size = 256;
+  unsigned long verbose = 0;
+  double learning_rate = 0.5;
+  double momentum_factor = 0.9;
+  int opt;
+
+  setlocale(LC_NUMERIC, "");
+
+  memset(&spec, 0, sizeof(spec));
+  spec.input_count = 2;
+  spec.target_count = 1;
+  spec.normalize = NEURAL_NET_CSV_NORM_NONE;
+  while ((opt = getopt(argc, argv, "i:o:H:l:m:e:b:n:w:hv")) != -1) {
+    switch (opt) {
+      case 'i': spec.input_count = strtoul(optarg, NULL, 0); break;
+      case 'o': spec.target_count = strtoul(optarg, NULL, 0); break;
+      case 'H': hidden = strtoul(optarg, NULL, 0); break;
+      case 'l': learning_rate = strtod(optarg, NULL); break;
+      case 'm': momentum_factor = strtod(optarg, NULL); break;
+      case 'e': epochs = strtoul(optarg, NULL, 0); break;
+      case 'b': batch_size = strtoul(optarg, NULL, 0); break;
+      case 'n':
+        for (spec.normalize = 0; spec.normalize <= NEURAL_NET_CSV_NORM_MINMAX; spec.normalize++) {
+          if (strcmp(optarg, norm_names[spec.normalize]) == 0) {
+            break;
+          }
+        }
+        break;
+      case 'w': spec.workers = strtoul(optarg, NULL, 0); break;
+      case 'h': spec.header = 1; break;
+      case 'v': verbose = 1; break;
+      default:
+        usage(argv[0]);
+        status = STATUS_BAD_PARAM;
+        goto donedone;
+    }
+  }
+  if ((optind >= argc) || (spec.normalize > NEURAL_NET_CSV_NORM_MINMAX)
+      || (hidden == 0)) {
+    usage(argv[0]);
+    status = STATUS_BAD_PARAM;
+    goto donedone;
+  }
+
+  status = NeuralNetCsv_load(&data, argv[optind], &spec);
+  if (StatusErr(status)) {
+    printf("Unable to load '%s' status=%d\n", argv[optind], status);
+    goto donedone;
+  }
+  printf("Loaded rows=%'ld cols=%ld bytes=%'ld chunks=%ld time=%.3fs MB/s=%'.0f\n",
+      data.rows, data.cols, data.bytes, data.chunks, data.parse_secs,
+      (double)data.bytes / (data.parse_secs * 1.0e6));
+  if (verbose) {
+    for (unsigned long col = 0; col < data.cols; col++) {
+      NeuralNetCsvStats* stat = &data.stats[col];
+      printf("column %ld mean=%g stddev=%g min=%g max=%g\n", col,
+          stat->mean, stat->stddev, stat->min, stat->max);
+    }
+  }
+
+  rand0_1_seed(1);
+  status = NeuralNet_init(&nn, data.input_count, 1, data.target_count);
+  if (StatusErr(status)) goto done_data;
+  status = nn.add_hidden(&nn, hidden);
+  if (StatusErr(status)) goto done_nn;
+  status = nn.start(&nn);
+  if (StatusErr(status)) goto done_nn;
+  nn.learning_rate = learning_rate;
+  nn.momentum_factor = momentum_factor;
+
+  output = Pattern_create(data.target_count);
+  if (output == NULL) {
+    status = STATUS_OOM;
+    goto done_nn;
+  }
+
+  status = NeuralNetCsvBatcher_init(&batcher, &data, batch_size, 1, 1);
+  if (StatusErr(status)) goto done_nn;
+
+  struct timeval start;
+  struct timeval end;
+  gettimeofday(&start, NULL);
+  double error = 0.0;
+  unsigned long samples = 0;
+  unsigned long epoch = 0;
+  for (;;) {
+    NeuralNetCsvBatch* batch = batcher.next(&batcher);
+    if (batch->epoch != epoch) {
+      printf("Epoch=%ld Error=%lf\n", epoch, error / (double)data.rows);
+      error = 0.0;
+      epoch = batch->epoch;
+    }
+    if (epoch >= epochs) {
+      break;
+    }
+    for (unsigned long i = 0; i < batch->count; i++) {
+      nn.set_inputs(&nn, batch->inputs[i]);
+      nn.process(&nn);
+      nn.get_outputs(&nn, output);
+      error += nn.adjust_weights(&nn, output, batch->targets[i]);
+    }
+    samples += batch->count;
+  }
+  gettimeofday(&end, NULL);
+
+  double secs = (double)(end.tv_sec - start.tv_sec)
+    + ((double)(end.tv_usec - start.tv_usec) / 1000000.0);
+  printf("samples=%'ld time=%.3fs eps=%'.0f prefetch_waits=%'ld\n",
+      samples, secs, (double)samples / secs, batcher.waits);
+  batcher.deinit(&batcher);
+
+done_nn:
+  free(output);
+  nn.deinit(&nn);
+
+done_data:
+  data.deinit(&data);
+
+donedone:
+  dbg("nn-csv:- status=%d\n", status);
+  return StatusOk(status) ? 0 : 1;
+}
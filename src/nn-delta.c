@@ -0,0 +1,184 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#if !defined(DBG)
+#define DBG 0
+#endif
+
+#include "NeuralNet.h"
+#include "NeuralNetDelta.h"
+#include "NeuralNetTrain.h"
+#include "dbg.h"
+#include "rand0_1.h"
+
+#include <locale.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+static double now_secs(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (double)tv.tv_sec + ((double)tv.tv_usec / 1000000.0);
+}
+
+static void usage(char* name) {
+  printf("Usage: %s [options]\n", name);
+  printf("  Compare full and incremental forward passes on queries that\n");
+  printf("  each change a few inputs of the previous one\n");
+  printf("  -i <n>: inputs, default 1024\n");
+  printf("  -H <n>: neurons per hidden layer, default 256\n");
+  printf("  -L <n>: hidden layers, default 2\n");
+  printf("  -t <n>: outputs, default 10\n");
+  printf("  -c <n>: inputs changed per query, default 4\n");
+  printf("  -q <n>: queries, default 10000\n");
+  printf("  -x <x>: epsilon, output changes not propagated, default 1e-6\n");
+  printf("  -R <n>: full recompute every n queries, 0 never, default 1000\n");
+}
+
+int main(int argc, char** argv) {
+  Status status;
+  NeuralNet nn;
+  NeuralNetDelta delta;
+  unsigned long inputs = 1024;
+  unsigned long hidden = 256;
+  unsigned long hidden_layers = 2;
+  unsigned long outputs = 10;
+  unsigned long changes = 4;
+  unsigned long queries = 10000;
+  double epsilon = 1e-6;
+  unsigned long refresh = 1000;
+  Pattern** patterns = NULL;
+  Pattern* output = NULL;
+  Pattern* expected = NULL;
+  int opt;
+
+  setlocale(LC_NUMERIC, "");
+  memset(&nn, 0, sizeof(nn));
+  memset(&delta, 0, sizeof(delta));
+
+  while ((opt = getopt(argc, argv, "i:H:L:t:c:q:x:R:")) != -1) {
+    switch (opt) {
+      case 'i': inputs = strtoul(optarg, NULL, 0); break;
+      case 'H': hidden = strtoul(optarg, NULL, 0); break;
+      case 'L': hidden_layers = strtoul(optarg, NULL, 0); break;
+      case 't': outputs = strtoul(optarg, NULL, 0); break;
+      case 'c': changes = strtoul(optarg, NULL, 0); break;
+      case 'q': queries = strtoul(optarg, NULL, 0); break;
+      case 'x': epsilon = strtod(optarg, NULL); break;
+      case 'R': refresh = strtoul(optarg, NULL, 0); break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if ((inputs == 0) || (outputs == 0) || (queries == 0)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  // Each query changes a few inputs of the one before
+  rand0_1_seed(1);
+  patterns = calloc(queries, sizeof(Pattern*));
+  output = Pattern_create(outputs);
+  expected = Pattern_create(outputs);
+  if ((patterns == NULL) || (output == NULL) || (expected == NULL)) {
+    status = STATUS_OOM;
+    goto donedone;
+  }
+  for (unsigned long q = 0; q < queries; q++) {
+    patterns[q] = Pattern_create(inputs);
+    if (patterns[q] == NULL) { status = STATUS_OOM; goto donedone; }
+    for (unsigned long i = 0; i < inputs; i++) {
+      patterns[q]->data[i] = (q == 0) ? rand0_1() : patterns[q - 1]->data[i];
+    }
+    for (unsigned long c = 0; (q > 0) && (c < changes); c++) {
+      unsigned long i = (unsigned long)(rand0_1() * (double)inputs) % inputs;
+      patterns[q]->data[i] = rand0_1();
+    }
+  }
+
+  status = NeuralNet_init(&nn, inputs, hidden_layers, outputs);
+  if (StatusErr(status)) goto donedone;
+  for (unsigned long l = 0; l < hidden_layers; l++) {
+    status = nn.add_hidden(&nn, hidden);
+    if (StatusErr(status)) goto done;
+  }
+  status = nn.start(&nn);
+  if (StatusErr(status)) goto done;
+  status = NeuralNetDelta_init(&delta, &nn, epsilon, refresh);
+  if (StatusErr(status)) goto done;
+
+  double checksum = 0.0;
+  double start = now_secs();
+  for (unsigned long q = 0; q < queries; q++) {
+    nn.set_inputs(&nn, patterns[q]);
+    nn.process(&nn);
+    nn.get_outputs(&nn, expected);
+    checksum += expected->data[0];
+  }
+  double full_secs = now_secs() - start;
+
+  start = now_secs();
+  for (unsigned long q = 0; q < queries; q++) {
+    delta.process(&delta, patterns[q], output);
+    checksum += output->data[0];
+  }
+  double delta_secs = now_secs() - start;
+
+  // Largest difference from a full pass
+  double max_diff = 0.0;
+  for (unsigned long q = 0; q < queries; q++) {
+    delta.process(&delta, patterns[q], output);
+    nn.set_inputs(&nn, patterns[q]);
+    nn.process(&nn);
+    nn.get_outputs(&nn, expected);
+    for (unsigned long t = 0; t < outputs; t++) {
+      double diff = fabs(output->data[t] - expected->data[t]);
+      max_diff = diff > max_diff ? diff : max_diff;
+    }
+  }
+
+  NeuralNetDeltaStats stats;
+  delta.stats(&delta, &stats);
+  printf("full:        %'.0lf queries/s\n", (double)queries / full_secs);
+  printf("incremental: %'.0lf queries/s speedup=%.1lfx\n",
+      (double)queries / delta_secs, full_secs / delta_secs);
+  printf("full recomputes=%ld updates=%'ld suppressed=%'ld macs=%.2lf%% of full\n",
+      stats.full, stats.updates, stats.suppressed,
+      (100.0 * (double)stats.macs) / (double)stats.full_macs);
+  printf("max_diff=%g checksum=%lf\n", max_diff, checksum);
+
+done:
+  if (delta.deinit != NULL) {
+    delta.deinit(&delta);
+  }
+  nn.deinit(&nn);
+
+donedone:
+  for (unsigned long q = 0; (patterns != NULL) && (q < queries); q++) {
+    free(patterns[q]);
+  }
+  free(patterns);
+  free(output);
+  free(expected);
+  dbg("nn-delta:- status=%d\n", status);
+  return StatusOk(status) ? 0 : 1;
+}
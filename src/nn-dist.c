@@ -0,0 +1,299 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#if !defined(DBG)
+#define DBG 0
+#endif
+
+#include "NeuralNet.h"
+#include "NeuralNetDist.h"
+#include "NeuralNetTrain.h"
+#include "dbg.h"
+#include "rand0_1.h"
+
+#include <locale.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+typedef struct Options {
+  char* name;
+  unsigned long procs;
+  unsigned long compress;
+  unsigned long top_k;
+  unsigned long input_count;
+  unsigned long hidden_layers;
+  unsigned long hidden;
+  unsigned long output_count;
+  unsigned long batch;
+  unsigned long steps;
+} Options;
+
+static void usage(char* name) {
+  printf("Usage: %s [options]\n", name);
+  printf("  Data parallel training by worker processes which average their\n");
+  printf("  gradients through shared memory\n");
+  printf("  -p <n>:    worker processes, default 2\n");
+  printf("  -c <c>:    gradient compression none, fp16 or topk, default none\n");
+  printf("  -k <n>:    gradients each worker sends with topk, default 10%%\n");
+  printf("  -i <n>:    inputs, default 32\n");
+  printf("  -L <n>:    hidden layers, default 1\n");
+  printf("  -H <n>:    neurons per hidden layer, default 64\n");
+  printf("  -o <n>:    outputs, default 4\n");
+  printf("  -b <n>:    samples per worker per step, default 16\n");
+  printf("  -s <n>:    steps, default 500\n");
+  printf("  -N <name>: shared memory object, default /nn-dist\n");
+}
+
+static double now_secs(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (double)tv.tv_sec + ((double)tv.tv_usec / 1000000.0);
+}
+
+static Status build(NeuralNet* nn, Options* o) {
+  Status status;
+
+  status = NeuralNet_init(nn, o->input_count, o->hidden_layers, o->output_count);
+  if (StatusErr(status)) return status;
+  for (unsigned long l = 0; l < o->hidden_layers; l++) {
+    status = nn->add_hidden(nn, o->hidden);
+    if (StatusErr(status)) goto done;
+  }
+  status = nn->start(nn);
+
+done:
+  if (StatusErr(status)) {
+    nn->deinit(nn);
+  }
+  return status;
+}
+
+/** Random samples whose target t is whether input t is above 0.5 */
+static void make_batch(Pattern** inputs, Pattern** targets, unsigned long count) {
+  for (unsigned long s = 0; s < count; s++) {
+    for (unsigned long i = 0; i < inputs[s]->count; i++) {
+      inputs[s]->data[i] = rand0_1();
+    }
+    for (unsigned long t = 0; t < targets[s]->count; t++) {
+      double x = inputs[s]->data[t % inputs[s]->count];
+      targets[s]->data[t] = x > 0.5 ? 1.0 : 0.0;
+    }
+  }
+}
+
+/** FNV-1a of the weights, equal on every rank if the replicas agree */
+static unsigned long checksum(NeuralNet* nn) {
+  unsigned long hash = 14695981039346656037UL;
+  for (unsigned long l = 1; l <= nn->out_layer; l++) {
+    NeuronLayer* layer = &nn->layers[l];
+    unsigned long bytes = (nn->layers[l-1].count + 1) * sizeof(double);
+    for (unsigned long n = 0; n < layer->count; n++) {
+      unsigned char* p = (unsigned char*)layer->neurons[n].weights;
+      for (unsigned long b = 0; b < bytes; b++) {
+        hash = (hash ^ p[b]) * 1099511628211UL;
+      }
+    }
+  }
+  return hash;
+}
+
+static int worker(Options* o, unsigned long rank) {
+  Status status;
+  NeuralNet nn;
+  NeuralNetDist dist;
+  Pattern** inputs = NULL;
+  Pattern** targets = NULL;
+
+  memset(&dist, 0, sizeof(dist));
+
+  // Each rank starts from different weights until sync and
+  // draws different samples
+  rand0_1_seed((unsigned int)(rank + 1));
+  status = build(&nn, o);
+  if (StatusErr(status)) goto donedone;
+
+  inputs = calloc(o->batch, sizeof(Pattern*));
+  targets = calloc(o->batch, sizeof(Pattern*));
+  if ((inputs == NULL) || (targets == NULL)) { status = STATUS_OOM; goto done; }
+  for (unsigned long s = 0; s < o->batch; s++) {
+    inputs[s] = Pattern_create(o->input_count);
+    targets[s] = Pattern_create(o->output_count);
+    if ((inputs[s] == NULL) || (targets[s] == NULL)) { status = STATUS_OOM; goto done; }
+  }
+
+  status = NeuralNetDist_init(&dist, &nn, o->name, rank);
+  if (StatusErr(status)) {
+    printf("rank=%ld unable to attach to %s status=%d\n", rank, o->name, status);
+    goto done;
+  }
+  dist.sync(&dist);
+
+  double start = now_secs();
+  unsigned long report = (o->steps >= 10) ? o->steps / 10 : 1;
+  for (unsigned long step = 0; step < o->steps; step++) {
+    make_batch(inputs, targets, o->batch);
+    double loss = dist.step(&dist, inputs, targets, o->batch);
+    if ((rank == 0) && (((step + 1) % report) == 0)) {
+      printf("step=%'ld loss=%lf\n", step + 1, loss / (double)dist.samples);
+    }
+  }
+  double secs = now_secs() - start;
+
+  if (rank == 0) {
+    double samples = (double)(o->steps * o->batch * o->procs);
+    printf("procs=%ld samples=%'.0lf time=%.3lfs eps=%'.0lf\n", o->procs,
+        samples, secs, samples / secs);
+  }
+  printf("rank=%ld checksum=%016lx\n", rank, checksum(&nn));
+
+done:
+  dist.deinit(&dist);
+  for (unsigned long s = 0; (inputs != NULL) && (s < o->batch); s++) {
+    free(inputs[s]);
+    free(targets[s]);
+  }
+  free(inputs);
+  free(targets);
+  nn.deinit(&nn);
+
+donedone:
+  return StatusOk(status) ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+  Status status;
+  NeuralNet nn;
+  Options o = {
+    .name = "/nn-dist",
+    .procs = 2,
+    .compress = NEURAL_NET_DIST_NONE,
+    .top_k = 0,
+    .input_count = 32,
+    .hidden_layers = 1,
+    .hidden = 64,
+    .output_count = 4,
+    .batch = 16,
+    .steps = 500,
+  };
+  pid_t* pids = NULL;
+  int opt;
+
+  setlocale(LC_NUMERIC, "");
+
+  while ((opt = getopt(argc, argv, "p:c:k:i:L:H:o:b:s:N:")) != -1) {
+    switch (opt) {
+      case 'p': o.procs = strtoul(optarg, NULL, 0); break;
+      case 'c':
+        if (strcmp(optarg, "none") == 0) {
+          o.compress = NEURAL_NET_DIST_NONE;
+        } else if (strcmp(optarg, "fp16") == 0) {
+          o.compress = NEURAL_NET_DIST_FP16;
+        } else if (strcmp(optarg, "topk") == 0) {
+          o.compress = NEURAL_NET_DIST_TOPK;
+        } else {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'k': o.top_k = strtoul(optarg, NULL, 0); break;
+      case 'i': o.input_count = strtoul(optarg, NULL, 0); break;
+      case 'L': o.hidden_layers = strtoul(optarg, NULL, 0); break;
+      case 'H': o.hidden = strtoul(optarg, NULL, 0); break;
+      case 'o': o.output_count = strtoul(optarg, NULL, 0); break;
+      case 'b': o.batch = strtoul(optarg, NULL, 0); break;
+      case 's': o.steps = strtoul(optarg, NULL, 0); break;
+      case 'N': o.name = optarg; break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if ((o.procs == 0) || (o.batch == 0)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  // The shared memory is sized from the shape of the network
+  status = build(&nn, &o);
+  if (StatusErr(status)) goto donedone;
+  if ((o.compress == NEURAL_NET_DIST_TOPK) && (o.top_k == 0)) {
+    unsigned long params = 0;
+    for (unsigned long l = 1; l <= nn.out_layer; l++) {
+      params += nn.layers[l].count * (nn.layers[l-1].count + 1);
+    }
+    o.top_k = (params + 9) / 10;
+  }
+  status = NeuralNetDist_create(o.name, &nn, o.procs, o.compress, o.top_k);
+  nn.deinit(&nn);
+  if (StatusErr(status)) {
+    printf("Unable to create %s status=%d\n", o.name, status);
+    goto donedone;
+  }
+
+  pids = calloc(o.procs, sizeof(pid_t));
+  if (pids == NULL) { status = STATUS_OOM; goto done; }
+  fflush(stdout);
+  for (unsigned long r = 0; r < o.procs; r++) {
+    pids[r] = fork();
+    if (pids[r] == 0) {
+      int rc = worker(&o, r);
+      free(pids);
+      exit(rc);
+    } else if (pids[r] < 0) {
+      status = STATUS_ERR;
+      break;
+    }
+  }
+
+  // The others would wait forever on a rank that died, so stop them all
+  unsigned long running = 0;
+  for (unsigned long r = 0; r < o.procs; r++) {
+    running += pids[r] > 0;
+  }
+  if (StatusErr(status)) {
+    for (unsigned long r = 0; r < o.procs; r++) {
+      if (pids[r] > 0) kill(pids[r], SIGKILL);
+    }
+  }
+  while (running > 0) {
+    int wstatus;
+    pid_t pid = wait(&wstatus);
+    if (pid < 0) {
+      break;
+    }
+    running -= 1;
+    if (!WIFEXITED(wstatus) || (WEXITSTATUS(wstatus) != 0)) {
+      status = STATUS_ERR;
+      for (unsigned long r = 0; r < o.procs; r++) {
+        if ((pids[r] > 0) && (pids[r] != pid)) kill(pids[r], SIGKILL);
+      }
+    }
+  }
+
+done:
+  NeuralNetDist_remove(o.name);
+  free(pids);
+
+donedone:
+  dbg("nn-dist:- status=%d\n", status);
+  return StatusOk(status) ? 0 : 1;
+}
@@ -0,0 +1,243 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#if !defined(DBG)
+#define DBG 0
+#endif
+
+#include "NeuralNet.h"
+#include "NeuralNetArena.h"
+#include "NeuralNetClone.h"
+#include "NeuralNetTrain.h"
+#include "dbg.h"
+#include "rand0_1.h"
+
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+static void usage(char* name) {
+  printf("Usage: %s [options]\n", name);
+  printf("  Compare building, cloning and forking variants of a base network\n");
+  printf("  and the memory the forks use once fine-tuned\n");
+  printf("  -i <n>:    inputs, default 64\n");
+  printf("  -L <n>:    hidden layers, default 2\n");
+  printf("  -H <n>:    neurons per hidden layer, default 256\n");
+  printf("  -o <n>:    outputs, default 8\n");
+  printf("  -v <n>:    variants, default 100\n");
+  printf("  -n <n>:    samples to fine-tune each fork with, default 10\n");
+  printf("  -t <n>:    fine-tune only the top n layers of each fork, default all\n");
+}
+
+static double now_us(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return ((double)tv.tv_sec * 1000000.0) + (double)tv.tv_usec;
+}
+
+static Status build(NeuralNet* nn, unsigned long input_count,
+    unsigned long hidden_layers, unsigned long hidden, unsigned long output_count) {
+  Status status;
+
+  status = NeuralNet_init(nn, input_count, hidden_layers, output_count);
+  if (StatusErr(status)) return status;
+  nn->alloc_mode = NEURAL_NET_ALLOC_MMAP;
+  for (unsigned long l = 0; l < hidden_layers; l++) {
+    status = nn->add_hidden(nn, hidden);
+    if (StatusErr(status)) goto done;
+  }
+  status = nn->start(nn);
+
+done:
+  if (StatusErr(status)) {
+    nn->deinit(nn);
+  }
+  return status;
+}
+
+static void train(NeuralNet* nn, Pattern* input, Pattern* target,
+    Pattern* output, unsigned long samples) {
+  for (unsigned long s = 0; s < samples; s++) {
+    for (unsigned long i = 0; i < input->count; i++) {
+      input->data[i] = rand0_1();
+    }
+    for (unsigned long t = 0; t < target->count; t++) {
+      target->data[t] = rand0_1() >= 0.5 ? 1.0 : 0.0;
+    }
+    nn->set_inputs(nn, input);
+    nn->process(nn);
+    nn->get_outputs(nn, output);
+    nn->adjust_weights(nn, output, target);
+  }
+}
+
+/** Sum of private_bytes over count networks */
+static unsigned long private_bytes(NeuralNet* nns, unsigned long count) {
+  unsigned long bytes = 0;
+  for (unsigned long v = 0; v < count; v++) {
+    NeuralNetFootprint fp;
+    NeuralNet_footprint(&nns[v], &fp);
+    bytes += fp.private_bytes;
+  }
+  return bytes;
+}
+
+static void deinit_all(NeuralNet* nns, unsigned long* count) {
+  for (unsigned long v = 0; v < *count; v++) {
+    nns[v].deinit(&nns[v]);
+  }
+  *count = 0;
+}
+
+int main(int argc, char** argv) {
+  Status status;
+  NeuralNet base;
+  NeuralNet* nns = NULL;
+  Pattern* input = NULL;
+  Pattern* target = NULL;
+  Pattern* output = NULL;
+  Pattern* expected = NULL;
+  unsigned long input_count = 64;
+  unsigned long hidden_layers = 2;
+  unsigned long hidden = 256;
+  unsigned long output_count = 8;
+  unsigned long variants = 100;
+  unsigned long samples = 10;
+  unsigned long top = 0;
+  unsigned long made = 0;
+  int opt;
+
+  setlocale(LC_NUMERIC, "");
+  memset(&base, 0, sizeof(base));
+
+  while ((opt = getopt(argc, argv, "i:L:H:o:v:n:t:")) != -1) {
+    switch (opt) {
+      case 'i': input_count = strtoul(optarg, NULL, 0); break;
+      case 'L': hidden_layers = strtoul(optarg, NULL, 0); break;
+      case 'H': hidden = strtoul(optarg, NULL, 0); break;
+      case 'o': output_count = strtoul(optarg, NULL, 0); break;
+      case 'v': variants = strtoul(optarg, NULL, 0); break;
+      case 'n': samples = strtoul(optarg, NULL, 0); break;
+      case 't': top = strtoul(optarg, NULL, 0); break;
+      default:
+        usage(argv[0]);
+        status = STATUS_BAD_PARAM;
+        goto donedone;
+    }
+  }
+  if (variants == 0) {
+    usage(argv[0]);
+    status = STATUS_BAD_PARAM;
+    goto donedone;
+  }
+
+  rand0_1_seed(1);
+
+  nns = calloc(variants, sizeof(NeuralNet));
+  input = Pattern_create(input_count);
+  target = Pattern_create(output_count);
+  output = Pattern_create(output_count);
+  expected = Pattern_create(output_count);
+  if ((nns == NULL) || (input == NULL) || (target == NULL) || (output == NULL)
+      || (expected == NULL)) {
+    status = STATUS_OOM;
+    goto donedone;
+  }
+
+  status = build(&base, input_count, hidden_layers, hidden, output_count);
+  if (StatusErr(status)) goto donedone;
+  train(&base, input, target, output, 100);
+
+  // Building from scratch, what a variant cost before
+  double start = now_us();
+  for (made = 0; made < variants; made++) {
+    status = build(&nns[made], input_count, hidden_layers, hidden, output_count);
+    if (StatusErr(status)) goto done;
+  }
+  double build_us = (now_us() - start) / (double)variants;
+  deinit_all(nns, &made);
+
+  start = now_us();
+  for (made = 0; made < variants; made++) {
+    status = NeuralNet_clone(&nns[made], &base);
+    if (StatusErr(status)) goto done;
+  }
+  double clone_us = (now_us() - start) / (double)variants;
+  unsigned long clone_bytes = private_bytes(nns, variants);
+  deinit_all(nns, &made);
+
+  status = NeuralNet_share(&base);
+  if (StatusErr(status)) goto done;
+  start = now_us();
+  for (made = 0; made < variants; made++) {
+    status = NeuralNet_fork(&nns[made], &base);
+    if (StatusErr(status)) goto done;
+  }
+  double fork_us = (now_us() - start) / (double)variants;
+
+  // The forks must compute exactly what the base does
+  for (unsigned long i = 0; i < input->count; i++) {
+    input->data[i] = rand0_1();
+  }
+  base.set_inputs(&base, input);
+  base.process(&base);
+  base.get_outputs(&base, expected);
+  unsigned long mismatches = 0;
+  for (unsigned long v = 0; v < variants; v++) {
+    nns[v].set_inputs(&nns[v], input);
+    nns[v].process(&nns[v]);
+    nns[v].get_outputs(&nns[v], output);
+    if (memcmp(output->data, expected->data, output->count * sizeof(double)) != 0) {
+      mismatches += 1;
+    }
+  }
+  unsigned long fork_bytes = private_bytes(nns, variants);
+
+  for (unsigned long v = 0; v < variants; v++) {
+    if ((top > 0) && (top < nns[v].out_layer)) {
+      status = NeuralNet_freeze(&nns[v], nns[v].out_layer + 1 - top);
+      if (StatusErr(status)) goto done;
+    }
+    train(&nns[v], input, target, output, samples);
+  }
+  unsigned long tuned_bytes = private_bytes(nns, variants);
+
+  NeuralNetFootprint fp;
+  NeuralNet_footprint(&base, &fp);
+  printf("variants=%'ld bytes=%'ld mismatches=%ld\n", variants, fp.bytes, mismatches);
+  printf("us/variant build=%'.1lf clone=%'.1lf fork=%'.1lf\n",
+      build_us, clone_us, fork_us);
+  printf("private bytes clones=%'ld forks=%'ld fine-tuned forks=%'ld\n",
+      clone_bytes, fork_bytes, tuned_bytes);
+  status = (mismatches == 0) ? STATUS_OK : STATUS_ERR;
+
+done:
+  deinit_all(nns, &made);
+  base.deinit(&base);
+
+donedone:
+  free(nns);
+  free(input);
+  free(target);
+  free(output);
+  free(expected);
+  dbg("nn-fork:- status=%d\n", status);
+  return StatusOk(status) ? 0 : 1;
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if !defined(DBG)
+#define DBG 0
+#endif
+
+#include "NeuralNet.h"
+#include "NeuralNetIoShm.h"
+#include "dbg.h"
+
+#include <locale.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <time.h>
+
+static double now(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (double)tv.tv_sec + ((double)tv.tv_usec / 1000000.0);
+}
+
+static void sleep_ms(unsigned long ms) {
+  struct timespec ts = { .tv_sec = (time_t)(ms / 1000), .tv_nsec = (long)((ms % 1000) * 1000000) };
+  nanosleep(&ts, NULL);
+}
+
+static void usage(char* name) {
+  printf("Usage: %s name [interval_ms] [count]\n", name);
+  printf("  Follow the shared memory ring test-nn publishes with shm:name\n");
+  printf("  name:        shared memory object, e.g. /nn-live\n");
+  printf("  interval_ms: milliseconds between samples, default 500\n");
+  printf("  count:       samples to take, default until the writer closes\n");
+}
+
+int main(int argc, char** argv) {
+  Status status;
+  NeuralNetIoShmReader reader;
+  NeuralNetIoShmView view;
+  unsigned long interval_ms = 500;
+  unsigned long count = 0;
+
+  setlocale(LC_NUMERIC, "");
+
+  if (argc < 2) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (argc > 2) {
+    interval_ms = strtoul(argv[2], NULL, 0);
+  }
+  if (argc > 3) {
+    count = strtoul(argv[3], NULL, 0);
+  }
+
+  // The writer may not have created the ring yet
+  for (unsigned long tries = 0; ; tries++) {
+    status = NeuralNetIoShmReader_init(&reader, argv[1]);
+    if (StatusOk(status) || (tries >= 100)) {
+      break;
+    }
+    sleep_ms(50);
+  }
+  if (StatusErr(status)) {
+    printf("Unable to open '%s'\n", argv[1]);
+    goto donedone;
+  }
+
+  NeuralNetIoShmHeader* h = reader.header;
+  unsigned long last_frame = 0;
+  unsigned long have_last = 0;
+  unsigned long retries = 0;
+  double last_time = now();
+  for (unsigned long sample = 0; (count == 0) || (sample < count); sample++) {
+    int closed = atomic_load_explicit(&h->closed, memory_order_acquire) != 0;
+
+    // Summarize the frame in place, skipping the two bounding box points
+    double sum = 0.0;
+    status = reader.peek(&reader, &view);
+    while (StatusOk(status)) {
+      sum = 0.0;
+      for (unsigned long p = 2; p < reader.points_per_epoch; p++) {
+        sum += view.points[(p * 4) + 2];
+      }
+      if (reader.valid(&reader, &view)) {
+        break;
+      }
+      retries += 1;
+      status = reader.peek(&reader, &view);
+    }
+
+    double t = now();
+    if (StatusOk(status)) {
+      double rate = have_last ? (double)(view.frame - last_frame) / (t - last_time) : 0.0;
+      printf("frame=%'ld epoch=%'ld frames/s=%'.0lf mean=%lf retries=%ld\n",
+          view.frame, view.epoch, rate,
+          sum / (double)(reader.points_per_epoch - 2), retries);
+      last_frame = view.frame;
+      have_last = 1;
+    } else if (have_last) {
+      // Frames were published so the writer died filling a slot
+      printf("writer stopped publishing\n");
+      break;
+    }
+    last_time = t;
+
+    if (closed) {
+      printf("writer closed\n");
+      break;
+    }
+    sleep_ms(interval_ms);
+  }
+  status = STATUS_OK;
+
+  reader.deinit(&reader);
+
+donedone:
+  dbg("nn-live:- status=%d\n", status);
+  return StatusOk(status) ? 0 : 1;
+}
@@ -0,0 +1,252 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if !defined(DBG)
+#define DBG 0
+#endif
+
+#include "NeuralNet.h"
+#include "NeuralNetOnline.h"
+#include "NeuralNetQueue.h"
+#include "NeuralNetSynth.h"
+#include "NeuralNetTrain.h"
+#include "dbg.h"
+
+#include <limits.h>
+#include <locale.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_PRODUCERS 64
+
+static void usage(char* name) {
+  printf("Usage: %s [options] < rows\n", name);
+  printf("  Train a network online from binary rows on stdin, each row is the\n");
+  printf("  input then the target values as host order doubles, or from\n");
+  printf("  synthetic samples pushed by producer threads\n");
+  printf("  -i <n>:    inputs, default 2\n");
+  printf("  -o <n>:    outputs, default 1\n");
+  printf("  -H <n>:    hidden layer neurons, default 4\n");
+  printf("  -t <n>:    trainer threads all training the one network, default 1\n");
+  printf("  -q <n>:    queue capacity in samples, default 1024\n");
+  printf("  -l <n>:    learning rate, default 0.5\n");
+  printf("  -m <n>:    momentum factor, default 0.9\n");
+  printf("  -x:        softmax output with cross entropy loss\n");
+  printf("  -k <kind>: push parity, gaussian, teacher or bars samples\n");
+  printf("             instead of reading stdin\n");
+  printf("  -p <n>:    producer threads pushing the -k samples, default 1\n");
+  printf("  -n <n>:    -k samples, default 100000\n");
+}
+
+/** Pushes every producers'th sample of synth starting at first */
+typedef struct Producer {
+  NeuralNetSynth* synth;
+  NeuralNetQueue* queue;
+  unsigned long first;
+  unsigned long producers;
+  unsigned long pushed;
+  pthread_t thread;
+} Producer;
+
+static void* producer_thread(void* arg) {
+  Producer* p = arg;
+  NeuralNetSynth* synth = p->synth;
+  Pattern* input = Pattern_create(synth->spec.input_count);
+  Pattern* target = Pattern_create(synth->spec.target_count);
+
+  if ((input != NULL) && (target != NULL)) {
+    for (unsigned long i = p->first; i < synth->spec.samples; i += p->producers) {
+      synth->sample(synth, i, input, target);
+      if (StatusErr(p->queue->push(p->queue, input, target))) {
+        break;
+      }
+      p->pushed += 1;
+    }
+  }
+  free(input);
+  free(target);
+  return NULL;
+}
+
+int main(int argc, char** argv) {
+  Status status;
+  NeuralNet nn;
+  NeuralNetQueue queue;
+  NeuralNetQueueStats stats;
+  NeuralNetOnline online;
+  NeuralNetSynth synth;
+  NeuralNetSynthSpec spec;
+  Producer producers[MAX_PRODUCERS];
+  char* kind_names[] = { "parity", "gaussian", "teacher", "bars" };
+  unsigned long inputs = 2;
+  unsigned long outputs = 1;
+  unsigned long hidden = 4;
+  unsigned long trainers = 1;
+  unsigned long producer_count = 1;
+  unsigned long capacity = 1024;
+  unsigned long output_type = NEURAL_NET_OUTPUT_SIGMOID;
+  unsigned long kind = ULONG_MAX;
+  unsigned long samples = 100000;
+  unsigned long started = 0;
+  unsigned long expected = 0;
+  double learning_rate = 0.5;
+  double momentum_factor = 0.9;
+  int nn_ok = 0;
+  int queue_ok = 0;
+  int opt;
+
+  setlocale(LC_NUMERIC, "");
+  memset(&synth, 0, sizeof(synth));
+
+  while ((opt = getopt(argc, argv, "i:o:H:t:q:l:m:xk:p:n:")) != -1) {
+    switch (opt) {
+      case 'i': inputs = strtoul(optarg, NULL, 0); break;
+      case 'o': outputs = strtoul(optarg, NULL, 0); break;
+      case 'H': hidden = strtoul(optarg, NULL, 0); break;
+      case 't': trainers = strtoul(optarg, NULL, 0); break;
+      case 'q': capacity = strtoul(optarg, NULL, 0); break;
+      case 'l': learning_rate = strtod(optarg, NULL); break;
+      case 'm': momentum_factor = strtod(optarg, NULL); break;
+      case 'x': output_type = NEURAL_NET_OUTPUT_SOFTMAX; break;
+      case 'k':
+        for (kind = 0; kind <= NEURAL_NET_SYNTH_BARS; kind++) {
+          if (strcmp(optarg, kind_names[kind]) == 0) break;
+        }
+        if (kind > NEURAL_NET_SYNTH_BARS) {
+          usage(argv[0]);
+          status = STATUS_BAD_PARAM;
+          goto donedone;
+        }
+        break;
+      case 'p': producer_count = strtoul(optarg, NULL, 0); break;
+      case 'n': samples = strtoul(optarg, NULL, 0); break;
+      default:
+        usage(argv[0]);
+        status = STATUS_BAD_PARAM;
+        goto donedone;
+    }
+  }
+  if ((trainers == 0) || (hidden == 0) || (producer_count == 0)
+      || (producer_count > MAX_PRODUCERS)) {
+    usage(argv[0]);
+    status = STATUS_BAD_PARAM;
+    goto donedone;
+  }
+
+  if (kind != ULONG_MAX) {
+    memset(&spec, 0, sizeof(spec));
+    spec.kind = kind;
+    spec.input_count = inputs;
+    spec.target_count = outputs;
+    spec.samples = samples;
+    spec.seed = 1;
+    spec.spread = 0.1;
+    status = NeuralNetSynth_init(&synth, &spec);
+    if (StatusErr(status)) {
+      usage(argv[0]);
+      goto donedone;
+    }
+    // Parity and bars choose their own targets
+    outputs = synth.spec.target_count;
+    expected = synth.spec.samples;
+  }
+
+  status = NeuralNet_init(&nn, inputs, 1, outputs);
+  if (StatusErr(status)) goto done;
+  nn_ok = 1;
+  nn.output_type = output_type;
+  status = nn.add_hidden(&nn, hidden);
+  if (StatusErr(status)) goto done;
+  status = nn.start(&nn);
+  if (StatusErr(status)) goto done;
+  nn.learning_rate = learning_rate;
+  nn.momentum_factor = momentum_factor;
+
+  status = NeuralNetQueue_init(&queue, capacity, inputs, outputs);
+  if (StatusErr(status)) goto done;
+  queue_ok = 1;
+
+  status = NeuralNetOnline_init(&online, &queue, &nn, trainers);
+  if (StatusErr(status)) goto done;
+
+  if (kind != ULONG_MAX) {
+    // The producers push disjoint samples concurrently
+    for (; started < producer_count; started++) {
+      Producer* p = &producers[started];
+      memset(p, 0, sizeof(*p));
+      p->synth = &synth;
+      p->queue = &queue;
+      p->first = started;
+      p->producers = producer_count;
+      if (pthread_create(&p->thread, NULL, producer_thread, p) != 0) {
+        status = STATUS_ERR;
+        break;
+      }
+    }
+    for (unsigned long i = 0; i < started; i++) {
+      pthread_join(producers[i].thread, NULL);
+    }
+  } else {
+    // This thread is the producer
+    status = NeuralNetQueue_read_fd(&queue, STDIN_FILENO);
+    if (StatusErr(status)) {
+      printf("Error reading rows from stdin, trailing partial row?\n");
+    }
+  }
+  queue.close(&queue);
+  online.wait(&online);
+
+  queue.stats(&queue, &stats);
+  printf("samples=%'ld time=%.3fs throughput=%'.0f/s lag avg=%.1fus max=%.1fus"
+      " full_waits=%'ld empty_waits=%'ld\n",
+      stats.popped, stats.elapsed_sec, stats.throughput,
+      stats.lag_ns_avg / 1000.0, (double)stats.lag_ns_max / 1000.0,
+      stats.full_waits, stats.empty_waits);
+  for (unsigned long i = 0; i < started; i++) {
+    printf("producer %ld pushed=%'ld\n", i, producers[i].pushed);
+  }
+  for (unsigned long i = 0; i < online.count; i++) {
+    printf("trainer %ld samples=%'ld\n", i, online.trainers[i].samples);
+  }
+  printf("network samples=%'ld error=%g\n", online.samples, online.error);
+
+  // Every sample pushed must have been trained on once the queue drains
+  if ((stats.popped != stats.pushed) || (online.samples != stats.pushed)
+      || ((expected != 0) && (stats.pushed != expected))) {
+    printf("Lost samples, expected=%'ld pushed=%'ld popped=%'ld trained=%'ld\n",
+        expected, stats.pushed, stats.popped, online.samples);
+    status = STATUS_ERR;
+  }
+  online.deinit(&online);
+
+done:
+  if (queue_ok) {
+    queue.deinit(&queue);
+  }
+  if (nn_ok) {
+    nn.deinit(&nn);
+  }
+
+donedone:
+  if (synth.deinit != NULL) {
+    synth.deinit(&synth);
+  }
+  dbg("nn-online:- status=%d\n", status);
+  return StatusOk(status) ? 0 : 1;
+}
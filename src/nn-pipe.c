@@ -0,0 +1,168 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if !defined(DBG)
+#define DBG 0
+#endif
+
+#include "NeuralNet.h"
+#include "NeuralNetPipeline.h"
+#include "NeuralNetTrain.h"
+#include "dbg.h"
+#include "rand0_1.h"
+
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+static void usage(char* name) {
+  printf("Usage: %s [options]\n", name);
+  printf("  Pipeline parallel training of a deep narrow net on the majority\n");
+  printf("  function of random bits\n");
+  printf("  -i <n>: inputs, default 16\n");
+  printf("  -L <n>: hidden layers, default 8\n");
+  printf("  -H <n>: neurons per hidden layer, default 64\n");
+  printf("  -n <n>: samples, default 4096\n");
+  printf("  -e <n>: epochs, default 20\n");
+  printf("  -s <n>: stages, default one per cpu\n");
+  printf("  -m <n>: micro batches per mini batch, default 8\n");
+  printf("  -b <n>: samples per micro batch, default 4\n");
+  printf("  -l <n>: learning rate, default 0.5\n");
+  printf("  -g:     GPipe schedule instead of 1F1B\n");
+}
+
+int main(int argc, char** argv) {
+  Status status;
+  NeuralNet nn;
+  NeuralNetPipeline pipe;
+  Pattern** inputs = NULL;
+  Pattern** targets = NULL;
+  unsigned long input_count = 16;
+  unsigned long hidden_layers = 8;
+  unsigned long hidden = 64;
+  unsigned long samples = 4096;
+  unsigned long epochs = 20;
+  unsigned long stages = 0;
+  unsigned long micro_batches = 8;
+  unsigned long micro_batch_size = 4;
+  unsigned long schedule = NEURAL_NET_PIPELINE_1F1B;
+  double learning_rate = 0.5;
+  int opt;
+
+  setlocale(LC_NUMERIC, "");
+  memset(&nn, 0, sizeof(nn));
+  memset(&pipe, 0, sizeof(pipe));
+
+  while ((opt = getopt(argc, argv, "i:L:H:n:e:s:m:b:l:g")) != -1) {
+    switch (opt) {
+      case 'i': input_count = strtoul(optarg, NULL, 0); break;
+      case 'L': hidden_layers = strtoul(optarg, NULL, 0); break;
+      case 'H': hidden = strtoul(optarg, NULL, 0); break;
+      case 'n': samples = strtoul(optarg, NULL, 0); break;
+      case 'e': epochs = strtoul(optarg, NULL, 0); break;
+      case 's': stages = strtoul(optarg, NULL, 0); break;
+      case 'm': micro_batches = strtoul(optarg, NULL, 0); break;
+      case 'b': micro_batch_size = strtoul(optarg, NULL, 0); break;
+      case 'l': learning_rate = strtod(optarg, NULL); break;
+      case 'g': schedule = NEURAL_NET_PIPELINE_GPIPE; break;
+      default:
+        usage(argv[0]);
+        status = STATUS_BAD_PARAM;
+        goto donedone;
+    }
+  }
+
+  rand0_1_seed(1);
+
+  // Target is 1 when more than half of the input bits are set
+  inputs = calloc(samples, sizeof(Pattern*));
+  targets = calloc(samples, sizeof(Pattern*));
+  if ((inputs == NULL) || (targets == NULL)) {
+    status = STATUS_OOM;
+    goto donedone;
+  }
+  for (unsigned long p = 0; p < samples; p++) {
+    inputs[p] = Pattern_create(input_count);
+    targets[p] = Pattern_create(1);
+    if ((inputs[p] == NULL) || (targets[p] == NULL)) {
+      status = STATUS_OOM;
+      goto donedone;
+    }
+    unsigned long ones = 0;
+    for (unsigned long i = 0; i < input_count; i++) {
+      unsigned long bit = rand0_1() >= 0.5;
+      inputs[p]->data[i] = (double)bit;
+      ones += bit;
+    }
+    targets[p]->data[0] = ((2 * ones) > input_count) ? 1.0 : 0.0;
+  }
+
+  status = NeuralNet_init(&nn, input_count, hidden_layers, 1);
+  if (StatusErr(status)) goto donedone;
+  nn.learning_rate = learning_rate;
+  for (unsigned long l = 0; l < hidden_layers; l++) {
+    status = nn.add_hidden(&nn, hidden);
+    if (StatusErr(status)) goto done;
+  }
+  status = nn.start(&nn);
+  if (StatusErr(status)) goto done;
+
+  status = NeuralNetPipeline_init(&pipe, &nn, stages, micro_batches,
+      micro_batch_size, schedule);
+  if (StatusErr(status)) {
+    printf("Unable to create the pipeline status=%d\n", status);
+    goto done;
+  }
+  for (unsigned long s = 0; s < pipe.stage_count; s++) {
+    printf("stage %ld: layers %ld..%ld\n", s, pipe.stages[s].first_layer,
+        pipe.stages[s].last_layer);
+  }
+
+  struct timeval start;
+  struct timeval end;
+  gettimeofday(&start, NULL);
+  for (unsigned long epoch = 0; epoch < epochs; epoch++) {
+    double error = pipe.train(&pipe, inputs, targets, samples);
+    printf("Epoch=%ld Error=%lf\n", epoch, error / (double)samples);
+  }
+  gettimeofday(&end, NULL);
+
+  double secs = (double)(end.tv_sec - start.tv_sec)
+    + ((double)(end.tv_usec - start.tv_usec) / 1000000.0);
+  printf("stages=%ld %s time=%.3lfs samples/s=%'.0lf\n", pipe.stage_count,
+      schedule == NEURAL_NET_PIPELINE_GPIPE ? "gpipe" : "1f1b", secs,
+      (double)(samples * epochs) / secs);
+
+  pipe.deinit(&pipe);
+
+done:
+  nn.deinit(&nn);
+
+donedone:
+  if (inputs != NULL) {
+    for (unsigned long p = 0; p < samples; p++) {
+      free(inputs[p]);
+      free(targets[p]);
+    }
+  }
+  free(inputs);
+  free(targets);
+  dbg("nn-pipe:- status=%d\n", status);
+  return StatusOk(status) ? 0 : 1;
+}
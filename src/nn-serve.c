@@ -0,0 +1,304 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#if !defined(DBG)
+#define DBG 0
+#endif
+
+#include "NeuralNet.h"
+#include "NeuralNetSnapshot.h"
+#include "NeuralNetSynth.h"
+#include "NeuralNetTrain.h"
+#include "dbg.h"
+#include "rand0_1.h"
+
+#include <limits.h>
+#include <locale.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+typedef struct Server {
+  NeuralNetSnapshot* snap;
+  NeuralNetSynth* synth;
+  atomic_ulong* stop;
+  unsigned long first;        // First sample this reader predicts
+  unsigned long versions;     // Distinct versions this reader saw
+  Status status;
+  char pad[4];
+} Server;
+
+static double now_secs(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (double)tv.tv_sec + ((double)tv.tv_usec / 1000000.0);
+}
+
+static void usage(char* name) {
+  printf("Usage: %s [options]\n", name);
+  printf("  Train on synthetic data while reader threads predict from\n");
+  printf("  the weights the trainer publishes\n");
+  printf("  -k <kind>: parity, gaussian or teacher, default gaussian\n");
+  printf("  -i <n>:    inputs, default 16\n");
+  printf("  -t <n>:    outputs, default 4\n");
+  printf("  -n <n>:    samples per epoch, default 10000\n");
+  printf("  -H <n>:    hidden neurons, default 32\n");
+  printf("  -e <n>:    epochs, default 10\n");
+  printf("  -r <n>:    reader threads, default 2\n");
+  printf("  -p <n>:    publish every n samples, default 1000\n");
+  printf("  -s <n>:    seed, default 1\n");
+}
+
+static void* serve(void* arg) {
+  Server* server = arg;
+  NeuralNetSnapshotReader reader;
+  Pattern* input = NULL;
+  Pattern* target = NULL;
+  Pattern* output = NULL;
+  unsigned long last = 0;
+
+  server->status = NeuralNetSnapshotReader_init(&reader, server->snap);
+  if (StatusErr(server->status)) {
+    return NULL;
+  }
+  input = Pattern_create(server->synth->spec.input_count);
+  target = Pattern_create(server->synth->spec.target_count);
+  output = Pattern_create(server->synth->spec.target_count);
+  if ((input == NULL) || (target == NULL) || (output == NULL)) {
+    server->status = STATUS_OOM;
+    goto done;
+  }
+
+  for (unsigned long s = server->first; !atomic_load_explicit(server->stop,
+        memory_order_relaxed); s++) {
+    unsigned long version;
+    server->synth->sample(server->synth, s % server->synth->spec.samples, input, target);
+    if (StatusOk(reader.predict(&reader, input, output, &version))
+        && (version != last)) {
+      server->versions += 1;
+      last = version;
+    }
+  }
+
+done:
+  free(input);
+  free(target);
+  free(output);
+  reader.deinit(&reader);
+  return NULL;
+}
+
+int main(int argc, char** argv) {
+  Status status;
+  NeuralNet nn;
+  NeuralNetSnapshot snap;
+  NeuralNetSnapshotReader checker;
+  NeuralNetSynth synth;
+  NeuralNetSynthSpec spec = {
+    .kind = NEURAL_NET_SYNTH_GAUSSIAN,
+    .input_count = 16,
+    .target_count = 4,
+    .samples = 10000,
+    .hidden = 0,
+    .seed = 1,
+    .spread = 0.1,
+  };
+  char* kind_names[] = { "parity", "gaussian", "teacher" };
+  unsigned long hidden = 32;
+  unsigned long epochs = 10;
+  unsigned long reader_count = 2;
+  unsigned long publish_every = 1000;
+  atomic_ulong stop;
+  pthread_t* threads = NULL;
+  Server* servers = NULL;
+  unsigned long started = 0;
+  Pattern* input = NULL;
+  Pattern* target = NULL;
+  Pattern* output = NULL;
+  Pattern* served = NULL;
+  unsigned int* perm = NULL;
+  double publish_secs = 0.0;
+  double train_secs = 0.0;
+  double max_diff = 0.0;
+  int opt;
+
+  setlocale(LC_NUMERIC, "");
+  memset(&nn, 0, sizeof(nn));
+  memset(&snap, 0, sizeof(snap));
+  memset(&checker, 0, sizeof(checker));
+  memset(&synth, 0, sizeof(synth));
+  atomic_init(&stop, 0);
+
+  while ((opt = getopt(argc, argv, "k:i:t:n:H:e:r:p:s:")) != -1) {
+    switch (opt) {
+      case 'k':
+        for (spec.kind = 0; spec.kind <= NEURAL_NET_SYNTH_TEACHER; spec.kind++) {
+          if (strcmp(optarg, kind_names[spec.kind]) == 0) break;
+        }
+        if (spec.kind > NEURAL_NET_SYNTH_TEACHER) {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'i': spec.input_count = strtoul(optarg, NULL, 0); break;
+      case 't': spec.target_count = strtoul(optarg, NULL, 0); break;
+      case 'n': spec.samples = strtoul(optarg, NULL, 0); break;
+      case 'H': hidden = strtoul(optarg, NULL, 0); break;
+      case 'e': epochs = strtoul(optarg, NULL, 0); break;
+      case 'r': reader_count = strtoul(optarg, NULL, 0); break;
+      case 'p': publish_every = strtoul(optarg, NULL, 0); break;
+      case 's': spec.seed = strtoul(optarg, NULL, 0); break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if ((publish_every == 0) || (spec.samples == 0) || (spec.samples > UINT_MAX)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  status = NeuralNetSynth_init(&synth, &spec);
+  if (StatusErr(status)) {
+    usage(argv[0]);
+    goto donedone;
+  }
+  input = Pattern_create(synth.spec.input_count);
+  target = Pattern_create(synth.spec.target_count);
+  output = Pattern_create(synth.spec.target_count);
+  served = Pattern_create(synth.spec.target_count);
+  threads = calloc(reader_count + 1, sizeof(pthread_t));
+  servers = calloc(reader_count + 1, sizeof(Server));
+  perm = calloc(synth.spec.samples, sizeof(unsigned int));
+  if ((input == NULL) || (target == NULL) || (output == NULL) || (served == NULL)
+      || (threads == NULL) || (servers == NULL) || (perm == NULL)) {
+    status = STATUS_OOM;
+    goto donedone;
+  }
+
+  rand0_1_seed(1);
+  status = NeuralNet_init(&nn, synth.spec.input_count, 1, synth.spec.target_count);
+  if (StatusErr(status)) goto donedone;
+  status = nn.add_hidden(&nn, hidden);
+  if (StatusErr(status)) goto done;
+  status = nn.start(&nn);
+  if (StatusErr(status)) goto done;
+
+  // One more reader than the servers to check the last version
+  status = NeuralNetSnapshot_init(&snap, &nn, reader_count + 1);
+  if (StatusErr(status)) goto done;
+  status = snap.publish(&snap, &nn);
+  if (StatusErr(status)) goto done;
+
+  for (started = 0; started < reader_count; started++) {
+    servers[started].snap = &snap;
+    servers[started].synth = &synth;
+    servers[started].stop = &stop;
+    servers[started].first = (started * synth.spec.samples) / reader_count;
+    if (pthread_create(&threads[started], NULL, serve, &servers[started]) != 0) {
+      status = STATUS_ERR;
+      goto done;
+    }
+  }
+
+  double start = now_secs();
+  for (unsigned long epoch = 0; epoch < epochs; epoch++) {
+    double error = 0.0;
+    double epoch_start = now_secs();
+    NeuralNet_shuffle(perm, (unsigned int)synth.spec.samples);
+    for (unsigned long s = 0; s < synth.spec.samples; s++) {
+      synth.sample(&synth, perm[s], input, target);
+      nn.set_inputs(&nn, input);
+      nn.process(&nn);
+      nn.get_outputs(&nn, output);
+      error += nn.adjust_weights(&nn, output, target);
+      if (((s + 1) % publish_every) == 0) {
+        double t = now_secs();
+        status = snap.publish(&snap, &nn);
+        publish_secs += now_secs() - t;
+        if (StatusErr(status)) goto done;
+      }
+    }
+    printf("epoch=%ld error=%lf eps=%'.0lf\n", epoch + 1,
+        error / (double)synth.spec.samples,
+        (double)synth.spec.samples / (now_secs() - epoch_start));
+  }
+  train_secs = now_secs() - start;
+
+  // The served outputs of the final version must match the network's
+  status = snap.publish(&snap, &nn);
+  if (StatusErr(status)) goto done;
+  status = NeuralNetSnapshotReader_init(&checker, &snap);
+  if (StatusErr(status)) goto done;
+  for (unsigned long s = 0; (s < synth.spec.samples) && (s < 1000); s++) {
+    synth.sample(&synth, s, input, target);
+    nn.set_inputs(&nn, input);
+    nn.process(&nn);
+    nn.get_outputs(&nn, output);
+    checker.predict(&checker, input, served, NULL);
+    for (unsigned long t = 0; t < output->count; t++) {
+      double diff = fabs(output->data[t] - served->data[t]);
+      max_diff = diff > max_diff ? diff : max_diff;
+    }
+  }
+
+done:
+  atomic_store(&stop, 1);
+  for (unsigned long r = 0; r < started; r++) {
+    pthread_join(threads[r], NULL);
+    if (StatusOk(status) && StatusErr(servers[r].status)) {
+      status = servers[r].status;
+    }
+  }
+  if (StatusOk(status)) {
+    NeuralNetSnapshotStats stats;
+    snap.stats(&snap, &stats);
+    printf("train eps=%'.0lf publish=%.2lf%% predictions/s=%'.0lf\n",
+        (double)(synth.spec.samples * epochs) / train_secs,
+        (publish_secs * 100.0) / train_secs,
+        (double)stats.predictions / train_secs);
+    printf("published=%ld reclaimed=%ld retired=%ld max_diff=%g\n",
+        stats.published, stats.reclaimed, stats.retired, max_diff);
+    for (unsigned long r = 0; r < started; r++) {
+      printf("reader=%ld versions seen=%ld\n", r, servers[r].versions);
+    }
+  }
+  if (checker.deinit != NULL) {
+    checker.deinit(&checker);
+  }
+  if (snap.deinit != NULL) {
+    snap.deinit(&snap);
+  }
+  nn.deinit(&nn);
+
+donedone:
+  synth.deinit(&synth);
+  free(threads);
+  free(servers);
+  free(perm);
+  free(input);
+  free(target);
+  free(output);
+  free(served);
+  dbg("nn-serve:- status=%d\n", status);
+  return StatusOk(status) ? 0 : 1;
+}
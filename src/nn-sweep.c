@@ -0,0 +1,170 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#if !defined(DBG)
+#define DBG 0
+#endif
+
+#include "NeuralNet.h"
+#include "NeuralNetSweep.h"
+#include "dbg.h"
+
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define INPUT_COUNT 2
+typedef struct InputPattern {
+  unsigned long count;
+  double data[INPUT_COUNT];
+} InputPattern;
+
+#define OUTPUT_COUNT 1
+typedef struct OutputPattern {
+  unsigned long count;
+  double data[OUTPUT_COUNT];
+} OutputPattern;
+
+static InputPattern xor_input_patterns[] = {
+  { .count = INPUT_COUNT, .data[0] = 0, .data[1] = 0 },
+  { .count = INPUT_COUNT, .data[0] = 1, .data[1] = 0 },
+  { .count = INPUT_COUNT, .data[0] = 0, .data[1] = 1 },
+  { .count = INPUT_COUNT, .data[0] = 1, .data[1] = 1 },
+};
+
+static OutputPattern xor_target_patterns[] = {
+  { .count = OUTPUT_COUNT, .data[0] = 0 },
+  { .count = OUTPUT_COUNT, .data[0] = 1 },
+  { .count = OUTPUT_COUNT, .data[0] = 1 },
+  { .count = OUTPUT_COUNT, .data[0] = 0 },
+};
+
+#define PATTERN_COUNT (sizeof(xor_input_patterns)/sizeof(InputPattern))
+
+static Pattern* inputs[PATTERN_COUNT];
+static Pattern* targets[PATTERN_COUNT];
+
+#define MAX_LIST 64
+
+static double learning_rates[MAX_LIST] = { 0.1, 0.3, 0.5, 0.9 };
+static double momentum_factors[MAX_LIST] = { 0.0, 0.5, 0.9 };
+static unsigned long hidden[MAX_LIST] = { 2, 3, 4 };
+static unsigned long seeds[MAX_LIST] = { 1, 2, 3, 4 };
+
+/** Parse a comma separated list of doubles, returns the count */
+static unsigned long parse_doubles(char* arg, double* list) {
+  unsigned long count = 0;
+  for (char* s = strtok(arg, ","); (s != NULL) && (count < MAX_LIST); s = strtok(NULL, ",")) {
+    list[count++] = strtod(s, NULL);
+  }
+  return count;
+}
+
+/** Parse a comma separated list of unsigned longs, returns the count */
+static unsigned long parse_ulongs(char* arg, unsigned long* list) {
+  unsigned long count = 0;
+  for (char* s = strtok(arg, ","); (s != NULL) && (count < MAX_LIST); s = strtok(NULL, ",")) {
+    list[count++] = strtoul(s, NULL, 0);
+  }
+  return count;
+}
+
+static void usage(char* name) {
+  printf("Usage: %s [options]\n", name);
+  printf("  Sweep XOR hyperparameters with successive halving\n");
+  printf("  -l <list>: learning rates, default 0.1,0.3,0.5,0.9\n");
+  printf("  -m <list>: momentum factors, default 0.0,0.5,0.9\n");
+  printf("  -h <list>: hidden layer neurons, default 2,3,4\n");
+  printf("  -s <list>: seeds, default 1,2,3,4\n");
+  printf("  -r <n>:    draw n random configurations from the ranges of the\n");
+  printf("             lists instead of the full grid\n");
+  printf("  -R <n>:    seed for -r, default 1\n");
+  printf("  -b <n>:    epochs of the first rung, default 250\n");
+  printf("  -B <n>:    maximum epochs, default 100000\n");
+  printf("  -e <n>:    keep 1/n of the configurations per rung, default 2\n");
+  printf("  -t <n>:    error threshold, default 0.0004\n");
+  printf("  -w <n>:    worker threads, default one per cpu\n");
+}
+
+int main(int argc, char** argv) {
+  Status status;
+  NeuralNetSweepSpec spec;
+  NeuralNetSweep sweep;
+  int opt;
+
+  setlocale(LC_NUMERIC, "");
+
+  memset(&spec, 0, sizeof(spec));
+  spec.learning_rates = learning_rates;
+  spec.learning_rate_count = 4;
+  spec.momentum_factors = momentum_factors;
+  spec.momentum_factor_count = 3;
+  spec.hidden = hidden;
+  spec.hidden_count = 3;
+  spec.seeds = seeds;
+  spec.seed_count = 4;
+  spec.random_seed = 1;
+  spec.min_epochs = 250;
+  spec.max_epochs = 100000;
+  spec.eta = 2;
+  spec.error_threshold = 0.0004;
+
+  while ((opt = getopt(argc, argv, "l:m:h:s:r:R:b:B:e:t:w:")) != -1) {
+    switch (opt) {
+      case 'l': spec.learning_rate_count = parse_doubles(optarg, learning_rates); break;
+      case 'm': spec.momentum_factor_count = parse_doubles(optarg, momentum_factors); break;
+      case 'h': spec.hidden_count = parse_ulongs(optarg, hidden); break;
+      case 's': spec.seed_count = parse_ulongs(optarg, seeds); break;
+      case 'r': spec.random_samples = strtoul(optarg, NULL, 0); break;
+      case 'R': spec.random_seed = strtoul(optarg, NULL, 0); break;
+      case 'b': spec.min_epochs = strtoul(optarg, NULL, 0); break;
+      case 'B': spec.max_epochs = strtoul(optarg, NULL, 0); break;
+      case 'e': spec.eta = strtoul(optarg, NULL, 0); break;
+      case 't': spec.error_threshold = strtod(optarg, NULL); break;
+      case 'w': spec.workers = strtoul(optarg, NULL, 0); break;
+      default:
+        usage(argv[0]);
+        status = STATUS_BAD_PARAM;
+        goto donedone;
+    }
+  }
+
+  for (unsigned long p = 0; p < PATTERN_COUNT; p++) {
+    inputs[p] = (Pattern*)&xor_input_patterns[p];
+    targets[p] = (Pattern*)&xor_target_patterns[p];
+  }
+  spec.inputs = inputs;
+  spec.targets = targets;
+  spec.pattern_count = PATTERN_COUNT;
+
+  status = NeuralNetSweep_init(&sweep, &spec);
+  if (StatusErr(status)) {
+    printf("Unable to set up the sweep status=%d\n", status);
+    usage(argv[0]);
+    goto donedone;
+  }
+
+  status = sweep.run(&sweep);
+  if (StatusOk(status)) {
+    sweep.print(&sweep, stdout);
+  }
+  sweep.deinit(&sweep);
+
+donedone:
+  dbg("nn-sweep:- status=%d\n", status);
+  return StatusOk(status) ? 0 : 1;
+}
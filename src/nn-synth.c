@@ -0,0 +1,348 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#if !defined(DBG)
+#define DBG 0
+#endif
+
+#include "NeuralNet.h"
+#include "NeuralNetArena.h"
+#include "NeuralNetConv.h"
+#include "NeuralNetSkip.h"
+#include "NeuralNetSparse.h"
+#include "NeuralNetSynth.h"
+#include "NeuralNetTrain.h"
+#include "dbg.h"
+#include "rand0_1.h"
+
+#include <limits.h>
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <unistd.h>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+static void usage(char* name) {
+  printf("Usage: %s [options]\n", name);
+  printf("  Generate synthetic data and write it as CSV or train on it as\n");
+  printf("  it's generated, reporting throughput and memory\n");
+  printf("  -k <kind>: parity, gaussian, teacher or bars, default parity\n");
+  printf("  -i <n>:    inputs, default 8\n");
+  printf("  -t <n>:    classes or teacher outputs, default 4\n");
+  printf("  -n <n>:    samples, default 1000, parity defaults to every pattern\n");
+  printf("  -T <n>:    teacher hidden neurons, default the inputs\n");
+  printf("  -d <x>:    cluster stddev or teacher noise, default 0.1\n");
+  printf("  -s <n>:    seed, default 1\n");
+  printf("  -o <file>: write the samples to a CSV file and exit\n");
+  printf("  -L <n>:    hidden layers trained, default 1\n");
+  printf("  -H <n>:    neurons per hidden layer trained, default 2 * inputs\n");
+  printf("  -C <n>:    first hidden layer a 3x3 convolution of n channels over\n");
+  printf("             the square image of the inputs, fails if the error\n");
+  printf("             doesn't go down\n");
+  printf("  -e <n>:    epochs, default 10\n");
+  printf("  -a <mode>: weight storage heap, mmap, thp or hugetlb, default heap\n");
+  printf("  -g <x>:    skip updating neurons whose |pd_error| is below x\n");
+  printf("  -p <x>:    prune weights whose magnitude is below x, then keep training\n");
+  printf("  -K <n>:    prune all but the n largest input weights of each neuron\n");
+  printf("  -P <n>:    prune after this many epochs, default half of them\n");
+  printf("  -z:        flush denormals to zero, momentums that decay into\n");
+  printf("             them can slow training many times over\n");
+}
+
+static double now_secs(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (double)tv.tv_sec + ((double)tv.tv_usec / 1000000.0);
+}
+
+/** Print the density of each layer and the footprint of nn's weights */
+static void print_density(NeuralNet* nn, char* when) {
+  NeuralNetFootprint fp;
+
+  printf("%s:", when);
+  for (unsigned long l = 1; l <= nn->out_layer; l++) {
+    NeuronLayer* layer = &nn->layers[l];
+    double weights = (double)(layer->count * (nn->layers[l - 1].count + 1));
+    double stored = weights;
+    if (layer->sparse != NULL) {
+      stored = (double)layer->sparse->nnz;
+    } else if (layer->mask != NULL) {
+      stored -= (double)layer->mask->count;
+    }
+    printf(" layer%ld=%.3lf", l, stored / weights);
+  }
+  NeuralNet_footprint(nn, &fp);
+  printf(" weights bytes=%'ld\n", fp.bytes);
+}
+
+/** Whether output picks the same class as target, or rounds the same for one output */
+static unsigned long correct(Pattern* output, Pattern* target) {
+  if (output->count == 1) {
+    return (output->data[0] >= 0.5) == (target->data[0] >= 0.5);
+  }
+  unsigned long best = 0;
+  for (unsigned long t = 1; t < output->count; t++) {
+    best = output->data[t] > output->data[best] ? t : best;
+  }
+  return target->data[best] >= 0.5;
+}
+
+int main(int argc, char** argv) {
+  Status status;
+  NeuralNet nn;
+  NeuralNetSynth synth;
+  NeuralNetSynthSpec spec = {
+    .kind = NEURAL_NET_SYNTH_PARITY,
+    .input_count = 8,
+    .target_count = 4,
+    .samples = 0,
+    .hidden = 0,
+    .seed = 1,
+    .spread = 0.1,
+  };
+  char* kind_names[] = { "parity", "gaussian", "teacher", "bars" };
+  char* alloc_names[] = { "heap", "mmap", "thp", "hugetlb" };
+  unsigned long alloc_mode = NEURAL_NET_ALLOC_HEAP;
+  unsigned long hidden_layers = 1;
+  unsigned long hidden = 0;
+  unsigned long conv_channels = 0;
+  unsigned long epochs = 10;
+  unsigned long samples_set = 0;
+  double skip_threshold = 0.0;
+  double prune_threshold = 0.0;
+  unsigned long prune_top_k = 0;
+  unsigned long prune_epoch = ULONG_MAX;
+  char* out_path = NULL;
+  unsigned int* perm = NULL;
+  Pattern* input = NULL;
+  Pattern* target = NULL;
+  Pattern* output = NULL;
+  int opt;
+
+  setlocale(LC_NUMERIC, "");
+  memset(&nn, 0, sizeof(nn));
+  memset(&synth, 0, sizeof(synth));
+
+  while ((opt = getopt(argc, argv, "k:i:t:n:T:d:s:o:L:H:C:e:a:g:p:K:P:z")) != -1) {
+    switch (opt) {
+      case 'k':
+        for (spec.kind = 0; spec.kind <= NEURAL_NET_SYNTH_BARS; spec.kind++) {
+          if (strcmp(optarg, kind_names[spec.kind]) == 0) break;
+        }
+        if (spec.kind > NEURAL_NET_SYNTH_BARS) {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'a':
+        for (alloc_mode = 0; alloc_mode <= NEURAL_NET_ALLOC_HUGETLB; alloc_mode++) {
+          if (strcmp(optarg, alloc_names[alloc_mode]) == 0) break;
+        }
+        if (alloc_mode > NEURAL_NET_ALLOC_HUGETLB) {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'i': spec.input_count = strtoul(optarg, NULL, 0); break;
+      case 't': spec.target_count = strtoul(optarg, NULL, 0); break;
+      case 'n': spec.samples = strtoul(optarg, NULL, 0); samples_set = 1; break;
+      case 'T': spec.hidden = strtoul(optarg, NULL, 0); break;
+      case 'd': spec.spread = strtod(optarg, NULL); break;
+      case 's': spec.seed = strtoul(optarg, NULL, 0); break;
+      case 'o': out_path = optarg; break;
+      case 'L': hidden_layers = strtoul(optarg, NULL, 0); break;
+      case 'H': hidden = strtoul(optarg, NULL, 0); break;
+      case 'C': conv_channels = strtoul(optarg, NULL, 0); break;
+      case 'e': epochs = strtoul(optarg, NULL, 0); break;
+      case 'g': skip_threshold = strtod(optarg, NULL); break;
+      case 'p': prune_threshold = strtod(optarg, NULL); break;
+      case 'K': prune_top_k = strtoul(optarg, NULL, 0); break;
+      case 'P': prune_epoch = strtoul(optarg, NULL, 0); break;
+      case 'z':
+#if defined(__SSE__)
+        // Flush to zero and denormals are zero
+        _mm_setcsr(_mm_getcsr() | 0x8040);
+#endif
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if (!samples_set && (spec.kind != NEURAL_NET_SYNTH_PARITY)) {
+    spec.samples = 1000;
+  }
+
+  status = NeuralNetSynth_init(&synth, &spec);
+  if (StatusErr(status)) {
+    usage(argv[0]);
+    goto donedone;
+  }
+  printf("kind=%s inputs=%ld targets=%ld samples=%'ld seed=%ld\n",
+      kind_names[synth.spec.kind], synth.spec.input_count, synth.spec.target_count,
+      synth.spec.samples, synth.spec.seed);
+
+  if (out_path != NULL) {
+    double start = now_secs();
+    status = synth.write(&synth, out_path);
+    if (StatusOk(status)) {
+      printf("wrote %s in %.3lfs\n", out_path, now_secs() - start);
+    }
+    goto donedone;
+  }
+
+  // Train on the samples as they're generated, nothing is stored
+  rand0_1_seed(1);
+  input = Pattern_create(synth.spec.input_count);
+  target = Pattern_create(synth.spec.target_count);
+  output = Pattern_create(synth.spec.target_count);
+  if ((input == NULL) || (target == NULL) || (output == NULL)) {
+    status = STATUS_OOM;
+    goto donedone;
+  }
+  if (synth.spec.samples <= UINT_MAX) {
+    perm = calloc(synth.spec.samples, sizeof(unsigned int));
+    if (perm == NULL) { status = STATUS_OOM; goto donedone; }
+  }
+
+  status = NeuralNet_init(&nn, synth.spec.input_count,
+      hidden_layers + (conv_channels > 0 ? 1 : 0), synth.spec.target_count);
+  if (StatusErr(status)) goto donedone;
+  nn.alloc_mode = alloc_mode;
+  nn.skip_threshold = skip_threshold;
+  if (conv_channels > 0) {
+    // The inputs as one plane, as bars makes them, same size out
+    unsigned long side = 1;
+    while ((side + 1) * (side + 1) <= synth.spec.input_count) {
+      side += 1;
+    }
+    NeuralNetConvSpec conv = {
+      .in_channels = 1,
+      .in_height = side,
+      .in_width = synth.spec.input_count / side,
+      .out_channels = conv_channels,
+      .kernel_height = 3,
+      .kernel_width = 3,
+      .pad_height = 1,
+      .pad_width = 1,
+    };
+    status = nn.add_conv(&nn, &conv);
+    if (StatusErr(status)) {
+      printf("nn-synth: %ld inputs aren't a square image for -C\n",
+          synth.spec.input_count);
+      goto done;
+    }
+  }
+  for (unsigned long l = 0; l < hidden_layers; l++) {
+    status = nn.add_hidden(&nn, hidden > 0 ? hidden : 2 * synth.spec.input_count);
+    if (StatusErr(status)) goto done;
+  }
+  status = nn.start(&nn);
+  if (StatusErr(status)) goto done;
+
+  int pruning = (prune_threshold > 0.0) || (prune_top_k > 0);
+  if (prune_epoch == ULONG_MAX) {
+    prune_epoch = epochs / 2;
+  }
+  double total_secs = 0.0;
+  double dense_secs = 0.0;
+  double first_error = 0.0;
+  double last_error = 0.0;
+  for (unsigned long epoch = 0; epoch < epochs; epoch++) {
+    double error = 0.0;
+    unsigned long right = 0;
+
+    if (pruning && (epoch == prune_epoch)) {
+      dense_secs = total_secs;
+      print_density(&nn, "before prune");
+      status = nn.prune(&nn, prune_threshold, prune_top_k);
+      if (StatusErr(status)) goto done;
+      print_density(&nn, "after prune");
+    }
+
+    double start = now_secs();
+
+    if (perm != NULL) {
+      NeuralNet_shuffle(perm, (unsigned int)synth.spec.samples);
+    }
+    for (unsigned long s = 0; s < synth.spec.samples; s++) {
+      synth.sample(&synth, (perm != NULL) ? perm[s] : s, input, target);
+      nn.set_inputs(&nn, input);
+      nn.process(&nn);
+      nn.get_outputs(&nn, output);
+      right += correct(output, target);
+      error += nn.adjust_weights(&nn, output, target);
+    }
+
+    double secs = now_secs() - start;
+    total_secs += secs;
+    last_error = error / (double)synth.spec.samples;
+    if (epoch == 0) {
+      first_error = last_error;
+    }
+    printf("epoch=%ld error=%lf accuracy=%.4lf eps=%'.0lf\n", epoch + 1,
+        error / (double)synth.spec.samples,
+        (double)right / (double)synth.spec.samples,
+        (double)synth.spec.samples / secs);
+  }
+
+  NeuralNetFootprint fp;
+  struct rusage ru;
+  NeuralNet_footprint(&nn, &fp);
+  getrusage(RUSAGE_SELF, &ru);
+  printf("samples/s=%'.0lf weights bytes=%'ld resident=%'ld maxrss=%'ldkB\n",
+      (double)(synth.spec.samples * epochs) / total_secs, fp.bytes,
+      fp.resident_bytes, ru.ru_maxrss);
+  if (pruning && (prune_epoch > 0) && (prune_epoch < epochs)) {
+    double samples = (double)synth.spec.samples;
+    printf("dense samples/s=%'.0lf pruned samples/s=%'.0lf\n",
+        samples * (double)prune_epoch / dense_secs,
+        samples * (double)(epochs - prune_epoch) / (total_secs - dense_secs));
+    print_density(&nn, "at the end");
+  }
+  if ((conv_channels > 0) && (epochs > 1)) {
+    printf("conv error first=%lf last=%lf %s\n", first_error, last_error,
+        last_error < first_error ? "went down" : "did NOT go down");
+    if (!(last_error < first_error)) {
+      status = STATUS_ERR;
+    }
+  }
+  if (skip_threshold > 0.0) {
+    unsigned long updates;
+    unsigned long skipped;
+    NeuralNet_skip_stats(&nn, &updates, &skipped);
+    printf("skipped=%.1lf%% of %'ld neuron updates\n",
+        (100.0 * (double)skipped) / (double)(updates > 0 ? updates : 1), updates);
+  }
+
+done:
+  nn.deinit(&nn);
+
+donedone:
+  synth.deinit(&synth);
+  free(perm);
+  free(input);
+  free(target);
+  free(output);
+  dbg("nn-synth:- status=%d\n", status);
+  return StatusOk(status) ? 0 : 1;
+}
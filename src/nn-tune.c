@@ -0,0 +1,154 @@
+/*
+ * Copyright 2016 Wink Saville
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#if !defined(DBG)
+#define DBG 0
+#endif
+
+#include "NeuralNet.h"
+#include "NeuralNetTrain.h"
+#include "NeuralNetTune.h"
+#include "dbg.h"
+#include "rand0_1.h"
+
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+static void usage(char* name) {
+  printf("Usage: %s [options]\n", name);
+  printf("  Tune the kernels of a topology offline and compare the training\n");
+  printf("  rate of the default loops with the tuned kernels\n");
+  printf("  -i <n>:    inputs, default 64\n");
+  printf("  -L <n>:    hidden layers, default 2\n");
+  printf("  -H <n>:    neurons per hidden layer, default 256\n");
+  printf("  -o <n>:    outputs, default 8\n");
+  printf("  -n <n>:    samples to time, default 2000\n");
+  printf("  -w <n>:    pool size for threaded kernels, default one per cpu\n");
+  printf("  -c <file>: kernel cache, reused unless -f\n");
+  printf("  -f:        tune even if the cache has the shapes\n");
+}
+
+/** @return samples per second training on random samples */
+static double train_rate(NeuralNet* nn, Pattern* input, Pattern* target,
+    Pattern* output, unsigned long samples) {
+  struct timeval start;
+  struct timeval end;
+
+  gettimeofday(&start, NULL);
+  for (unsigned long s = 0; s < samples; s++) {
+    for (unsigned long i = 0; i < input->count; i++) {
+      input->data[i] = rand0_1();
+    }
+    for (unsigned long t = 0; t < target->count; t++) {
+      target->data[t] = rand0_1() >= 0.5 ? 1.0 : 0.0;
+    }
+    nn->set_inputs(nn, input);
+    nn->process(nn);
+    nn->get_outputs(nn, output);
+    nn->adjust_weights(nn, output, target);
+  }
+  gettimeofday(&end, NULL);
+
+  double secs = (double)(end.tv_sec - start.tv_sec)
+    + ((double)(end.tv_usec - start.tv_usec) / 1000000.0);
+  return (double)samples / secs;
+}
+
+int main(int argc, char** argv) {
+  Status status;
+  NeuralNet nn;
+  Pattern* input = NULL;
+  Pattern* target = NULL;
+  Pattern* output = NULL;
+  unsigned long input_count = 64;
+  unsigned long hidden_layers = 2;
+  unsigned long hidden = 256;
+  unsigned long output_count = 8;
+  unsigned long samples = 2000;
+  unsigned long workers = 0;
+  unsigned long mode = NEURAL_NET_TUNE_CACHE;
+  char* cache = NULL;
+  int opt;
+
+  setlocale(LC_NUMERIC, "");
+  memset(&nn, 0, sizeof(nn));
+
+  while ((opt = getopt(argc, argv, "i:L:H:o:n:w:c:f")) != -1) {
+    switch (opt) {
+      case 'i': input_count = strtoul(optarg, NULL, 0); break;
+      case 'L': hidden_layers = strtoul(optarg, NULL, 0); break;
+      case 'H': hidden = strtoul(optarg, NULL, 0); break;
+      case 'o': output_count = strtoul(optarg, NULL, 0); break;
+      case 'n': samples = strtoul(optarg, NULL, 0); break;
+      case 'w': workers = strtoul(optarg, NULL, 0); break;
+      case 'c': cache = optarg; break;
+      case 'f': mode = NEURAL_NET_TUNE_FORCE; break;
+      default:
+        usage(argv[0]);
+        status = STATUS_BAD_PARAM;
+        goto donedone;
+    }
+  }
+
+  rand0_1_seed(1);
+
+  input = Pattern_create(input_count);
+  target = Pattern_create(output_count);
+  output = Pattern_create(output_count);
+  if ((input == NULL) || (target == NULL) || (output == NULL)) {
+    status = STATUS_OOM;
+    goto donedone;
+  }
+
+  status = NeuralNet_init(&nn, input_count, hidden_layers, output_count);
+  if (StatusErr(status)) goto donedone;
+  for (unsigned long l = 0; l < hidden_layers; l++) {
+    status = nn.add_hidden(&nn, hidden);
+    if (StatusErr(status)) goto done;
+  }
+  status = nn.start(&nn);
+  if (StatusErr(status)) goto done;
+
+  double loops = train_rate(&nn, input, target, output, samples);
+
+  nn.tune_mode = mode;
+  nn.tune_cache = cache;
+  status = NeuralNetTune_start(&nn, workers);
+  if (StatusErr(status)) {
+    printf("Unable to tune status=%d\n", status);
+    goto done;
+  }
+  NeuralNetTune_print(&nn, stdout);
+
+  double tuned = train_rate(&nn, input, target, output, samples);
+  printf("samples/s loops=%'.0lf tuned=%'.0lf speedup=%.2lfx\n", loops, tuned,
+      tuned / loops);
+
+done:
+  nn.deinit(&nn);
+
+donedone:
+  free(input);
+  free(target);
+  free(output);
+  dbg("nn-tune:- status=%d\n", status);
+  return StatusOk(status) ? 0 : 1;
+}
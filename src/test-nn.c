@@ -18,9 +18,22 @@
 #endif
 
 #include "NeuralNet.h"
+#include "NeuralNetArena.h"
+#include "NeuralNetCheckpoint.h"
 #include "NeuralNetIo.h"
+#include "NeuralNetIoNpy.h"
+#include "NeuralNetIoReader.h"
+#include "NeuralNetIoShm.h"
+#include "NeuralNetLbfgs.h"
+#include "NeuralNetPop.h"
+#include "NeuralNetRace.h"
+#include "NeuralNetSkip.h"
+#include "NeuralNetTrain.h"
+#include "NeuralNetTrainer.h"
+#include "NeuralNetTune.h"
 #include "dbg.h"
 #include "rand0_1.h"
+#include "unused.h"
 
 #include <errno.h>
 #include <limits.h>
@@ -31,6 +44,7 @@
 #include <time.h>
 #include <sys/time.h>
 #include <locale.h>
+#include <unistd.h>
 
 #define INPUT_COUNT 2
 typedef struct InputPattern {
@@ -62,30 +76,429 @@ static NeuralNet nn;
 
 static OutputPattern xor_output[sizeof(xor_target_patterns)/sizeof(OutputPattern)];
 
+#define PATTERN_COUNT (sizeof(xor_input_patterns)/sizeof(InputPattern))
+
+/** Fill in xor_output from nn for the table */
+static void fill_outputs(void) {
+  for (unsigned long p = 0; p < PATTERN_COUNT; p++) {
+    nn.set_inputs(&nn, (Pattern*)&xor_input_patterns[p]);
+    nn.process(&nn);
+    xor_output[p].count = OUTPUT_COUNT;
+    nn.get_outputs(&nn, (Pattern*)&xor_output[p]);
+  }
+}
+
+/**
+ * Keeps the output of every pattern for the table, as trained, and
+ * writes a frame of the network after every pattern
+ */
+typedef struct FrameWriter {
+  NeuralNetIoWriter* writer;  // NULL if there is no output file
+  OutputPattern* output;      // Output of the pattern just trained
+  unsigned int* perm;         // Order of the epoch
+  unsigned long epoch;        // Epoch being trained
+  unsigned long pattern_count;
+} FrameWriter;
+
+static void write_frame(void* arg, unsigned int rp) {
+  FrameWriter* frames = arg;
+  NeuralNetIoWriter* writer = frames->writer;
+
+  xor_output[frames->perm[rp]] = *frames->output;
+  if (writer != NULL) {
+    writer->begin_epoch(writer, (frames->epoch * frames->pattern_count) + rp);
+    writer->write_epoch(writer);
+    writer->end_epoch(writer);
+  }
+}
+
+/** Every frame starts with the bounding box */
+static Status check_box(void* ctx, unsigned long frame, const double* points) {
+  const double box[8] = { 0.0, 0.0, -12.0, -12.0, 1.0, 1.0, +12.0, +12.0 };
+
+  unused(ctx);
+  if (memcmp(points, box, sizeof(box)) != 0) {
+    printf("Frame %'ld has no bounding box\n", frame);
+    return STATUS_ERR;
+  }
+  return STATUS_OK;
+}
+
+/**
+ * Read the closed file at path back through NeuralNetIoReader and
+ * check it has the frames the writer wrote and that the weights of
+ * the last frame are those of nn.
+ */
+static Status read_back(char* path, unsigned long frames, unsigned long first_seq) {
+  Status status;
+  NeuralNetIoReader reader;
+  unsigned long mismatches = 0;
+
+  status = NeuralNetIoReader_init(&reader, path);
+  if (StatusErr(status)) {
+    printf("Unable to read back '%s'\n", path);
+    return status;
+  }
+
+  if (reader.truncated || (reader.frame_count != frames)
+      || (reader.points_per_epoch != nn.get_points(&nn))
+      || ((frames > 0) && (reader.first_seq != first_seq))) {
+    printf("Read back '%s' frames=%'ld first_seq=%'ld truncated=%ld"
+        " expected frames=%'ld first_seq=%'ld\n", path, reader.frame_count,
+        reader.first_seq, reader.truncated, frames, first_seq);
+    status = STATUS_ERR;
+    goto done;
+  }
+  status = reader.for_each(&reader, 0, frames, check_box, NULL);
+  if (StatusErr(status)) goto done;
+
+  if (frames > 0) {
+    // Weights follow the box and the inputs, as NeuralNetIo_write_epoch writes them
+    const double* point = reader.frame(&reader, frames - 1) + (4 * (2 + nn.layers[0].count));
+    for (unsigned long l = 1; l <= nn.out_layer; l++) {
+      NeuronLayer* layer = &nn.layers[l];
+      for (unsigned long n = 0; n < layer->count; n++) {
+        for (unsigned long i = 0; i <= layer->neurons[n].inputs->count; i++, point += 4) {
+          double weight = NeuronLayer_weight(layer, n, i);
+          mismatches += memcmp(&point[2], &weight, sizeof(weight)) != 0;
+        }
+      }
+    }
+  }
+  if (mismatches > 0) {
+    printf("Read back '%s' %'ld weights of the last frame don't match\n", path, mismatches);
+    status = STATUS_ERR;
+    goto done;
+  }
+  printf("Read back %'ld frames of %'ld points from '%s', the last matches the network\n",
+      frames, reader.points_per_epoch, path);
+
+done:
+  reader.deinit(&reader);
+  return status;
+}
+
+/**
+ * Race racers seeds to error_threshold and replace nn with the
+ * winner, epoch and error are set to the winning run's.
+ */
+static Status race_seeds(unsigned long racers, unsigned long hidden_neurons,
+    double error_threshold, unsigned long* epoch, double* error) {
+  Status status;
+  NeuralNetRaceSpec spec;
+  NeuralNetRace race;
+  NeuralNet winner;
+  Pattern* inputs[PATTERN_COUNT];
+  Pattern* targets[PATTERN_COUNT];
+
+  for (unsigned long p = 0; p < PATTERN_COUNT; p++) {
+    inputs[p] = (Pattern*)&xor_input_patterns[p];
+    targets[p] = (Pattern*)&xor_target_patterns[p];
+  }
+
+  memset(&spec, 0, sizeof(spec));
+  spec.racers = racers;
+  spec.first_seed = 1;
+  spec.max_restarts = 64;
+  spec.hidden = hidden_neurons;
+  spec.learning_rate = nn.learning_rate;
+  spec.momentum_factor = nn.momentum_factor;
+  spec.alloc_mode = nn.alloc_mode;
+  spec.weight_type = nn.weight_type;
+  spec.error_threshold = error_threshold;
+  spec.stall_epochs = 1000;
+  spec.stall_improvement = 0.001;
+  spec.straggler_ratio = 100.0;
+  spec.inputs = inputs;
+  spec.targets = targets;
+  spec.pattern_count = PATTERN_COUNT;
+
+  status = NeuralNetRace_init(&race, &spec);
+  if (StatusErr(status)) goto donedone;
+  status = race.run(&race);
+  if (StatusErr(status)) goto done;
+  race.print(&race, stdout);
+
+  if (race.winner == NULL) {
+    status = STATUS_ERR;
+    goto done;
+  }
+  *epoch = atomic_load(&race.winner->epochs);
+  *error = atomic_load(&race.winner->error);
+  status = race.take(&race, &winner);
+  if (StatusErr(status)) goto done;
+  nn.deinit(&nn);
+  nn = winner;
+  fill_outputs();
+
+done:
+  race.deinit(&race);
+donedone:
+  return status;
+}
+
+/**
+ * Train nn with the time sliced trainer, giving each step budget_us,
+ * as an event loop would and report the step latencies. epoch is set
+ * to the epochs trained and error to the last epoch's error.
+ */
+static Status train_sliced(unsigned long budget_us, double error_threshold,
+    unsigned long epoch_count, unsigned long* epoch, double* error) {
+  Status status;
+  NeuralNetTrainer trainer;
+  NeuralNetTrainerProgress progress;
+  Pattern* inputs[PATTERN_COUNT];
+  Pattern* targets[PATTERN_COUNT];
+
+  for (unsigned long p = 0; p < PATTERN_COUNT; p++) {
+    inputs[p] = (Pattern*)&xor_input_patterns[p];
+    targets[p] = (Pattern*)&xor_target_patterns[p];
+  }
+
+  status = NeuralNetTrainer_init(&trainer, &nn, inputs, targets, PATTERN_COUNT);
+  if (StatusErr(status)) goto done;
+  trainer.error_threshold = error_threshold;
+  trainer.max_epochs = epoch_count == ULONG_MAX ? 0 : epoch_count;
+
+  unsigned long steps = 0;
+  double worst_us = 0.0;
+  while (!trainer.done) {
+    struct timespec before;
+    struct timespec after;
+    clock_gettime(CLOCK_MONOTONIC, &before);
+    trainer.step(&trainer, 0, budget_us * 1000);
+    clock_gettime(CLOCK_MONOTONIC, &after);
+    double us = ((double)(after.tv_sec - before.tv_sec) * 1.0e6)
+      + ((double)(after.tv_nsec - before.tv_nsec) / 1.0e3);
+    worst_us = us > worst_us ? us : worst_us;
+    steps += 1;
+  }
+
+  trainer.progress(&trainer, &progress);
+  printf("Steps=%'ld budget=%'ldus worst=%.1lfus ns_per_sample=%.0lf samples=%'ld\n",
+      steps, budget_us, worst_us, progress.ns_per_sample, progress.samples);
+  *epoch = progress.epoch;
+  *error = progress.last_error;
+  trainer.deinit(&trainer);
+  fill_outputs();
+
+done:
+  return status;
+}
+
+/**
+ * Train width networks of nn's topology in lock step as a population
+ * until one reaches error_threshold and replace nn's weights with it,
+ * network 0 starts with nn's initial weights. epoch and error are set
+ * to the best network's.
+ */
+static Status train_population(unsigned long width, unsigned long hidden_neurons,
+    double error_threshold, unsigned long epoch_count, unsigned long* epoch,
+    double* error) {
+  Status status;
+  NeuralNetPop pop;
+  unsigned long counts[3] = { INPUT_COUNT, hidden_neurons, OUTPUT_COUNT };
+  Pattern* inputs[PATTERN_COUNT];
+  Pattern* targets[PATTERN_COUNT];
+
+  for (unsigned long p = 0; p < PATTERN_COUNT; p++) {
+    inputs[p] = (Pattern*)&xor_input_patterns[p];
+    targets[p] = (Pattern*)&xor_target_patterns[p];
+  }
+
+  rand0_1_seed(1);
+  status = NeuralNetPop_init(&pop, width, 3, counts, 1);
+  if (StatusErr(status)) goto donedone;
+  pop.learning_rate = nn.learning_rate;
+  pop.momentum_factor = nn.momentum_factor;
+  pop.error_threshold = error_threshold;
+
+  struct timespec before;
+  struct timespec after;
+  clock_gettime(CLOCK_MONOTONIC, &before);
+  for (unsigned long e = 0; e < epoch_count; e++) {
+    unsigned long remaining = pop.train_epoch(&pop, inputs, targets, PATTERN_COUNT);
+    if (pop.perm_count == 0) {
+      status = STATUS_OOM;
+      goto done;
+    }
+    if (remaining < width) {
+      break;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &after);
+  double secs = (double)(after.tv_sec - before.tv_sec)
+    + ((double)(after.tv_nsec - before.tv_nsec) / 1.0e9);
+
+  // The best is a converged one, else the one with the least error
+  unsigned long best = 0;
+  unsigned long converged = 0;
+  unsigned long net_epochs = 0;
+  for (unsigned long k = 0; k < width; k++) {
+    net_epochs += pop.epochs[k];
+    if (!pop.active[k]) {
+      converged += 1;
+    }
+    int better;
+    if (pop.active[k] != pop.active[best]) {
+      better = !pop.active[k];
+    } else {
+      better = pop.errors[k] < pop.errors[best];
+    }
+    if (better) {
+      best = k;
+    }
+  }
+  printf("Networks=%'ld converged=%'ld best=%'ld network_epochs=%'ld network_eps=%'.0lf\n",
+      width, converged, best, net_epochs, secs > 0.0 ? (double)net_epochs / secs : 0.0);
+
+  status = pop.extract(&pop, best, &nn);
+  if (StatusErr(status)) goto done;
+  *epoch = pop.epochs[best];
+  *error = pop.errors[best];
+  fill_outputs();
+
+done:
+  pop.deinit(&pop);
+donedone:
+  return status;
+}
+
+/**
+ * Train nn full batch with L-BFGS keeping history corrections, epoch
+ * is set to the iterations and error to the last loss.
+ */
+static Status train_lbfgs(unsigned long history, double error_threshold,
+    unsigned long epoch_count, unsigned long* epoch, double* error) {
+  Status status;
+  NeuralNetLbfgs lbfgs;
+  Pattern* inputs[PATTERN_COUNT];
+  Pattern* targets[PATTERN_COUNT];
+
+  for (unsigned long p = 0; p < PATTERN_COUNT; p++) {
+    inputs[p] = (Pattern*)&xor_input_patterns[p];
+    targets[p] = (Pattern*)&xor_target_patterns[p];
+  }
+
+  status = NeuralNetLbfgs_init(&lbfgs, &nn, inputs, targets, PATTERN_COUNT,
+      history, 0);
+  if (StatusErr(status)) goto done;
+  lbfgs.error_threshold = error_threshold;
+
+  status = lbfgs.run(&lbfgs, epoch_count == ULONG_MAX ? 0 : epoch_count);
+  printf("Iterations=%'ld evaluations=%'ld restarts=%'ld chunks=%'ld\n",
+      lbfgs.iterations, lbfgs.evaluations, lbfgs.restarts, lbfgs.chunk_count);
+  *epoch = lbfgs.iterations;
+  *error = lbfgs.loss;
+  lbfgs.deinit(&lbfgs);
+  fill_outputs();
+
+done:
+  return status;
+}
+
 int main(int argc, char** argv) {
   Status status;
   unsigned long epoch = 0;
+  unsigned long first_epoch = 0;
   unsigned long epoch_count = 0;
   double error = 0.0;
+  double resumed_error = (double)INFINITY;
   double error_threshold = 0.0004;
+  char* checkpoint_path = NULL;
+  unsigned long checkpoint_interval = 1000;
+  unsigned long alloc_mode = NEURAL_NET_ALLOC_HEAP;
+  char* alloc_names[] = { "heap", "mmap", "thp", "hugetlb" };
+  unsigned long weight_type = NEURAL_NET_WEIGHTS_DOUBLE;
+  char* weight_names[] = { "double", "bf16", "fp16" };
+  unsigned long racers = 0;
+  unsigned long slice_us = 0;
+  unsigned long lbfgs_history = 0;
+  unsigned long population = 0;
+  double skip_threshold = 0.0;
+  char* kernel_cache = NULL;
+  int opt;
 
   NeuralNetIoWriter *writer = NULL;
+  NeuralNetCheckpoint *checkpoint = NULL;
 
   setlocale(LC_NUMERIC, "");
 
   dbg("test-nn:+\n");
 
-  if (argc < 2) {
-    printf("Usage: %s <param1> <file>\n", argv[0]);
+  while ((opt = getopt(argc, argv, "a:c:C:g:k:l:p:r:s:W:")) != -1) {
+    switch (opt) {
+      case 'a':
+        for (alloc_mode = 0; alloc_mode <= NEURAL_NET_ALLOC_HUGETLB; alloc_mode++) {
+          if (strcmp(optarg, alloc_names[alloc_mode]) == 0) break;
+        }
+        if (alloc_mode > NEURAL_NET_ALLOC_HUGETLB) {
+          argc = 0;
+        }
+        break;
+      case 'W':
+        for (weight_type = 0; weight_type <= NEURAL_NET_WEIGHTS_FP16; weight_type++) {
+          if (strcmp(optarg, weight_names[weight_type]) == 0) break;
+        }
+        if (weight_type > NEURAL_NET_WEIGHTS_FP16) {
+          argc = 0;
+        }
+        break;
+      case 'c':
+        checkpoint_path = optarg;
+        break;
+      case 'C':
+        checkpoint_interval = strtoul(optarg, NULL, 0);
+        break;
+      case 'g':
+        skip_threshold = strtod(optarg, NULL);
+        break;
+      case 'k':
+        kernel_cache = optarg;
+        break;
+      case 'l':
+        lbfgs_history = strtoul(optarg, NULL, 0);
+        break;
+      case 'p':
+        population = strtoul(optarg, NULL, 0);
+        break;
+      case 'r':
+        racers = strtoul(optarg, NULL, 0);
+        break;
+      case 's':
+        slice_us = strtoul(optarg, NULL, 0);
+        break;
+      default:
+        argc = 0;
+        break;
+    }
+  }
+
+  if ((argc - optind) < 1) {
+    printf("Usage: %s [-a <alloc>] [-W <precision>] [-c <checkpoint> [-C <interval>]] [-g <pd_error>] [-k <cache>] [-l <history> | -p <width> | -r <racers> | -s <us>] <param1> <file>\n", argv[0]);
+    printf("  -a:     weight storage heap, mmap, thp or hugetlb, default heap\n");
+    printf("  -W:     weight precision double, bf16 or fp16, default double\n");
+    printf("  -c:     checkpoint file, resume from it if it exists\n");
+    printf("  -C:     epochs between checkpoints, default 1000\n");
+    printf("  -g:     skip updating neurons whose |pd_error| is below this\n");
+    printf("  -k:     autotune the kernels at start, reusing choices cached in file\n");
+    printf("  -l:     train full batch with L-BFGS keeping this many corrections\n");
+    printf("  -p:     train a population of this many networks in lock step\n");
+    printf("          and keep the first to reach the error threshold\n");
+    printf("  -r:     race this many seeds on their own threads and keep the\n");
+    printf("          first to reach the error threshold\n");
+    printf("  -s:     train in steps of at most this many microseconds\n");
     printf("  param1: if param1 >= 1 then number of epochs\n");
     printf("          else if param1 >= 0.0 && param1 < 1.0 then error threshold typical = 0.0004\n");
     printf("          else param1 invalid\n");
-    printf("  file:   output file, optional\n");
+    printf("  file:   output file, optional, shm:/name publishes to a shared\n");
+    printf("          memory ring for nn-live instead, npy:prefix writes the\n");
+    printf("          weights, outputs and errors as prefix.*.npy arrays\n");
     status = STATUS_ERR;
     goto donedone;
   }
 
-  error_threshold = strtod(argv[1], NULL);
+  error_threshold = strtod(argv[optind], NULL);
   if (error_threshold < 0.0) {
     printf("param1:%'lg is < 0.0, aborting\n", error_threshold);
     status = STATUS_ERR;
@@ -105,12 +518,37 @@ int main(int argc, char** argv) {
 
 
   char* out_path = "";
-  if (argc == 3) {
-    out_path = argv[2];
+  if ((argc - optind) == 2) {
+    out_path = argv[optind + 1];
   }
 
   dbg("test-nn: epoch_count=%ld out_pat='%s'\n", epoch_count, out_path);
 
+  if ((racers > 0) && (!(error_threshold > 0.0) || (checkpoint_path != NULL)
+        || (strlen(out_path) > 0))) {
+    printf("-r needs an error threshold and no checkpoint or output file\n");
+    status = STATUS_ERR;
+    goto donedone;
+  }
+  if ((slice_us > 0) && ((racers > 0) || (checkpoint_path != NULL)
+        || (strlen(out_path) > 0))) {
+    printf("-s can not be used with -r, a checkpoint or an output file\n");
+    status = STATUS_ERR;
+    goto donedone;
+  }
+  if ((population > 0) && ((racers > 0) || (slice_us > 0)
+        || (checkpoint_path != NULL) || (strlen(out_path) > 0))) {
+    printf("-p can not be used with -r, -s, a checkpoint or an output file\n");
+    status = STATUS_ERR;
+    goto donedone;
+  }
+  if ((lbfgs_history > 0) && ((population > 0) || (racers > 0) || (slice_us > 0)
+        || (checkpoint_path != NULL) || (strlen(out_path) > 0))) {
+    printf("-l can not be used with -p, -r, -s, a checkpoint or an output file\n");
+    status = STATUS_ERR;
+    goto donedone;
+  }
+
   // seed the random number generator
 #if 0
   struct timespec spec;
@@ -118,9 +556,9 @@ int main(int argc, char** argv) {
   double dnow_us = (((double)spec.tv_sec * 1.0e9) + spec.tv_nsec) / 1.0e3;
   int now = (int)(long)dnow_us;
   dbg("dnow_us=%lf now=0x%x\n", dnow_us, now);
-  srand(now);
+  rand0_1_seed((unsigned int)now);
 #else
-  srand(1);
+  rand0_1_seed(1);
 #endif
 
   unsigned long num_inputs = 2;
@@ -128,6 +566,13 @@ int main(int argc, char** argv) {
   unsigned long num_outputs = 1;
   status = NeuralNet_init(&nn, num_inputs, num_hidden, num_outputs);
   if (StatusErr(status)) goto done;
+  nn.alloc_mode = alloc_mode;
+  nn.weight_type = weight_type;
+  nn.skip_threshold = skip_threshold;
+  if (kernel_cache != NULL) {
+    nn.tune_mode = NEURAL_NET_TUNE_CACHE;
+    nn.tune_cache = kernel_cache;
+  }
 
   // Each hidden layer is fully connected plus a bias
   unsigned long hidden_neurons = 2;
@@ -136,13 +581,40 @@ int main(int argc, char** argv) {
 
   status = nn.start(&nn);
   if (StatusErr(status)) goto done;
+  if (kernel_cache != NULL) {
+    NeuralNetTune_print(&nn, stdout);
+  }
 
   unsigned int pattern_count = sizeof(xor_input_patterns)/sizeof(InputPattern);
   unsigned int* rand_ps = calloc(pattern_count, sizeof(unsigned int));
 
+  if (checkpoint_path != NULL) {
+    // Resume from the checkpoint if there is one
+    if (access(checkpoint_path, F_OK) == 0) {
+      status = NeuralNetCheckpoint_load(checkpoint_path, &nn, &first_epoch,
+          &resumed_error, rand_ps, pattern_count);
+      if (StatusErr(status)) {
+        printf("Unable to resume from checkpoint '%s'\n", checkpoint_path);
+        goto done;
+      }
+      printf("Resuming from checkpoint '%s' at epoch=%'ld error=%.3lg\n",
+          checkpoint_path, first_epoch, resumed_error);
+    }
+    checkpoint = calloc(1, sizeof(NeuralNetCheckpoint));
+    status = NeuralNetCheckpoint_init(checkpoint, &nn, checkpoint_path);
+    if (StatusErr(status)) goto done;
+  }
+
   if (strlen(out_path) > 0) {
     writer = calloc(1, sizeof(NeuralNetIoWriter));
-    status = NeuralNetIoWriter_init(writer, &nn, nn.get_points(&nn), out_path);
+    if (strncmp(out_path, "shm:", 4) == 0) {
+      status = NeuralNetIoShmWriter_init(writer, &nn, nn.get_points(&nn),
+          out_path + 4, NEURAL_NET_IO_SHM_SLOTS);
+    } else if (strncmp(out_path, "npy:", 4) == 0) {
+      status = NeuralNetIoNpyWriter_init(writer, &nn, out_path + 4);
+    } else {
+      status = NeuralNetIoWriter_init(writer, &nn, nn.get_points(&nn), out_path);
+    }
     if (StatusErr(status)) goto done;
   } else {
     writer = NULL;
@@ -150,49 +622,67 @@ int main(int argc, char** argv) {
 
   struct timeval start;
   gettimeofday(&start, NULL);
-  for (epoch = 0; epoch < epoch_count; epoch++) {
-    error = 0.0;
-
-    // Shuffle rand_patterns by swapping the current
-    // position t with a random location after the
-    // current position.
-
-    // Start by resetting to sequential order
-    for (unsigned int p = 0; p < pattern_count; p++) {
-      rand_ps[p] = p;
-    }
-
-    // Shuffle
-    for (unsigned int p = 0; p < pattern_count; p++) {
-      double r0_1 = rand0_1();
-      unsigned int rp = p + (unsigned int)(r0_1 * (pattern_count - p));
-      unsigned t = rand_ps[p];
-      rand_ps[p] = rand_ps[rp];
-      rand_ps[rp] = t;
-      //dbg("r0_1=%lf rp=%d rand_ps[%d]=%d\n", r0_1, rp, p, rand_ps[p]);
-    }
-
-    // Process the pattern and accumulate the error
-    for (unsigned int rp = 0; rp < pattern_count; rp++) {
-      unsigned int p = rand_ps[rp];
-      nn.set_inputs(&nn, (Pattern*)&xor_input_patterns[p]);
-      nn.process(&nn);
-      xor_output[p].count = OUTPUT_COUNT;
-      nn.get_outputs(&nn, (Pattern*)&xor_output[p]);
-      error += nn.adjust_weights(&nn, (Pattern*)&xor_output[p],
-          (Pattern*)&xor_target_patterns[p]);
-
-      if (writer != NULL) {
-        writer->begin_epoch(writer, (epoch * pattern_count) + rp);
-        writer->write_epoch(writer);
-        writer->end_epoch(writer);
-      }
+  if (racers > 0) {
+    status = race_seeds(racers, hidden_neurons, error_threshold, &epoch, &error);
+    if (StatusErr(status)) {
+      printf("The race did not converge status=%d\n", status);
+      goto done;
     }
+  } else if (population > 0) {
+    status = train_population(population, hidden_neurons, error_threshold,
+        epoch_count, &epoch, &error);
+    if (StatusErr(status)) goto done;
+  } else if (lbfgs_history > 0) {
+    status = train_lbfgs(lbfgs_history, error_threshold, epoch_count, &epoch, &error);
+    if (StatusErr(status)) {
+      printf("L-BFGS stopped making progress status=%d\n", status);
+      goto done;
+    }
+  } else if (slice_us > 0) {
+    status = train_sliced(slice_us, error_threshold, epoch_count, &epoch, &error);
+    if (StatusErr(status)) goto done;
+  } else {
+    Pattern* inputs[PATTERN_COUNT];
+    Pattern* targets[PATTERN_COUNT];
+    for (unsigned long p = 0; p < PATTERN_COUNT; p++) {
+      inputs[p] = (Pattern*)&xor_input_patterns[p];
+      targets[p] = (Pattern*)&xor_target_patterns[p];
+    }
+    OutputPattern output = { .count = OUTPUT_COUNT };
+    FrameWriter frames = { .writer = writer, .output = &output, .perm = rand_ps,
+      .pattern_count = pattern_count };
 
-    // Stop if we've reached the error_threshold
-    if (error < error_threshold) {
-      break;
+    // A checkpoint that had already converged isn't trained further
+    if (first_epoch > 0) {
+      error = resumed_error;
+    }
+    unsigned long trained = 0;
+    for (epoch = first_epoch; (epoch < epoch_count) && !(resumed_error < error_threshold);
+        epoch++) {
+      frames.epoch = epoch;
+      error = NeuralNet_train_epoch_each(&nn, inputs, targets, (Pattern*)&output,
+          rand_ps, pattern_count, write_frame, &frames);
+      trained += 1;
+
+      if ((checkpoint != NULL) && (checkpoint_interval > 0)
+          && (((epoch + 1) % checkpoint_interval) == 0)) {
+        checkpoint->save(checkpoint, epoch + 1, error, rand_ps, pattern_count);
+      }
+
+      // Stop if we've reached the error_threshold
+      if (error < error_threshold) {
+        break;
+      }
     }
+    if (trained == 0) {
+      fill_outputs();
+    }
+  }
+  if (checkpoint != NULL) {
+    // Save the final state, epoch is the epochs completed or if the
+    // error_threshold was reached the epoch that reached it, which
+    // a resumed run doesn't train again
+    checkpoint->save(checkpoint, epoch, error, rand_ps, pattern_count);
   }
   struct timeval end;
   gettimeofday(&end, NULL);
@@ -200,10 +690,36 @@ int main(int argc, char** argv) {
   double start_usec = (start.tv_sec * 1000000.0) + start.tv_usec;
   double end_usec = (end.tv_sec * 1000000.0) + end.tv_usec;
   double time_sec = (end_usec - start_usec) / 1000000;
-  unsigned long eps = (unsigned long)(epoch / time_sec);
+  unsigned long eps = (unsigned long)((epoch - first_epoch) / time_sec);
 
   printf("\n\nEpoch=%'ld Error=%.3lg time=%.3lfs eps=%'ld\n", epoch, error, time_sec, eps);
 
+  NeuralNetFootprint fp;
+  NeuralNet_footprint(&nn, &fp);
+  printf("Storage=%s page_size=%'ld bytes=%'ld mapped=%'ld resident=%'ld huge=%'ld\n",
+      alloc_names[fp.mode], fp.page_size, fp.bytes, fp.mapped_bytes,
+      fp.resident_bytes, fp.huge_bytes);
+  if (skip_threshold > 0.0) {
+    unsigned long updates;
+    unsigned long skipped;
+    NeuralNet_skip_flush(&nn);
+    NeuralNet_skip_stats(&nn, &updates, &skipped);
+    printf("Skipped=%.1lf%% of %'ld neuron updates\n",
+        (100.0 * (double)skipped) / (double)(updates > 0 ? updates : 1), updates);
+  }
+
+  if ((writer != NULL) && (strncmp(out_path, "shm:", 4) != 0)
+      && (strncmp(out_path, "npy:", 4) != 0)) {
+    // Close the file so it has its footer and check it reads back
+    unsigned long frames = writer->frames;
+    unsigned long first_seq = writer->first_seq;
+    writer->deinit(writer, epoch);
+    free(writer);
+    writer = NULL;
+    status = read_back(out_path, frames, first_seq);
+    if (StatusErr(status)) goto done;
+  }
+
   nn.stop(&nn);
 
   printf("\nPat");
@@ -234,6 +750,10 @@ int main(int argc, char** argv) {
 
 
 done:
+  if (checkpoint != NULL) {
+    checkpoint->deinit(checkpoint);
+    free(checkpoint);
+  }
   if (writer != NULL) {
     writer->deinit(writer, epoch);
   }